@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "arena.h"
+
+#include <assert.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#   define THREAD_LOCAL __declspec(thread)
+#else
+#   include <sys/mman.h>
+#   define THREAD_LOCAL __thread
+#endif
+
+#define ALLOC_ALIGN     64U                 /* Cache line */
+#define COMMIT_ALIGN    0x10000U
+#define HUGE_PAGE_SIZE  (2U * 1024U * 1024U)
+
+static THREAD_LOCAL ARENA *current_arena;
+
+static size_t align_size(size_t value, size_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+int arena_init(ARENA *arena, size_t reserve_size)
+{
+    memset(arena, 0, sizeof(*arena));
+
+    reserve_size = align_size(reserve_size, HUGE_PAGE_SIZE);
+
+#ifdef _WIN32
+    arena->base = (uint8_t *)VirtualAlloc(NULL, reserve_size, MEM_RESERVE, PAGE_NOACCESS);
+    if ( ! arena->base)
+        return 1;
+#else
+    {
+        void *const base = mmap(NULL, reserve_size, PROT_NONE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED)
+            return 1;
+
+        arena->base = (uint8_t *)base;
+    }
+#endif
+
+    arena->reserved = reserve_size;
+
+    return 0;
+}
+
+void arena_destroy(ARENA *arena)
+{
+    if (arena->base) {
+#ifdef _WIN32
+        VirtualFree(arena->base, 0, MEM_RELEASE);
+#else
+        munmap(arena->base, arena->reserved);
+#endif
+    }
+
+    memset(arena, 0, sizeof(*arena));
+}
+
+static int commit(ARENA *arena, size_t end)
+{
+    size_t new_committed;
+
+    if (end <= arena->committed)
+        return 0;
+
+    new_committed = align_size(end, COMMIT_ALIGN);
+    if (new_committed > arena->reserved)
+        new_committed = arena->reserved;
+
+#ifdef _WIN32
+    if ( ! VirtualAlloc(arena->base + arena->committed, new_committed - arena->committed,
+                        MEM_COMMIT, PAGE_READWRITE))
+        return 1;
+#else
+    if (mprotect(arena->base + arena->committed, new_committed - arena->committed,
+                 PROT_READ | PROT_WRITE))
+        return 1;
+#endif
+
+    arena->committed = new_committed;
+
+    return 0;
+}
+
+static void advise_huge_pages(uint8_t *ptr, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+    /* The advice is only a hint, ignore failure */
+    if (size >= HUGE_PAGE_SIZE)
+        madvise(ptr, size & ~(size_t)(HUGE_PAGE_SIZE - 1), MADV_HUGEPAGE);
+#endif
+}
+
+void *arena_alloc(ARENA *arena, size_t size, unsigned flags)
+{
+    const size_t align = (flags & ARENA_HUGE_PAGES) ? HUGE_PAGE_SIZE : ALLOC_ALIGN;
+    size_t       offs;
+    size_t       end;
+    uint8_t     *ptr;
+
+    if ( ! arena->base)
+        return NULL;
+
+    offs = align_size(arena->used, align);
+    end  = offs + align_size(size, ALLOC_ALIGN);
+
+    if (end < offs || end > arena->reserved || commit(arena, end))
+        return NULL;
+
+    ptr = arena->base + offs;
+
+    if (flags & ARENA_HUGE_PAGES)
+        advise_huge_pages(ptr, size);
+
+    /* Memory above dirty offset is still zero after it was committed */
+    if ((flags & ARENA_ZERO) && offs < arena->dirty)
+        memset(ptr, 0, ((end < arena->dirty) ? end : arena->dirty) - offs);
+
+    arena->used = end;
+    if (end > arena->dirty)
+        arena->dirty = end;
+    if (end > arena->peak)
+        arena->peak = end;
+
+    return ptr;
+}
+
+void arena_free(ARENA *arena, void *ptr, size_t size)
+{
+    const size_t offs = (size_t)((uint8_t *)ptr - arena->base);
+
+    assert(arena_owns(arena, ptr));
+
+    if (offs + align_size(size, ALLOC_ALIGN) == arena->used)
+        arena->used = offs;
+}
+
+int arena_owns(const ARENA *arena, const void *ptr)
+{
+    const uint8_t *const byte_ptr = (const uint8_t *)ptr;
+
+    return arena->base && byte_ptr >= arena->base && byte_ptr < arena->base + arena->reserved;
+}
+
+void arena_reset(ARENA *arena)
+{
+    arena->used = 0;
+    arena->peak = 0;
+}
+
+ARENA *set_current_arena(ARENA *arena)
+{
+    ARENA *const prev = current_arena;
+
+    current_arena = arena;
+
+    return prev;
+}
+
+ARENA *get_current_arena(void)
+{
+    return current_arena;
+}
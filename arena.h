@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Arena allocator.  Address space is reserved once and memory is committed
+ * on demand as allocations are bumped.  Memory which has never been handed
+ * out is known to be zero, so zeroing is only done for memory which is reused.
+ */
+typedef struct {
+    uint8_t *base;
+    size_t   reserved;  /* Size of reserved address space                  */
+    size_t   committed; /* Size of memory accessible to the process        */
+    size_t   used;      /* Offset of the next allocation                   */
+    size_t   dirty;     /* Memory above this offset has never been handed out */
+    size_t   peak;      /* Highest offset used since the arena was reset   */
+} ARENA;
+
+enum ARENA_FLAGS {
+    ARENA_ZERO       = 1,   /* Memory must be filled with zeroes                */
+    ARENA_HUGE_PAGES = 2    /* Large buffer, request transparent huge pages     */
+};
+
+/* Reserves address space for the arena, returns non-zero on failure */
+int arena_init(ARENA *arena, size_t reserve_size);
+
+/* Releases all memory of the arena */
+void arena_destroy(ARENA *arena);
+
+/* Returns NULL if there is not enough space left in the arena */
+void *arena_alloc(ARENA *arena, size_t size, unsigned flags);
+
+/* Only the most recent allocation is actually returned to the arena */
+void arena_free(ARENA *arena, void *ptr, size_t size);
+
+/* Returns non-zero if ptr was allocated from the arena */
+int arena_owns(const ARENA *arena, const void *ptr);
+
+/* Makes all memory available again without returning it to the OS, starts
+ * tracking a new peak
+ */
+void arena_reset(ARENA *arena);
+
+/* Sets arena used by buf_alloc() in the calling thread, returns previous arena.
+ * If no arena is set, buffers are allocated from the heap.
+ */
+ARENA *set_current_arena(ARENA *arena);
+ARENA *get_current_arena(void);
@@ -6,7 +6,6 @@
 #include "bit_stream.h"
 
 #include <assert.h>
-#include <string.h>
 
 void init_model(MODEL *model)
 {
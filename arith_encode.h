@@ -5,4 +5,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* Returns size of the encoded data.  If the returned size is larger than
+ * max_dest_size, the output was truncated and encoding has to be repeated
+ * with a buffer of at least the returned size.
+ */
 size_t arith_encode(void *dest, size_t max_dest_size, const void *src, size_t size);
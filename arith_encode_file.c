@@ -33,19 +33,26 @@ int main(int argc, char *argv[])
     dest      = (char *)malloc(dest_size);
     if ( ! dest) {
         perror(NULL);
-        free(buf.buf);
+        buf_free(buf);
         return EXIT_FAILURE;
     }
 
     actual_size = arith_encode(dest, dest_size, buf.buf, buf.size);
 
+    if (actual_size > dest_size) {
+        fprintf(stderr, "Error: Encoded data does not fit in %zu bytes\n", dest_size);
+        buf_free(buf);
+        free(dest);
+        return EXIT_FAILURE;
+    }
+
     printf("Input:  %zu bytes\n", buf.size);
     printf("Output: %zu bytes\n", actual_size);
 
     decoded = (char *)malloc(buf.size);
     if ( ! decoded) {
         perror(NULL);
-        free(buf.buf);
+        buf_free(buf);
         return EXIT_FAILURE;
     }
 
@@ -53,12 +60,12 @@ int main(int argc, char *argv[])
 
     if (memcmp(buf.buf, decoded, buf.size)) {
         fprintf(stderr, "Decoded data doesn't match original!\n");
-        free(buf.buf);
+        buf_free(buf);
         free(decoded);
         return EXIT_FAILURE;
     }
 
-    free(buf.buf);
+    buf_free(buf);
     free(decoded);
 
     return EXIT_SUCCESS;
@@ -0,0 +1,768 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "arith_decode.h"
+#include "arith_encode.h"
+#include "find_repeats.h"
+#include "lza_compress.h"
+#include "lza_decompress.h"
+#include "perf.h"
+#include "report.h"
+#include "timer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Benchmark of individual compression stages on a synthetic corpus.
+ *
+ * The corpus is generated from a fixed seed, so it is identical on every
+ * run and every machine, and compression ratios can be compared exactly.
+ * Results are compared against a baseline file, which contains tolerances
+ * and one line per corpus and stage:
+ *
+ *     tolerance speed  0.50
+ *     tolerance ratio  0.002
+ *     tolerance memory 0.20
+ *     CORPUS STAGE MB/s RATIO PEAK_MB
+ */
+
+#define CORPUS_SIZE (256U << 10)
+#define MIN_TIME_US 500000U     /* Fast stages are repeated for at least this long */
+
+/*****************************************************************************/
+/* Corpus generator                                                          */
+
+static uint64_t rng_state;
+
+static uint32_t rng(void)
+{
+    /* xorshift64* */
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 0x2545F4914F6CDD1DU) >> 32);
+}
+
+static uint32_t rng_range(uint32_t range)
+{
+    return rng() % range;
+}
+
+static size_t put_bytes(uint8_t *buf, size_t pos, size_t size, const uint8_t *bytes, size_t num_bytes)
+{
+    if (num_bytes > size - pos)
+        num_bytes = size - pos;
+
+    memcpy(&buf[pos], bytes, num_bytes);
+
+    return pos + num_bytes;
+}
+
+static size_t put_uint32(uint8_t *buf, size_t pos, size_t size, uint32_t value)
+{
+    const uint8_t bytes[4] = {
+        (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)
+    };
+
+    return put_bytes(buf, pos, size, bytes, sizeof(bytes));
+}
+
+/* Functions with x86-64 prologues, epilogues and typical instructions */
+static void gen_code(uint8_t *buf, size_t size)
+{
+    static const uint8_t prologue[] = { 0x55, 0x48, 0x89, 0xE5, 0x48, 0x83, 0xEC };
+    static const uint8_t epilogue[] = { 0x48, 0x89, 0xEC, 0x5D, 0xC3 };
+    static const uint8_t templates[][4] = {
+        { 3, 0x48, 0x8B, 0x45 },   /* mov rax, [rbp+disp8]     */
+        { 3, 0x48, 0x89, 0x45 },   /* mov [rbp+disp8], rax     */
+        { 3, 0x8B, 0x4D, 0x00 },   /* mov ecx, [rbp+disp8]     */
+        { 2, 0x89, 0xC7, 0x00 },   /* mov edi, eax             */
+        { 3, 0x48, 0x85, 0xC0 },   /* test rax, rax            */
+        { 3, 0x48, 0x01, 0xD0 },   /* add rax, rdx             */
+        { 2, 0x31, 0xC0, 0x00 },   /* xor eax, eax             */
+        { 3, 0x48, 0x83, 0xC0 },   /* add rax, imm8            */
+    };
+
+    size_t   pos  = 0;
+    uint32_t func = 0;
+
+    while (pos < size) {
+        uint32_t num_insns = 4 + rng_range(40);
+
+        pos = put_bytes(buf, pos, size, prologue, sizeof(prologue));
+        if (pos < size)
+            buf[pos++] = (uint8_t)(8 * (1 + rng_range(8)));
+
+        while (num_insns-- && pos < size) {
+            const uint32_t kind = rng_range(16);
+
+            if (kind < 8) {
+                const uint8_t *const insn = templates[kind];
+
+                pos = put_bytes(buf, pos, size, &insn[1], insn[0]);
+                if (kind == 0 || kind == 1 || kind == 2 || kind == 7) {
+                    if (pos < size)
+                        buf[pos++] = (uint8_t)(rng_range(16) * 8);
+                }
+            }
+            else if (kind < 12) {
+                /* call rel32, targets are other functions */
+                const uint8_t call = 0xE8;
+
+                pos = put_bytes(buf, pos, size, &call, 1);
+                pos = put_uint32(buf, pos, size, (func - rng_range(64)) * 0x60U - (uint32_t)pos);
+            }
+            else if (kind < 14) {
+                /* je/jne rel32 within the function */
+                const uint8_t jcc[2] = { 0x0F, (uint8_t)(0x84 + (kind & 1)) };
+
+                pos = put_bytes(buf, pos, size, jcc, sizeof(jcc));
+                pos = put_uint32(buf, pos, size, rng_range(0x80));
+            }
+            else {
+                /* lea rcx, [rip+rel32] */
+                const uint8_t lea[3] = { 0x48, 0x8D, 0x0D };
+
+                pos = put_bytes(buf, pos, size, lea, sizeof(lea));
+                pos = put_uint32(buf, pos, size, 0x10000U + rng_range(0x1000) * 8);
+            }
+        }
+
+        pos = put_bytes(buf, pos, size, epilogue, sizeof(epilogue));
+
+        /* Align functions to 16 bytes with int3 */
+        while ((pos & 15) && pos < size)
+            buf[pos++] = 0xCC;
+
+        ++func;
+    }
+}
+
+/* Tables of 64-bit pointers into an image, like vtables or relocated data */
+static void gen_pointers(uint8_t *buf, size_t size)
+{
+    uint64_t ptr = 0x140001000U;
+    size_t   pos;
+
+    for (pos = 0; pos + 8 <= size; pos += 8) {
+        uint64_t value = ptr;
+        uint32_t i;
+
+        if (rng_range(16) == 0)
+            value = 0;
+        else
+            ptr += 0x10U * (1 + rng_range(32));
+
+        for (i = 0; i < 8; i++)
+            buf[pos + i] = (uint8_t)(value >> (i * 8));
+    }
+
+    memset(&buf[pos], 0, size - pos);
+}
+
+/* UTF-16LE strings, as found in Windows resources */
+static void gen_utf16(uint8_t *buf, size_t size)
+{
+    static const char *const words[] = {
+        "File", "Edit", "View", "Help", "Open", "Save", "Close", "Window",
+        "Error", "Warning", "Cannot", "find", "the", "specified", "path",
+        "Microsoft", "Corporation", "Version", "Copyright", "Settings"
+    };
+
+    size_t pos = 0;
+
+    while (pos < size) {
+        uint32_t num_words = 1 + rng_range(6);
+
+        while (num_words--) {
+            const char *word = words[rng_range(sizeof(words) / sizeof(words[0]))];
+
+            for ( ; *word && pos + 2 <= size; ++word) {
+                buf[pos++] = (uint8_t)*word;
+                buf[pos++] = 0;
+            }
+
+            if (num_words && pos + 2 <= size) {
+                buf[pos++] = ' ';
+                buf[pos++] = 0;
+            }
+        }
+
+        /* Null terminator */
+        while (pos < size) {
+            buf[pos++] = 0;
+            if ( ! (pos & 1))
+                break;
+        }
+    }
+}
+
+/* Long runs of zeros separated by short chunks of data */
+static void gen_zeros(uint8_t *buf, size_t size)
+{
+    size_t pos = 0;
+
+    while (pos < size) {
+        size_t run = 0x100U + rng_range(0x10000);
+        size_t data;
+
+        if (run > size - pos)
+            run = size - pos;
+
+        memset(&buf[pos], 0, run);
+        pos += run;
+
+        for (data = rng_range(0x200); data && pos < size; data--)
+            buf[pos++] = (uint8_t)rng_range(0x20);
+    }
+}
+
+/* Incompressible data, like embedded compressed resources */
+static void gen_random(uint8_t *buf, size_t size)
+{
+    size_t pos;
+
+    for (pos = 0; pos < size; pos++)
+        buf[pos] = (uint8_t)(rng() >> 24);
+}
+
+typedef void (* GEN_FUNC)(uint8_t *buf, size_t size);
+
+static const struct {
+    const char *name;
+    GEN_FUNC    gen;
+} corpora[] = {
+    { "code",     gen_code     },
+    { "pointers", gen_pointers },
+    { "utf16",    gen_utf16    },
+    { "zeros",    gen_zeros    },
+    { "random",   gen_random   },
+    { "mixed",    NULL         }
+};
+
+#define NUM_CORPORA (sizeof(corpora) / sizeof(corpora[0]))
+
+static void gen_corpus(uint8_t *buf, size_t size, uint32_t corpus)
+{
+    rng_state = 0x6D696E696679U + corpus;
+
+    if (corpora[corpus].gen)
+        corpora[corpus].gen(buf, size);
+    else {
+        /* Chunks of all other corpora, like sections of an executable */
+        const size_t chunk_size = 0x10000;
+        size_t       pos;
+
+        for (pos = 0; pos < size; pos += chunk_size) {
+            const uint32_t kind = rng_range(NUM_CORPORA - 1);
+
+            corpora[kind].gen(&buf[pos], (size - pos < chunk_size) ? (size - pos) : chunk_size);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* Memory measurement                                                        */
+
+#ifdef __linux__
+/* Resets peak RSS to the current RSS, returns non-zero if not supported */
+static int reset_peak_memory(void)
+{
+    FILE *const file = fopen("/proc/self/clear_refs", "w");
+    int         error;
+
+    if ( ! file)
+        return 1;
+
+    error = fputs("5", file) < 0;
+
+    return fclose(file) || error;
+}
+
+static uint64_t read_peak_memory(void)
+{
+    FILE *const file = fopen("/proc/self/status", "r");
+    char        line[256];
+    uint64_t    peak = 0;
+
+    if ( ! file)
+        return get_peak_memory();
+
+    while (fgets(line, sizeof(line), file)) {
+        if ( ! strncmp(line, "VmHWM:", 6)) {
+            peak = strtoull(line + 6, NULL, 10) * 1024U;
+            break;
+        }
+    }
+
+    fclose(file);
+
+    return peak ? peak : get_peak_memory();
+}
+#else
+/* Peak memory of the process cannot be reset, so it only grows */
+static int reset_peak_memory(void)
+{
+    return 1;
+}
+
+static uint64_t read_peak_memory(void)
+{
+    return get_peak_memory();
+}
+#endif
+
+/*****************************************************************************/
+/* Stages                                                                    */
+
+enum STAGE {
+    STAGE_FIND_REPEATS,
+    STAGE_LZ_COMPRESS,
+    STAGE_ARITH_ENCODE,
+    STAGE_ARITH_DECODE,
+    STAGE_LZ_DECOMPRESS,
+
+    NUM_STAGES
+};
+
+static const char *const stage_names[NUM_STAGES] = {
+    "find_repeats", "lz_compress", "arith_encode", "arith_decode", "lz_decompress"
+};
+
+typedef struct {
+    double      mb_per_s;   /* Throughput of stage input, or output for decompression */
+    double      ratio;      /* Output size divided by input size, 0 if not applicable */
+    double      peak_mb;    /* Peak resident memory while running the stage */
+    int         valid;
+    PERF_VALUES perf;       /* Hardware counters summed over all runs */
+    uint64_t    perf_bytes; /* Bytes processed by all runs */
+} RESULT;
+
+/* Data passed between stages */
+typedef struct {
+    const uint8_t *input;
+    size_t         size;
+    uint8_t       *lz;
+    size_t         lz_size;
+    uint8_t       *packed;
+    size_t         packed_size;
+} PIPELINE;
+
+static void ignore_literal(void *cookie, const uint8_t *buf, size_t pos, size_t size)
+{
+}
+
+static void ignore_match(void *cookie, const uint8_t *buf, size_t pos, OCCURRENCE occurrence)
+{
+}
+
+/* Runs one iteration of a stage, returns non-zero on failure */
+static int run_stage(enum STAGE stage, PIPELINE *pipeline)
+{
+    switch (stage) {
+
+        case STAGE_FIND_REPEATS:
+            return find_repeats(pipeline->input, pipeline->size, ignore_literal, ignore_match, NULL);
+
+        case STAGE_LZ_COMPRESS: {
+            const size_t           bound      = lz_compress_bound(pipeline->size);
+            const COMPRESSED_SIZES compressed = lz_compress(pipeline->lz, bound, pipeline->input, pipeline->size);
+
+            pipeline->lz_size = compressed.lz;
+            return ! compressed.lz;
+        }
+
+        case STAGE_ARITH_ENCODE: {
+            const size_t capacity = pipeline->lz_size + pipeline->lz_size / 8 + 64;
+
+            pipeline->packed_size = arith_encode(pipeline->packed, capacity, pipeline->lz, pipeline->lz_size);
+            return pipeline->packed_size > capacity;
+        }
+
+        case STAGE_ARITH_DECODE: {
+            uint8_t *const decoded = (uint8_t *)malloc(pipeline->lz_size);
+            int            error   = 1;
+
+            if (decoded) {
+                arith_decode(decoded, pipeline->lz_size, pipeline->packed, pipeline->packed_size);
+                error = memcmp(decoded, pipeline->lz, pipeline->lz_size) != 0;
+                free(decoded);
+            }
+            return error;
+        }
+
+        case STAGE_LZ_DECOMPRESS: {
+            uint8_t *const decoded = (uint8_t *)malloc(pipeline->size);
+            int            error   = 1;
+
+            if (decoded) {
+                lz_decompress(decoded, pipeline->size, pipeline->lz, NULL);
+                error = memcmp(decoded, pipeline->input, pipeline->size) != 0;
+                free(decoded);
+            }
+            return error;
+        }
+
+        default:
+            return 1;
+    }
+}
+
+static RESULT bench_stage(enum STAGE stage, PIPELINE *pipeline, uint32_t repeat, PERF_COUNTERS *perf)
+{
+    RESULT   result;
+    uint64_t best_us  = ~(uint64_t)0;
+    uint64_t total_us = 0;
+    size_t   bytes;
+    uint32_t i;
+
+    memset(&result, 0, sizeof(result));
+
+    reset_peak_memory();
+
+    for (i = 0; i < repeat || total_us < MIN_TIME_US; i++) {
+        PERF_VALUES    perf_begin;
+        PERF_VALUES    perf_end;
+        uint64_t       start;
+        uint64_t       elapsed;
+
+        if (perf)
+            read_perf_counters(perf, &perf_begin);
+
+        start = get_time_us();
+
+        if (run_stage(stage, pipeline)) {
+            fprintf(stderr, "Error: Stage %s failed\n", stage_names[stage]);
+            return result;
+        }
+
+        elapsed   = get_time_us() - start;
+
+        if (perf) {
+            read_perf_counters(perf, &perf_end);
+            add_perf_values(&result.perf, &perf_begin, &perf_end);
+        }
+
+        total_us += elapsed;
+        if (elapsed < best_us)
+            best_us = elapsed;
+    }
+
+    result.peak_mb = (double)read_peak_memory() / (1024.0 * 1024.0);
+
+    if (stage == STAGE_ARITH_ENCODE || stage == STAGE_ARITH_DECODE)
+        bytes = pipeline->lz_size;
+    else
+        bytes = pipeline->size;
+
+    if (stage == STAGE_LZ_COMPRESS)
+        result.ratio = (double)pipeline->lz_size / (double)pipeline->size;
+    else if (stage == STAGE_ARITH_ENCODE)
+        result.ratio = (double)pipeline->packed_size / (double)pipeline->lz_size;
+
+    result.mb_per_s   = (double)bytes / (double)(best_us ? best_us : 1) * (1e6 / (1024.0 * 1024.0));
+    result.perf_bytes = (uint64_t)bytes * i;
+    result.valid      = 1;
+
+    return result;
+}
+
+/*****************************************************************************/
+/* Baseline                                                                  */
+
+typedef struct {
+    double speed;       /* Allowed relative slowdown            */
+    double ratio;       /* Allowed relative increase of ratio   */
+    double memory;      /* Allowed relative increase of memory  */
+} TOLERANCE;
+
+typedef struct {
+    TOLERANCE tolerance;
+    RESULT    results[NUM_CORPORA][NUM_STAGES];
+} BASELINE;
+
+static int find_name(const char *name, const char *const *names, size_t num_names)
+{
+    size_t i;
+
+    for (i = 0; i < num_names; i++)
+        if ( ! strcmp(name, names[i]))
+            return (int)i;
+
+    return -1;
+}
+
+static int find_corpus(const char *name)
+{
+    uint32_t i;
+
+    for (i = 0; i < NUM_CORPORA; i++)
+        if ( ! strcmp(name, corpora[i].name))
+            return (int)i;
+
+    return -1;
+}
+
+/* Returns non-zero if the baseline file exists but is invalid */
+static int load_baseline(const char *filename, BASELINE *baseline, int update)
+{
+    FILE *const file = fopen(filename, "r");
+    char        line[256];
+    unsigned    line_no = 0;
+
+    baseline->tolerance.speed  = 0.50;
+    baseline->tolerance.ratio  = 0.002;
+    baseline->tolerance.memory = 0.20;
+
+    /* Missing baseline is created with --update */
+    if ( ! file) {
+        if ( ! update)
+            perror(filename);
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        char   name[32];
+        char   value_name[32];
+        double values[3];
+
+        ++line_no;
+
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        if (sscanf(line, "tolerance %31s %lf", value_name, &values[0]) == 2) {
+            if ( ! strcmp(value_name, "speed"))
+                baseline->tolerance.speed = values[0];
+            else if ( ! strcmp(value_name, "ratio"))
+                baseline->tolerance.ratio = values[0];
+            else if ( ! strcmp(value_name, "memory"))
+                baseline->tolerance.memory = values[0];
+            else
+                break;
+        }
+        else if (sscanf(line, "%31s %31s %lf %lf %lf", name, value_name,
+                        &values[0], &values[1], &values[2]) == 5) {
+            const int corpus = find_corpus(name);
+            const int stage  = find_name(value_name, stage_names, NUM_STAGES);
+            RESULT   *result;
+
+            if (corpus < 0 || stage < 0)
+                break;
+
+            result           = &baseline->results[corpus][stage];
+            result->mb_per_s = values[0];
+            result->ratio    = values[1];
+            result->peak_mb  = values[2];
+            result->valid    = 1;
+        }
+        else
+            break;
+    }
+
+    if ( ! feof(file)) {
+        fprintf(stderr, "%s:%u: Error: Invalid baseline entry\n", filename, line_no);
+        fclose(file);
+        return 1;
+    }
+
+    fclose(file);
+
+    return 0;
+}
+
+static int save_baseline(const char *filename, const BASELINE *baseline)
+{
+    FILE *const file = fopen(filename, "w");
+    uint32_t    corpus;
+    uint32_t    stage;
+    int         error;
+
+    if ( ! file) {
+        perror(filename);
+        return 1;
+    }
+
+    fprintf(file, "# Baseline for make bench, update with make bench BENCH_UPDATE=1\n");
+    fprintf(file, "# Tolerances are relative: slowdown, increase of ratio, increase of memory\n");
+    fprintf(file, "tolerance speed  %.3f\n",  baseline->tolerance.speed);
+    fprintf(file, "tolerance ratio  %.3f\n",  baseline->tolerance.ratio);
+    fprintf(file, "tolerance memory %.3f\n",  baseline->tolerance.memory);
+    fprintf(file, "# corpus  stage          MB/s      ratio   peak_MB\n");
+
+    for (corpus = 0; corpus < NUM_CORPORA; corpus++)
+        for (stage = 0; stage < NUM_STAGES; stage++) {
+            const RESULT *const result = &baseline->results[corpus][stage];
+
+            fprintf(file, "%-9s %-13s %9.2f %10.6f %9.1f\n",
+                    corpora[corpus].name, stage_names[stage],
+                    result->mb_per_s, result->ratio, result->peak_mb);
+        }
+
+    error = ferror(file);
+
+    if (fclose(file) || error) {
+        fprintf(stderr, "Error: Failed to write to file %s\n", filename);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Returns description of the regression or NULL if the result is within tolerance */
+static const char *check_result(const RESULT *result, const RESULT *base, const TOLERANCE *tolerance)
+{
+    if ( ! base->valid)
+        return NULL;
+
+    if (result->mb_per_s < base->mb_per_s * (1.0 - tolerance->speed))
+        return "slower";
+
+    /* Allow for rounding of the ratio in the baseline file */
+    if (result->ratio > base->ratio * (1.0 + tolerance->ratio) + 1e-6)
+        return "worse ratio";
+
+    if (result->peak_mb > base->peak_mb * (1.0 + tolerance->memory) + 1.0)
+        return "more memory";
+
+    return NULL;
+}
+
+/*****************************************************************************/
+
+static void print_usage(void)
+{
+    fprintf(stderr, "Usage: bench [OPTIONS]\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    --baseline=FILE      Compare results against FILE\n");
+    fprintf(stderr, "    --perf               Print hardware performance counters of each stage\n");
+    fprintf(stderr, "    --repeat=N           Minimum number of runs of each stage, the fastest is used\n");
+    fprintf(stderr, "    --update             Save results in the baseline file\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static BASELINE baseline;
+    static BASELINE measured;
+    const char     *baseline_file = NULL;
+    uint32_t        repeat        = 1;
+    int             update        = 0;
+    int             use_perf      = 0;
+    unsigned        num_failed    = 0;
+    uint32_t        corpus;
+    int             i;
+    PIPELINE        pipeline;
+    uint8_t        *input;
+    PERF_COUNTERS  *perf          = NULL;
+
+    for (i = 1; i < argc; i++) {
+        const char *const arg = argv[i];
+
+        if ( ! strncmp(arg, "--baseline=", 11))
+            baseline_file = arg + 11;
+        else if ( ! strncmp(arg, "--repeat=", 9) && atoi(arg + 9) > 0)
+            repeat = (uint32_t)atoi(arg + 9);
+        else if ( ! strcmp(arg, "--update"))
+            update = 1;
+        else if ( ! strcmp(arg, "--perf"))
+            use_perf = 1;
+        else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (update && ! baseline_file) {
+        fprintf(stderr, "Error: --update requires --baseline\n");
+        return EXIT_FAILURE;
+    }
+
+    if (baseline_file && load_baseline(baseline_file, &baseline, update))
+        return EXIT_FAILURE;
+
+    if (use_perf) {
+        perf = open_perf_counters();
+        if ( ! perf)
+            fprintf(stderr, "Warning: Hardware performance counters are not available, ignoring --perf\n");
+    }
+
+    input           = (uint8_t *)malloc(CORPUS_SIZE);
+    pipeline.lz     = (uint8_t *)malloc(lz_compress_bound(CORPUS_SIZE));
+    pipeline.packed = (uint8_t *)malloc(lz_compress_bound(CORPUS_SIZE) * 9 / 8 + 64);
+
+    if ( ! input || ! pipeline.lz || ! pipeline.packed) {
+        perror(NULL);
+        return EXIT_FAILURE;
+    }
+
+    printf("%-9s %-13s %9s %10s %9s\n", "corpus", "stage", "MB/s", "ratio", "peak MB");
+
+    for (corpus = 0; corpus < NUM_CORPORA; corpus++) {
+        uint32_t stage;
+
+        gen_corpus(input, CORPUS_SIZE, corpus);
+
+        pipeline.input = input;
+        pipeline.size  = CORPUS_SIZE;
+
+        for (stage = 0; stage < NUM_STAGES; stage++) {
+            const RESULT *const base   = &baseline.results[corpus][stage];
+            RESULT *const       result = &measured.results[corpus][stage];
+            const char         *status;
+
+            *result = bench_stage((enum STAGE)stage, &pipeline, repeat, perf);
+            if ( ! result->valid)
+                return EXIT_FAILURE;
+
+            status = check_result(result, base, &baseline.tolerance);
+
+            printf("%-9s %-13s %9.2f %10.6f %9.1f", corpora[corpus].name, stage_names[stage],
+                   result->mb_per_s, result->ratio, result->peak_mb);
+
+            if (base->valid)
+                printf("  (baseline %9.2f %10.6f %9.1f)%s%s",
+                       base->mb_per_s, base->ratio, base->peak_mb,
+                       status ? " REGRESSION: " : "", status ? status : "");
+            printf("\n");
+
+            if (status)
+                ++num_failed;
+        }
+    }
+
+    if (perf) {
+        printf("\nHardware counters per byte of stage throughput\n");
+        printf("%-9s %-13s", "corpus", "stage");
+        print_perf_columns(stdout);
+
+        for (corpus = 0; corpus < NUM_CORPORA; corpus++) {
+            uint32_t stage;
+
+            for (stage = 0; stage < NUM_STAGES; stage++) {
+                const RESULT *const result = &measured.results[corpus][stage];
+
+                printf("%-9s %-13s", corpora[corpus].name, stage_names[stage]);
+                print_perf_values(stdout, &result->perf, result->perf_bytes);
+            }
+        }
+
+        close_perf_counters(perf);
+    }
+
+    free(pipeline.packed);
+    free(pipeline.lz);
+    free(input);
+
+    if (update) {
+        measured.tolerance = baseline.tolerance;
+        return save_baseline(baseline_file, &measured) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (num_failed)
+        printf("%u regressions\n", num_failed);
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
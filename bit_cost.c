@@ -0,0 +1,345 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "bit_cost.h"
+#include "bit_ops.h"
+
+#include <math.h>
+#include <string.h>
+
+/* The model used by the arithmetic coder counts zeroes and ones among the
+ * last 64 bits of its input, see update_model().  Initially the history
+ * contains alternating ones and zeroes and each count is one larger than
+ * the number of bits with that value in the history.
+ */
+#define MODEL_HISTORY 64
+#define MODEL_TOTAL   (MODEL_HISTORY + 2)
+
+typedef struct {
+    size_t   pos;       /* Bit position in LZ77 data */
+    size_t   end;
+} COST_STREAM;
+
+typedef struct {
+    const uint8_t *lz;
+    double         spent;   /* Cost of all bits read so far */
+    int            error;
+    double         log_prob[MODEL_TOTAL];   /* -log2(count / MODEL_TOTAL) */
+} COST_CTX;
+
+static const char *const packet_names[COST_NUM_PACKETS] = {
+    "lit", "match", "shortrep", "longrep0", "longrep1", "longrep2", "longrep3", "padding"
+};
+
+static const char *const stream_names[LZS_NUM_STREAMS] = {
+    "type", "literal_msb", "literal", "size", "offset"
+};
+
+/* LZ77 data preceded by the initial history of the model */
+static uint8_t get_history_byte(const uint8_t *lz, size_t idx)
+{
+    return (idx < MODEL_HISTORY / 8) ? 0xAAU : lz[idx - MODEL_HISTORY / 8];
+}
+
+/* The probability of a bit only depends on the 64 bits preceding it */
+static double get_cost(const COST_CTX *ctx, size_t pos, uint32_t bit)
+{
+    const size_t   first  = pos >> 3;
+    const unsigned shift  = (unsigned)(pos & 7U);
+    uint64_t       window = 0;
+    unsigned       ones;
+    unsigned       i;
+
+    for (i = 0; i < MODEL_HISTORY / 8; i++)
+        window = (window << 8) | get_history_byte(ctx->lz, first + i);
+
+    if (shift)
+        window = (window << shift) | (uint64_t)(get_history_byte(ctx->lz, first + i) >> (8 - shift));
+
+    ones = count_ones(window);
+
+    return ctx->log_prob[bit ? (1 + ones) : (1 + MODEL_HISTORY - ones)];
+}
+
+static uint32_t read_bits(COST_CTX *ctx, COST_STREAM *stream, int bits, double *cost)
+{
+    uint32_t value = 0;
+
+    while (bits--) {
+        uint32_t bit = 0;
+
+        if (stream->pos < stream->end) {
+            double bit_cost;
+
+            bit      = (ctx->lz[stream->pos >> 3] >> (7U - (stream->pos & 7U))) & 1U;
+            bit_cost = get_cost(ctx, stream->pos, bit);
+
+            *cost      += bit_cost;
+            ctx->spent += bit_cost;
+            ++stream->pos;
+        }
+        else
+            ctx->error = 1;
+
+        value = (value << 1) | bit;
+    }
+
+    return value;
+}
+
+static uint32_t read_length(COST_CTX *ctx, COST_STREAM *stream, double *cost)
+{
+    uint32_t value = 2;
+    int      bits  = 3;
+
+    if (read_bits(ctx, stream, 1, cost)) {
+        value += 8;
+
+        if (read_bits(ctx, stream, 1, cost)) {
+            bits   = LZA_LENGTH_TAIL_BITS;
+            value += 8;
+        }
+    }
+
+    return value + read_bits(ctx, stream, bits, cost);
+}
+
+static uint64_t read_distance(COST_CTX *ctx, COST_STREAM *stream, int slot_bits, double *cost)
+{
+    const uint32_t data = read_bits(ctx, stream, slot_bits, cost);
+    uint64_t       value;
+    int            bits;
+
+    if (data < 2)
+        return data + 1;
+
+    bits  = (int)(data >> 1) - 1;
+    value = (uint64_t)((data & 1) + 2) << bits;
+
+    if (bits > 32) {
+        value += (uint64_t)read_bits(ctx, stream, bits - 32, cost) << 32;
+        bits   = 32;
+    }
+
+    return value + read_bits(ctx, stream, bits, cost) + 1;
+}
+
+/* Reads packet type and returns the packet, the cost of type bits is only
+ * attributed once the whole type is known.
+ */
+static enum COST_PACKET read_type(COST_CTX *ctx, COST_STREAM *stream, BIT_COSTS *costs)
+{
+    double           cost   = 0;
+    enum COST_PACKET packet = COST_LIT;
+
+    if (read_bits(ctx, stream, 1, &cost)) {
+        if ( ! read_bits(ctx, stream, 1, &cost))
+            packet = COST_MATCH;
+        else {
+            const uint32_t rep = read_bits(ctx, stream, 2, &cost);
+
+            if ( ! rep)
+                packet = COST_SHORTREP;
+            else if (rep < 3)
+                packet = (enum COST_PACKET)(COST_LONGREP0 + rep - 1);
+            else
+                packet = (enum COST_PACKET)(COST_LONGREP2 + read_bits(ctx, stream, 1, &cost));
+        }
+    }
+
+    costs->bits[packet][LZS_TYPE] += cost;
+
+    return packet;
+}
+
+/* Spreads cost of a packet evenly over the bytes it produces */
+static void add_byte_costs(double *byte_costs, size_t pos, size_t size, size_t src_size, double cost)
+{
+    const double byte_cost = cost / (double)size;
+    size_t       end       = pos + size;
+
+    if (end > src_size)
+        end = src_size;
+
+    for ( ; pos < end; pos++)
+        byte_costs[pos] += byte_cost;
+}
+
+int get_bit_costs(BIT_COSTS  *costs,
+                  double     *byte_costs,
+                  const void *lz,
+                  size_t      lz_size,
+                  size_t      src_size)
+{
+    COST_CTX    ctx;
+    COST_STREAM header;
+    COST_STREAM stream[LZS_NUM_STREAMS];
+    size_t      pos;
+    size_t      num_bytes = 0;
+    const int   slot_bits = LZA_SLOT_BITS(src_size);
+    uint32_t    i;
+
+    memset(costs, 0, sizeof(*costs));
+
+    if (byte_costs)
+        memset(byte_costs, 0, src_size * sizeof(double));
+
+    ctx.lz    = (const uint8_t *)lz;
+    ctx.spent = 0;
+    ctx.error = 0;
+    for (i = 1; i < MODEL_TOTAL; i++)
+        ctx.log_prob[i] = log2((double)MODEL_TOTAL / (double)i);
+    ctx.log_prob[0] = 0;
+
+    /* Load sizes of each stream, the header is padded to whole bytes */
+    header.pos = 0;
+    header.end = lz_size * 8;
+    for (i = 0; i < LZS_NUM_STREAMS; i++) {
+        const size_t size = (size_t)read_distance(&ctx, &header, slot_bits, &costs->header);
+
+        stream[i].end = size * 8;
+    }
+
+    header.end = (header.pos + 7) & ~(size_t)7;
+    while (header.pos < header.end)
+        read_bits(&ctx, &header, 1, &costs->header);
+
+    pos = header.end;
+    for (i = 0; i < LZS_NUM_STREAMS; i++) {
+        const size_t size = stream[i].end;
+
+        if (size > lz_size * 8 - pos) {
+            ctx.error = 1;
+            return ctx.error;
+        }
+
+        stream[i].pos  = pos;
+        stream[i].end  = pos + size;
+        pos           += size;
+    }
+
+    while (num_bytes < src_size && ! ctx.error) {
+        const double           spent  = ctx.spent;
+        const enum COST_PACKET packet = read_type(&ctx, &stream[LZS_TYPE], costs);
+        double *const          cost   = costs->bits[packet];
+        size_t                 size   = 1;
+
+        switch (packet) {
+            case COST_LIT:
+                read_bits(&ctx, &stream[LZS_LITERAL_MSB], 1, &cost[LZS_LITERAL_MSB]);
+                read_bits(&ctx, &stream[LZS_LITERAL], 7, &cost[LZS_LITERAL]);
+                break;
+
+            case COST_MATCH:
+                size = read_length(&ctx, &stream[LZS_SIZE], &cost[LZS_SIZE]);
+                read_distance(&ctx, &stream[LZS_OFFSET], slot_bits, &cost[LZS_OFFSET]);
+                break;
+
+            case COST_SHORTREP:
+                break;
+
+            default:
+                size = read_length(&ctx, &stream[LZS_SIZE], &cost[LZS_SIZE]);
+                break;
+        }
+
+        if (byte_costs)
+            add_byte_costs(byte_costs, num_bytes, size, src_size, ctx.spent - spent);
+
+        num_bytes += size;
+    }
+
+    /* Remaining bits of each stream were emitted by emit_tail() */
+    for (i = 0; i < LZS_NUM_STREAMS; i++) {
+        while (stream[i].pos < stream[i].end)
+            read_bits(&ctx, &stream[i], 1, &costs->bits[COST_PADDING][i]);
+    }
+
+    if (num_bytes != src_size)
+        ctx.error = 1;
+
+    costs->total = costs->header;
+    for (i = 0; i < COST_NUM_PACKETS; i++) {
+        uint32_t j;
+
+        for (j = 0; j < LZS_NUM_STREAMS; j++)
+            costs->total += costs->bits[i][j];
+    }
+
+    return ctx.error;
+}
+
+static double get_packet_cost(const BIT_COSTS *costs, uint32_t packet)
+{
+    double   cost = 0;
+    uint32_t i;
+
+    for (i = 0; i < LZS_NUM_STREAMS; i++)
+        cost += costs->bits[packet][i];
+
+    return cost;
+}
+
+static double get_stream_cost(const BIT_COSTS *costs, uint32_t stream)
+{
+    double   cost = 0;
+    uint32_t i;
+
+    for (i = 0; i < COST_NUM_PACKETS; i++)
+        cost += costs->bits[i][stream];
+
+    return cost;
+}
+
+void print_bit_costs(FILE *file, const BIT_COSTS *costs)
+{
+    const double total = costs->total ? costs->total : 1;
+    uint32_t     i;
+    uint32_t     j;
+
+    fprintf(file, "Compressed bits spent:\n");
+
+    fprintf(file, "        %-10s", "");
+    for (j = 0; j < LZS_NUM_STREAMS; j++)
+        fprintf(file, " %12s", stream_names[j]);
+    fprintf(file, " %12s\n", "total");
+
+    for (i = 0; i < COST_NUM_PACKETS; i++) {
+        const double cost = get_packet_cost(costs, i);
+
+        fprintf(file, "        %-10s", packet_names[i]);
+        for (j = 0; j < LZS_NUM_STREAMS; j++)
+            fprintf(file, " %12.1f", costs->bits[i][j]);
+        fprintf(file, " %12.1f %5.1f%%\n", cost, cost * 100 / total);
+    }
+
+    fprintf(file, "        %-10s", "total");
+    for (j = 0; j < LZS_NUM_STREAMS; j++)
+        fprintf(file, " %12.1f", get_stream_cost(costs, j));
+    fprintf(file, " %12.1f\n", costs->total);
+
+    fprintf(file, "        %-10s", "");
+    for (j = 0; j < LZS_NUM_STREAMS; j++)
+        fprintf(file, " %11.1f%%", get_stream_cost(costs, j) * 100 / total);
+    fprintf(file, "\n");
+
+    fprintf(file, "        header     %12.1f\n", costs->header);
+}
+
+void write_json_bit_costs(FILE *file, const BIT_COSTS *costs)
+{
+    uint32_t i;
+    uint32_t j;
+
+    fprintf(file, "{\"total\":%.1f,\"header\":%.1f", costs->total, costs->header);
+
+    for (i = 0; i < COST_NUM_PACKETS; i++) {
+        fprintf(file, ",\"%s\":{", packet_names[i]);
+        for (j = 0; j < LZS_NUM_STREAMS; j++)
+            fprintf(file, "%s\"%s\":%.1f", j ? "," : "", stream_names[j], costs->bits[i][j]);
+        fprintf(file, "}");
+    }
+
+    fprintf(file, "}");
+}
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include "lza_defines.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Packets which produce bits in LZ77 streams */
+enum COST_PACKET {
+    COST_LIT,
+    COST_MATCH,
+    COST_SHORTREP,
+    COST_LONGREP0,
+    COST_LONGREP1,
+    COST_LONGREP2,
+    COST_LONGREP3,
+    COST_PADDING,       /* Tail bits which flush each stream */
+
+    COST_NUM_PACKETS
+};
+
+/* Number of compressed bits which the arithmetic coder spends on each bit
+ * of LZ77 data, attributed to the stream and packet which produced the bit.
+ * The values are fractional, the cost of a bit is -log2(p), where p is the
+ * probability the model assigns to the bit.
+ */
+typedef struct {
+    double bits[COST_NUM_PACKETS][LZS_NUM_STREAMS];
+    double header;      /* Stream sizes preceding the streams */
+    double total;
+} BIT_COSTS;
+
+/* Replays the arithmetic coder's model over LZ77 data produced by
+ * lz_compress() for src_size bytes of input.  If byte_costs is not NULL,
+ * it receives the cost of each input byte, the cost of a packet is spread
+ * evenly over the bytes it produces.  Returns non-zero if the LZ77 data
+ * is malformed.
+ */
+int get_bit_costs(BIT_COSTS  *costs,
+                  double     *byte_costs,
+                  const void *lz,
+                  size_t      lz_size,
+                  size_t      src_size);
+
+void print_bit_costs(FILE *file, const BIT_COSTS *costs);
+
+/* Writes costs as a JSON object */
+void write_json_bit_costs(FILE *file, const BIT_COSTS *costs);
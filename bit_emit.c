@@ -3,14 +3,16 @@
  */
 
 #include "bit_emit.h"
+#include "stats.h"
 #include <assert.h>
 
 void init_bit_emitter(BIT_EMITTER *emitter, uint8_t *buf, size_t size)
 {
-    emitter->buf   = buf;
-    emitter->begin = buf;
-    emitter->end   = buf + size;
-    emitter->data  = 1;
+    emitter->buf      = buf;
+    emitter->begin    = buf;
+    emitter->end      = buf + size;
+    emitter->overflow = 0;
+    emitter->data     = 1;
 }
 
 void emit_bit(BIT_EMITTER *emitter, uint32_t bit)
@@ -20,10 +22,17 @@ void emit_bit(BIT_EMITTER *emitter, uint32_t bit)
     emitter->data = (emitter->data << 1) | (bit & 1U);
 
     if (emitter->data > 0xFFU) {
-        assert(emitter->buf < emitter->end);
+        /* If the buffer is full, only count the bytes, so that the caller
+         * can find out how much space is needed.
+         */
+        if (emitter->buf < emitter->end)
+            *(emitter->buf++) = (uint8_t)emitter->data;
+        else
+            ++emitter->overflow;
 
-        *(emitter->buf++) = (uint8_t)emitter->data;
-        emitter->data     = 1;
+        STATS_ADD(emitter_flushes, 1);
+
+        emitter->data = 1;
     }
 }
 
@@ -51,5 +60,5 @@ size_t emit_tail(BIT_EMITTER *emitter)
     /* Emit 7 bits, which is enough to force out the last byte, but won't emit a byte unnecessarily */
     emit_bits(emitter, last_bit, 7);
 
-    return (size_t)(emitter->buf - emitter->begin);
+    return (size_t)(emitter->buf - emitter->begin) + emitter->overflow;
 }
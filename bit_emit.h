@@ -2,6 +2,8 @@
  * Copyright (c) 2022 Chris Dragan
  */
 
+#pragma once
+
 #include <stddef.h>
 #include <stdint.h>
 
@@ -9,10 +11,16 @@ typedef struct {
     uint8_t *buf;
     uint8_t *begin;
     uint8_t *end;
+    size_t   overflow;  /* Number of bytes which did not fit in the buffer */
     uint32_t data;
 } BIT_EMITTER;
 
 void init_bit_emitter(BIT_EMITTER *emitter, uint8_t *buf, size_t size);
 void emit_bit(BIT_EMITTER *emitter, uint32_t bit);
 void emit_bits(BIT_EMITTER *emitter, size_t value, int bits);
+
+/* Flushes remaining bits and returns total number of bytes emitted, including
+ * bytes which did not fit in the buffer.  If the returned size exceeds the
+ * size of the buffer, the output is incomplete.
+ */
 size_t emit_tail(BIT_EMITTER *emitter);
@@ -2,6 +2,8 @@
  * Copyright (c) 2022 Chris Dragan
  */
 
+#include <stdint.h>
+
 inline static int count_leading_zeroes(unsigned int value)
 {
 #if defined(__GNUC__) || defined(__clang__)
@@ -16,3 +18,19 @@ inline static int count_leading_zeroes(unsigned int value)
 #error "Not implemented!"
 #endif
 }
+
+inline static int count_leading_zeroes64(uint64_t value)
+{
+    const unsigned int high = (unsigned int)(value >> 32);
+
+    return high ? count_leading_zeroes(high) : (32 + count_leading_zeroes((unsigned int)value));
+}
+
+inline static unsigned count_ones(uint64_t value)
+{
+    value = value - ((value >> 1) & 0x5555555555555555ULL);
+    value = (value & 0x3333333333333333ULL) + ((value >> 2) & 0x3333333333333333ULL);
+    value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+
+    return (unsigned)((value * 0x0101010101010101ULL) >> 56);
+}
@@ -4,7 +4,6 @@
 
 #include "bit_stream.h"
 #include <assert.h>
-#include <stdio.h>
 
 void init_bit_stream(BIT_STREAM *stream, const void *buf, size_t size)
 {
@@ -3,15 +3,27 @@
  */
 
 #include "buffer.h"
+#include "arena.h"
 
 #include <assert.h>
 #include <stdlib.h>
 
 BUFFER buf_alloc(size_t size)
 {
-    BUFFER buf;
+    return buf_alloc_flags(size, ARENA_ZERO);
+}
+
+BUFFER buf_alloc_flags(size_t size, unsigned flags)
+{
+    ARENA *const arena = get_current_arena();
+    BUFFER       buf   = { NULL, 0 };
+
+    if (arena)
+        buf.buf = (uint8_t *)arena_alloc(arena, size, flags);
 
-    buf.buf = (uint8_t *)calloc(size, 1);
+    /* Fall back to the heap if the arena is exhausted */
+    if ( ! buf.buf)
+        buf.buf = (uint8_t *)((flags & ARENA_ZERO) ? calloc(size, 1) : malloc(size));
 
     if (buf.buf)
         buf.size = size;
@@ -19,6 +31,16 @@ BUFFER buf_alloc(size_t size)
     return buf;
 }
 
+void buf_free(BUFFER buf)
+{
+    ARENA *const arena = get_current_arena();
+
+    if (arena && arena_owns(arena, buf.buf))
+        arena_free(arena, buf.buf, buf.size);
+    else
+        free(buf.buf);
+}
+
 BUFFER buf_truncate(BUFFER buf, size_t pos)
 {
     assert(pos <= buf.size);
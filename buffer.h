@@ -12,8 +12,15 @@ typedef struct {
     size_t   size;
 } BUFFER;
 
+/* Allocates zero-filled buffer from the current arena or from the heap */
 BUFFER buf_alloc(size_t size);
 
+/* Allocates buffer with ARENA_FLAGS, contents are undefined without ARENA_ZERO */
+BUFFER buf_alloc_flags(size_t size, unsigned flags);
+
+/* Frees buffer allocated with buf_alloc() or buf_alloc_flags() */
+void buf_free(BUFFER buf);
+
 BUFFER buf_truncate(BUFFER buf, size_t pos);
 
 BUFFER buf_get_tail(BUFFER buf, size_t pos);
@@ -0,0 +1,469 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "cache.h"
+#include "version.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#   include <direct.h>
+#   include <process.h>
+#   include <sys/utime.h>
+
+typedef SRWLOCK MUTEX;
+
+static void init_mutex(MUTEX *mutex)       { InitializeSRWLock(mutex); }
+static void destroy_mutex(MUTEX *mutex)    { }
+static void lock_mutex(MUTEX *mutex)       { AcquireSRWLockExclusive(mutex); }
+static void unlock_mutex(MUTEX *mutex)     { ReleaseSRWLockExclusive(mutex); }
+
+#   define make_dir(dir) _mkdir(dir)
+#   define get_pid()     ((unsigned)_getpid())
+#   define touch(path)   _utime(path, NULL)
+#else
+#   include <dirent.h>
+#   include <pthread.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#   include <utime.h>
+
+typedef pthread_mutex_t MUTEX;
+
+static void init_mutex(MUTEX *mutex)       { pthread_mutex_init(mutex, NULL); }
+static void destroy_mutex(MUTEX *mutex)    { pthread_mutex_destroy(mutex); }
+static void lock_mutex(MUTEX *mutex)       { pthread_mutex_lock(mutex); }
+static void unlock_mutex(MUTEX *mutex)     { pthread_mutex_unlock(mutex); }
+
+#   define make_dir(dir) mkdir(dir, 0777)
+#   define get_pid()     ((unsigned)getpid())
+#   define touch(path)   utime(path, NULL)
+#endif
+
+#define ENTRY_EXT    ".mini"
+#define MAX_PATH_LEN 1024
+#define MAX_DIR_LEN  (MAX_PATH_LEN - 64)    /* Leaves room for entry file names */
+
+struct CACHE_STRUCT {
+    MUTEX    mutex;         /* Serializes stores and evictions within the process */
+    uint64_t max_size;
+    uint32_t tmp_id;        /* Makes temporary file names unique */
+    char     dir[MAX_DIR_LEN];
+};
+
+/* Header of each cache entry file, followed by the cached output */
+typedef struct {
+    char      magic[4];
+    uint32_t  dummy_align;
+    CACHE_KEY key;
+    uint64_t  output_size;
+} ENTRY_HEADER;
+
+static const char entry_magic[4] = { 'M', 'N', 'F', 'C' };
+
+/*****************************************************************************/
+/* Hashing, based on the structure of xxHash64 with four independent lanes   */
+
+#define PRIME1 0x9E3779B185EBCA87U
+#define PRIME2 0xC2B2AE3D27D4EB4FU
+#define PRIME3 0x165667B19E3779F9U
+#define PRIME4 0x85EBCA77C2B2AE63U
+#define PRIME5 0x27D4EB2F165667C5U
+
+static uint64_t rotl64(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t read64(const uint8_t *src)
+{
+    uint64_t value;
+    memcpy(&value, src, sizeof(value));
+    return value;
+}
+
+static uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    acc  = rotl64(acc, 31);
+    return acc * PRIME1;
+}
+
+static uint64_t merge_round(uint64_t acc, uint64_t value)
+{
+    acc ^= hash_round(0, value);
+    return acc * PRIME1 + PRIME4;
+}
+
+static uint64_t avalanche(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+static uint64_t hash_string(const char *str, uint64_t seed)
+{
+    uint64_t hash = seed ^ PRIME5;
+
+    while (*str)
+        hash = rotl64(hash ^ ((uint8_t)*(str++) * PRIME5), 11) * PRIME1;
+
+    return avalanche(hash);
+}
+
+CACHE_KEY get_cache_key(const void *data, size_t size, const char *settings)
+{
+    const uint8_t *src  = (const uint8_t *)data;
+    const uint8_t *end  = src + size;
+    const uint64_t seed = hash_string(settings, hash_string(MINIFY_VERSION, 0));
+    uint64_t       lane[4];
+    uint64_t       tail = 0;
+    CACHE_KEY      key;
+    int            i;
+
+    lane[0] = seed + PRIME1 + PRIME2;
+    lane[1] = seed + PRIME2;
+    lane[2] = seed;
+    lane[3] = seed - PRIME1;
+
+    for ( ; end - src >= 32; src += 32) {
+        lane[0] = hash_round(lane[0], read64(src));
+        lane[1] = hash_round(lane[1], read64(src + 8));
+        lane[2] = hash_round(lane[2], read64(src + 16));
+        lane[3] = hash_round(lane[3], read64(src + 24));
+    }
+
+    for (i = 0; end - src >= 8; src += 8, i++)
+        lane[i] = hash_round(lane[i], read64(src));
+
+    for (i = 0; src < end; i += 8)
+        tail |= (uint64_t)*(src++) << i;
+
+    /* Two halves of the key are produced from the lanes in different order */
+    key.hash[0] = rotl64(lane[0], 1) + rotl64(lane[1], 7) + rotl64(lane[2], 12) + rotl64(lane[3], 18);
+    key.hash[1] = rotl64(lane[3], 1) + rotl64(lane[2], 7) + rotl64(lane[1], 12) + rotl64(lane[0], 18);
+
+    for (i = 0; i < 4; i++) {
+        key.hash[0] = merge_round(key.hash[0], lane[i]);
+        key.hash[1] = merge_round(key.hash[1], lane[3 - i] ^ PRIME3);
+    }
+
+    key.hash[0] = avalanche(hash_round(key.hash[0] ^ (uint64_t)size, tail));
+    key.hash[1] = avalanche(hash_round(key.hash[1] + (uint64_t)size, tail ^ PRIME5));
+    key.size    = size;
+
+    return key;
+}
+
+/*****************************************************************************/
+/* Cache directory                                                           */
+
+CACHE *open_cache(const char *dir, uint64_t max_size)
+{
+    CACHE       *cache;
+    const size_t len = strlen(dir);
+
+    if (len >= MAX_DIR_LEN) {
+        fprintf(stderr, "Error: Cache directory name %s is too long\n", dir);
+        return NULL;
+    }
+
+    /* Failure is detected when writing entries */
+    make_dir(dir);
+
+    cache = (CACHE *)calloc(1, sizeof(CACHE));
+    if ( ! cache) {
+        perror(NULL);
+        return NULL;
+    }
+
+    init_mutex(&cache->mutex);
+    cache->max_size = max_size;
+    memcpy(cache->dir, dir, len + 1);
+
+    return cache;
+}
+
+void close_cache(CACHE *cache)
+{
+    if (cache) {
+        destroy_mutex(&cache->mutex);
+        free(cache);
+    }
+}
+
+static void get_entry_path(const CACHE *cache, const CACHE_KEY *key, char *path)
+{
+    snprintf(path, MAX_PATH_LEN, "%s/%016llx%016llx" ENTRY_EXT,
+             cache->dir,
+             (unsigned long long)key->hash[0],
+             (unsigned long long)key->hash[1]);
+}
+
+BUFFER cache_lookup(CACHE *cache, const CACHE_KEY *key)
+{
+    char         path[MAX_PATH_LEN];
+    ENTRY_HEADER header;
+    BUFFER       output = { NULL, 0 };
+    FILE        *file;
+
+    get_entry_path(cache, key, path);
+
+    file = fopen(path, "rb");
+    if ( ! file)
+        return output;
+
+    if (fread(&header, 1, sizeof(header), file) == sizeof(header) &&
+        ! memcmp(header.magic, entry_magic, sizeof(entry_magic)) &&
+        ! memcmp(&header.key, key, sizeof(*key)) &&
+        header.output_size && (size_t)header.output_size == header.output_size) {
+
+        output = buf_alloc_flags((size_t)header.output_size, 0);
+
+        if (output.buf && fread(output.buf, 1, output.size, file) != output.size) {
+            buf_free(output);
+            output.buf  = NULL;
+            output.size = 0;
+        }
+    }
+
+    fclose(file);
+
+    /* Modification time is used for finding least recently used entries */
+    if (output.buf)
+        touch(path);
+    else
+        output.size = 0;
+
+    return output;
+}
+
+typedef struct {
+    char     name[40];
+    uint64_t size;
+    uint64_t time;
+} ENTRY_INFO;
+
+static int compare_time(const void *left, const void *right)
+{
+    const uint64_t left_time  = ((const ENTRY_INFO *)left)->time;
+    const uint64_t right_time = ((const ENTRY_INFO *)right)->time;
+
+    return (left_time < right_time) ? -1 : (left_time > right_time) ? 1 : 0;
+}
+
+static int is_entry_name(const char *name)
+{
+    const size_t len = strlen(name);
+
+    return len == 32 + sizeof(ENTRY_EXT) - 1 && ! strcmp(name + 32, ENTRY_EXT);
+}
+
+static int add_entry(ENTRY_INFO **entries, size_t *num_entries, size_t *capacity,
+                     const char *name, uint64_t size, uint64_t time)
+{
+    ENTRY_INFO *entry;
+
+    if (*num_entries == *capacity) {
+        const size_t      new_capacity = *capacity ? *capacity * 2 : 64;
+        ENTRY_INFO *const new_entries  = (ENTRY_INFO *)realloc(*entries, new_capacity * sizeof(ENTRY_INFO));
+
+        if ( ! new_entries)
+            return 1;
+
+        *entries  = new_entries;
+        *capacity = new_capacity;
+    }
+
+    entry = &(*entries)[(*num_entries)++];
+    memcpy(entry->name, name, strlen(name) + 1);
+    entry->size = size;
+    entry->time = time;
+
+    return 0;
+}
+
+#ifndef _WIN32
+static uint64_t get_mtime_ns(const struct stat *file_stat)
+{
+#ifdef __APPLE__
+    const struct timespec *const time = &file_stat->st_mtimespec;
+#else
+    const struct timespec *const time = &file_stat->st_mtim;
+#endif
+
+    return (uint64_t)time->tv_sec * 1000000000U + (uint64_t)time->tv_nsec;
+}
+#endif
+
+/* Lists all entries in the cache directory, returns NULL on failure */
+static ENTRY_INFO *list_entries(const CACHE *cache, size_t *num_entries)
+{
+    ENTRY_INFO *entries  = NULL;
+    size_t      capacity = 0;
+    int         error    = 0;
+
+#ifdef _WIN32
+    char             pattern[MAX_PATH_LEN];
+    WIN32_FIND_DATAA find_data;
+    HANDLE           find;
+
+    snprintf(pattern, sizeof(pattern), "%s/*" ENTRY_EXT, cache->dir);
+
+    find = FindFirstFileA(pattern, &find_data);
+    if (find == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    do {
+        if (is_entry_name(find_data.cFileName))
+            error = add_entry(&entries, num_entries, &capacity, find_data.cFileName,
+                              ((uint64_t)find_data.nFileSizeHigh << 32) | find_data.nFileSizeLow,
+                              ((uint64_t)find_data.ftLastWriteTime.dwHighDateTime << 32) |
+                                  find_data.ftLastWriteTime.dwLowDateTime);
+    } while ( ! error && FindNextFileA(find, &find_data));
+
+    FindClose(find);
+#else
+    DIR           *dir = opendir(cache->dir);
+    struct dirent *dir_entry;
+
+    if ( ! dir)
+        return NULL;
+
+    while ( ! error && (dir_entry = readdir(dir)) != NULL) {
+        char        path[MAX_PATH_LEN];
+        struct stat file_stat;
+
+        if ( ! is_entry_name(dir_entry->d_name))
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%.39s", cache->dir, dir_entry->d_name);
+
+        /* The entry could have been evicted by another process */
+        if (stat(path, &file_stat))
+            continue;
+
+        error = add_entry(&entries, num_entries, &capacity, dir_entry->d_name,
+                          (uint64_t)file_stat.st_size,
+                          get_mtime_ns(&file_stat));
+    }
+
+    closedir(dir);
+#endif
+
+    if (error) {
+        free(entries);
+        entries = NULL;
+    }
+
+    return entries;
+}
+
+/* Removes least recently used entries until the cache fits in the limit,
+ * except for the entry which has just been stored.
+ */
+static void evict_entries(const CACHE *cache, const char *keep_path)
+{
+    size_t      num_entries = 0;
+    uint64_t    total_size  = 0;
+    ENTRY_INFO *entries     = list_entries(cache, &num_entries);
+    size_t      i;
+
+    if ( ! entries)
+        return;
+
+    for (i = 0; i < num_entries; i++)
+        total_size += entries[i].size;
+
+    if (total_size > cache->max_size) {
+        qsort(entries, num_entries, sizeof(ENTRY_INFO), compare_time);
+
+        for (i = 0; i < num_entries && total_size > cache->max_size; i++) {
+            char path[MAX_PATH_LEN];
+
+            snprintf(path, sizeof(path), "%s/%s", cache->dir, entries[i].name);
+
+            if ( ! strcmp(path, keep_path))
+                continue;
+
+            remove(path);
+            total_size -= entries[i].size;
+        }
+    }
+
+    free(entries);
+}
+
+int cache_store(CACHE *cache, const CACHE_KEY *key, BUFFER output)
+{
+    char         path[MAX_PATH_LEN];
+    char         tmp_path[MAX_PATH_LEN];
+    ENTRY_HEADER header;
+    FILE        *file;
+    int          error = 1;
+
+    if (sizeof(header) + output.size > cache->max_size)
+        return 0;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, entry_magic, sizeof(entry_magic));
+    header.key         = *key;
+    header.output_size = output.size;
+
+    get_entry_path(cache, key, path);
+
+    lock_mutex(&cache->mutex);
+
+    /* Write to a temporary file first, so that other processes never see
+     * incomplete entries.
+     */
+    snprintf(tmp_path, sizeof(tmp_path), "%s/%016llx.%u.%u.tmp",
+             cache->dir, (unsigned long long)key->hash[0], get_pid(), cache->tmp_id++);
+
+    file = fopen(tmp_path, "wb");
+    if ( ! file)
+        perror(tmp_path);
+    else {
+        error = fwrite(&header, 1, sizeof(header), file) != sizeof(header) ||
+                fwrite(output.buf, 1, output.size, file) != output.size;
+
+        if (fclose(file))
+            error = 1;
+
+        if (error) {
+            fprintf(stderr, "Error: Failed to write to file %s\n", tmp_path);
+            remove(tmp_path);
+        }
+        else if (rename(tmp_path, path)) {
+            /* On Windows rename fails if the entry already exists, e.g. if
+             * another process has just stored it.
+             */
+            FILE *const existing = fopen(path, "rb");
+
+            if (existing)
+                fclose(existing);
+            else {
+                perror(path);
+                error = 1;
+            }
+
+            remove(tmp_path);
+        }
+    }
+
+    if ( ! error)
+        evict_entries(cache, path);
+
+    unlock_mutex(&cache->mutex);
+
+    return error;
+}
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include "buffer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Identifies contents of an input file together with the settings used
+ * to compress it.
+ */
+typedef struct {
+    uint64_t hash[2];
+    uint64_t size;
+} CACHE_KEY;
+
+/* Cache of compressed outputs stored in a directory, one file per entry.
+ * The least recently used entries are removed when the total size of the
+ * entries exceeds the limit.  The cache can be shared by multiple threads
+ * and by multiple processes.
+ */
+typedef struct CACHE_STRUCT CACHE;
+
+/* Creates the directory if it does not exist */
+CACHE *open_cache(const char *dir, uint64_t max_size);
+void   close_cache(CACHE *cache);
+
+/* Computes key from input data, minify version and settings, which is a
+ * string describing all options which affect the compressed output.
+ */
+CACHE_KEY get_cache_key(const void *data, size_t size, const char *settings);
+
+/* Returns cached output or an empty buffer if the entry does not exist.
+ * The returned buffer must be freed with buf_free().
+ */
+BUFFER cache_lookup(CACHE *cache, const CACHE_KEY *key);
+
+/* Stores output in the cache and evicts old entries if needed.
+ * Returns non-zero on failure.
+ */
+int cache_store(CACHE *cache, const CACHE_KEY *key, BUFFER output);
@@ -0,0 +1,230 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "delta.h"
+#include "dict.h"
+#include "lza_compress.h"
+#include "lza_decompress.h"
+#include "minify_ctx.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/* Patch format, all values are 32-bit little endian:
+ *
+ * "MNFP" magic
+ * old size         Size of the old version of the file
+ * old id           Hash of the old version, see get_dict_id()
+ * new size         Size of the new version of the file
+ * packed size      Size of the data which follows
+ * lz size          Size of LZ77 data after arithmetic decoding, 0 if the
+ *                  new version is stored uncompressed
+ * data
+ *
+ * The new version is compressed as if the old version preceded it, so
+ * unchanged parts are matches reaching back into the old version.
+ */
+
+static const char patch_magic[4] = { 'M', 'N', 'F', 'P' };
+
+#define PATCH_HEADER_SIZE 24U
+
+/* Sizes in the patch header are 32-bit */
+#define MAX_PATCH_INPUT_SIZE 0xFFFF0000U
+
+static void put_uint32(uint8_t *dest, uint32_t value)
+{
+    dest[0] = (uint8_t)value;
+    dest[1] = (uint8_t)(value >> 8);
+    dest[2] = (uint8_t)(value >> 16);
+    dest[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t get_uint32(const uint8_t *src)
+{
+    return (uint32_t)src[0] |
+           ((uint32_t)src[1] << 8) |
+           ((uint32_t)src[2] << 16) |
+           ((uint32_t)src[3] << 24);
+}
+
+static int write_patch(FILE *output, const uint8_t *header, const uint8_t *data, size_t size)
+{
+    if (fwrite(header, 1, PATCH_HEADER_SIZE, output) != PATCH_HEADER_SIZE ||
+        fwrite(data, 1, size, output) != size ||
+        fflush(output)) {
+        perror("Error: Failed to write output");
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Compresses the new version and verifies that it decompresses after the old version */
+static int compress_patch(MINIFY_CTX       *ctx,
+                          BUFFER            old_data,
+                          BUFFER            new_data,
+                          BUFFER            packed,
+                          BUFFER            decompressed,
+                          COMPRESSED_SIZES *compressed)
+{
+    *compressed = minify_compress(ctx, packed.buf, packed.size, new_data.buf, new_data.size);
+
+    if ( ! compressed->lz)
+        return 1;
+
+    if (compressed->compressed >= new_data.size)
+        return 0;
+
+    memcpy(decompressed.buf, old_data.buf, old_data.size);
+
+    lza_decompress_with_prefix(decompressed.buf + old_data.size, new_data.size, compressed->lz,
+                               packed.buf, compressed->compressed, old_data.size);
+
+    if (memcmp(new_data.buf, decompressed.buf + old_data.size, new_data.size)) {
+        fprintf(stderr, "Decompressed output doesn't match input data\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int create_patch(BUFFER old_data, BUFFER new_data, FILE *output, const PARSER_PARAMS *params)
+{
+    COMPRESSED_SIZES compressed;
+    MINIFY_CTX      *ctx;
+    BUFFER           packed;
+    BUFFER           decompressed;
+    uint8_t          header[PATCH_HEADER_SIZE];
+    int              error = 1;
+
+    if ( ! old_data.size || ! new_data.size) {
+        fprintf(stderr, "Error: Files for a patch must not be empty\n");
+        return 1;
+    }
+
+    if (new_data.size > MAX_PATCH_INPUT_SIZE || old_data.size > MAX_PATCH_INPUT_SIZE - new_data.size) {
+        fprintf(stderr, "Error: Files are too large for a patch\n");
+        return 1;
+    }
+
+    ctx = create_minify_ctx();
+    if ( ! ctx)
+        return 1;
+
+    if (params)
+        set_minify_ctx_params(ctx, params);
+
+    set_minify_ctx_dict(ctx, old_data.buf, old_data.size);
+
+    /* If the patch does not compress below the new version, it is stored */
+    packed       = buf_alloc_flags(new_data.size, 0);
+    decompressed = buf_alloc_flags(old_data.size + new_data.size + lz_compress_bound(new_data.size), 0);
+
+    if ( ! packed.buf || ! decompressed.buf)
+        perror(NULL);
+    else if ( ! compress_patch(ctx, old_data, new_data, packed, decompressed, &compressed)) {
+        const int stored = compressed.compressed >= new_data.size;
+
+        memcpy(header, patch_magic, sizeof(patch_magic));
+        put_uint32(&header[4],  (uint32_t)old_data.size);
+        put_uint32(&header[8],  get_dict_id(old_data.buf, old_data.size));
+        put_uint32(&header[12], (uint32_t)new_data.size);
+        put_uint32(&header[16], (uint32_t)(stored ? new_data.size : compressed.compressed));
+        put_uint32(&header[20], (uint32_t)(stored ? 0 : compressed.lz));
+
+        if (stored)
+            error = write_patch(output, header, new_data.buf, new_data.size);
+        else
+            error = write_patch(output, header, packed.buf, compressed.compressed);
+    }
+
+    buf_free(decompressed);
+    buf_free(packed);
+    destroy_minify_ctx(ctx);
+
+    return error;
+}
+
+static int read_data(FILE *input, void *dest, size_t size)
+{
+    const size_t num_read = fread(dest, 1, size, input);
+
+    if (num_read == size)
+        return 0;
+
+    if (ferror(input))
+        perror("Error: Failed to read input");
+    else
+        fprintf(stderr, "Error: Unexpected end of patch\n");
+
+    return 1;
+}
+
+int apply_patch(BUFFER old_data, FILE *input, FILE *output)
+{
+    BUFFER   packed;
+    BUFFER   decompressed;
+    uint8_t  header[PATCH_HEADER_SIZE];
+    uint32_t new_size;
+    uint32_t packed_size;
+    uint32_t lz_size;
+    int      error = 1;
+
+    if (read_data(input, header, sizeof(header)))
+        return 1;
+
+    if (memcmp(header, patch_magic, sizeof(patch_magic))) {
+        fprintf(stderr, "Error: Input is not a patch\n");
+        return 1;
+    }
+
+    if (get_uint32(&header[4]) != old_data.size ||
+        get_uint32(&header[8]) != get_dict_id(old_data.buf, old_data.size)) {
+        fprintf(stderr, "Error: Patch was created for a different version of the file\n");
+        return 1;
+    }
+
+    new_size    = get_uint32(&header[12]);
+    packed_size = get_uint32(&header[16]);
+    lz_size     = get_uint32(&header[20]);
+
+    if ( ! new_size || old_data.size > MAX_PATCH_INPUT_SIZE - new_size || packed_size > new_size ||
+        lz_size > lz_compress_bound(new_size) ||
+        (lz_size ? (packed_size < 3) : (packed_size != new_size))) {
+        fprintf(stderr, "Error: Corrupted patch\n");
+        return 1;
+    }
+
+    packed       = buf_alloc_flags(packed_size, 0);
+    decompressed = buf_alloc_flags(old_data.size + new_size + lz_size, 0);
+
+    if ( ! packed.buf || ! decompressed.buf)
+        perror(NULL);
+    else if ( ! read_data(input, packed.buf, packed_size)) {
+        const uint8_t *new_data = packed.buf;
+
+        if (lz_size) {
+            memcpy(decompressed.buf, old_data.buf, old_data.size);
+
+            if (lza_decompress_checked(decompressed.buf + old_data.size, new_size, lz_size,
+                                       packed.buf, packed_size, old_data.size))
+                new_data = NULL;
+            else
+                new_data = decompressed.buf + old_data.size;
+        }
+
+        if ( ! new_data)
+            fprintf(stderr, "Error: Corrupted patch\n");
+        else if (fwrite(new_data, 1, new_size, output) != new_size || fflush(output))
+            perror("Error: Failed to write output");
+        else
+            error = 0;
+    }
+
+    buf_free(decompressed);
+    buf_free(packed);
+
+    return error;
+}
@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include "buffer.h"
+#include "find_repeats.h"
+
+#include <stdio.h>
+
+/* Compresses new version of a file using the old version as a reference,
+ * parts of the new version found in the old one are encoded as matches.
+ * If params is NULL, default match finder heuristics are used.
+ * Returns non-zero on failure.
+ */
+int create_patch(BUFFER old_data, BUFFER new_data, FILE *output, const PARSER_PARAMS *params);
+
+/* Rebuilds new version of a file from the old version and a patch produced
+ * by create_patch().  Returns non-zero on failure.
+ */
+int apply_patch(BUFFER old_data, FILE *input, FILE *output);
@@ -0,0 +1,207 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "dict.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KMER_SIZE    8U     /* Length of substrings counted across samples */
+#define SEGMENT_SIZE 64U    /* Dictionary is assembled from segments of this size */
+#define HASH_BITS    20U
+
+/* Segments are only used if on average every other substring occurs in at
+ * least two samples, which also filters out false hits from hash collisions.
+ */
+#define MIN_SEGMENT_SCORE (SEGMENT_SIZE - KMER_SIZE + 1)
+
+typedef struct {
+    const uint8_t *data;
+    uint32_t       score;
+    uint32_t       order;   /* Keeps sorting deterministic */
+} SEGMENT;
+
+static uint32_t hash_kmer(const uint8_t *data)
+{
+    uint64_t value = 0;
+    uint32_t i;
+
+    for (i = 0; i < KMER_SIZE; i++)
+        value |= (uint64_t)data[i] << (i * 8);
+
+    return (uint32_t)((value * 0x9E3779B97F4A7C15ULL) >> (64 - HASH_BITS));
+}
+
+/* Score is the number of samples containing each substring of the segment,
+ * substrings found in only one sample don't help other inputs.
+ */
+static uint32_t score_segment(const uint32_t *counts, const uint8_t *data)
+{
+    uint32_t score = 0;
+    uint32_t i;
+
+    for (i = 0; i + KMER_SIZE <= SEGMENT_SIZE; i++) {
+        const uint32_t count = counts[hash_kmer(&data[i])];
+
+        if (count > 1)
+            score += count;
+    }
+
+    return score;
+}
+
+static int compare_segments(const void *left, const void *right)
+{
+    const SEGMENT *const l = (const SEGMENT *)left;
+    const SEGMENT *const r = (const SEGMENT *)right;
+
+    if (l->score != r->score)
+        return (l->score > r->score) ? -1 : 1;
+
+    return (l->order < r->order) ? -1 : (l->order > r->order);
+}
+
+static size_t count_kmers(const BUFFER samples[], size_t num_samples, uint32_t *counts, uint32_t *last_sample)
+{
+    size_t num_segments = 0;
+    size_t i_sample;
+
+    for (i_sample = 0; i_sample < num_samples; i_sample++) {
+        const BUFFER sample = samples[i_sample];
+        size_t       pos;
+
+        if (sample.size < SEGMENT_SIZE)
+            continue;
+
+        /* Each substring is only counted once per sample */
+        for (pos = 0; pos + KMER_SIZE <= sample.size; pos++) {
+            const uint32_t hash = hash_kmer(&sample.buf[pos]);
+
+            if (last_sample[hash] != (uint32_t)i_sample + 1) {
+                last_sample[hash] = (uint32_t)i_sample + 1;
+                ++counts[hash];
+            }
+        }
+
+        /* Segments overlap by half, so that common data is less likely to be split */
+        num_segments += (sample.size - SEGMENT_SIZE) / (SEGMENT_SIZE / 2) + 1;
+    }
+
+    return num_segments;
+}
+
+BUFFER train_dict(const BUFFER samples[], size_t num_samples, size_t dict_size)
+{
+    BUFFER    counts_buf;
+    BUFFER    last_buf;
+    BUFFER    dict;
+    SEGMENT  *segments;
+    uint32_t *counts;
+    size_t    num_segments;
+    size_t    used = 0;
+    size_t    i;
+
+    memset(&dict, 0, sizeof(dict));
+
+    if ( ! dict_size)
+        return dict;
+
+    counts_buf = buf_alloc(sizeof(uint32_t) << HASH_BITS);
+    last_buf   = buf_alloc(sizeof(uint32_t) << HASH_BITS);
+
+    if ( ! counts_buf.buf || ! last_buf.buf) {
+        perror(NULL);
+        buf_free(last_buf);
+        buf_free(counts_buf);
+        return dict;
+    }
+
+    counts       = (uint32_t *)counts_buf.buf;
+    num_segments = count_kmers(samples, num_samples, counts, (uint32_t *)last_buf.buf);
+
+    buf_free(last_buf);
+
+    segments = (SEGMENT *)malloc((num_segments ? num_segments : 1) * sizeof(SEGMENT));
+    dict     = buf_alloc(dict_size);
+
+    if ( ! segments || ! dict.buf) {
+        perror(NULL);
+        free(segments);
+        buf_free(dict);
+        buf_free(counts_buf);
+        memset(&dict, 0, sizeof(dict));
+        return dict;
+    }
+
+    num_segments = 0;
+    for (i = 0; i < num_samples; i++) {
+        const BUFFER sample = samples[i];
+        size_t       pos;
+
+        for (pos = 0; pos + SEGMENT_SIZE <= sample.size; pos += SEGMENT_SIZE / 2) {
+            SEGMENT *const segment = &segments[num_segments];
+
+            segment->data  = &sample.buf[pos];
+            segment->score = score_segment(counts, segment->data);
+            segment->order = (uint32_t)num_segments++;
+        }
+    }
+
+    qsort(segments, num_segments, sizeof(SEGMENT), compare_segments);
+
+    /* Segments are picked from the best one and placed from the end of the
+     * dictionary.  After a segment is picked, its substrings don't count
+     * anymore, so that other segments containing them are skipped.
+     */
+    for (i = 0; i < num_segments && used < dict_size; i++) {
+        const SEGMENT *const segment = &segments[i];
+        const uint32_t       score   = score_segment(counts, segment->data);
+        size_t               size    = dict_size - used;
+        uint32_t             pos;
+
+        if (segment->score < MIN_SEGMENT_SCORE)
+            break;
+
+        if (score < MIN_SEGMENT_SCORE || score * 2 < segment->score)
+            continue;
+
+        if (size > SEGMENT_SIZE)
+            size = SEGMENT_SIZE;
+
+        used += size;
+        memcpy(&dict.buf[dict_size - used], segment->data, size);
+
+        for (pos = 0; pos + KMER_SIZE <= SEGMENT_SIZE; pos++)
+            counts[hash_kmer(&segment->data[pos])] = 0;
+    }
+
+    free(segments);
+    buf_free(counts_buf);
+
+    if (used < dict_size) {
+        memmove(dict.buf, &dict.buf[dict_size - used], used);
+        dict = buf_truncate(dict, used);
+    }
+
+    if ( ! used) {
+        buf_free(dict);
+        memset(&dict, 0, sizeof(dict));
+    }
+
+    return dict;
+}
+
+uint32_t get_dict_id(const void *dict, size_t size)
+{
+    const uint8_t *data = (const uint8_t *)dict;
+    const uint8_t *end  = data + size;
+    uint32_t       hash = 2166136261U;
+
+    /* FNV-1a */
+    for ( ; data < end; data++)
+        hash = (hash ^ *data) * 16777619U;
+
+    return hash;
+}
@@ -0,0 +1,23 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include "buffer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEFAULT_DICT_SIZE (64U << 10)
+#define MAX_DICT_SIZE     (16U << 20)
+
+/* Builds a dictionary of up to dict_size bytes from segments of the samples,
+ * which contain substrings occurring in many samples.  The most useful
+ * segments are placed at the end of the dictionary, closest to the input.
+ * Returns empty buffer on failure or if the samples have nothing in common.
+ */
+BUFFER train_dict(const BUFFER samples[], size_t num_samples, size_t dict_size);
+
+/* Returns identifier of the dictionary, which is stored with compressed data */
+uint32_t get_dict_id(const void *dict, size_t size);
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include <stdint.h>
+
+#define MAX_ELF_SEGMENTS 16
+
+/* Stack of the thread which handles page faults in elf_lazy_loader */
+#define ELF_LAZY_STACK_SIZE (64U << 10)
+
+/* Original loadable segment, whose protection is restored after decompression */
+typedef struct {
+    uint64_t vaddr;     /* Page-aligned start of the segment */
+    uint64_t size;      /* Page-aligned size of the segment */
+    uint32_t prot;      /* PROT_* flags for mprotect */
+    uint32_t reserved;
+} ELF_SEGMENT;
+
+/* Independently compressed block of the image */
+typedef struct {
+    uint32_t comp_offs; /* Offset of arithmetic coded data from comp_data */
+    uint32_t comp_size;
+    uint32_t lz_size;   /* Size of LZ77 data after arithmetic decoding */
+} ELF_BLOCK;
+
+/* This structure is used by the ELF loaders to locate compressed data.  It is stored
+ * in the executable file uncompressed and it is referenced directly.  Addresses
+ * are 64-bit regardless of the host which produces the executable.
+ */
+typedef struct {
+    uint64_t    decomp_base;        /* Start of the original image */
+    uint64_t    entry_point;        /* Original entry point */
+    uint64_t    lz77_data;          /* Scratch space for LZ77 data of one block, follows the image */
+    uint64_t    comp_data;
+    uint64_t    blocks;             /* ELF_BLOCK for each block of the image */
+    uint64_t    block_buf;          /* Block buffer followed by fault handler's stack, lazy loader only */
+    uint32_t    image_size;         /* Size of the image data to decompress, multiple of page size */
+    uint32_t    block_size;         /* Size of each block except the last one, multiple of page size */
+    uint32_t    num_blocks;
+    uint32_t    num_segments;
+    ELF_SEGMENT segments[MAX_ELF_SEGMENTS];
+} ELF_LIVE_LAYOUT;
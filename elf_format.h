@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include "pe_format.h"
+
+/* Structures representing 64-bit ELF files */
+/* Reference: https://refspecs.linuxfoundation.org/elf/gabi4+/contents.html */
+
+/* The ELF header is located at offset 0 in an ELF file */
+typedef struct {
+    uint8_t   ident[16];
+    uint16_le type;
+    uint16_le machine;
+    uint32_le version;
+    uint64_le entry_point;
+    uint64_le ph_offset;        /* Offset of program headers in the file */
+    uint64_le sh_offset;        /* Offset of section headers in the file */
+    uint32_le flags;
+    uint16_le header_size;
+    uint16_le ph_entry_size;
+    uint16_le ph_count;
+    uint16_le sh_entry_size;
+    uint16_le sh_count;
+    uint16_le sh_str_index;
+} ELF64_HEADER;
+
+#define ELF_CLASS_64       2
+#define ELF_DATA_LE        1
+#define ELF_VERSION        1
+
+#define ELF_TYPE_EXEC      2
+#define ELF_TYPE_DYN       3
+
+#define ELF_MACHINE_X86_64 0x3E
+
+/* Program headers describe segments which are loaded by the OS */
+typedef struct {
+    uint32_le type;
+    uint32_le flags;
+    uint64_le offset;
+    uint64_le vaddr;
+    uint64_le paddr;
+    uint64_le file_size;
+    uint64_le mem_size;
+    uint64_le align;
+} ELF64_PROGRAM_HEADER;
+
+#define PT_NULL         0
+#define PT_LOAD         1
+#define PT_DYNAMIC      2
+#define PT_INTERP       3
+#define PT_NOTE         4
+#define PT_PHDR         6
+#define PT_TLS          7
+#define PT_GNU_EH_FRAME 0x6474E550U
+#define PT_GNU_STACK    0x6474E551U
+#define PT_GNU_RELRO    0x6474E552U
+#define PT_GNU_PROPERTY 0x6474E553U
+
+#define PF_X 1U
+#define PF_W 2U
+#define PF_R 4U
+
+/* Returns non-zero if the buffer contains a 64-bit little endian ELF file */
+inline static int is_elf64_le(const void *buf, size_t size)
+{
+    const uint8_t *const ident = (const uint8_t *)buf;
+
+    return size >= sizeof(ELF64_HEADER) &&
+           ident[0] == 0x7F && ident[1] == 'E' && ident[2] == 'L' && ident[3] == 'F' &&
+           ident[4] == ELF_CLASS_64 && ident[5] == ELF_DATA_LE;
+}
@@ -0,0 +1,291 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+/* Loader which decompresses blocks of the image on first touch.  The image is
+ * registered with userfaultfd and a hidden thread fills missing pages.  If the
+ * OS does not allow that, the whole image is decompressed up front.
+ */
+
+#include "elf_loader.h"
+
+#include <asm/errno.h>
+#include <asm/fcntl.h>
+#include <asm/signal.h>
+#include <linux/ioctl.h>
+#include <linux/sched.h>
+#include <linux/userfaultfd.h>
+
+#define PAGE_SIZE 0x1000U
+
+const ELF_LIVE_LAYOUT *live_layout = (ELF_LIVE_LAYOUT *)(uintptr_t)0xFACECAFEBEEFF00D;
+
+typedef struct {
+    const ELF_LIVE_LAYOUT *layout;
+    uint8_t               *block_buf;
+    uint8_t               *populated;       /* One byte per block, set once the block is in the image */
+    uint32_t               cached_block;    /* Block currently decompressed in block_buf */
+} HANDLER_STATE;
+
+static long raw_syscall4(long nr, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4)
+{
+    register uint64_t r10 __asm__("r10") = arg4;
+    long              ret;
+
+    __asm__ volatile ("syscall"
+                      : "=a" (ret)
+                      : "0" (nr), "D" (arg1), "S" (arg2), "d" (arg3), "r" (r10)
+                      : "rcx", "r11", "memory");
+
+    return ret;
+}
+
+static long uffd_ioctl(int ufd, unsigned long request, void *arg)
+{
+    return raw_syscall(__NR_ioctl, (uint64_t)ufd, request, (uintptr_t)arg);
+}
+
+static void close_fd(int fd)
+{
+    raw_syscall(__NR_close, (uint64_t)fd, 0, 0);
+}
+
+static const uint8_t *get_block(HANDLER_STATE *state, uint32_t i_block)
+{
+    if (state->cached_block != i_block) {
+        decompress_block(state->layout, i_block, state->block_buf);
+        state->cached_block = i_block;
+    }
+
+    return state->block_buf;
+}
+
+/* Copies pages into a registered range, skipping pages which already exist.
+ * Returns 0 if all pages were copied, 1 if some already existed or negative
+ * error code if copying has failed.
+ */
+static long copy_pages(int ufd, uint64_t dest, const uint8_t *src, uint32_t size)
+{
+    uint32_t chunk  = size;
+    long     result = 0;
+
+    while (size) {
+        struct uffdio_copy copy;
+        uint32_t           done;
+
+        copy.dst  = dest;
+        copy.src  = (uintptr_t)src;
+        copy.len  = (chunk < size) ? chunk : size;
+        copy.mode = 0;
+        copy.copy = 0;
+
+        uffd_ioctl(ufd, UFFDIO_COPY, &copy);
+
+        if (copy.copy > 0)
+            done = (uint32_t)copy.copy;
+        else if (copy.copy == -EEXIST) {
+            done   = PAGE_SIZE;
+            result = 1;
+        }
+        /* A single copy cannot span segments with different protection */
+        else if (copy.copy == -ENOENT && chunk > PAGE_SIZE) {
+            chunk = PAGE_SIZE;
+            continue;
+        }
+        else
+            return copy.copy ? (long)copy.copy : -EINVAL;
+
+        dest += done;
+        src  += done;
+        size -= done;
+    }
+
+    return result;
+}
+
+static void handle_fault(HANDLER_STATE *state, int ufd, uint64_t address)
+{
+    const ELF_LIVE_LAYOUT *const layout  = state->layout;
+    const uint32_t               i_block = (uint32_t)((address - layout->decomp_base) / layout->block_size);
+    const uint64_t               dest    = layout->decomp_base + (uint64_t)i_block * layout->block_size;
+    const long                   result  = copy_pages(ufd, dest, get_block(state, i_block),
+                                                      get_block_size(layout, i_block));
+
+    if (result >= 0)
+        state->populated[i_block] = 1;
+
+    /* The faulting page was not copied, e.g. because another fault has
+     * already filled it or because the process is forking.  Wake up the
+     * faulting thread, it will fault again if the page is still missing.
+     */
+    if (result) {
+        struct uffdio_range range;
+
+        range.start = address & ~(uint64_t)(PAGE_SIZE - 1);
+        range.len   = PAGE_SIZE;
+
+        uffd_ioctl(ufd, UFFDIO_WAKE, &range);
+    }
+}
+
+/* Fills the image of a forked child.  Blocks populated in the parent are
+ * already shared with the child, the remaining ones are decompressed.
+ */
+static void populate_child(HANDLER_STATE *state, int ufd)
+{
+    const ELF_LIVE_LAYOUT *const layout = state->layout;
+    uint32_t                     i;
+
+    for (i = 0; i < layout->num_blocks; i++) {
+        const uint64_t dest = layout->decomp_base + (uint64_t)i * layout->block_size;
+
+        if (state->populated[i])
+            continue;
+
+        for (;;) {
+            struct uffd_msg msg;
+            const long      result = copy_pages(ufd, dest, get_block(state, i), get_block_size(layout, i));
+
+            if (result >= 0)
+                break;
+
+            /* The child is gone */
+            if (result != -EAGAIN)
+                return;
+
+            /* The child is forking, its fork event must be handled before
+             * the copy can be retried.
+             */
+            if (raw_syscall(__NR_read, (uint64_t)ufd, (uintptr_t)&msg, sizeof(msg)) != sizeof(msg))
+                return;
+
+            if (msg.event == UFFD_EVENT_FORK) {
+                populate_child(state, (int)msg.arg.fork.ufd);
+                close_fd((int)msg.arg.fork.ufd);
+            }
+        }
+    }
+}
+
+/* Main function of the fault handling thread, runs until the process exits */
+void handle_faults(int ufd)
+{
+    const ELF_LIVE_LAYOUT *const layout = live_layout;
+    HANDLER_STATE                state;
+
+    state.layout       = layout;
+    state.block_buf    = (uint8_t *)(uintptr_t)layout->block_buf;
+    state.populated    = state.block_buf + layout->block_size + ELF_LAZY_STACK_SIZE;
+    state.cached_block = ~0U;
+
+    for (;;) {
+        struct uffd_msg msg;
+
+        if (raw_syscall(__NR_read, (uint64_t)ufd, (uintptr_t)&msg, sizeof(msg)) != sizeof(msg))
+            return;
+
+        switch (msg.event) {
+
+            case UFFD_EVENT_PAGEFAULT:
+                handle_fault(&state, ufd, msg.arg.pagefault.address);
+                break;
+
+            case UFFD_EVENT_FORK:
+                populate_child(&state, (int)msg.arg.fork.ufd);
+                close_fd((int)msg.arg.fork.ufd);
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+/* Starts a thread, which calls handle_faults(ufd) on the given stack.
+ * The thread does not share file descriptors with the process, so the
+ * original program does not see the userfaultfd descriptor.
+ */
+long start_handler_thread(uint64_t flags, uint64_t stack_top, int ufd);
+
+__asm__ (".text\n"
+         "start_handler_thread:\n"
+         "    mov  %edx, %r9d\n"
+         "    mov  $56, %eax\n"            /* __NR_clone */
+         "    xor  %edx, %edx\n"
+         "    xor  %r10d, %r10d\n"
+         "    xor  %r8d, %r8d\n"
+         "    syscall\n"
+         "    test %rax, %rax\n"
+         "    jnz  1f\n"
+         "    mov  %r9d, %edi\n"
+         "    call handle_faults\n"
+         "    mov  $60, %eax\n"            /* __NR_exit */
+         "    xor  %edi, %edi\n"
+         "    syscall\n"
+         "1:  ret\n");
+
+/* Registers the image with userfaultfd and starts the thread handling faults,
+ * returns non-zero if lazy decompression is not available.
+ */
+static int start_lazy_decompression(const ELF_LIVE_LAYOUT *layout)
+{
+    const uint64_t           thread_flags = CLONE_VM | CLONE_FS | CLONE_SIGHAND | CLONE_THREAD | CLONE_SYSVSEM;
+    const uint64_t           stack_top    = layout->block_buf + layout->block_size + ELF_LAZY_STACK_SIZE;
+    const uint64_t           all_signals  = ~(uint64_t)0;
+    uint64_t                 old_signals  = 0;
+    struct uffdio_api        api;
+    struct uffdio_register   reg;
+    long                     ufd;
+    long                     tid;
+
+    ufd = raw_syscall(__NR_userfaultfd, O_CLOEXEC, 0, 0);
+    if (ufd < 0)
+        return 1;
+
+    /* Forked children must get their own copy of the image */
+    api.api      = UFFD_API;
+    api.features = UFFD_FEATURE_EVENT_FORK;
+    api.ioctls   = 0;
+
+    reg.range.start = layout->decomp_base;
+    reg.range.len   = layout->image_size;
+    reg.mode        = UFFDIO_REGISTER_MODE_MISSING;
+    reg.ioctls      = 0;
+
+    if (uffd_ioctl((int)ufd, UFFDIO_API, &api) || uffd_ioctl((int)ufd, UFFDIO_REGISTER, &reg)) {
+        close_fd((int)ufd);
+        return 1;
+    }
+
+    /* Signals are delivered to the threads of the original program */
+    raw_syscall4(__NR_rt_sigprocmask, SIG_SETMASK, (uintptr_t)&all_signals, (uintptr_t)&old_signals, 8);
+
+    tid = start_handler_thread(thread_flags, stack_top, (int)ufd);
+
+    raw_syscall4(__NR_rt_sigprocmask, SIG_SETMASK, (uintptr_t)&old_signals, 0, 8);
+
+    /* The handler thread has its own copy of the descriptor, closing the last
+     * copy unregisters the image.
+     */
+    close_fd((int)ufd);
+
+    return tid < 0;
+}
+
+/* Starts lazy decompression of the image or decompresses it entirely if
+ * that is not possible, restores protection of its segments and returns
+ * the original entry point.
+ */
+uint64_t loader(void)
+{
+    const ELF_LIVE_LAYOUT *const layout = live_layout;
+
+    if (start_lazy_decompression(layout))
+        decompress_image(layout);
+
+    restore_protection(layout);
+
+    return layout->entry_point;
+}
+
+ELF_LOADER_ENTRY;
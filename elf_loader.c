@@ -0,0 +1,23 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "elf_loader.h"
+
+const ELF_LIVE_LAYOUT *live_layout = (ELF_LIVE_LAYOUT *)(uintptr_t)0xFACECAFEBEEFF00D;
+
+/* Decompresses the image, restores protection of its segments and returns
+ * the original entry point.
+ */
+uint64_t loader(void)
+{
+    const ELF_LIVE_LAYOUT *const layout = live_layout;
+
+    decompress_image(layout);
+
+    restore_protection(layout);
+
+    return layout->entry_point;
+}
+
+ELF_LOADER_ENTRY;
@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+/* Helpers shared by ELF loaders, which run without C runtime on x86-64 Linux */
+
+#include "arith_decode.h"
+#include "elf_common.h"
+#include "lza_decompress.h"
+
+#include <asm/unistd.h>
+
+static inline long raw_syscall(long nr, uint64_t arg1, uint64_t arg2, uint64_t arg3)
+{
+    long ret;
+
+    __asm__ volatile ("syscall"
+                      : "=a" (ret)
+                      : "0" (nr), "D" (arg1), "S" (arg2), "d" (arg3)
+                      : "rcx", "r11", "memory");
+
+    return ret;
+}
+
+static inline uint32_t get_block_size(const ELF_LIVE_LAYOUT *layout, uint32_t i_block)
+{
+    const uint32_t offset = i_block * layout->block_size;
+    const uint32_t left   = layout->image_size - offset;
+
+    return (left < layout->block_size) ? left : layout->block_size;
+}
+
+static inline void decompress_block(const ELF_LIVE_LAYOUT *layout, uint32_t i_block, uint8_t *dest)
+{
+    const ELF_BLOCK *const block     = (const ELF_BLOCK *)(uintptr_t)layout->blocks + i_block;
+    uint8_t *const         lz77_data = (uint8_t *)(uintptr_t)layout->lz77_data;
+
+    arith_decode(lz77_data, block->lz_size,
+                 (const uint8_t *)(uintptr_t)layout->comp_data + block->comp_offs, block->comp_size);
+
+    lz_decompress(dest, get_block_size(layout, i_block), lz77_data, NULL);
+}
+
+static inline void decompress_image(const ELF_LIVE_LAYOUT *layout)
+{
+    uint8_t *const dest = (uint8_t *)(uintptr_t)layout->decomp_base;
+    uint32_t       i;
+
+    for (i = 0; i < layout->num_blocks; i++)
+        decompress_block(layout, i, dest + (size_t)i * layout->block_size);
+}
+
+static inline void restore_protection(const ELF_LIVE_LAYOUT *layout)
+{
+    uint32_t i;
+
+    for (i = 0; i < layout->num_segments; i++)
+        raw_syscall(__NR_mprotect, layout->segments[i].vaddr, layout->segments[i].size,
+                    layout->segments[i].prot);
+}
+
+/* Entry point, the stack contains arguments and environment for the original
+ * entry point, so it is restored before jumping there.  The original entry
+ * point expects a function to register with atexit() in rdx, there is none.
+ * loader() returns the original entry point.
+ */
+#define ELF_LOADER_ENTRY                \
+    __asm__ (".text\n"                  \
+             ".globl _loader\n"         \
+             "_loader:\n"               \
+             "    mov  %rsp, %rbx\n"    \
+             "    and  $-16, %rsp\n"    \
+             "    call loader\n"        \
+             "    mov  %rbx, %rsp\n"    \
+             "    xor  %edx, %edx\n"    \
+             "    jmp  *%rax\n")
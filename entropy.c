@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "entropy.h"
+
+#include "bit_ops.h"
+
+#include <string.h>
+
+/* log2 values are fixed-point numbers with 16 fractional bits */
+#define LOG2_ONE (1U << 16)
+
+/* Random data yields about 7.95 bits per byte in a 4KB block, while code
+ * and tables are usually below 7 bits per byte.
+ */
+#define MIN_ENTROPY ((uint32_t)(7.9 * LOG2_ONE))
+
+/* Computes log2 without floating point, so that the pre-scan is cheap */
+static uint32_t log2_fixed(uint32_t value)
+{
+    const int int_bits = 31 - count_leading_zeroes(value);
+    uint32_t  result   = (uint32_t)int_bits * LOG2_ONE;
+    uint64_t  mantissa = (uint64_t)value << (31 - int_bits);
+    uint32_t  bit;
+
+    /* Mantissa is in [1, 2) with 31 fractional bits, each squaring
+     * yields the next bit of the fractional part of the result.
+     */
+    for (bit = LOG2_ONE >> 1; bit; bit >>= 1) {
+        mantissa = (mantissa * mantissa) >> 31;
+
+        if (mantissa >= (2ULL << 31)) {
+            mantissa >>= 1;
+            result    |= bit;
+        }
+    }
+
+    return result;
+}
+
+int is_incompressible(const uint8_t *data, size_t size)
+{
+    uint32_t histogram[256];
+    uint64_t sum = 0;
+    uint32_t log2_size;
+    size_t   i;
+
+    if ( ! size)
+        return 0;
+
+    memset(histogram, 0, sizeof(histogram));
+
+    for (i = 0; i < size; i++)
+        ++histogram[data[i]];
+
+    log2_size = log2_fixed((uint32_t)size);
+    if (log2_size < MIN_ENTROPY)
+        return 0;
+
+    /* Entropy is log2(size) - sum(count * log2(count)) / size */
+    for (i = 0; i < 256; i++) {
+        const uint32_t count = histogram[i];
+
+        if (count > 1)
+            sum += (uint64_t)count * log2_fixed(count);
+    }
+
+    return (uint64_t)size * (log2_size - MIN_ENTROPY) >= sum;
+}
+
+size_t get_incompressible_size(const uint8_t *buf, size_t size)
+{
+    size_t pos = 0;
+
+    while (size - pos >= ENTROPY_BLOCK_SIZE && is_incompressible(&buf[pos], ENTROPY_BLOCK_SIZE))
+        pos += ENTROPY_BLOCK_SIZE;
+
+    return pos;
+}
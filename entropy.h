@@ -0,0 +1,23 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Size of blocks examined by the entropy pre-scan */
+#define ENTROPY_BLOCK_SIZE 4096U
+
+/* Returns non-zero if order-0 entropy of the data is close to 8 bits per byte.
+ * Such data, e.g. compressed resources or encrypted blobs, is not worth
+ * looking for matches in and expands when compressed.
+ */
+int is_incompressible(const uint8_t *data, size_t size);
+
+/* Returns size of incompressible data at the beginning of the buffer,
+ * which is a multiple of ENTROPY_BLOCK_SIZE.  A partial block at the
+ * end of the buffer is never considered incompressible.
+ */
+size_t get_incompressible_size(const uint8_t *buf, size_t size);
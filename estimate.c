@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "estimate.h"
+#include "bit_ops.h"
+#include "buffer.h"
+#include "lza_compress.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Same model as in update_model(), the probability of a bit is derived from
+ * the number of bits with the same value among the last 64 bits.
+ */
+#define MODEL_HISTORY 64
+#define MODEL_TOTAL   (MODEL_HISTORY + 2)
+
+typedef struct {
+    uint64_t history;
+    unsigned ones;                          /* Number of ones in history */
+    double   one_bits[MODEL_HISTORY + 1];   /* Cost of one by number of ones in history */
+    double   zero_bits[MODEL_HISTORY + 1];  /* Cost of zero by number of ones in history */
+} ESTIMATOR;
+
+static void init_estimator(ESTIMATOR *est)
+{
+    unsigned i;
+
+    for (i = 0; i <= MODEL_HISTORY; i++) {
+        est->one_bits[i]  = log2((double)MODEL_TOTAL / (double)(i + 1));
+        est->zero_bits[i] = log2((double)MODEL_TOTAL / (double)(MODEL_HISTORY - i + 1));
+    }
+
+    est->history = 0xAAAAAAAAAAAAAAAAULL;
+    est->ones    = MODEL_HISTORY / 2;
+}
+
+static double add_bytes(ESTIMATOR *est, const uint8_t *data, size_t size)
+{
+    uint64_t history = est->history;
+    unsigned ones    = est->ones;
+    double   bits    = 0;
+    size_t   i;
+
+    for (i = 0; i < size; i++) {
+        const unsigned byte = data[i];
+        int            bit_idx;
+
+        for (bit_idx = 7; bit_idx >= 0; bit_idx--) {
+            const unsigned bit = (byte >> bit_idx) & 1U;
+
+            bits    += bit ? est->one_bits[ones] : est->zero_bits[ones];
+            ones    += bit - (unsigned)(history >> 63);
+            history  = (history << 1) | bit;
+        }
+    }
+
+    est->history = history;
+    est->ones    = ones;
+
+    return bits;
+}
+
+double estimate_arith_bits(const void *data, size_t size)
+{
+    ESTIMATOR est;
+
+    init_estimator(&est);
+
+    return add_bytes(&est, (const uint8_t *)data, size);
+}
+
+int estimate_lza_size(SIZE_ESTIMATE       *estimate,
+                      const void          *src,
+                      size_t               src_size,
+                      const PARSER_PARAMS *params)
+{
+    COMPRESSED_SIZES compressed;
+    PARSER_PARAMS    reduced;
+    ESTIMATOR        est;
+    OFFSET_MAP      *map;
+    BUFFER           lz_buf;
+    const uint8_t   *lz;
+    size_t           hdr_size;
+    double           total;
+    uint32_t         i;
+
+    memset(estimate, 0, sizeof(*estimate));
+
+    if ( ! src_size)
+        return 0;
+
+    if (params)
+        reduced = *params;
+    else
+        get_default_parser_params(&reduced);
+
+    if ( ! reduced.max_chunks || reduced.max_chunks > ESTIMATE_MAX_CHUNKS)
+        reduced.max_chunks = ESTIMATE_MAX_CHUNKS;
+
+    lz_buf = buf_alloc(lz_compress_bound(src_size));
+    if ( ! lz_buf.buf) {
+        perror(NULL);
+        return 1;
+    }
+
+    map = create_offset_map(get_offset_map_input_size(src_size, &reduced));
+    if ( ! map) {
+        buf_free(lz_buf);
+        return 1;
+    }
+
+    set_offset_map_params(map, &reduced);
+
+    compressed = lz_compress_with_map(map, lz_buf.buf, lz_buf.size, src, src_size);
+
+    destroy_offset_map(map);
+
+    if ( ! compressed.lz) {
+        buf_free(lz_buf);
+        return 1;
+    }
+
+    /* The header is followed by each stream */
+    hdr_size = compressed.lz;
+    for (i = 0; i < LZS_NUM_STREAMS; i++)
+        hdr_size -= compressed.streams[i];
+
+    init_estimator(&est);
+
+    lz                    = lz_buf.buf;
+    estimate->lz          = compressed.lz;
+    estimate->header_bits = add_bytes(&est, lz, hdr_size);
+    total                 = estimate->header_bits;
+    lz                   += hdr_size;
+
+    for (i = 0; i < LZS_NUM_STREAMS; i++) {
+        estimate->streams[i]     = compressed.streams[i];
+        estimate->stream_bits[i] = add_bytes(&est, lz, compressed.streams[i]);
+        total                   += estimate->stream_bits[i];
+        lz                      += compressed.streams[i];
+    }
+
+    /* The arithmetic coder adds up to a byte when flushing */
+    estimate->compressed = (size_t)ceil(total / 8) + 1;
+
+    buf_free(lz_buf);
+
+    return 0;
+}
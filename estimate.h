@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include "find_repeats.h"
+#include "lza_defines.h"
+
+#include <stddef.h>
+
+/* Maximum number of location chunks searched for matches by the estimator.
+ * The reduced search finds fewer long matches, so the estimate is usually
+ * slightly larger than the actual size, more so for data with many
+ * candidate matches, like text.
+ */
+#define ESTIMATE_MAX_CHUNKS 2
+
+typedef struct {
+    size_t lz;                              /* Size after LZ77 compression with reduced search */
+    size_t streams[LZS_NUM_STREAMS];        /* Size of each LZ77 stream */
+    double stream_bits[LZS_NUM_STREAMS];    /* Estimated entropy of each LZ77 stream */
+    double header_bits;                     /* Estimated entropy of the LZ77 header */
+    size_t compressed;                      /* Estimated size of lza_compress() output */
+} SIZE_ESTIMATE;
+
+/* Estimates size of data after arith_encode() without encoding it.
+ * This replays the coder's model, but skips the coding itself.
+ */
+double estimate_arith_bits(const void *data, size_t size);
+
+/* Estimates size of the output of lza_compress() much faster than running it.
+ * Matches are found with the given parameters, except that at most
+ * ESTIMATE_MAX_CHUNKS location chunks are searched for each position.
+ * params can be NULL for default parameters.  Returns non-zero on failure.
+ */
+int estimate_lza_size(SIZE_ESTIMATE       *estimate,
+                      const void          *src,
+                      size_t               src_size,
+                      const PARSER_PARAMS *params);
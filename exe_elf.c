@@ -0,0 +1,772 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "exe_elf.h"
+#include "arena.h"
+#include "arith_decode.h"
+#include "arith_encode.h"
+#include "elf_common.h"
+#include "elf_format.h"
+#include "lza_decompress.h"
+#include "lza_compress.h"
+#include "loaders.h"
+#include "timer.h"
+
+#include <assert.h>
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Layout of the packed executable in memory.  The loader segment is placed
+ * below the original image, so that it is the first loadable segment, which
+ * is where the OS looks for program headers.  It is kept small, because
+ * executables are usually linked close to the lowest address which can be
+ * mapped.  Compressed data is placed in the data segment above the image.
+ *
+ * stub_base ----------> +----------------+ <- Loader segment, mapped from the beginning of the file
+ *                       |  ELF header    |
+ *                       |  prog headers  |
+ * loader -------------> +----------------+ <- Arithmetic decoder and LZ77 decompressor, the entry point
+ *                       |     loader     |
+ * live_layout --------> +----------------+ <- Live layout structure used by the loader
+ *                       |  live layout   |
+ *                       +----------------+
+ *                       :                :
+ * va_start -----------> +----------------+ <- Image segment, which has no data in the file;
+ *                       |    original    |    original segments are decompressed here
+ *                       |     image      |    and their protection is restored
+ * va_end -------------> +----------------+
+ *                       |   LZ77 data    | <- LZ77 data of one block is decoded here by the arithmetic decoder
+ * block_buf ----------> +----------------+
+ *                       |  block buffer  | <- Lazy loader only: block decompressed on first touch,
+ *                       |  handler stack |    stack of the fault handling thread and a byte
+ *                       |   populated    |    for each block marking it as present
+ *                       +----------------+
+ *                       :                :
+ * comp_data ----------> +----------------+ <- Data segment, mapped from the rest of the file;
+ *                       |   compressed   |    blocks of the image, each compressed independently
+ *                       |     blocks     |
+ * blocks -------------> +----------------+ <- Index of compressed blocks
+ *                       |  block index   |
+ *                       +----------------+
+ *
+ * The eager loader decompresses the image as a single block.  The lazy loader
+ * registers the image with userfaultfd and decompresses blocks when they are
+ * first touched, see elf_lazy_loader.c.
+ */
+
+#define PAGE_SIZE 0x1000U
+
+/* Lowest address at which Linux allows mapping memory by default */
+#define MIN_STUB_BASE 0x10000U
+
+/* End of user address space with 4-level page tables */
+#define MAX_USER_ADDR (1ULL << 47)
+
+/* Loader, image and data segments */
+#define NUM_OUT_SEGMENTS 3U
+
+#define PROT_READ  1U
+#define PROT_WRITE 2U
+#define PROT_EXEC  4U
+
+typedef struct {
+    uint64_t stub_base;
+    uint64_t va_start;     /* Page-aligned start of the original image */
+    uint64_t data_end;     /* End of data loaded from the file, the rest is zero */
+    uint64_t va_end;       /* Page-aligned end of the original image, including bss */
+    uint64_t comp_data;    /* Address of compressed data, same offset in page as in the file */
+    uint32_t loader_offs;
+    uint32_t live_layout_offs;
+    uint32_t comp_data_offs;
+    uint32_t blocks_offs;
+    uint32_t end_offs;
+} LAYOUT;
+
+/* Prints diagnostic information, unless running in quiet mode */
+#define INFO(...) do { if (verbose) printf(__VA_ARGS__); } while (0)
+
+/* Prints error, unless the executable is only being checked */
+#define ERROR(...) do { if ( ! quiet) fprintf(stderr, __VA_ARGS__); } while (0)
+
+static uint64_t align_up(uint64_t value, uint64_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+static const LOADER_STUB *get_loader_stub(const char *name)
+{
+    uint32_t i;
+
+    for (i = 0; i < num_loader_stubs; i++) {
+        const LOADER_STUB *const stub = &loader_stubs[i];
+
+        if (stub->machine == ELF_MACHINE_X86_64 && ! strcmp(stub->name, name))
+            return stub;
+    }
+
+    fprintf(stderr, "Error: Missing %s loader for machine 0x%x\n", name, ELF_MACHINE_X86_64);
+    return NULL;
+}
+
+/* Returns program headers or NULL if the file is not an x86-64 executable */
+static const ELF64_PROGRAM_HEADER *get_program_headers(const void *buf, size_t size, uint32_t *num_headers)
+{
+    const ELF64_HEADER *const header = (const ELF64_HEADER *)buf;
+    const uint64_t            offset = get_uint64_le(header->ph_offset);
+    const uint32_t            count  = get_uint16_le(header->ph_count);
+
+    if (get_uint16_le(header->machine) != ELF_MACHINE_X86_64 ||
+        get_uint16_le(header->type) != ELF_TYPE_EXEC)
+        return NULL;
+
+    if (get_uint16_le(header->ph_entry_size) != sizeof(ELF64_PROGRAM_HEADER) ||
+        offset > size || count > (size - offset) / sizeof(ELF64_PROGRAM_HEADER))
+        return NULL;
+
+    *num_headers = count;
+
+    return (const ELF64_PROGRAM_HEADER *)at_offset(buf, (uint32_t)offset);
+}
+
+/* Only statically linked x86-64 executables are packed.  Other ELF files, such
+ * as dynamically linked or position-independent executables, shared libraries
+ * and object files, are compressed like any other file.
+ */
+int is_elf_file(const void *buf, size_t size)
+{
+    const ELF64_PROGRAM_HEADER *headers;
+    uint32_t                    num_headers = 0;
+    uint32_t                    i;
+
+    if ( ! is_elf64_le(buf, size))
+        return 0;
+
+    headers = get_program_headers(buf, size, &num_headers);
+    if ( ! headers)
+        return 0;
+
+    for (i = 0; i < num_headers; i++) {
+        const uint32_t type = get_uint32_le(headers[i].type);
+
+        if (type == PT_INTERP || type == PT_DYNAMIC)
+            return 0;
+    }
+
+    return 1;
+}
+
+static uint32_t get_prot(uint32_t flags)
+{
+    return ((flags & PF_R) ? PROT_READ  : 0U) |
+           ((flags & PF_W) ? PROT_WRITE : 0U) |
+           ((flags & PF_X) ? PROT_EXEC  : 0U);
+}
+
+/* Checks loadable segments and finds the range of addresses they occupy,
+ * errors are printed unless quiet is non-zero.
+ */
+static int parse_segments(const ELF64_PROGRAM_HEADER *headers,
+                          uint32_t                    num_headers,
+                          size_t                      size,
+                          LAYOUT                     *layout,
+                          ELF_LIVE_LAYOUT            *live,
+                          int                         quiet)
+{
+    uint32_t i;
+
+    layout->va_start = ~(uint64_t)0;
+
+    for (i = 0; i < num_headers; i++) {
+        const ELF64_PROGRAM_HEADER *const ph        = &headers[i];
+        const uint32_t                    type      = get_uint32_le(ph->type);
+        const uint64_t                    offset    = get_uint64_le(ph->offset);
+        const uint64_t                    vaddr     = get_uint64_le(ph->vaddr);
+        const uint64_t                    file_size = get_uint64_le(ph->file_size);
+        const uint64_t                    mem_size  = get_uint64_le(ph->mem_size);
+        ELF_SEGMENT                      *segment;
+
+        if (type != PT_LOAD)
+            continue;
+
+        if (file_size > mem_size || offset > size || file_size > size - offset ||
+            vaddr + mem_size < vaddr || vaddr + mem_size > MAX_USER_ADDR) {
+            ERROR("Error: Corrupted ELF file, invalid segment %u\n", i);
+            return 1;
+        }
+
+        if (live->num_segments == MAX_ELF_SEGMENTS) {
+            ERROR("Error: Too many loadable segments in ELF file\n");
+            return 1;
+        }
+
+        if ( ! mem_size)
+            continue;
+
+        segment        = &live->segments[live->num_segments++];
+        segment->vaddr = vaddr & ~(uint64_t)(PAGE_SIZE - 1);
+        segment->size  = align_up(vaddr + mem_size, PAGE_SIZE) - segment->vaddr;
+        segment->prot  = get_prot(get_uint32_le(ph->flags));
+
+        /* Segments sharing a page get combined protection */
+        if (live->num_segments > 1) {
+            ELF_SEGMENT *const prev = segment - 1;
+
+            if (segment->vaddr < prev->vaddr + prev->size) {
+                if (segment->vaddr < prev->vaddr) {
+                    ERROR("Error: Loadable segments in ELF file are not sorted\n");
+                    return 1;
+                }
+
+                prev->prot    |= segment->prot;
+                segment->prot |= prev->prot;
+            }
+        }
+
+        if (segment->vaddr < layout->va_start)
+            layout->va_start = segment->vaddr;
+        if (vaddr + file_size > layout->data_end)
+            layout->data_end = vaddr + file_size;
+        if (segment->vaddr + segment->size > layout->va_end)
+            layout->va_end = segment->vaddr + segment->size;
+    }
+
+    if ( ! live->num_segments) {
+        ERROR("Error: No loadable segments in ELF file\n");
+        return 1;
+    }
+
+    if (layout->data_end < layout->va_start)
+        layout->data_end = layout->va_start;
+
+    /* The loader only decompresses LZ77 data with compact distance slots */
+    if (layout->va_end - layout->va_start > LZA_MAX_COMPACT_SIZE - 0x10000U) {
+        ERROR("Error: ELF image is too large\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Copies contents of loadable segments into the image, gaps are left zeroed */
+static void load_image(const void *buf, const ELF64_PROGRAM_HEADER *headers, uint32_t num_headers,
+                       const LAYOUT *layout, BUFFER image)
+{
+    uint32_t i;
+
+    for (i = 0; i < num_headers; i++) {
+        const ELF64_PROGRAM_HEADER *const ph = &headers[i];
+
+        if (get_uint32_le(ph->type) != PT_LOAD || ! get_uint64_le(ph->file_size))
+            continue;
+
+        memcpy(image.buf + (get_uint64_le(ph->vaddr) - layout->va_start),
+               at_offset(buf, (uint32_t)get_uint64_le(ph->offset)),
+               (size_t)get_uint64_le(ph->file_size));
+    }
+}
+
+/* Program headers which are copied from the original executable.  The runtime
+ * finds TLS, RELRO and unwind tables through them.  Notes are dropped, because
+ * the OS reads them from the file.
+ */
+static int is_kept_header(uint32_t type)
+{
+    return type == PT_TLS || type == PT_GNU_STACK || type == PT_GNU_RELRO || type == PT_GNU_EH_FRAME;
+}
+
+static uint32_t count_kept_headers(const ELF64_PROGRAM_HEADER *headers, uint32_t num_headers)
+{
+    uint32_t count = 0;
+    uint32_t i;
+
+    for (i = 0; i < num_headers; i++)
+        if (is_kept_header(get_uint32_le(headers[i].type)))
+            ++count;
+
+    return count;
+}
+
+static void set_program_header(ELF64_PROGRAM_HEADER *ph, uint32_t flags, uint64_t offset, uint64_t vaddr,
+                               uint64_t file_size, uint64_t mem_size)
+{
+    ph->type      = make_uint32_le(PT_LOAD);
+    ph->flags     = make_uint32_le(flags);
+    ph->offset    = make_uint64_le(offset);
+    ph->vaddr     = make_uint64_le(vaddr);
+    ph->paddr     = make_uint64_le(vaddr);
+    ph->file_size = make_uint64_le(file_size);
+    ph->mem_size  = make_uint64_le(mem_size);
+    ph->align     = make_uint64_le(PAGE_SIZE);
+}
+
+static void fill_elf_header(BUFFER                      output,
+                            const void                 *buf,
+                            const ELF64_PROGRAM_HEADER *headers,
+                            uint32_t                    num_headers,
+                            const LAYOUT               *layout,
+                            uint64_t                    entry_point,
+                            uint64_t                    image_mem_size)
+{
+    const ELF64_HEADER *const orig_header = (const ELF64_HEADER *)buf;
+    ELF64_HEADER       *const header      = (ELF64_HEADER *)output.buf;
+    ELF64_PROGRAM_HEADER     *ph          = (ELF64_PROGRAM_HEADER *)(output.buf + sizeof(ELF64_HEADER));
+    uint32_t                  num_out     = NUM_OUT_SEGMENTS;
+    uint32_t                  i;
+
+    memcpy(header->ident, orig_header->ident, sizeof(header->ident));
+    header->type          = make_uint16_le(ELF_TYPE_EXEC);
+    header->machine       = make_uint16_le(ELF_MACHINE_X86_64);
+    header->version       = make_uint32_le(ELF_VERSION);
+    header->entry_point   = make_uint64_le(entry_point);
+    header->ph_offset     = make_uint64_le(sizeof(ELF64_HEADER));
+    header->header_size   = make_uint16_le((uint16_t)sizeof(ELF64_HEADER));
+    header->ph_entry_size = make_uint16_le((uint16_t)sizeof(ELF64_PROGRAM_HEADER));
+
+    set_program_header(ph++, PF_R | PF_X, 0, layout->stub_base, layout->comp_data_offs, layout->comp_data_offs);
+    set_program_header(ph++, PF_R | PF_W, 0, layout->va_start, 0, image_mem_size);
+    set_program_header(ph++, PF_R, layout->comp_data_offs, layout->comp_data,
+                       layout->end_offs - layout->comp_data_offs, layout->end_offs - layout->comp_data_offs);
+
+    for (i = 0; i < num_headers; i++) {
+        if ( ! is_kept_header(get_uint32_le(headers[i].type)))
+            continue;
+
+        *ph        = headers[i];
+        ph->offset = make_uint64_le(0);
+        ++ph;
+        ++num_out;
+    }
+
+    header->ph_count = make_uint16_le((uint16_t)num_out);
+}
+
+static int install_live_layout(BUFFER loader, uint64_t layout_va, const char *name)
+{
+    static const uint8_t signature[] = { 0x0D, 0xF0, 0xEF, 0xBE, 0xFE, 0xCA, 0xCE, 0xFA };
+    size_t               pos;
+
+    for (pos = 0; pos + sizeof(signature) <= loader.size; pos++) {
+        if (memcmp(&loader.buf[pos], signature, sizeof(signature)) == 0) {
+            const uint64_le out_layout_va = make_uint64_le(layout_va);
+
+            memcpy(&loader.buf[pos], out_layout_va.bytes, sizeof(signature));
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "Error: Live layout signature not found in %s loader\n", name);
+    return 1;
+}
+
+/* Decode and decompress each block of the output and compare it with the original image */
+static int verify_compression(BUFFER image, uint32_t block_size, const ELF_BLOCK *blocks,
+                              uint32_t num_blocks, BUFFER lz77_data, BUFFER comp_data)
+{
+    BUFFER   arith_output = buf_alloc_flags(lz77_data.size, 0);
+    BUFFER   decompressed = { NULL, 0 };
+    uint32_t lz_offs      = 0;
+    uint32_t i;
+    int      error        = 1;
+
+    if ( ! arith_output.buf) {
+        perror(NULL);
+        return 1;
+    }
+
+    decompressed = buf_alloc_flags(block_size, ARENA_HUGE_PAGES);
+    if ( ! decompressed.buf) {
+        perror(NULL);
+        goto cleanup;
+    }
+
+    for (i = 0; i < num_blocks; i++) {
+        const uint32_t offset = i * block_size;
+        const uint32_t size   = ((uint32_t)image.size - offset < block_size)
+                                ? (uint32_t)image.size - offset : block_size;
+
+        arith_decode(arith_output.buf, blocks[i].lz_size,
+                     comp_data.buf + blocks[i].comp_offs, blocks[i].comp_size);
+
+        if (memcmp(lz77_data.buf + lz_offs, arith_output.buf, blocks[i].lz_size) != 0) {
+            fprintf(stderr, "Error: Arithmetic coding verification failed in block %u\n", i);
+            goto cleanup;
+        }
+
+        lz_decompress(decompressed.buf, size, arith_output.buf, NULL);
+
+        if (memcmp(image.buf + offset, decompressed.buf, size) != 0) {
+            fprintf(stderr, "Error: LZ77 compression verification failed in block %u\n", i);
+            goto cleanup;
+        }
+
+        lz_offs += blocks[i].lz_size;
+    }
+
+    error = 0;
+
+cleanup:
+    buf_free(decompressed);
+    buf_free(arith_output);
+
+    return error;
+}
+
+/* Accumulates statistics of compressed blocks */
+static void add_sizes(COMPRESSED_SIZES *total, const COMPRESSED_SIZES *block)
+{
+    uint32_t i;
+
+    total->compressed     += block->compressed;
+    total->lz             += block->lz;
+    total->degraded       += block->degraded;
+    total->stats_lit      += block->stats_lit;
+    total->stats_match    += block->stats_match;
+    total->stats_shortrep += block->stats_shortrep;
+
+    for (i = 0; i < LZS_NUM_STREAMS; i++)
+        total->streams[i] += block->streams[i];
+
+    for (i = 0; i < 4; i++)
+        total->stats_longrep[i] += block->stats_longrep[i];
+}
+
+/* Size of the image data which is compressed, the rest is bss zeroed by the OS */
+static uint32_t get_image_size(const LAYOUT *layout)
+{
+    const uint64_t size = align_up(layout->data_end, PAGE_SIZE) - layout->va_start;
+
+    return (uint32_t)(size ? size : PAGE_SIZE);
+}
+
+/* Size of scratch space after the image: LZ77 data of one block and, for the
+ * lazy loader, a block buffer, a stack for the fault handler and a byte per block.
+ */
+static uint64_t get_scratch_size(uint64_t max_lz_size, uint32_t block_size, uint32_t num_blocks, int lazy)
+{
+    uint64_t size = align_up(max_lz_size, PAGE_SIZE);
+
+    if (lazy)
+        size += block_size + ELF_LAZY_STACK_SIZE + align_up(num_blocks, PAGE_SIZE);
+
+    return size;
+}
+
+size_t estimate_elf_memory(const void *buf, size_t size)
+{
+    ELF_LIVE_LAYOUT             live;
+    LAYOUT                      layout;
+    const ELF64_PROGRAM_HEADER *headers;
+    uint32_t                    num_headers = 0;
+    size_t                      image_size;
+
+    memset(&live, 0, sizeof(live));
+    memset(&layout, 0, sizeof(layout));
+
+    assert(is_elf_file(buf, size));
+
+    /* Unsupported executables are reported by exe_elf() */
+    headers = get_program_headers(buf, size, &num_headers);
+    if (parse_segments(headers, num_headers, size, &layout, &live, 1))
+        return size;
+
+    image_size = get_image_size(&layout);
+
+    /* Loaded image and LZ77 output, or decompressed image during verification */
+    return size + image_size * 2 + lz_compress_bound(image_size);
+}
+
+BUFFER exe_elf(const void          *buf,
+               size_t               size,
+               const PARSER_PARAMS *params,
+               uint32_t             lazy_block_size,
+               int                  verbose,
+               REPORT              *report)
+{
+    const ELF64_PROGRAM_HEADER *headers;
+    const LOADER_STUB          *stub;
+    const char                 *stub_name = lazy_block_size ? "elf_lazy_loader" : "elf_loader";
+    ELF_LIVE_LAYOUT             live;
+    LAYOUT                      layout;
+    COMPRESSED_SIZES            compressed;
+    BUFFER                      image      = { NULL, 0 };
+    BUFFER                      lz77_buf   = { NULL, 0 };
+    BUFFER                      lz77_data  = { NULL, 0 };
+    BUFFER                      blocks_buf = { NULL, 0 };
+    BUFFER                      output     = { NULL, 0 };
+    ELF_BLOCK                  *blocks;
+    uint64_t                    image_mem_size;
+    uint64_t                    scratch_size;
+    uint64_t                    stub_size;
+    uint64_t                    max_above_size;
+    uint64_t                    entry_point;
+    uint32_t                    num_headers = 0;
+    uint32_t                    headers_size;
+    uint32_t                    block_size;
+    uint32_t                    num_blocks;
+    uint32_t                    max_lz_size = 0;
+    uint32_t                    comp_size;
+    uint32_t                    comp_capacity;
+    uint32_t                    i;
+    int                         error       = 1;
+    uint64_t                    phase_start = get_time_us();
+
+    assert(is_elf_file(buf, size));
+    assert(lazy_block_size % PAGE_SIZE == 0);
+
+    memset(&live, 0, sizeof(live));
+    memset(&layout, 0, sizeof(layout));
+    memset(&compressed, 0, sizeof(compressed));
+
+    headers = get_program_headers(buf, size, &num_headers);
+    if (parse_segments(headers, num_headers, size, &layout, &live, 0))
+        return output;
+
+    entry_point = get_uint64_le(((const ELF64_HEADER *)buf)->entry_point);
+
+    stub = get_loader_stub(stub_name);
+    if ( ! stub)
+        return output;
+
+    /* Only the headers, the loader and the live layout are placed below the
+     * image, so check that they fit before spending time on compression.
+     */
+    headers_size            = (uint32_t)(sizeof(ELF64_HEADER) + sizeof(ELF64_PROGRAM_HEADER) *
+                                         (NUM_OUT_SEGMENTS + count_kept_headers(headers, num_headers)));
+    layout.loader_offs      = (uint32_t)align_up(headers_size, 16);
+    layout.live_layout_offs = (uint32_t)align_up(layout.loader_offs + stub->text_size, 8);
+    layout.comp_data_offs   = (uint32_t)align_up(layout.live_layout_offs + sizeof(ELF_LIVE_LAYOUT), 16);
+
+    stub_size = align_up(layout.comp_data_offs, PAGE_SIZE);
+    if (layout.va_start < MIN_STUB_BASE + stub_size) {
+        fprintf(stderr, "Error: Not enough address space below the ELF image for the loader\n");
+        return output;
+    }
+    layout.stub_base = layout.va_start - stub_size;
+
+    /* Load segments into the image, only pages with data from the file are
+     * compressed, the remaining bss is zeroed by the OS.
+     */
+    image = buf_alloc_flags(get_image_size(&layout), ARENA_ZERO | ARENA_HUGE_PAGES);
+    if ( ! image.buf) {
+        perror(NULL);
+        return output;
+    }
+
+    load_image(buf, headers, num_headers, &layout, image);
+
+    /* The eager loader decompresses the whole image as one block */
+    block_size = (lazy_block_size && lazy_block_size < image.size) ? lazy_block_size : (uint32_t)image.size;
+    num_blocks = (uint32_t)((image.size + block_size - 1) / block_size);
+
+    blocks_buf = buf_alloc_flags(num_blocks * sizeof(ELF_BLOCK), ARENA_ZERO);
+    if ( ! blocks_buf.buf) {
+        perror(NULL);
+        goto cleanup;
+    }
+    blocks = (ELF_BLOCK *)blocks_buf.buf;
+
+    /* Scratch space and the data segment follow the image.  Compressed size
+     * is not known yet, so check with a generous estimate that they fit.
+     */
+    max_above_size = get_scratch_size(lz_compress_bound(block_size), block_size, num_blocks, lazy_block_size != 0) +
+                     (uint64_t)lz_compress_bound(block_size) * num_blocks * 2 + num_blocks * sizeof(ELF_BLOCK);
+    if (max_above_size > MAX_USER_ADDR - layout.va_end) {
+        fprintf(stderr, "Error: Not enough address space above the ELF image for compressed data\n");
+        goto cleanup;
+    }
+
+    phase_start = end_phase(report, REPORT_PARSE, phase_start);
+
+    /* Compress each block of the image with LZ77 */
+    {
+        const size_t lz_bound = lz_compress_bound(block_size) * num_blocks;
+        size_t       lz_size  = 0;
+        OFFSET_MAP  *map;
+
+        lz77_buf = buf_alloc(lz_bound);
+        if ( ! lz77_buf.buf) {
+            perror(NULL);
+            goto cleanup;
+        }
+
+        map = create_offset_map(get_offset_map_input_size(block_size, params));
+        if ( ! map)
+            goto cleanup;
+
+        if (params)
+            set_offset_map_params(map, params);
+
+        for (i = 0; i < num_blocks; i++) {
+            const uint32_t   offset = i * block_size;
+            const uint32_t   left   = (uint32_t)image.size - offset;
+            COMPRESSED_SIZES block;
+
+            block = lz_compress_with_map(map, lz77_buf.buf + lz_size, lz_bound - lz_size,
+                                         image.buf + offset, (left < block_size) ? left : block_size);
+            if ( ! block.lz)
+                break;
+
+            if (num_blocks == 1)
+                compressed = block;
+            else
+                add_sizes(&compressed, &block);
+
+            blocks[i].lz_size = (uint32_t)block.lz;
+            lz_size          += block.lz;
+
+            if (block.lz > max_lz_size)
+                max_lz_size = (uint32_t)block.lz;
+        }
+
+        destroy_offset_map(map);
+
+        if (i < num_blocks)
+            goto cleanup;
+
+        lz77_data = buf_truncate(lz77_buf, lz_size);
+    }
+
+    phase_start = end_phase(report, REPORT_LZ77, phase_start);
+
+    /* Encode LZ77 data of each block with arithmetic coder directly into the
+     * output file.  If it turns out to be larger than expected, repeat
+     * encoding with the exact size.
+     */
+    comp_capacity = (uint32_t)(lz77_data.size + lz77_data.size / 8 + 64 * num_blocks);
+    for (;;) {
+        BUFFER   comp_data;
+        uint32_t lz_offs = 0;
+
+        output = buf_alloc(layout.comp_data_offs + align_up(comp_capacity, 8) + num_blocks * sizeof(ELF_BLOCK));
+        if ( ! output.buf) {
+            perror(NULL);
+            goto cleanup;
+        }
+
+        comp_data = buf_slice(output, layout.comp_data_offs, comp_capacity);
+        comp_size = 0;
+
+        for (i = 0; i < num_blocks; i++) {
+            const uint32_t avail = (comp_size < comp_capacity) ? comp_capacity - comp_size : 0;
+
+            /* Once the buffer is full, only the size of remaining blocks is determined */
+            blocks[i].comp_offs = comp_size;
+            blocks[i].comp_size = (uint32_t)arith_encode(comp_data.buf + (avail ? comp_size : 0), avail,
+                                                         lz77_data.buf + lz_offs, blocks[i].lz_size);
+
+            comp_size += blocks[i].comp_size;
+            lz_offs   += blocks[i].lz_size;
+        }
+
+        if (comp_size <= comp_capacity)
+            break;
+
+        comp_capacity = comp_size;
+        buf_free(output);
+        output.buf = NULL;
+    }
+
+    compressed.compressed = comp_size;
+
+    phase_start = end_phase(report, REPORT_ARITH, phase_start);
+
+    layout.blocks_offs = (uint32_t)align_up(layout.comp_data_offs + comp_size, 8);
+    layout.end_offs    = layout.blocks_offs + num_blocks * (uint32_t)sizeof(ELF_BLOCK);
+
+    /* The data segment is mapped from the file after the scratch space, its
+     * address has the same offset in page as the compressed data in the file.
+     */
+    scratch_size     = get_scratch_size(max_lz_size, block_size, num_blocks, lazy_block_size != 0);
+    image_mem_size   = layout.va_end - layout.va_start + scratch_size;
+    layout.comp_data = layout.va_end + scratch_size + (layout.comp_data_offs & (PAGE_SIZE - 1));
+    if (layout.end_offs - layout.comp_data_offs > MAX_USER_ADDR - layout.comp_data) {
+        fprintf(stderr, "Error: Not enough address space above the ELF image for compressed data\n");
+        goto cleanup;
+    }
+
+    /* Add loader */
+    memcpy(output.buf + layout.loader_offs, stub->text, stub->text_size);
+    if (install_live_layout(buf_slice(output, layout.loader_offs, stub->text_size),
+                            layout.stub_base + layout.live_layout_offs, stub_name))
+        goto cleanup;
+
+    /* Add layout and block index which are used by the loader */
+    live.decomp_base = layout.va_start;
+    live.entry_point = entry_point;
+    live.lz77_data   = layout.va_end;
+    live.comp_data   = layout.comp_data;
+    live.blocks      = layout.comp_data + (layout.blocks_offs - layout.comp_data_offs);
+    live.block_buf   = lazy_block_size ? layout.va_end + align_up(max_lz_size, PAGE_SIZE) : 0;
+    live.image_size  = (uint32_t)image.size;
+    live.block_size  = block_size;
+    live.num_blocks  = num_blocks;
+    memcpy(output.buf + layout.live_layout_offs, &live, sizeof(live));
+    memcpy(output.buf + layout.blocks_offs, blocks, num_blocks * sizeof(ELF_BLOCK));
+
+    fill_elf_header(output, buf, headers, num_headers, &layout,
+                    layout.stub_base + layout.loader_offs + stub->entry_point_offs, image_mem_size);
+
+    output.size = layout.end_offs;
+
+    INFO("Compression stats:\n");
+    INFO("        LIT                      %zu\n", compressed.stats_lit);
+    INFO("        MATCH                    %zu\n", compressed.stats_match);
+    INFO("        SHORTREP                 %zu\n", compressed.stats_shortrep);
+    INFO("        LONGREP0                 %zu\n", compressed.stats_longrep[0]);
+    INFO("        LONGREP1                 %zu\n", compressed.stats_longrep[1]);
+    INFO("        LONGREP2                 %zu\n", compressed.stats_longrep[2]);
+    INFO("        LONGREP3                 %zu\n", compressed.stats_longrep[3]);
+    INFO("        Original data            %zu\n", image.size);
+    INFO("        Blocks                   %u x %u bytes\n", num_blocks, block_size);
+    INFO("        LZ77 compressed          %zu\n", compressed.lz);
+    INFO("        Arith encoded            %zu\n", compressed.compressed);
+
+    INFO("Process virtual address space layout:\n");
+    INFO("        stub base                0x%" PRIx64 "\n", layout.stub_base);
+    INFO("        loader offs              0x%x (%u bytes)\n", layout.loader_offs,      layout.live_layout_offs - layout.loader_offs);
+    INFO("        live layout offs         0x%x (%u bytes)\n", layout.live_layout_offs, layout.comp_data_offs - layout.live_layout_offs);
+    INFO("        image                    0x%" PRIx64 " (%" PRIu64 " bytes)\n", layout.va_start, layout.va_end - layout.va_start);
+    INFO("        scratch                  0x%" PRIx64 " (%" PRIu64 " bytes)\n", layout.va_end,   scratch_size);
+    INFO("        comp data                0x%" PRIx64 " (%u bytes)\n", layout.comp_data, layout.blocks_offs - layout.comp_data_offs);
+    INFO("        blocks                   0x%" PRIx64 " (%u bytes)\n",
+         layout.comp_data + (layout.blocks_offs - layout.comp_data_offs), layout.end_offs - layout.blocks_offs);
+
+    report->sizes      = compressed;
+    report->image_base = layout.stub_base;
+    add_report_region(report, "loader",      layout.loader_offs,      layout.live_layout_offs - layout.loader_offs);
+    add_report_region(report, "live_layout", layout.live_layout_offs, layout.comp_data_offs - layout.live_layout_offs);
+    add_report_region(report, "image",       (uint32_t)stub_size,     (uint32_t)(layout.va_end - layout.va_start));
+    add_report_region(report, "comp_data",   (uint32_t)(layout.comp_data - layout.stub_base),
+                      layout.blocks_offs - layout.comp_data_offs);
+    add_report_region(report, "blocks",      (uint32_t)(layout.comp_data - layout.stub_base) + (layout.blocks_offs - layout.comp_data_offs),
+                      layout.end_offs - layout.blocks_offs);
+
+    /* Verify compression */
+    if (verify_compression(image, block_size, blocks, num_blocks, lz77_data,
+                           buf_slice(output, layout.comp_data_offs, comp_size)))
+        goto cleanup;
+
+    end_phase(report, REPORT_VERIFY, phase_start);
+
+    error = 0;
+
+cleanup:
+    buf_free(blocks_buf);
+    buf_free(lz77_buf);
+    buf_free(image);
+
+    if (error) {
+        buf_free(output);
+
+        output.buf  = NULL;
+        output.size = 0;
+    }
+
+    return output;
+}
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "buffer.h"
+#include "find_repeats.h"
+#include "report.h"
+
+/* Default size of blocks decompressed on first touch */
+#define DEFAULT_ELF_LAZY_BLOCK_SIZE (64U << 10)
+
+int    is_elf_file(const void *buf, size_t size);
+
+/* Compresses a statically linked x86-64 ELF executable.  If params is NULL,
+ * default heuristics are used to find matches.  If lazy_block_size is non-zero,
+ * the image is split into blocks of that size, which must be a multiple of
+ * page size, and the loader decompresses each block on first touch.
+ * Diagnostic information is printed if verbose is non-zero, statistics are
+ * stored in report.
+ */
+BUFFER exe_elf(const void          *buf,
+               size_t               size,
+               const PARSER_PARAMS *params,
+               uint32_t             lazy_block_size,
+               int                  verbose,
+               REPORT              *report);
+
+/* Returns approximate amount of memory needed to compress the executable, including input */
+size_t estimate_elf_memory(const void *buf, size_t size);
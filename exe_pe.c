@@ -3,11 +3,15 @@
  */
 
 #include "exe_pe.h"
+#include "arena.h"
 #include "arith_decode.h"
 #include "arith_encode.h"
-#include "load_file.h"
+#include "bit_cost.h"
 #include "lza_decompress.h"
 #include "lza_compress.h"
+#include "pe_format.h"
+#include "loaders.h"
+#include "timer.h"
 
 #include <assert.h>
 #define __STDC_FORMAT_MACROS
@@ -31,8 +35,9 @@
  *                       |    process     |
  *                       |    data        | <- Original process data is located in this block;
  *                       |                |    in the new exe this area is reserved and this is where
- *                       |                |    the program will be decompressed
- *                       |                |
+ *                       |                |    the program will be decompressed; pages which are
+ *                       |                |    entirely zero are not compressed and are not touched
+ *                       |                |    by the decompressor
  * iat_rva ------------> +----------------+ <- New/packed Import Address Table is decompressed here in
  *                       |      iat       |    a format which is compressible, so it occupies less space
  *                       |                |
@@ -49,6 +54,9 @@
  *                       |     LZ77       |    arithmetic decoder
  *                       |  decompressor  |
  *                       |                |
+ * zero_regions_rva ---> +----------------+ <- List of zero regions in original process data, which
+ *                       |  zero regions  |    the LZ77 decompressor skips; decoded here by the
+ *                       |                |    arithmetic decoder
  * comp_data_rva ------> +----------------+ <- This is where the fully compressed program is loaded
  *                       |   compressed   |    by the OS loader from the new executable;
  *                       |    program     |    this is also the begining of the second section
@@ -76,6 +84,7 @@ typedef struct {
     uint32_t import_loader_rva;
     uint32_t lz77_data_rva;
     uint32_t lz77_decompressor_rva;
+    uint32_t zero_regions_rva;
     uint32_t comp_data_rva;
     uint32_t arith_decoder_rva;
     uint32_t live_layout_rva;
@@ -86,263 +95,14 @@ typedef struct {
     uint32_t end_rva;
 } LAYOUT;
 
-/* Auxiliary endianness-agnostic data types */
-
-typedef struct {
-    uint8_t bytes[2];
-} uint16_le;
-
-typedef struct {
-    uint8_t bytes[4];
-} uint32_le;
-
-typedef struct {
-    uint8_t bytes[8];
-} uint64_le;
-
-uint16_t get_uint16_le(uint16_le data)
-{
-    return (uint16_t)((uint32_t)data.bytes[0] + ((uint32_t)data.bytes[1] << 8));
-}
-
-uint32_t get_uint32_le(uint32_le data)
-{
-    return (uint32_t)data.bytes[0] +
-           ((uint32_t)data.bytes[1] << 8) +
-           ((uint32_t)data.bytes[2] << 16) +
-           ((uint32_t)data.bytes[3] << 24);
-}
-
-uint64_t get_uint64_le(uint64_le data)
-{
-    return (uint64_t)data.bytes[0] +
-           ((uint64_t)data.bytes[1] << 8) +
-           ((uint64_t)data.bytes[2] << 16) +
-           ((uint64_t)data.bytes[3] << 24) +
-           ((uint64_t)data.bytes[4] << 32) +
-           ((uint64_t)data.bytes[5] << 40) +
-           ((uint64_t)data.bytes[6] << 48) +
-           ((uint64_t)data.bytes[7] << 56);
-}
-
-static uint16_le make_uint16_le(uint16_t value)
-{
-    uint16_le data;
-
-    data.bytes[0] = (uint8_t)(value & 0xFFU);
-    data.bytes[1] = (uint8_t)((value >> 8) & 0xFFU);
-
-    return data;
-}
-
-static uint32_le make_uint32_le(uint32_t value)
-{
-    uint32_le data;
-
-    data.bytes[0] = (uint8_t)(value & 0xFFU);
-    data.bytes[1] = (uint8_t)((value >> 8) & 0xFFU);
-    data.bytes[2] = (uint8_t)((value >> 16) & 0xFFU);
-    data.bytes[3] = (uint8_t)((value >> 24) & 0xFFU);
-
-    return data;
-}
-
-static uint64_le make_uint64_le(uint64_t value)
-{
-    uint64_le data;
-
-    data.bytes[0] = (uint8_t)(value & 0xFFU);
-    data.bytes[1] = (uint8_t)((value >> 8) & 0xFFU);
-    data.bytes[2] = (uint8_t)((value >> 16) & 0xFFU);
-    data.bytes[3] = (uint8_t)((value >> 24) & 0xFFU);
-    data.bytes[4] = (uint8_t)((value >> 32) & 0xFFU);
-    data.bytes[5] = (uint8_t)((value >> 40) & 0xFFU);
-    data.bytes[6] = (uint8_t)((value >> 48) & 0xFFU);
-    data.bytes[7] = (uint8_t)((value >> 56) & 0xFFU);
-
-    return data;
-}
+/* Prints diagnostic information, unless running in quiet mode */
+#define INFO(...) do { if (verbose) printf(__VA_ARGS__); } while (0)
 
 static uint32_t align_up(uint32_t value, uint32_t align)
 {
     return ((value - 1) / align + 1) * align;
 }
 
-/* Structures representing various data structures in PE files */
-/* Reference: https://learn.microsoft.com/en-us/windows/win32/debug/pe-format */
-
-/* The MZ (DOS) header is located at offset 0 in a PE file */
-typedef struct {
-    uint16_le mz_signature;
-    uint8_t   useless[0x3A];
-    uint32_le pe_offset;
-} DOS_HEADER;
-
-/* The PE header is located at offset `pe_offset` from the beginning of the file */
-typedef struct {
-    uint32_le pe_signature;
-    uint16_le machine;
-    uint16_le number_of_sections; /* Sections follow the optional header */
-    uint32_le time_date_stamp;
-    uint32_le symbol_table_offset;
-    uint32_le number_of_symbols;
-    uint16_le optional_hdr_size; /* "Optional" header is the PE32_HEADER */
-    uint16_le flags;
-} PE_HEADER;
-
-#define PE_MACHINE_X86_32  0x014C
-#define PE_MACHINE_X86_64  0x8664
-#define PE_MACHINE_AARCH64 0xAA64
-
-#define PE_FLAG_RELOCS_STRIPPED     0x0001
-#define PE_FLAG_EXECUTABLE_IMAGE    0x0002
-#define PE_FLAG_LARGE_ADDRESS_AWARE 0x0020
-#define PE_FLAG_32BIT_MACHINE       0x0100
-#define PE_FLAG_DLL                 0x2000
-#define PE_FLAG_UNSUPPORTED         0xD09C
-
-typedef struct {
-    uint32_le virtual_address;
-    uint32_le size;
-} DATA_DIRECTORY;
-
-/* The "optional" header immediately follows the PE header.
- * The actual size of this header is specified in the PE header.
- */
-typedef struct {
-    uint16_le pe_format;
-    uint8_t   linker_ver_major;
-    uint8_t   linker_ver_minor;
-    uint32_le size_of_code;
-    uint32_le size_of_data;
-    uint32_le size_of_uninitialized_data;
-    uint32_le entry_point;
-    uint32_le base_of_code;
-    union { /* Different layout between 32-bit and 64-bit executable */
-        struct {
-            uint32_le base_of_data;
-            uint32_le image_base;
-        } u32;
-        struct {
-            uint64_le image_base;
-        } u64;
-    } u1;
-    uint32_le section_alignment;
-    uint32_le file_alignment;
-    uint16_le min_os_ver_major;
-    uint16_le min_os_ver_minor;
-    uint16_le image_ver_major;
-    uint16_le image_ver_minor;
-    uint16_le subsystem_ver_major;
-    uint16_le subsystem_ver_minor;
-    uint32_le reserved_win32_version;
-    uint32_le size_of_image;
-    uint32_le size_of_headers;
-    uint32_le checksum;
-    uint16_le subsystem;
-    uint16_le dll_flags;
-    union { /* Different layout between 32-bit and 64-bit executable */
-        struct {
-            uint32_le size_of_stack_reserve;
-            uint32_le size_of_stack_commit;
-            uint32_le size_of_head_reserve;
-            uint32_le size_of_heap_commit;
-            uint32_le reserved_loader_flags;
-            uint32_le number_of_rva_and_sizes;
-            DATA_DIRECTORY rva_and_sizes[1]; /* There is one or more data directories */
-        } u32;                               /* at the end of the optional header */
-        struct {
-            uint64_le size_of_stack_reserve;
-            uint64_le size_of_stack_commit;
-            uint64_le size_of_head_reserve;
-            uint64_le size_of_heap_commit;
-            uint32_le reserved_loader_flags;
-            uint32_le number_of_rva_and_sizes;
-            DATA_DIRECTORY rva_and_sizes[1];
-        } u64;
-    } u2;
-} PE32_HEADER;
-
-#define PE_FORMAT_PE32      0x010B
-#define PE_FORMAT_PE32_PLUS 0x020B
-
-#define SUBSYSTEM_GUI 0x02
-#define SUBSYSTEM_CUI 0x03
-
-#define DIR_EXPORT_TABLE            0
-#define DIR_IMPORT_TABLE            1
-#define DIR_RESOURCE_TABLE          2
-#define DIR_EXCEPTION_TABLE         3
-#define DIR_CERTIFICATE_TABLE       4
-#define DIR_BASE_RELOCATION_TABLE   5
-#define DIR_DEBUG                   6
-#define DIR_ARCHITECTURE            7
-#define DIR_GLOBAL_PTR              8
-#define DIR_TLS_TABLE               9
-#define DIR_LOAD_CONFIG_TABLE       10
-#define DIR_BOUND_IMPORT            11
-#define DIR_IAT                     12
-#define DIR_DELAY_IMPORT_DESCRIPTOR 13
-#define DIR_CLR_RUNTIME_HEADER      14
-#define DIR_RESERVED                15
-
-/* Import directory is located at an RVA specified by DIR_IMPORT_TABLE data directory */
-typedef struct {
-    uint32_le import_lookup_table_rva;
-    uint32_le time_stamp;
-    uint32_le forwarder_chain;
-    uint32_le name_rva;
-    uint32_le import_address_table_rva;
-} IMPORT_DIR_ENTRY;
-
-/* Section headers immediately follow the optional header (after the
- * data directory entries).  The number of section headers is specified
- * by the `number_of_sections` member in the PE header.
- */
-typedef struct {
-    char      name[8];
-    uint32_le virtual_size;
-    uint32_le virtual_address;
-    uint32_le size_of_raw_data;
-    uint32_le pointer_to_raw_data;
-    uint32_le pointer_to_relocations;
-    uint32_le pointer_to_line_numbers;
-    uint16_le number_of_relocations;
-    uint16_le number_of_line_numbers;
-    uint32_le flags;
-} SECTION_HEADER;
-
-#define SECTION_TYPE_NO_PAD            0x00000008U
-#define SECTION_CNT_CODE               0x00000020U
-#define SECTION_CNT_INITIALIZED_DATA   0x00000040U
-#define SECTION_CNT_UNINITIALIZED_DATA 0x00000080U
-#define SECTION_LNK_INFO               0x00000200U
-#define SECTION_LNK_REMOVE             0x00000800U
-#define SECTION_LNK_COMDAT             0x00001000U
-#define SECTION_GPREL                  0x00008000U
-#define SECTION_ALIGN_1BYTES           0x00100000U
-#define SECTION_ALIGN_2BYTES           0x00200000U
-#define SECTION_ALIGN_4BYTES           0x00300000U
-#define SECTION_ALIGN_8BYTES           0x00400000U
-#define SECTION_ALIGN_16BYTES          0x00500000U
-#define SECTION_ALIGN_32BYTES          0x00600000U
-#define SECTION_ALIGN_64BYTES          0x00700000U
-#define SECTION_ALIGN_128BYTES         0x00800000U
-#define SECTION_ALIGN_256BYTES         0x00900000U
-#define SECTION_ALIGN_512BYTES         0x00A00000U
-#define SECTION_ALIGN_1024BYTES        0x00B00000U
-#define SECTION_ALIGN_2048BYTES        0x00C00000U
-#define SECTION_ALIGN_4096BYTES        0x00D00000U
-#define SECTION_ALIGN_8192BYTES        0x00E00000U
-#define SECTION_LNK_NRELOC_OVFL        0x01000000U
-#define SECTION_MEM_DISCARDABLE        0x02000000U
-#define SECTION_MEM_NOT_CACHED         0x04000000U
-#define SECTION_MEM_NOT_PAGED          0x08000000U
-#define SECTION_MEM_SHARED             0x10000000U
-#define SECTION_MEM_EXECUTE            0x20000000U
-#define SECTION_MEM_READ               0x40000000U
-#define SECTION_MEM_WRITE              0x80000000U
-
 /* Size of the new PE header.  It has to be aligned to file_alignment; minimum file_alignment is
  * 512 bytes.  It cannot be zero.  Therefore it must be exactly 512.
  */
@@ -514,7 +274,7 @@ static void fill_pe_header(BUFFER             process_va,
     const uint32_t     aligned_end  = align_up(layout->end_rva, 0x1000);
     const uint32_t     sec_flags    = SECTION_MEM_EXECUTE | SECTION_MEM_READ | SECTION_MEM_WRITE;
 
-    section_header = (SECTION_HEADER *)((uint8_t *)&new_header->u2 +
+    section_header = (SECTION_HEADER *)(process_va.buf + offsetof(MINIMAL_PE_HEADER, u2) +
             ((pe_format == PE_FORMAT_PE32) ? sizeof(new_header->u2.u32)
                                            : sizeof(new_header->u2.u64)));
 
@@ -578,40 +338,6 @@ static void decode_section_flags(char *buf, size_t size, uint32_t flags)
         append_str(buf, size, " unknown");
 }
 
-static const void *at_offset(const void *buf, uint32_t offset)
-{
-    return (const uint8_t *)buf + offset;
-}
-
-static uint32_t get_pe_offset(const void *buf, size_t size)
-{
-    const DOS_HEADER *dos_header;
-    const PE_HEADER  *pe_header;
-    uint32_t          pe_offset;
-
-    if (size < sizeof(DOS_HEADER))
-        return 0;
-
-    dos_header = (const DOS_HEADER *)buf;
-
-    /* "MZ" signature */
-    if (get_uint16_le(dos_header->mz_signature) != 0x5A4D)
-        return 0;
-
-    pe_offset = get_uint32_le(dos_header->pe_offset);
-
-    if (pe_offset + sizeof(PE_HEADER) > size)
-        return 0;
-
-    pe_header = (const PE_HEADER *)at_offset(buf, pe_offset);
-
-    /* "PE" signature */
-    if (get_uint32_le(pe_header->pe_signature) != 0x4550)
-        return 0;
-
-    return pe_offset;
-}
-
 static size_t push_iat_data(BUFFER *buf, const void *data, size_t size)
 {
     if (size <= buf->size) {
@@ -669,12 +395,14 @@ static int process_import_table(BUFFER   process_va,
                                 BUFFER   import_table,
                                 uint32_t va_start,
                                 BUFFER  *iat_data,
-                                int      is_64bit)
+                                int      is_64bit,
+                                int      verbose)
 {
     IMPORT_DIR_ENTRY       *import_dir_entry = (IMPORT_DIR_ENTRY *)import_table.buf;
     IMPORT_DIR_ENTRY *const import_table_end = (IMPORT_DIR_ENTRY *)(import_table.buf + import_table.size);
     BUFFER                  iat_buf_left     = *iat_data;
     size_t                  iat_size         = 0;
+    const int               dry_run          = ! iat_data->buf; /* Only determine size */
 
     /* Process each DLL */
     for ( ; import_dir_entry + 1 <= import_table_end; import_dir_entry++) {
@@ -695,7 +423,7 @@ static int process_import_table(BUFFER   process_va,
             return 1;
         }
 
-        printf("import %s\n", (const char *)dll_name);
+        INFO("import %s\n", (const char *)dll_name);
 
         /* We will compress the IAT, so the executable will have to fill out the
          * IAT on its own after it is loaded.
@@ -726,7 +454,7 @@ static int process_import_table(BUFFER   process_va,
                 break;
 
             if (by_ordinal) {
-                printf("        ord                      %u\n", (uint32_t)value & 0xFFFFU);
+                INFO("        ord                      %u\n", (uint32_t)value & 0xFFFFU);
                 fprintf(stderr, "Error: Importing functions by ordinal number is not supported\n");
                 return 1;
             }
@@ -735,19 +463,21 @@ static int process_import_table(BUFFER   process_va,
             fun_name     = (const char *)buf_at_offset(process_va, fun_name_rva, 3) + 2;
             hint         = get_uint16_le(*(uint16_le *)buf_at_offset(process_va, fun_name_rva, 2));
 
-            printf("        name                     %s (hint %u)\n", fun_name, hint);
+            INFO("        name                     %s (hint %u)\n", fun_name, hint);
 
             iat_size += push_iat_string(&iat_buf_left, fun_name);
         }
 
         /* 0 (empty string) indicates end of symbols for this DLL */
         iat_size += push_iat_byte(&iat_buf_left, 0);
+        if (dry_run)
+            continue;
         if (iat_size >= iat_data->size)
             break;
 
-        printf("        import address table     0x%x\n", import_address_table_rva);
-        printf("        iat size                 0x%x\n", rva - import_address_table_rva);
-        printf("        import lookup table      0x%x\n", import_lookup_table_rva);
+        INFO("        import address table     0x%x\n", import_address_table_rva);
+        INFO("        iat size                 0x%x\n", rva - import_address_table_rva);
+        INFO("        import lookup table      0x%x\n", import_lookup_table_rva);
 
         /* Clear the library name in the original executable, since the executable
          * will have to load it manually.
@@ -762,6 +492,11 @@ static int process_import_table(BUFFER   process_va,
     /* 0 (empty string) indicates end of symbols for this DLL */
     iat_size += push_iat_byte(&iat_buf_left, 0);
 
+    if (dry_run) {
+        iat_data->size = iat_size;
+        return 0;
+    }
+
     if (iat_size > iat_data->size) {
         fprintf(stderr, "Error: Failed to accommodate import address table\n");
         return 1;
@@ -780,114 +515,77 @@ int is_pe_file(const void *buf, size_t size)
     return get_pe_offset(buf, size) > 0;
 }
 
-static uint32_t add_loader(BUFFER *output, const char *loader_name, uint32_t machine)
+static const LOADER_STUB *get_loader_stub(const char *loader_name, uint32_t machine)
 {
-    BUFFER                file_buf;
-    static char           filename[64];
-    const PE_HEADER      *pe_header;
-    const PE32_HEADER    *opt_header;
-    const SECTION_HEADER *section_header;
-    uint32_t              pe_offset;
-    uint32_t              sect_offset;
-    uint32_t              num_sections;
-    uint32_t              text_pos;
-    uint32_t              text_virt_size;
-    uint32_t              text_file_size;
-    uint32_t              text_size;
-    uint32_t              text_virt_offs;
-    uint32_t              entry_point;
-    uint32_t              i;
-    uint32_t              entry_point_offs = ~0U;
-
-    assert(machine == PE_MACHINE_X86_32 || machine == PE_MACHINE_X86_64);
-    snprintf(filename, sizeof(filename), "loaders/windows/%s/%s.exe",
-             (machine == PE_MACHINE_X86_32) ? "x86" : "x64",
-             loader_name);
-
-    file_buf = load_file(filename);
-    if ( ! file_buf.buf)
-        return ~0U;
+    uint32_t i;
 
-    pe_offset = get_pe_offset(file_buf.buf, file_buf.size);
+    for (i = 0; i < num_loader_stubs; i++) {
+        const LOADER_STUB *const stub = &loader_stubs[i];
 
-    if (pe_offset == 0) {
-        fprintf(stderr, "Error: %s is not a PE file\n", filename);
-        goto cleanup;
+        if (stub->machine == machine && ! strcmp(stub->name, loader_name))
+            return stub;
     }
 
-    if (file_buf.size < pe_offset + (uint32_t)sizeof(PE_HEADER)) {
-        fprintf(stderr, "Error: Corrupted %s, PE header is outside of the file\n", filename);
-        goto cleanup;
-    }
-
-    pe_header    = (const PE_HEADER *)at_offset(file_buf.buf, pe_offset);
-    opt_header   = (const PE32_HEADER *)at_offset(file_buf.buf, pe_offset + (uint32_t)sizeof(PE_HEADER));
-    sect_offset  = pe_offset + (uint32_t)sizeof(PE_HEADER) + get_uint16_le(pe_header->optional_hdr_size);
-    num_sections = get_uint16_le(pe_header->number_of_sections);
+    fprintf(stderr, "Error: Missing %s loader for machine 0x%x\n", loader_name, machine);
+    return NULL;
+}
 
-    if (file_buf.size < sect_offset + num_sections * (uint32_t)sizeof(SECTION_HEADER)) {
-        fprintf(stderr, "Error: Corrupted %s, section headers are outside of the file\n", filename);
-        goto cleanup;
+static uint32_t add_loader(BUFFER *output, const LOADER_STUB *stub)
+{
+    if (stub->text_size > output->size) {
+        fprintf(stderr, "Error: Not enough buffer space %zu for %s loader .text section of size %u\n",
+                output->size, stub->name, stub->text_size);
+        return ~0U;
     }
 
-    section_header = (const SECTION_HEADER *)at_offset(file_buf.buf, sect_offset);
-
-    for (i = 0; i < num_sections; i++) {
-        if ( ! strncmp(section_header[i].name, ".text", sizeof(section_header[i].name)))
-            break;
-    }
+    memcpy(output->buf, stub->text, stub->text_size);
 
-    if (i == num_sections) {
-        fprintf(stderr, "Error: Failed to find .text section in %s\n", filename);
-        goto cleanup;
-    }
+    output->size = stub->text_size;
 
-    text_pos       = get_uint32_le(section_header[i].pointer_to_raw_data);
-    text_file_size = get_uint32_le(section_header[i].size_of_raw_data);
-    text_virt_size = get_uint32_le(section_header[i].virtual_size);
-    text_size      = text_file_size < text_virt_size ? text_file_size : text_virt_size;
-    text_virt_offs = get_uint32_le(section_header[i].virtual_address);
-    entry_point    = get_uint32_le(opt_header->entry_point);
+    return stub->entry_point_offs;
+}
 
-    if (file_buf.size < text_pos + text_file_size) {
-        fprintf(stderr, "Error: Corrupted %s, .text section is outside of the file\n", filename);
-        goto cleanup;
-    }
+size_t estimate_pe_memory(const void *buf, size_t size)
+{
+    const uint32_t     pe_offset = get_pe_offset(buf, size);
+    const PE_HEADER   *pe_header;
+    const PE32_HEADER *opt_header;
+    uint32_t           image_size;
 
-    if (text_size > output->size) {
-        fprintf(stderr, "Error: Not enough buffer space %zu for %s loader .text section of size %u\n",
-                output->size, filename, text_size);
-        goto cleanup;
-    }
+    assert(pe_offset);
 
-    if (entry_point < text_virt_offs || entry_point >= text_virt_offs + text_size) {
-        fprintf(stderr, "Error: Corrupted %s, entry point 0x%x is outside .text section\n",
-                filename, entry_point);
-        goto cleanup;
-    }
+    pe_header = (const PE_HEADER *)at_offset(buf, pe_offset);
 
-    memcpy(output->buf, buf_at_offset(file_buf, text_pos, text_file_size), text_size);
+    if (pe_offset + sizeof(PE_HEADER) + sizeof(PE32_HEADER) > size ||
+        get_uint16_le(pe_header->optional_hdr_size) < sizeof(PE32_HEADER))
+        return size;
 
-    output->size = text_size;
+    opt_header = (const PE32_HEADER *)at_offset(buf, pe_offset + (uint32_t)sizeof(PE_HEADER));
+    image_size = align_up(get_uint32_le(opt_header->size_of_image), 0x1000);
 
-    entry_point_offs = entry_point - text_virt_offs;
+    /* Upper bound of the allocations done in exe_pe(): loaded image, compacted
+     * image and LZ77 output, or decompressed image during verification.
+     */
+    return size + image_size * 2 + lz_compress_bound(image_size);
+}
 
-cleanup:
-    free(file_buf.buf);
+static const char str_kernel32_dll[]     = "KERNEL32.dll";
+static const char str_load_library_a[]   = "LoadLibraryA";
+static const char str_get_proc_address[] = "GetProcAddress";
 
-    return entry_point_offs;
+static uint32_t get_mini_import_dir_size(uint16_t pe_format)
+{
+    return (uint32_t)(sizeof(str_kernel32_dll) + sizeof(str_load_library_a) + sizeof(str_get_proc_address)) +
+           3U * (pe_format == PE_FORMAT_PE32 ? 4U : 8U) +
+           2 * (uint32_t)sizeof(IMPORT_DIR_ENTRY);
 }
 
 static BUFFER add_mini_import_dir(BUFFER    output,
-                                  uint32_t  import_dir_rva,
+                                  uint32_t  import_str_rva,
                                   uint16_t  pe_format,
                                   uint32_t *out_import_table_offs,
                                   uint32_t *out_iat_offs)
 {
-    static const char str_kernel32_dll[]     = "KERNEL32.dll";
-    static const char str_load_library_a[]   = "LoadLibraryA";
-    static const char str_get_proc_address[] = "GetProcAddress";
-
     const uint32_t    kernel_offs   = 0;
     const uint32_t    load_lib_offs = kernel_offs + (uint32_t)sizeof(str_kernel32_dll);
     const uint32_t    get_proc_offs = load_lib_offs + (uint32_t)sizeof(str_load_library_a);
@@ -899,6 +597,8 @@ static BUFFER add_mini_import_dir(BUFFER    output,
     IMPORT_DIR_ENTRY *import_dir;
     uint32_le        *iat;
 
+    assert(total_size == get_mini_import_dir_size(pe_format));
+
     if (total_size > output.size) {
         BUFFER empty = { NULL, 0 };
 
@@ -911,8 +611,8 @@ static BUFFER add_mini_import_dir(BUFFER    output,
     /* Fill import directory entry */
     import_dir = (IMPORT_DIR_ENTRY *)buf_at_offset(output, dir_offs, dir_size);
 
-    import_dir->name_rva                 = make_uint32_le(import_dir_rva + kernel_offs);
-    import_dir->import_address_table_rva = make_uint32_le(import_dir_rva + iat_offs);
+    import_dir->name_rva                 = make_uint32_le(import_str_rva + kernel_offs);
+    import_dir->import_address_table_rva = make_uint32_le(import_str_rva + iat_offs);
 
     /* Fill import address table */
     iat = (uint32_le *)buf_at_offset(output, iat_offs, iat_size);
@@ -922,12 +622,12 @@ static BUFFER add_mini_import_dir(BUFFER    output,
      * minus 2.  We don't care about the actual value of the ordinal, it's just a hint.
      */
     if (pe_format == PE_FORMAT_PE32) {
-        iat[0] = make_uint32_le(import_dir_rva + load_lib_offs - 2);
-        iat[1] = make_uint32_le(import_dir_rva + get_proc_offs - 2);
+        iat[0] = make_uint32_le(import_str_rva + load_lib_offs - 2);
+        iat[1] = make_uint32_le(import_str_rva + get_proc_offs - 2);
     }
     else {
-        iat[0] = make_uint32_le(import_dir_rva + load_lib_offs - 2);
-        iat[2] = make_uint32_le(import_dir_rva + get_proc_offs - 2);
+        iat[0] = make_uint32_le(import_str_rva + load_lib_offs - 2);
+        iat[2] = make_uint32_le(import_str_rva + get_proc_offs - 2);
     }
 
     /* Copy strings */
@@ -950,6 +650,7 @@ typedef struct {
     uint32_le lz77_decomp;
     uint32_le comp_data;
     uint32_le mini_iat;
+    uint32_le zero_regions;
     uint32_le lz77_data_size;
     uint32_le comp_data_size;
 } FINAL_LAYOUT_32;
@@ -963,6 +664,7 @@ typedef struct {
     uint64_le lz77_decomp;
     uint64_le comp_data;
     uint64_le mini_iat;
+    uint64_le zero_regions;
     uint32_le lz77_data_size;
     uint32_le comp_data_size;
 } FINAL_LAYOUT_64;
@@ -1006,6 +708,7 @@ static void fill_live_layout(BUFFER   output,
         final_layout->lz77_decomp    = make_uint32_le((uint32_t)layout->image_base + layout->lz77_decompressor_rva + lz77_decomp_offs);
         final_layout->comp_data      = make_uint32_le((uint32_t)layout->image_base + layout->comp_data_rva);
         final_layout->mini_iat       = make_uint32_le((uint32_t)layout->image_base + layout->mini_iat_rva);
+        final_layout->zero_regions   = make_uint32_le((uint32_t)layout->image_base + layout->zero_regions_rva);
         final_layout->lz77_data_size = make_uint32_le(lz77_data_size);
         final_layout->comp_data_size = make_uint32_le(comp_data_size);
     }
@@ -1022,49 +725,266 @@ static void fill_live_layout(BUFFER   output,
         final_layout->lz77_decomp    = make_uint64_le(layout->image_base + layout->lz77_decompressor_rva + lz77_decomp_offs);
         final_layout->comp_data      = make_uint64_le(layout->image_base + layout->comp_data_rva);
         final_layout->mini_iat       = make_uint64_le(layout->image_base + layout->mini_iat_rva);
+        final_layout->zero_regions   = make_uint64_le(layout->image_base + layout->zero_regions_rva);
         final_layout->lz77_data_size = make_uint32_le(lz77_data_size);
         final_layout->comp_data_size = make_uint32_le(comp_data_size);
     }
 }
 
-static int verify_compression(BUFFER   process_va,
-                              LAYOUT  *layout,
-                              BUFFER   scratch,
-                              uint32_t lz77_data_size,
-                              uint32_t comp_data_size)
+#define PAGE_SIZE 0x1000U
+
+static int is_zero_page(const uint8_t *page)
 {
-    BUFFER arith_output;
-    BUFFER decompressed;
-    BUFFER comp_data;
-    BUFFER orig_lz77_data;
+    static const uint8_t zero_page[PAGE_SIZE];
 
-    if (scratch.size < lz77_data_size + layout->lz77_data_rva) {
-        fprintf(stderr, "Error: Not enough buffer space to verify compression\n");
-        return 1;
+    return memcmp(page, zero_page, PAGE_SIZE) == 0;
+}
+
+/* Find runs of pages filled with zeroes.  Returns the number of regions found.
+ * The regions are stored in the regions array if it is not NULL.  Offsets of
+ * regions are relative to the beginning of the image.
+ */
+static uint32_t find_zero_regions(BUFFER image, ZERO_REGION *regions)
+{
+    uint32_t num_regions = 0;
+    uint32_t offs        = 0;
+
+    assert(image.size % PAGE_SIZE == 0);
+
+    while (offs < image.size) {
+        uint32_t begin;
+
+        if ( ! is_zero_page(image.buf + offs)) {
+            offs += PAGE_SIZE;
+            continue;
+        }
+
+        begin = offs;
+
+        do
+            offs += PAGE_SIZE;
+        while (offs < image.size && is_zero_page(image.buf + offs));
+
+        if (regions) {
+            regions[num_regions].offset = begin;
+            regions[num_regions].size   = offs - begin;
+        }
+
+        ++num_regions;
     }
 
-    arith_output   = buf_truncate(scratch, lz77_data_size);
-    scratch        = buf_get_tail(scratch, lz77_data_size);
-    decompressed   = buf_truncate(scratch, layout->lz77_data_rva - layout->decomp_base_rva);
-    comp_data      = buf_slice(process_va, layout->comp_data_rva, comp_data_size);
-    orig_lz77_data = buf_slice(process_va, layout->lz77_data_rva, lz77_data_size);
+    return num_regions;
+}
+
+static uint32_t get_zero_regions_size(const ZERO_REGION *regions)
+{
+    uint32_t size = 0;
+
+    for ( ; regions->size; ++regions)
+        size += regions->size;
+
+    return size;
+}
+
+/* Copy image data except zero regions into a new contiguous buffer, followed by tail */
+static BUFFER compact_image(BUFFER image, const ZERO_REGION *regions, BUFFER tail)
+{
+    const uint32_t zero_size = get_zero_regions_size(regions);
+    BUFFER         compact   = buf_alloc_flags(image.size - zero_size + tail.size, ARENA_HUGE_PAGES);
+    uint8_t       *dest      = compact.buf;
+    size_t         offs      = 0;
+
+    if ( ! compact.buf) {
+        perror(NULL);
+        return compact;
+    }
+
+    for (;;) {
+        const size_t end = regions->size ? regions->offset : image.size;
+
+        memcpy(dest, image.buf + offs, end - offs);
+        dest += end - offs;
+
+        if ( ! regions->size)
+            break;
+
+        offs = end + regions->size;
+        ++regions;
+    }
+
+    if (tail.size) {
+        memcpy(dest, tail.buf, tail.size);
+        dest += tail.size;
+    }
+
+    assert(dest == compact.buf + compact.size);
+
+    return compact;
+}
+
+static size_t get_zero_regions_data_size(uint32_t num_regions)
+{
+    /* Include terminating empty region */
+    return (num_regions + 1) * 2 * sizeof(uint32_le);
+}
+
+static BUFFER add_zero_regions(BUFFER output, const ZERO_REGION *regions, uint32_t num_regions)
+{
+    const size_t total_size = get_zero_regions_data_size(num_regions);
+    uint32_le   *dest       = (uint32_le *)output.buf;
+    uint32_t     i;
+
+    if (total_size > output.size) {
+        BUFFER empty = { NULL, 0 };
+
+        fprintf(stderr, "Error: Not enough buffer space for zero regions\n");
+        return empty;
+    }
+
+    /* Include terminating empty region */
+    for (i = 0; i <= num_regions; i++) {
+        *(dest++) = make_uint32_le(regions[i].offset);
+        *(dest++) = make_uint32_le(regions[i].size);
+    }
+
+    return buf_truncate(output, total_size);
+}
+
+/* Maps compressed bits of each byte of the compacted image and the tail
+ * (IAT and import loader) back to RVAs.
+ */
+static int analyze_compression(const PE_ANALYSIS    *analysis,
+                               int                   verbose,
+                               const LAYOUT         *layout,
+                               const SECTION_HEADER *section_header,
+                               uint32_t              num_sections,
+                               const ZERO_REGION    *zero_regions,
+                               BUFFER                lz77_data,
+                               size_t                compact_size,
+                               size_t                tail_size)
+{
+    const uint32_t va_start   = layout->decomp_base_rva;
+    const uint32_t image_size = layout->iat_rva - va_start;
+    const uint32_t end        = align_up(layout->iat_rva + (uint32_t)tail_size, PAGE_SIZE);
+    double *const  byte_costs = (double *)malloc(compact_size * sizeof(double));
+    HEATMAP *const heatmap    = create_heatmap(va_start, end - va_start);
+    BIT_COSTS      costs;
+    size_t         pos        = 0;
+    uint32_t       offs       = 0;
+    uint32_t       i;
+    int            error      = 1;
+
+    if ( ! byte_costs || ! heatmap) {
+        if ( ! byte_costs)
+            perror(NULL);
+        goto cleanup;
+    }
+
+    if (get_bit_costs(&costs, byte_costs, lz77_data.buf, lz77_data.size, compact_size)) {
+        fprintf(stderr, "Error: Failed to attribute compressed bits to the image\n");
+        goto cleanup;
+    }
+
+    for (i = 0; i < num_sections; i++)
+        add_heatmap_region(heatmap,
+                           (const char *)section_header[i].name,
+                           sizeof(section_header[i].name),
+                           get_uint32_le(section_header[i].virtual_address),
+                           get_uint32_le(section_header[i].virtual_size));
+
+    if (layout->import_loader_rva > layout->iat_rva) {
+        add_heatmap_region(heatmap, "iat", ~(size_t)0, layout->iat_rva,
+                           layout->import_loader_rva - layout->iat_rva);
+        add_heatmap_region(heatmap, "import loader", ~(size_t)0, layout->import_loader_rva,
+                           (uint32_t)tail_size - (layout->import_loader_rva - layout->iat_rva));
+    }
+
+    /* Zero regions were removed from the compacted image */
+    for (;;) {
+        const uint32_t chunk_end = zero_regions->size ? zero_regions->offset : image_size;
+
+        add_heatmap_costs(heatmap, va_start + offs, &byte_costs[pos], chunk_end - offs);
+        pos += chunk_end - offs;
+
+        if ( ! zero_regions->size)
+            break;
+
+        offs = chunk_end + zero_regions->size;
+        ++zero_regions;
+    }
+
+    add_heatmap_costs(heatmap, layout->iat_rva, &byte_costs[pos], compact_size - pos);
+
+    if (verbose) {
+        print_bit_costs(stdout, &costs);
+        print_heatmap(stdout, heatmap);
+    }
+
+    error = 0;
+
+    if (analysis->format != HEATMAP_NONE) {
+        error = save_heatmap(heatmap, analysis->heatmap_file, analysis->format);
+        if ( ! error && verbose)
+            printf("Saved heat map in %s\n", analysis->heatmap_file);
+    }
+
+cleanup:
+    destroy_heatmap(heatmap);
+    free(byte_costs);
+
+    return error;
+}
+
+/* Decode and decompress the output and compare it with the original image
+ * followed by the tail (IAT and import loader).
+ */
+static int verify_compression(BUFFER             process_va,
+                              BUFFER             lz_tail,
+                              const LAYOUT      *layout,
+                              BUFFER             lz77_data,
+                              BUFFER             comp_data,
+                              const ZERO_REGION *zero_regions)
+{
+    const size_t image_size   = layout->iat_rva - layout->decomp_base_rva;
+    BUFFER       arith_output = buf_alloc_flags(lz77_data.size, 0);
+    BUFFER       decompressed = { NULL, 0 };
+    int          error        = 1;
+
+    if ( ! arith_output.buf) {
+        perror(NULL);
+        return 1;
+    }
 
     arith_decode(arith_output.buf, arith_output.size,
                  comp_data.buf,    comp_data.size);
 
-    if (memcmp(orig_lz77_data.buf, arith_output.buf, arith_output.size) != 0) {
+    if (memcmp(lz77_data.buf, arith_output.buf, arith_output.size) != 0) {
         fprintf(stderr, "Error: Arithmetic coding verification failed\n");
-        return 1;
+        goto cleanup;
+    }
+
+    /* Zero regions are not written by the decompressor, buf_alloc() clears them */
+    decompressed = buf_alloc_flags(image_size + lz_tail.size, ARENA_ZERO | ARENA_HUGE_PAGES);
+    if ( ! decompressed.buf) {
+        perror(NULL);
+        goto cleanup;
     }
 
-    lz_decompress(decompressed.buf, decompressed.size, arith_output.buf);
+    lz_decompress(decompressed.buf, decompressed.size, arith_output.buf, zero_regions);
 
-    if (memcmp(process_va.buf + layout->decomp_base_rva, decompressed.buf, decompressed.size) != 0) {
+    if (memcmp(process_va.buf + layout->decomp_base_rva, decompressed.buf, image_size) != 0 ||
+        (lz_tail.size && memcmp(lz_tail.buf, decompressed.buf + image_size, lz_tail.size) != 0)) {
         fprintf(stderr, "Error: LZ77 compression verification failed\n");
-        return 1;
+        goto cleanup;
     }
 
-    return 0;
+    error = 0;
+
+cleanup:
+    buf_free(decompressed);
+    buf_free(arith_output);
+
+    return error;
 }
 
 static void patch_32bit_arith_decoder(BUFFER buf, const LAYOUT *layout)
@@ -1133,7 +1053,12 @@ static int install_live_layout(BUFFER buf, uint16_t pe_format, const LAYOUT *lay
     return 1;
 }
 
-BUFFER exe_pe(const void *buf, size_t size)
+BUFFER exe_pe(const void          *buf,
+              size_t               size,
+              const PARSER_PARAMS *params,
+              int                  verbose,
+              const PE_ANALYSIS   *analysis,
+              REPORT              *report)
 {
     const PE_HEADER      *pe_header;
     const PE32_HEADER    *opt_header;
@@ -1141,10 +1066,10 @@ BUFFER exe_pe(const void *buf, size_t size)
     const SECTION_HEADER *section_header;
     LAYOUT                layout         = { 0 };
     COMPRESSED_SIZES      compressed;
-    size_t                alloc_size;
-    BUFFER                mem_image;  /* Memory allocated to create processsed output */
-    BUFFER                process_va; /* Image of the program loaded in memory */
-    BUFFER                output         = { NULL, 0 };
+    BUFFER                process_va;    /* Image of the program loaded in memory */
+    BUFFER                lz_tail        = { NULL, 0 }; /* IAT and import loader following the image */
+    BUFFER                lz77_buf       = { NULL, 0 }; /* Input for arithmetic coder */
+    BUFFER                output         = { NULL, 0 }; /* Output file */
     BUFFER                iat_data       = { NULL, 0 };
     BUFFER                import_loader  = { NULL, 0 };
     BUFFER                lz77_data      = { NULL, 0 };
@@ -1153,6 +1078,9 @@ BUFFER exe_pe(const void *buf, size_t size)
     BUFFER                arith_decoder  = { NULL, 0 };
     BUFFER                header_data    = { NULL, 0 };
     BUFFER                live_layout    = { NULL, 0 };
+    BUFFER                zero_data      = { NULL, 0 };
+    ZERO_REGION          *zero_regions   = NULL;
+    uint32_t              num_zero_regions;
     uint32_t              machine;
     uint32_t              dir_size;
     const uint32_t        pe_offset      = get_pe_offset(buf, size);
@@ -1162,13 +1090,18 @@ BUFFER exe_pe(const void *buf, size_t size)
     uint32_t              va_start       = ~0U;
     uint32_t              va_end         = 0;
     uint32_t              lz77_data_size = 0;
-    uint32_t              import_loader_offs;
+    uint32_t              import_loader_offs = 0;
     uint32_t              lz77_decomp_offs;
     uint32_t              arith_decoder_offs;
+    uint32_t              comp_capacity;
+    const LOADER_STUB    *import_loader_stub = NULL;
+    const LOADER_STUB    *lz77_decomp_stub;
+    const LOADER_STUB    *arith_decoder_stub;
     unsigned int          i;
     int                   error          = 1;
     uint16_t              pe_flags;
     uint16_t              pe_format;
+    uint64_t              phase_start    = get_time_us();
 
     /* Parse PE headers */
     assert(pe_offset);
@@ -1241,41 +1174,41 @@ BUFFER exe_pe(const void *buf, size_t size)
     }
 
     /* Print optional header */
-    printf("        PE flags                 0x%x\n",              pe_flags);
-    printf("optional header:\n");
-    printf("        linker ver               %u.%u\n",             opt_header->linker_ver_major, opt_header->linker_ver_minor);
-    printf("        code size                0x%x\n",              get_uint32_le(opt_header->size_of_code));
-    printf("        data size                0x%x\n",              get_uint32_le(opt_header->size_of_data));
-    printf("        uninitialized data size  0x%x\n",              get_uint32_le(opt_header->size_of_uninitialized_data));
-    printf("        entry point              0x%x\n",              get_uint32_le(opt_header->entry_point));
-    printf("        code base                0x%x\n",              get_uint32_le(opt_header->base_of_code));
+    INFO("        PE flags                 0x%x\n",              pe_flags);
+    INFO("optional header:\n");
+    INFO("        linker ver               %u.%u\n",             opt_header->linker_ver_major, opt_header->linker_ver_minor);
+    INFO("        code size                0x%x\n",              get_uint32_le(opt_header->size_of_code));
+    INFO("        data size                0x%x\n",              get_uint32_le(opt_header->size_of_data));
+    INFO("        uninitialized data size  0x%x\n",              get_uint32_le(opt_header->size_of_uninitialized_data));
+    INFO("        entry point              0x%x\n",              get_uint32_le(opt_header->entry_point));
+    INFO("        code base                0x%x\n",              get_uint32_le(opt_header->base_of_code));
     if (pe_format == PE_FORMAT_PE32) {
-        printf("        data base                0x%x\n",          get_uint32_le(opt_header->u1.u32.base_of_data));
-        printf("        image base               0x%x\n",          get_uint32_le(opt_header->u1.u32.image_base));
+        INFO("        data base                0x%x\n",          get_uint32_le(opt_header->u1.u32.base_of_data));
+        INFO("        image base               0x%x\n",          get_uint32_le(opt_header->u1.u32.image_base));
     }
     else
-        printf("        image base               0x%" PRIx64 "\n", get_uint64_le(opt_header->u1.u64.image_base));
-    printf("        section alignment        %u\n",                get_uint32_le(opt_header->section_alignment));
-    printf("        file alignment           %u\n",                get_uint32_le(opt_header->file_alignment));
-    printf("        min os ver               %u.%u\n",             get_uint16_le(opt_header->min_os_ver_major), get_uint16_le(opt_header->min_os_ver_minor));
-    printf("        image ver                %u.%u\n",             get_uint16_le(opt_header->image_ver_major), get_uint16_le(opt_header->image_ver_minor));
-    printf("        subsystem ver            %u.%u\n",             get_uint16_le(opt_header->subsystem_ver_major), get_uint16_le(opt_header->subsystem_ver_minor));
-    printf("        image size               0x%x\n",              get_uint32_le(opt_header->size_of_image));
-    printf("        headers size             0x%x\n",              get_uint32_le(opt_header->size_of_headers));
-    printf("        checksum                 0x%x\n",              get_uint32_le(opt_header->checksum));
-    printf("        subsystem                %u\n",                get_uint16_le(opt_header->subsystem));
-    printf("        dll_flags                0x%x\n",              get_uint16_le(opt_header->dll_flags));
+        INFO("        image base               0x%" PRIx64 "\n", get_uint64_le(opt_header->u1.u64.image_base));
+    INFO("        section alignment        %u\n",                get_uint32_le(opt_header->section_alignment));
+    INFO("        file alignment           %u\n",                get_uint32_le(opt_header->file_alignment));
+    INFO("        min os ver               %u.%u\n",             get_uint16_le(opt_header->min_os_ver_major), get_uint16_le(opt_header->min_os_ver_minor));
+    INFO("        image ver                %u.%u\n",             get_uint16_le(opt_header->image_ver_major), get_uint16_le(opt_header->image_ver_minor));
+    INFO("        subsystem ver            %u.%u\n",             get_uint16_le(opt_header->subsystem_ver_major), get_uint16_le(opt_header->subsystem_ver_minor));
+    INFO("        image size               0x%x\n",              get_uint32_le(opt_header->size_of_image));
+    INFO("        headers size             0x%x\n",              get_uint32_le(opt_header->size_of_headers));
+    INFO("        checksum                 0x%x\n",              get_uint32_le(opt_header->checksum));
+    INFO("        subsystem                %u\n",                get_uint16_le(opt_header->subsystem));
+    INFO("        dll_flags                0x%x\n",              get_uint16_le(opt_header->dll_flags));
     if (pe_format == PE_FORMAT_PE32) {
-        printf("        size_of_stack_reserve    0x%x\n",          get_uint32_le(opt_header->u2.u32.size_of_stack_reserve));
-        printf("        size_of_stack_commit     0x%x\n",          get_uint32_le(opt_header->u2.u32.size_of_stack_commit));
-        printf("        size_of_head_reserve     0x%x\n",          get_uint32_le(opt_header->u2.u32.size_of_head_reserve));
-        printf("        size_of_heap_commit      0x%x\n",          get_uint32_le(opt_header->u2.u32.size_of_heap_commit));
+        INFO("        size_of_stack_reserve    0x%x\n",          get_uint32_le(opt_header->u2.u32.size_of_stack_reserve));
+        INFO("        size_of_stack_commit     0x%x\n",          get_uint32_le(opt_header->u2.u32.size_of_stack_commit));
+        INFO("        size_of_head_reserve     0x%x\n",          get_uint32_le(opt_header->u2.u32.size_of_head_reserve));
+        INFO("        size_of_heap_commit      0x%x\n",          get_uint32_le(opt_header->u2.u32.size_of_heap_commit));
     }
     else {
-        printf("        size_of_stack_reserve    0x%" PRIx64 "\n", get_uint64_le(opt_header->u2.u64.size_of_stack_reserve));
-        printf("        size_of_stack_commit     0x%" PRIx64 "\n", get_uint64_le(opt_header->u2.u64.size_of_stack_commit));
-        printf("        size_of_head_reserve     0x%" PRIx64 "\n", get_uint64_le(opt_header->u2.u64.size_of_head_reserve));
-        printf("        size_of_heap_commit      0x%" PRIx64 "\n", get_uint64_le(opt_header->u2.u64.size_of_heap_commit));
+        INFO("        size_of_stack_reserve    0x%" PRIx64 "\n", get_uint64_le(opt_header->u2.u64.size_of_stack_reserve));
+        INFO("        size_of_stack_commit     0x%" PRIx64 "\n", get_uint64_le(opt_header->u2.u64.size_of_stack_commit));
+        INFO("        size_of_head_reserve     0x%" PRIx64 "\n", get_uint64_le(opt_header->u2.u64.size_of_head_reserve));
+        INFO("        size_of_heap_commit      0x%" PRIx64 "\n", get_uint64_le(opt_header->u2.u64.size_of_heap_commit));
     }
 
     /* Process and print sections */
@@ -1294,12 +1227,12 @@ BUFFER exe_pe(const void *buf, size_t size)
         if (section_va + va_size > va_end)
             va_end = section_va + va_size;
 
-        printf("section %.8s\n", section_header[i].name);
-        printf("        pointer_to_raw_data      0x%x\n", get_uint32_le(section_header[i].pointer_to_raw_data));
-        printf("        size_of_raw_data         0x%x\n", get_uint32_le(section_header[i].size_of_raw_data));
-        printf("        virtual_address          0x%x\n", get_uint32_le(section_header[i].virtual_address));
-        printf("        virtual_size             0x%x\n", get_uint32_le(section_header[i].virtual_size));
-        printf("        flags                    0x%x%s\n", get_uint32_le(section_header[i].flags), str_flags);
+        INFO("section %.8s\n", section_header[i].name);
+        INFO("        pointer_to_raw_data      0x%x\n", get_uint32_le(section_header[i].pointer_to_raw_data));
+        INFO("        size_of_raw_data         0x%x\n", get_uint32_le(section_header[i].size_of_raw_data));
+        INFO("        virtual_address          0x%x\n", get_uint32_le(section_header[i].virtual_address));
+        INFO("        virtual_size             0x%x\n", get_uint32_le(section_header[i].virtual_size));
+        INFO("        flags                    0x%x%s\n", get_uint32_le(section_header[i].flags), str_flags);
 
         if (section_va < 0x1000) {
             fprintf(stderr, "Error: Unexpected section %u starting at RVA 0x%x\n", i, section_va);
@@ -1328,10 +1261,11 @@ BUFFER exe_pe(const void *buf, size_t size)
     }
 
     va_end     = align_up(va_end, 0x1000);
-    alloc_size = va_end * 3 + estimate_compress_size(va_end);
-    mem_image  = buf_alloc(alloc_size);
-    process_va = buf_truncate(mem_image, va_end);
-    output     = buf_get_tail(mem_image, va_end);
+    process_va = buf_alloc_flags(va_end, ARENA_ZERO | ARENA_HUGE_PAGES);
+    if ( ! process_va.buf) {
+        perror(NULL);
+        return output;
+    }
 
     if (pe_format == PE_FORMAT_PE32)
         layout.image_base = get_uint32_le(opt_header->u1.u32.image_base);
@@ -1416,8 +1350,8 @@ BUFFER exe_pe(const void *buf, size_t size)
             goto cleanup;
         }
 
-        printf("dir %u (%s): va=0x%x size=0x%x\n",
-               i, name, virtual_address, entry_size);
+        INFO("dir %u (%s): va=0x%x size=0x%x\n",
+             i, name, virtual_address, entry_size);
 
         switch (i) {
             /* We don't care about supporting exceptions, so just fill
@@ -1440,14 +1374,29 @@ BUFFER exe_pe(const void *buf, size_t size)
                 break;
 
             case DIR_IMPORT_TABLE:
-                iat_data = output;
+                /* First determine size of the IAT data */
                 if (process_import_table(process_va, entry_buf, va_start, &iat_data,
-                                         pe_format == PE_FORMAT_PE32_PLUS))
+                                         pe_format == PE_FORMAT_PE32_PLUS, 0))
+                    goto cleanup;
+
+                import_loader_stub = get_loader_stub("pe_load_imports", machine);
+                if ( ! import_loader_stub)
                     goto cleanup;
 
+                /* IAT data and import loader are compressed together with the image */
                 iat_data.size = align_up((uint32_t)iat_data.size, 16);
+                lz_tail       = buf_alloc(iat_data.size + import_loader_stub->text_size);
+                if ( ! lz_tail.buf) {
+                    perror(NULL);
+                    goto cleanup;
+                }
+
+                iat_data = buf_truncate(lz_tail, iat_data.size);
+                if (process_import_table(process_va, entry_buf, va_start, &iat_data,
+                                         pe_format == PE_FORMAT_PE32_PLUS, verbose))
+                    goto cleanup;
 
-                output = buf_get_tail(output, iat_data.size);
+                iat_data.size = align_up((uint32_t)iat_data.size, 16);
 
                 layout.import_loader_rva = layout.iat_rva + (uint32_t)iat_data.size;
                 break;
@@ -1461,13 +1410,11 @@ BUFFER exe_pe(const void *buf, size_t size)
     if (iat_data.size) {
 
         /* Add import loader */
-        import_loader = output;
-        import_loader_offs = add_loader(&import_loader, "pe_load_imports", machine);
+        import_loader = buf_get_tail(lz_tail, iat_data.size);
+        import_loader_offs = add_loader(&import_loader, import_loader_stub);
         if (import_loader_offs == ~0U)
             goto cleanup;
 
-        output = buf_get_tail(output, import_loader.size);
-
         layout.lz77_data_rva = layout.import_loader_rva + (uint32_t)import_loader.size;
     }
     /* Ignore import table if it's absent */
@@ -1479,60 +1426,153 @@ BUFFER exe_pe(const void *buf, size_t size)
     /* TODO separate .text section into streams */
     /* TODO add loader to restore .text section */
 
-    /* Compress the program's address space with LZ77 */
-    lz77_data  = output;
-    compressed = lz_compress(lz77_data.buf, lz77_data.size, process_va.buf + va_start, layout.lz77_data_rva - va_start);
+    phase_start = end_phase(report, REPORT_PARSE, phase_start);
 
-    if ( ! compressed.lz)
+    /* The loader only decompresses LZ77 data with compact distance slots */
+    if (va_end - va_start > LZA_MAX_COMPACT_SIZE) {
+        fprintf(stderr, "Error: PE image is too large\n");
         goto cleanup;
+    }
 
-    layout.lz77_decompressor_rva = align_up(layout.lz77_data_rva + (uint32_t)compressed.lz, 16);
-    lz77_data.size               = layout.lz77_decompressor_rva - layout.lz77_data_rva;
+    /* Find pages filled with zeroes, they are skipped during compression
+     * and are left untouched by the decompressor.
+     */
+    {
+        const BUFFER image = buf_slice(process_va, va_start, va_end - va_start);
+
+        num_zero_regions = find_zero_regions(image, NULL);
+
+        zero_regions = (ZERO_REGION *)calloc(num_zero_regions + 1, sizeof(ZERO_REGION));
+        if ( ! zero_regions) {
+            perror(NULL);
+            goto cleanup;
+        }
+
+        find_zero_regions(image, zero_regions);
+    }
 
-    output = buf_get_tail(output, lz77_data.size);
+    /* Compress the program's address space with LZ77 */
+    {
+        const BUFFER compact = compact_image(buf_slice(process_va, va_start, va_end - va_start),
+                                             zero_regions, lz_tail);
+        size_t       lz_bound;
+        OFFSET_MAP  *map;
+
+        if ( ! compact.buf)
+            goto cleanup;
+
+        lz77_decomp_stub = get_loader_stub("pe_lz_decompress", machine);
+        if ( ! lz77_decomp_stub) {
+            buf_free(compact);
+            goto cleanup;
+        }
+
+        /* LZ77 data is followed by LZ77 decompressor and the list of zero regions,
+         * these are all encoded together with the arithmetic coder.
+         */
+        lz_bound = lz_compress_bound(compact.size);
+        lz77_buf = buf_alloc(lz_bound + 16 + lz77_decomp_stub->text_size +
+                             get_zero_regions_data_size(num_zero_regions));
+        if ( ! lz77_buf.buf) {
+            perror(NULL);
+            buf_free(compact);
+            goto cleanup;
+        }
+
+        map = create_offset_map(get_offset_map_input_size(compact.size, params));
+        if ( ! map) {
+            buf_free(compact);
+            goto cleanup;
+        }
+
+        if (params)
+            set_offset_map_params(map, params);
+
+        compressed = lz_compress_with_map(map, lz77_buf.buf, lz_bound, compact.buf, compact.size);
+
+        destroy_offset_map(map);
+        buf_free(compact);
+
+        if ( ! compressed.lz)
+            goto cleanup;
+
+        if (analysis &&
+            analyze_compression(analysis, verbose, &layout, section_header, num_sections, zero_regions,
+                                buf_truncate(lz77_buf, compressed.lz), compact.size, lz_tail.size))
+            goto cleanup;
+    }
+
+    layout.lz77_decompressor_rva = align_up(layout.lz77_data_rva + (uint32_t)compressed.lz, 16);
+    lz77_data                    = buf_truncate(lz77_buf, layout.lz77_decompressor_rva - layout.lz77_data_rva);
 
     /* Add LZ77 decompressor */
-    lz77_decomp = output;
-    lz77_decomp_offs = add_loader(&lz77_decomp, "pe_lz_decompress", machine);
+    lz77_decomp = buf_get_tail(lz77_buf, lz77_data.size);
+    lz77_decomp_offs = add_loader(&lz77_decomp, lz77_decomp_stub);
     if (lz77_decomp_offs == ~0U)
         goto cleanup;
 
-    lz77_data_size       = (uint32_t)lz77_decomp.size;
-    output               = buf_get_tail(output, lz77_decomp.size);
-    lz77_data_size      += (uint32_t)lz77_data.size;
-    layout.comp_data_rva = layout.lz77_decompressor_rva + (uint32_t)lz77_decomp.size;
+    lz77_data_size          = (uint32_t)(lz77_data.size + lz77_decomp.size);
+    layout.zero_regions_rva = layout.lz77_decompressor_rva + (uint32_t)lz77_decomp.size;
 
-    /* Next section is loaded from file, so align it on 4K */
-    {
-        const uint32_t tail = layout.comp_data_rva % 0x1000;
-        const uint32_t fill = tail ? (0x1000 - tail) : 0;
+    /* Add list of zero regions */
+    zero_data = add_zero_regions(buf_get_tail(lz77_buf, lz77_data_size), zero_regions, num_zero_regions);
+    if ( ! zero_data.buf)
+        goto cleanup;
+
+    lz77_data_size      += (uint32_t)zero_data.size;
+    lz77_data            = buf_truncate(lz77_buf, lz77_data_size);
+    layout.comp_data_rva = align_up(layout.zero_regions_rva + (uint32_t)zero_data.size, 0x1000);
+
+    phase_start = end_phase(report, REPORT_LZ77, phase_start);
+
+    arith_decoder_stub = get_loader_stub("pe_arith_decode", machine);
+    if ( ! arith_decoder_stub)
+        goto cleanup;
 
-        layout.comp_data_rva += fill;
-        output = buf_get_tail(output, fill);
+    /* Encode the LZ77-compressed data with arithmetic coder directly into the
+     * output file.  The size of the encoded data is not known in advance, so
+     * assume it is not much larger than its input and if it turns out to be
+     * larger, repeat encoding with the exact size.
+     */
+    comp_capacity = lz77_data_size + lz77_data_size / 8 + 64;
+    for (;;) {
+        output = buf_alloc(new_header_size + align_up(comp_capacity, 16) +
+                           arith_decoder_stub->text_size + (uint32_t)sizeof(FINAL_LAYOUT_64) +
+                           get_mini_import_dir_size(pe_format));
+        if ( ! output.buf) {
+            perror(NULL);
+            goto cleanup;
+        }
+
+        comp_data             = buf_slice(output, new_header_size, comp_capacity);
+        compressed.compressed = arith_encode(comp_data.buf, comp_data.size, lz77_data.buf, lz77_data_size);
+
+        if (compressed.compressed <= comp_capacity)
+            break;
+
+        comp_capacity = (uint32_t)compressed.compressed;
+        buf_free(output);
+        output.buf = NULL;
     }
 
-    /* Encode the LZ77-compressed data with arithmetic coder */
-    comp_data                = output;
-    compressed.compressed    = arith_encode(comp_data.buf, comp_data.size, lz77_data.buf, lz77_data_size);
     comp_data.size           = align_up((uint32_t)compressed.compressed, 16);
-    output                   = buf_get_tail(output, comp_data.size);
     layout.arith_decoder_rva = layout.comp_data_rva + (uint32_t)comp_data.size;
+    phase_start              = end_phase(report, REPORT_ARITH, phase_start);
 
     /* Add arithmetic decoder */
-    arith_decoder = output;
-    arith_decoder_offs = add_loader(&arith_decoder, "pe_arith_decode", machine);
+    arith_decoder = buf_get_tail(output, new_header_size + comp_data.size);
+    arith_decoder_offs = add_loader(&arith_decoder, arith_decoder_stub);
     if (arith_decoder_offs == ~0U)
         goto cleanup;
 
-    output                 = buf_get_tail(output, arith_decoder.size);
     layout.live_layout_rva = layout.arith_decoder_rva + (uint32_t)arith_decoder.size;
 
     /* Make room for live layout (filled later) */
-    live_layout = make_room_for_live_layout(output, &layout, pe_format);
+    live_layout = make_room_for_live_layout(buf_get_tail(output, new_header_size + layout.live_layout_rva - layout.comp_data_rva),
+                                            &layout, pe_format);
     if ( ! live_layout.buf)
         goto cleanup;
 
-    output                = buf_get_tail(output, live_layout.size);
     layout.import_str_rva = layout.live_layout_rva + (uint32_t)live_layout.size;
 
     /* Add import directory */
@@ -1541,18 +1581,18 @@ BUFFER exe_pe(const void *buf, size_t size)
         uint32_t import_table_offs;
         uint32_t iat_offs;
 
-        import_dir = add_mini_import_dir(output, layout.import_dir_rva, pe_format,
+        import_dir = add_mini_import_dir(buf_get_tail(output, new_header_size + layout.import_str_rva - layout.comp_data_rva),
+                                         layout.import_str_rva, pe_format,
                                          &import_table_offs, &iat_offs);
         if ( ! import_dir.buf)
             goto cleanup;
 
-        output = buf_get_tail(output, import_dir.size);
         layout.mini_iat_rva   = layout.import_str_rva + iat_offs;
         layout.import_dir_rva = layout.import_str_rva + import_table_offs;
         layout.end_rva        = layout.import_str_rva + (uint32_t)import_dir.size;
 
         layout.trailing_zero_rva = layout.end_rva;
-        while (process_va.buf[layout.trailing_zero_rva - 1] == 0)
+        while (output.buf[new_header_size + layout.trailing_zero_rva - layout.comp_data_rva - 1] == 0)
             --layout.trailing_zero_rva;
     }
 
@@ -1575,52 +1615,80 @@ BUFFER exe_pe(const void *buf, size_t size)
                    layout.arith_decoder_rva + arith_decoder_offs,
                    opt_header);
 
-    printf("Compression stats:\n");
-    printf("        LIT                      %zu\n", compressed.stats_lit);
-    printf("        MATCH                    %zu\n", compressed.stats_match);
-    printf("        SHORTREP                 %zu\n", compressed.stats_shortrep);
-    printf("        LONGREP0                 %zu\n", compressed.stats_longrep[0]);
-    printf("        LONGREP1                 %zu\n", compressed.stats_longrep[1]);
-    printf("        LONGREP2                 %zu\n", compressed.stats_longrep[2]);
-    printf("        LONGREP3                 %zu\n", compressed.stats_longrep[3]);
-    printf("        Original data            %u\n",  layout.lz77_data_rva - va_start);
-    printf("        LZ77 compressed          %zu\n", compressed.lz);
-    printf("        Arith encoded            %zu\n", compressed.compressed);
-
-    printf("Wasted %u bytes in the header\n", new_header_size - (uint32_t)header_data.size);
-
-    printf("Process virtual address space layout:\n");
-    printf("        image base               0x%" PRIx64 "\n",   layout.image_base);
-    printf("        decomp base              0x%x\n",            layout.decomp_base_rva);
-    printf("        iat rva                  0x%x (%u bytes)\n", layout.iat_rva,               layout.import_loader_rva - layout.iat_rva);
-    printf("        import loader rva        0x%x (%u bytes)\n", layout.import_loader_rva,     layout.lz77_data_rva - layout.import_loader_rva);
-    printf("        lz77 data rva            0x%x (%u bytes)\n", layout.lz77_data_rva,         layout.lz77_decompressor_rva - layout.lz77_data_rva);
-    printf("        lz77 decompressor rva    0x%x (%u bytes)\n", layout.lz77_decompressor_rva, lz77_data_size - (layout.lz77_decompressor_rva - layout.lz77_data_rva));
-    printf("        comp data rva            0x%x (%u bytes)\n", layout.comp_data_rva,         layout.arith_decoder_rva - layout.comp_data_rva);
-    printf("        arith decoder rva        0x%x (%u bytes)\n", layout.arith_decoder_rva,     layout.live_layout_rva - layout.arith_decoder_rva);
-    printf("        live layout rva          0x%x (%u bytes)\n", layout.live_layout_rva,       layout.import_str_rva - layout.live_layout_rva);
-    printf("        import str rva           0x%x (%u bytes)\n", layout.import_str_rva,        layout.mini_iat_rva - layout.import_str_rva);
-    printf("        mini iat rva             0x%x (%u bytes)\n", layout.mini_iat_rva,          layout.import_dir_rva - layout.mini_iat_rva);
-    printf("        import dir rva           0x%x (%u bytes)\n", layout.import_dir_rva,        layout.end_rva - layout.import_dir_rva);
-    printf("        end rva                  0x%x\n",            layout.end_rva);
+    memcpy(output.buf, process_va.buf, new_header_size);
+
+    INFO("Compression stats:\n");
+    INFO("        LIT                      %zu\n", compressed.stats_lit);
+    INFO("        MATCH                    %zu\n", compressed.stats_match);
+    INFO("        SHORTREP                 %zu\n", compressed.stats_shortrep);
+    INFO("        LONGREP0                 %zu\n", compressed.stats_longrep[0]);
+    INFO("        LONGREP1                 %zu\n", compressed.stats_longrep[1]);
+    INFO("        LONGREP2                 %zu\n", compressed.stats_longrep[2]);
+    INFO("        LONGREP3                 %zu\n", compressed.stats_longrep[3]);
+    INFO("        Original data            %u\n",  layout.lz77_data_rva - va_start);
+    INFO("        Zero pages skipped       %u\n",  get_zero_regions_size(zero_regions) / PAGE_SIZE);
+    INFO("        LZ77 compressed          %zu\n", compressed.lz);
+    INFO("        Arith encoded            %zu\n", compressed.compressed);
+#ifdef MINIFY_STATS
+    if (verbose) {
+        print_compress_stats(stdout, &compressed.match_stats);
+        print_bit_costs(stdout, &compressed.bit_costs);
+    }
+#endif
+
+    INFO("Wasted %u bytes in the header\n", new_header_size - (uint32_t)header_data.size);
+
+    INFO("Process virtual address space layout:\n");
+    INFO("        image base               0x%" PRIx64 "\n",   layout.image_base);
+    INFO("        decomp base              0x%x\n",            layout.decomp_base_rva);
+    INFO("        iat rva                  0x%x (%u bytes)\n", layout.iat_rva,               layout.import_loader_rva - layout.iat_rva);
+    INFO("        import loader rva        0x%x (%u bytes)\n", layout.import_loader_rva,     layout.lz77_data_rva - layout.import_loader_rva);
+    INFO("        lz77 data rva            0x%x (%u bytes)\n", layout.lz77_data_rva,         layout.lz77_decompressor_rva - layout.lz77_data_rva);
+    INFO("        lz77 decompressor rva    0x%x (%u bytes)\n", layout.lz77_decompressor_rva, layout.zero_regions_rva - layout.lz77_decompressor_rva);
+    INFO("        zero regions rva         0x%x (%u bytes)\n", layout.zero_regions_rva,      (uint32_t)zero_data.size);
+    INFO("        comp data rva            0x%x (%u bytes)\n", layout.comp_data_rva,         layout.arith_decoder_rva - layout.comp_data_rva);
+    INFO("        arith decoder rva        0x%x (%u bytes)\n", layout.arith_decoder_rva,     layout.live_layout_rva - layout.arith_decoder_rva);
+    INFO("        live layout rva          0x%x (%u bytes)\n", layout.live_layout_rva,       layout.import_str_rva - layout.live_layout_rva);
+    INFO("        import str rva           0x%x (%u bytes)\n", layout.import_str_rva,        layout.mini_iat_rva - layout.import_str_rva);
+    INFO("        mini iat rva             0x%x (%u bytes)\n", layout.mini_iat_rva,          layout.import_dir_rva - layout.mini_iat_rva);
+    INFO("        import dir rva           0x%x (%u bytes)\n", layout.import_dir_rva,        layout.end_rva - layout.import_dir_rva);
+    INFO("        end rva                  0x%x\n",            layout.end_rva);
+
+    report->sizes      = compressed;
+    report->zero_pages = get_zero_regions_size(zero_regions) / PAGE_SIZE;
+    report->image_base = layout.image_base;
+    add_report_region(report, "iat",               layout.iat_rva,               layout.import_loader_rva - layout.iat_rva);
+    add_report_region(report, "import_loader",     layout.import_loader_rva,     layout.lz77_data_rva - layout.import_loader_rva);
+    add_report_region(report, "lz77_data",         layout.lz77_data_rva,         layout.lz77_decompressor_rva - layout.lz77_data_rva);
+    add_report_region(report, "lz77_decompressor", layout.lz77_decompressor_rva, layout.zero_regions_rva - layout.lz77_decompressor_rva);
+    add_report_region(report, "zero_regions",      layout.zero_regions_rva,      (uint32_t)zero_data.size);
+    add_report_region(report, "comp_data",         layout.comp_data_rva,         layout.arith_decoder_rva - layout.comp_data_rva);
+    add_report_region(report, "arith_decoder",     layout.arith_decoder_rva,     layout.live_layout_rva - layout.arith_decoder_rva);
+    add_report_region(report, "live_layout",       layout.live_layout_rva,       layout.import_str_rva - layout.live_layout_rva);
+    add_report_region(report, "import_str",        layout.import_str_rva,        layout.mini_iat_rva - layout.import_str_rva);
+    add_report_region(report, "mini_iat",          layout.mini_iat_rva,          layout.import_dir_rva - layout.mini_iat_rva);
+    add_report_region(report, "import_dir",        layout.import_dir_rva,        layout.end_rva - layout.import_dir_rva);
 
     /* Verify compression */
-    if (verify_compression(mem_image, &layout, output, lz77_data_size, (uint32_t)compressed.compressed))
+    if (verify_compression(process_va, lz_tail, &layout, lz77_data,
+                           buf_truncate(comp_data, compressed.compressed), zero_regions))
         goto cleanup;
 
-    /* Produce final file image */
-    output = mem_image;
-    memcpy(output.buf + new_header_size,
-           comp_data.buf,
-           layout.end_rva - layout.comp_data_rva);
+    end_phase(report, REPORT_VERIFY, phase_start);
 
+    /* Drop trailing zeroes from the output file */
     output.size = new_header_size + (layout.trailing_zero_rva - layout.comp_data_rva);
 
     error = 0;
 
 cleanup:
+    free(zero_regions);
+    buf_free(lz_tail);
+    buf_free(lz77_buf);
+    buf_free(process_va);
+
     if (error) {
-        free(mem_image.buf);
+        buf_free(output);
 
         output.buf  = NULL;
         output.size = 0;
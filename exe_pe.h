@@ -3,6 +3,30 @@
  */
 
 #include "buffer.h"
+#include "find_repeats.h"
+#include "heatmap.h"
+#include "report.h"
+
+/* Maps compressed size back to sections and pages of the image */
+typedef struct {
+    enum HEATMAP_FORMAT format;         /* HEATMAP_NONE if heat map is not saved */
+    const char         *heatmap_file;
+} PE_ANALYSIS;
 
 int    is_pe_file(const void *buf, size_t size);
-BUFFER exe_pe(const void *buf, size_t size);
+
+/* Compresses a PE executable.  If params is NULL, default heuristics are
+ * used to find matches.  Diagnostic information is printed if verbose
+ * is non-zero, statistics are stored in report.  If analysis is not NULL,
+ * compressed size of each section and page is also printed if verbose is
+ * non-zero and saved in a heat map file if requested.
+ */
+BUFFER exe_pe(const void          *buf,
+              size_t               size,
+              const PARSER_PARAMS *params,
+              int                  verbose,
+              const PE_ANALYSIS   *analysis,
+              REPORT              *report);
+
+/* Returns approximate amount of memory needed to compress the executable, including input */
+size_t estimate_pe_memory(const void *buf, size_t size);
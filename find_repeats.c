@@ -3,8 +3,13 @@
  */
 
 #include "find_repeats.h"
+#include "arena.h"
 #include "bit_ops.h"
+#include "buffer.h"
+#include "entropy.h"
 #include "lza_defines.h"
+#include "stats.h"
+#include "timer.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -14,26 +19,53 @@
 #define MAX_OFFSETS 15
 #define INVALID_ID  (~0U)
 
+/* Offsets in chunks are 32-bit and relative to the window base.  When a position
+ * does not fit, the window moves forward, keeping the last WINDOW_KEEP bytes.
+ */
+#define MAX_WINDOW_POS 0xFFFFFFF0U
+#define WINDOW_KEEP    0x80000000U
+
+/* Enough chunks for every position in the window */
+#define MAX_CHUNKS     ((MAX_WINDOW_POS / MAX_OFFSETS) * 2)
+
 typedef struct {
     uint32_t offset[MAX_OFFSETS];
     uint32_t next_id;
 } LOCATION_CHUNK;
 
-typedef struct {
+struct OFFSET_MAP_STRUCT {
     uint32_t       pair_ids[256 * 256];
+    PARSER_PARAMS  params;
     uint32_t       num_chunks;
     uint32_t       first_free_chunk_id;     /* For allocating new chunks */
+    uint32_t       base_chunk_id;           /* Chunks below this id belong to previous inputs */
     uint32_t       last_pair_index;         /* To avoid storing offsets for subsequent repeated bytes */
-    uint32_t       last_pos;                /* For assertions */
-    uint8_t        dummy_align[64 - 4 * sizeof(uint32_t)]; /* Align each chunk on cache line boundary */
+    size_t         last_pos;                /* For assertions */
+    size_t         degraded_size;           /* Bytes searched with reduced effort */
+    size_t         window_base;             /* Position, to which offsets in chunks are relative */
+    uint8_t        dummy_align[128 - 4 * sizeof(uint32_t) - 3 * sizeof(size_t) - sizeof(PARSER_PARAMS)]; /* Align each chunk on cache line boundary */
     LOCATION_CHUNK chunks[1];
-} OFFSET_MAP;
+};
 
 static uint32_t estimate_chunks(size_t file_size)
 {
-    const uint32_t est_chunk_count = ((uint32_t)file_size / MAX_OFFSETS) * 2;
+    const size_t est_chunk_count = (file_size / MAX_OFFSETS) * 2;
+
+    if (est_chunk_count < 0x10000U)
+        return 0x10000U;
+
+    return (est_chunk_count > MAX_CHUNKS) ? MAX_CHUNKS : (uint32_t)est_chunk_count;
+}
+
+/* Upper bound of the number of chunks used for a single input.  Each
+ * position allocates at most one chunk, but for large inputs the number
+ * of chunks is much lower in practice.
+ */
+static uint32_t get_chunks_needed(size_t file_size)
+{
+    const uint32_t est_chunk_count = estimate_chunks(file_size);
 
-    return (est_chunk_count < 0x10000U) ? 0x10000U : est_chunk_count;
+    return (file_size < est_chunk_count) ? (uint32_t)file_size : est_chunk_count;
 }
 
 static size_t calc_offset_map_size(uint32_t num_chunks)
@@ -44,32 +76,124 @@ static size_t calc_offset_map_size(uint32_t num_chunks)
 
 static void init_offset_map(OFFSET_MAP *map, uint32_t num_chunks)
 {
-    memset(map, 0xFF, calc_offset_map_size(num_chunks));
+    /* Chunks are initialized lazily in get_free_chunk() */
+    memset(map->pair_ids, 0xFF, sizeof(map->pair_ids));
 
     map->num_chunks          = num_chunks;
     map->first_free_chunk_id = 0;
+    map->base_chunk_id       = 0;
     map->last_pair_index     = ~0U;
-    map->last_pos            = ~0U;
+    map->last_pos            = ~(size_t)0;
+    map->degraded_size       = 0;
+    map->window_base         = 0;
 }
 
-static OFFSET_MAP *alloc_offset_map(size_t file_size)
+/* Prepares offset map for the next input.  Instead of clearing pair_ids,
+ * chunks used by previous inputs are skipped.  The map is only cleared
+ * when the remaining chunks may not be enough for the input.
+ */
+static void begin_offset_map(OFFSET_MAP *map, size_t file_size)
 {
-    const uint32_t num_chunks = estimate_chunks(file_size);
+    if (get_chunks_needed(file_size) > map->num_chunks - map->first_free_chunk_id)
+        init_offset_map(map, map->num_chunks);
 
-    OFFSET_MAP *const map = (OFFSET_MAP *)malloc(calc_offset_map_size(num_chunks));
-    if (map)
+    map->base_chunk_id   = map->first_free_chunk_id;
+    map->last_pair_index = ~0U;
+    map->last_pos        = ~(size_t)0;
+    map->window_base     = 0;
+}
+
+static uint32_t get_pair_chunk(const OFFSET_MAP *map, uint32_t idx)
+{
+    const uint32_t chunk_id = map->pair_ids[idx];
+
+    return (chunk_id < map->base_chunk_id) ? INVALID_ID : chunk_id;
+}
+
+void get_default_parser_params(PARSER_PARAMS *params)
+{
+    params->max_len3_distance = 1U << 11;
+    params->max_len4_distance = 1U << 13;
+    params->min_score         = 2;
+    params->trailing_rep      = 1;
+    params->max_chunks        = 0;
+    params->max_map_size      = 0;
+    params->deadline_us       = 0;
+}
+
+OFFSET_MAP *create_offset_map(size_t max_size)
+{
+    const uint32_t num_chunks = estimate_chunks(max_size);
+
+    OFFSET_MAP *const map = (OFFSET_MAP *)buf_alloc_flags(calc_offset_map_size(num_chunks),
+                                                          ARENA_HUGE_PAGES).buf;
+    if (map) {
         init_offset_map(map, num_chunks);
+        get_default_parser_params(&map->params);
+    }
     else
         perror(NULL);
 
     return map;
 }
 
+void set_offset_map_params(OFFSET_MAP *map, const PARSER_PARAMS *params)
+{
+    map->params = *params;
+}
+
+size_t get_offset_map_capacity(const OFFSET_MAP *map)
+{
+    /* Inverse of estimate_chunks() */
+    return (size_t)(map->num_chunks / 2) * MAX_OFFSETS + MAX_OFFSETS - 1;
+}
+
+size_t get_offset_map_size(const OFFSET_MAP *map)
+{
+    return calc_offset_map_size(map->num_chunks);
+}
+
+size_t get_offset_map_input_size(size_t size, const PARSER_PARAMS *params)
+{
+    size_t max_chunks;
+    size_t max_input;
+
+    if ( ! params || ! params->max_map_size)
+        return size;
+
+    max_chunks = (params->max_map_size > sizeof(OFFSET_MAP))
+                 ? (params->max_map_size - sizeof(OFFSET_MAP)) / sizeof(LOCATION_CHUNK) + 1 : 0;
+
+    /* Inverse of estimate_chunks(), which allocates at least 64K chunks */
+    max_input = max_chunks / 2 * MAX_OFFSETS;
+
+    return (size < max_input) ? size : max_input;
+}
+
+size_t get_offset_map_degraded_size(const OFFSET_MAP *map)
+{
+    return map->degraded_size;
+}
+
+void destroy_offset_map(OFFSET_MAP *map)
+{
+    BUFFER buf;
+
+    buf.buf  = (uint8_t *)map;
+    buf.size = calc_offset_map_size(map->num_chunks);
+
+    buf_free(buf);
+}
+
 static uint32_t get_free_chunk(OFFSET_MAP *map)
 {
-    assert(map->first_free_chunk_id < map->num_chunks);
+    const uint32_t chunk_id = map->first_free_chunk_id++;
+
+    assert(chunk_id < map->num_chunks);
 
-    return map->first_free_chunk_id++;
+    memset(&map->chunks[chunk_id], 0xFF, sizeof(LOCATION_CHUNK));
+
+    return chunk_id;
 }
 
 static uint32_t get_map_idx(const uint8_t *buf, size_t pos)
@@ -80,6 +204,37 @@ static uint32_t get_map_idx(const uint8_t *buf, size_t pos)
     return idx;
 }
 
+/* Moves the window, so that pos fits in it.  Offsets which fall out of the
+ * window are dropped.  Chunks are chained from the most recent offsets, so
+ * once a chunk loses an offset, all chunks following it are empty.
+ */
+static void move_window(OFFSET_MAP *map, size_t pos)
+{
+    const size_t shift = pos - WINDOW_KEEP - map->window_base;
+    uint32_t     chunk_id;
+
+    map->window_base += shift;
+
+    for (chunk_id = map->base_chunk_id; chunk_id < map->first_free_chunk_id; chunk_id++) {
+        LOCATION_CHUNK *const chunk = &map->chunks[chunk_id];
+        uint32_t              i;
+
+        for (i = 0; i < MAX_OFFSETS; i++) {
+            if (chunk->offset[i] == INVALID_ID)
+                continue;
+
+            if (chunk->offset[i] >= shift)
+                chunk->offset[i] -= (uint32_t)shift;
+            else {
+                chunk->offset[i] = INVALID_ID;
+                chunk->next_id   = INVALID_ID;
+            }
+        }
+    }
+
+    STATS_ADD(window_moves, 1);
+}
+
 static void set_offset(const uint8_t *buf, size_t pos, OFFSET_MAP *map)
 {
     const uint32_t  idx = get_map_idx(buf, pos) & 0xFFFFU;
@@ -89,9 +244,12 @@ static void set_offset(const uint8_t *buf, size_t pos, OFFSET_MAP *map)
 
 #ifndef NDEBUG
     assert(pos == map->last_pos + 1);
-    map->last_pos = (uint32_t)pos;
+    map->last_pos = pos;
 #endif
 
+    if (pos - map->window_base > MAX_WINDOW_POS)
+        move_window(map, pos);
+
     /* Performance optimization.  If we encounter two subsequent identical bytes,
      * only store the offset of the first such pair, don't store the offsets
      * for subsequent bytes.
@@ -103,7 +261,17 @@ static void set_offset(const uint8_t *buf, size_t pos, OFFSET_MAP *map)
 
     map->last_pair_index = idx;
 
-    chunk_id = map->pair_ids[idx];
+    /* If the input is larger than the map, forget all positions seen so far */
+    if (map->first_free_chunk_id == map->num_chunks) {
+        memset(map->pair_ids, 0xFF, sizeof(map->pair_ids));
+
+        map->first_free_chunk_id = 0;
+        map->base_chunk_id       = 0;
+
+        STATS_ADD(map_restarts, 1);
+    }
+
+    chunk_id = get_pair_chunk(map, idx);
 
     if (chunk_id != INVALID_ID) {
         chunk = &map->chunks[chunk_id];
@@ -113,13 +281,13 @@ static void set_offset(const uint8_t *buf, size_t pos, OFFSET_MAP *map)
 
             for (i = 1; i < MAX_OFFSETS; i++) {
                 if (chunk->offset[i] != INVALID_ID) {
-                    assert(pos > chunk->offset[i]);
+                    assert(pos - map->window_base > chunk->offset[i]);
                     break;
                 }
             }
             --i;
 
-            chunk->offset[i] = (uint32_t)pos;
+            chunk->offset[i] = (uint32_t)(pos - map->window_base);
             return;
         }
     }
@@ -128,11 +296,25 @@ static void set_offset(const uint8_t *buf, size_t pos, OFFSET_MAP *map)
 
     chunk                          = &map->chunks[new_id];
     chunk->next_id                 = chunk_id;
-    chunk->offset[MAX_OFFSETS - 1] = (uint32_t)pos;
+    chunk->offset[MAX_OFFSETS - 1] = (uint32_t)(pos - map->window_base);
 
     map->pair_ids[idx] = new_id;
 }
 
+/* Skips positions up to end, which are not stored in the map */
+static void skip_offsets(OFFSET_MAP *map, size_t end)
+{
+#ifndef NDEBUG
+    map->last_pos = end - 1;
+#endif
+
+    /* Distances of matches found at end must fit in 32 bits */
+    if (end - map->window_base > MAX_WINDOW_POS)
+        move_window(map, end);
+
+    map->last_pair_index = ~0U;
+}
+
 /* Append distance to the list of last 4 distances, without duplicates */
 static void update_last4(uint32_t last_dist[], uint32_t distance)
 {
@@ -153,8 +335,8 @@ static uint32_t compare(const uint8_t *buf, size_t left_pos, size_t right_pos, s
 {
     const uint8_t *left      = &buf[left_pos];
     const uint8_t *right     = &buf[right_pos];
-    const uint32_t right_end = (uint32_t)(size - right_pos);
-    const uint32_t end       = (right_end > MAX_LZA_SIZE) ? MAX_LZA_SIZE : right_end;
+    const size_t   right_end = size - right_pos;
+    const uint32_t end       = (right_end > MAX_LZA_SIZE) ? MAX_LZA_SIZE : (uint32_t)right_end;
     uint32_t       length    = 2;
 
     assert(left[0] == right[0]);
@@ -163,6 +345,9 @@ static uint32_t compare(const uint8_t *buf, size_t left_pos, size_t right_pos, s
     while ((length < end) && (left[length] == right[length]))
         ++length;
 
+    /* The first two bytes are known to match, the last compared byte may differ */
+    STATS_ADD(bytes_compared, length - 2 + (length < end));
+
     return length;
 }
 
@@ -303,29 +488,45 @@ static OCCURRENCE find_longest_occurrence(const uint8_t    *buf,
                                           const uint32_t    last_dist[],
                                           const OFFSET_MAP *map)
 {
-    OCCURRENCE   occurrence      = find_occurrence_at_last_dist(buf, pos, size, last_dist);
-    int          score           = calc_cond_longrep_score(occurrence);
-    const size_t repeated_length = get_repeated_byte_length(buf, pos, size);
-    uint32_t     trailing_rep    = occurrence.distance ?
-                    check_trailing_rep(buf, pos, size, occurrence) : 0;
+    const PARSER_PARAMS *params          = &map->params;
+    OCCURRENCE           occurrence      = find_occurrence_at_last_dist(buf, pos, size, last_dist);
+    int                  score           = calc_cond_longrep_score(occurrence);
+    const size_t         repeated_length = get_repeated_byte_length(buf, pos, size);
+    uint32_t             trailing_rep    = occurrence.distance ?
+                            check_trailing_rep(buf, pos, size, occurrence) : 0;
+
+    uint32_t chunk_id    = get_pair_chunk(map, get_map_idx(buf, pos));
+    uint32_t chunks_left = params->max_chunks ? params->max_chunks : ~0U;
+#ifdef MINIFY_STATS
+    uint32_t num_chunks  = 0;
+#endif
 
-    uint32_t chunk_id = map->pair_ids[get_map_idx(buf, pos)];
+    STATS_ADD(positions, 1);
 
-    while (chunk_id != INVALID_ID) {
+    /* Chunks are ordered from the most recent locations of the byte pair */
+    while (chunk_id != INVALID_ID && chunks_left--) {
         const LOCATION_CHUNK *chunk = &map->chunks[chunk_id];
         uint32_t              i;
 
+#ifdef MINIFY_STATS
+        ++num_chunks;
+#endif
+
         for (i = 0; i < MAX_OFFSETS; i++) {
             OCCURRENCE occ;
             int        cur_score;
             uint32_t   cur_trailing_rep;
+            size_t     old_pos;
 
-            const uint32_t old_pos = chunk->offset[i];
-            if (old_pos == INVALID_ID)
+            if (chunk->offset[i] == INVALID_ID)
                 continue;
 
+            STATS_ADD(offsets_examined, 1);
+
+            /* Positions up to pos are in the window, so the distance fits in 32 bits */
+            old_pos      = map->window_base + chunk->offset[i];
             occ.length   = compare(buf, old_pos, pos, size);
-            occ.distance = (uint32_t)pos - old_pos;
+            occ.distance = (uint32_t)(pos - old_pos);
 
             /* For repeated bytes, we only store the offset of the first pair,
              * so try to find shorter distance.
@@ -353,31 +554,41 @@ static OCCURRENCE find_longest_occurrence(const uint8_t    *buf,
                     break;
 
             /* Last distances already processed */
-            if (occ.last >= 0)
+            if (occ.last >= 0) {
+                STATS_ADD(rejected_last_dist, 1);
                 continue;
+            }
 
             cur_score = calc_match_score(occ);
 
             /* Prefer distances which encourage the use of subsequent SHORTREP */
             cur_trailing_rep = check_trailing_rep(buf, pos, size, occ);
 
-            if (cur_trailing_rep) {
-                if (cur_score < score)
+            if (cur_trailing_rep && params->trailing_rep) {
+                if (cur_score < score) {
+                    STATS_ADD(rejected_score, 1);
                     continue;
-                if (trailing_rep && cur_trailing_rep > trailing_rep && cur_score <= score)
+                }
+                if (trailing_rep && cur_trailing_rep > trailing_rep && cur_score <= score) {
+                    STATS_ADD(rejected_trailing_rep, 1);
                     continue;
+                }
             }
-            else if (cur_score <= score)
-                continue;
-
-            if (cur_score < 2)
+            else if (cur_score <= score) {
+                STATS_ADD(rejected_score, 1);
                 continue;
+            }
 
-            if (occ.length == 3 && occ.distance > (1U << 11))
+            if (cur_score < params->min_score) {
+                STATS_ADD(rejected_min_score, 1);
                 continue;
+            }
 
-            if (occ.length == 4 && occ.distance > (1U << 13))
+            if ((occ.length == 3 && occ.distance > params->max_len3_distance) ||
+                (occ.length == 4 && occ.distance > params->max_len4_distance)) {
+                STATS_ADD(rejected_far_short, 1);
                 continue;
+            }
 
             occurrence   = occ;
             score        = cur_score;
@@ -387,6 +598,9 @@ static OCCURRENCE find_longest_occurrence(const uint8_t    *buf,
         chunk_id = chunk->next_id;
     }
 
+    STATS_ADD(chunks_visited, num_chunks);
+    STATS_HIST(chain_length, num_chunks);
+
     return occurrence;
 }
 
@@ -420,6 +634,84 @@ static void report_literal_or_single_match(const uint8_t *buf,
         report_literal(cookie, buf, pos - num_literal, num_literal);
 }
 
+/* Search effort, which is reduced as the deadline approaches */
+enum SEARCH_EFFORT {
+    EFFORT_FULL,        /* Parameters as configured                          */
+    EFFORT_SHALLOW,     /* Fewer location chunks searched                    */
+    EFFORT_GREEDY,      /* Only the most recent chunk, no lazy matching      */
+    EFFORT_NONE         /* Deadline passed, the rest is reported as literals */
+};
+
+#define DEADLINE_CHECK_INTERVAL 0x10000U
+#define SHALLOW_MAX_CHUNKS      4U
+
+typedef struct {
+    uint64_t deadline;
+    uint64_t last_time;
+    size_t   last_pos;
+    size_t   next_pos;                  /* Position of the next check */
+    size_t   degraded;                  /* Bytes processed with reduced effort */
+    double   us_per_byte[EFFORT_NONE];  /* Last speed measured at each effort, 0 if unknown */
+    uint32_t max_chunks;                /* Configured number of chunks to search */
+    int      effort;
+} DEADLINE;
+
+static void init_deadline(DEADLINE *deadline, const OFFSET_MAP *map)
+{
+    memset(deadline, 0, sizeof(*deadline));
+
+    deadline->deadline   = map->params.deadline_us;
+    deadline->last_time  = deadline->deadline ? get_time_us() : 0;
+    deadline->next_pos   = deadline->deadline ? 0 : ~(size_t)0;
+    deadline->max_chunks = map->params.max_chunks;
+    deadline->effort     = EFFORT_FULL;
+}
+
+/* Adjusts search effort, so that at the speed measured since the last check
+ * the rest of the input is finished by the deadline.  Effort is increased
+ * again if the input is being processed fast enough.
+ */
+static void check_deadline(DEADLINE *deadline, OFFSET_MAP *map, size_t pos, size_t size)
+{
+    const uint64_t now = get_time_us();
+
+    if (deadline->effort != EFFORT_FULL)
+        deadline->degraded += pos - deadline->last_pos;
+
+    if (now >= deadline->deadline)
+        deadline->effort = EFFORT_NONE;
+    else if (pos > deadline->last_pos) {
+        const double time_left = (double)(deadline->deadline - now);
+        const double remaining = (double)(size - pos);
+        int          effort    = deadline->effort;
+
+        deadline->us_per_byte[effort] = (double)(now - deadline->last_time) /
+                                        (double)(pos - deadline->last_pos);
+
+        if (deadline->us_per_byte[effort] * remaining > time_left) {
+            if (effort < EFFORT_GREEDY)
+                ++effort;
+        }
+        /* Leave a margin, because speed varies across the input */
+        else if (effort > EFFORT_FULL && deadline->us_per_byte[effort - 1] * remaining < time_left * 0.75)
+            --effort;
+
+        deadline->effort = effort;
+    }
+
+    deadline->last_time = now;
+    deadline->last_pos  = pos;
+    deadline->next_pos  = pos + DEADLINE_CHECK_INTERVAL;
+
+    if (deadline->effort == EFFORT_FULL)
+        map->params.max_chunks = deadline->max_chunks;
+    else if (deadline->effort == EFFORT_SHALLOW)
+        map->params.max_chunks = ( ! deadline->max_chunks || deadline->max_chunks > SHALLOW_MAX_CHUNKS)
+                                 ? SHALLOW_MAX_CHUNKS : deadline->max_chunks;
+    else
+        map->params.max_chunks = 1;
+}
+
 int find_repeats(const uint8_t *buf,
                  size_t         size,
                  REPORT_LITERAL report_literal,
@@ -427,22 +719,105 @@ int find_repeats(const uint8_t *buf,
                  void          *cookie)
 {
     OFFSET_MAP *map;
-    size_t      pos          = 0;
-    size_t      num_literal  = 0;
-    uint32_t    last_dist[4] = { 0, 0, 0, 0 };
+    int         err;
 
     if ( ! size)
         return 0;
 
-    map = alloc_offset_map(size);
+    map = create_offset_map(size);
     if ( ! map)
         return 1;
 
+    err = find_repeats_with_map(map, buf, size, report_literal, report_match, cookie);
+
+    destroy_offset_map(map);
+
+    return err;
+}
+
+int find_repeats_with_map(OFFSET_MAP    *map,
+                          const uint8_t *buf,
+                          size_t         size,
+                          REPORT_LITERAL report_literal,
+                          REPORT_MATCH   report_match,
+                          void          *cookie)
+{
+    return find_repeats_with_prefix(map, buf, 0, size, report_literal, report_match, cookie);
+}
+
+int find_repeats_with_prefix(OFFSET_MAP    *map,
+                             const uint8_t *input,
+                             size_t         prefix_size,
+                             size_t         input_size,
+                             REPORT_LITERAL report_literal,
+                             REPORT_MATCH   report_match,
+                             void          *cookie)
+{
+    const uint8_t *const buf          = input - prefix_size;
+    const size_t         size         = prefix_size + input_size;
+    size_t               pos          = prefix_size;
+    size_t               num_literal  = 0;
+    size_t               next_scan    = prefix_size ? ~(size_t)0 : 0;
+    uint32_t             last_dist[4] = { 0, 0, 0, 0 };
+    DEADLINE             deadline;
+
+    map->degraded_size = 0;
+
+    if ( ! input_size)
+        return 0;
+
+    /* Inputs larger than the map are compressed as well, but the map is
+     * cleared whenever it fills up.
+     */
+    begin_offset_map(map, size);
+
+    /* Positions in the prefix are only stored in the map, so that matches
+     * can refer to them, the last byte of the prefix pairs with the input.
+     */
+    for (pos = 0; pos < prefix_size; pos++)
+        set_offset(buf, pos, map);
+
+    init_deadline(&deadline, map);
+    deadline.last_pos = prefix_size;
+
     /* Find subsequent matches as long as we have at least two consecutive bytes */
     while (pos + 1 < size) {
-        OCCURRENCE occurrence = find_longest_occurrence(buf, pos, size, last_dist, map);
+        OCCURRENCE occurrence;
         uint32_t   i;
 
+        if (pos >= deadline.next_pos) {
+            check_deadline(&deadline, map, pos, size);
+
+            /* Out of time, the output is still valid, just poorly compressed */
+            if (deadline.effort == EFFORT_NONE) {
+                num_literal += size - pos;
+                pos          = size;
+                break;
+            }
+        }
+
+        /* Don't look for matches in random data, like compressed resources,
+         * these blocks are reported as literals and are not stored in the map.
+         * With a prefix, e.g. a previous version of the file, even random
+         * data can have matches, so it is not skipped.
+         */
+        if (pos >= next_scan) {
+            const size_t block_pos = pos - pos % ENTROPY_BLOCK_SIZE;
+            const size_t skip      = get_incompressible_size(&buf[block_pos], size - block_pos);
+
+            /* The block following the skipped blocks has been found compressible */
+            next_scan = block_pos + skip + ENTROPY_BLOCK_SIZE;
+
+            if (skip) {
+                num_literal += block_pos + skip - pos;
+                pos          = block_pos + skip;
+                skip_offsets(map, pos);
+                continue;
+            }
+        }
+
+        occurrence = find_longest_occurrence(buf, pos, size, last_dist, map);
+
         if ( ! occurrence.length) {
             set_offset(buf, pos, map);
             ++pos;
@@ -451,7 +826,7 @@ int find_repeats(const uint8_t *buf,
         }
 
         /* See if we can find a better match */
-        if ((occurrence.last < 0) && (pos + 2 < size)) {
+        if ((occurrence.last < 0) && (pos + 2 < size) && (deadline.effort < EFFORT_GREEDY)) {
 
             const OCCURRENCE next_occurrence = find_occurrence_at_last_dist(buf, pos + 1, size, last_dist);
 
@@ -502,7 +877,11 @@ int find_repeats(const uint8_t *buf,
         report_literal_or_single_match(buf, pos - num_literal, num_literal, last_dist[0],
                                        report_literal, report_match, cookie);
 
-    free(map);
+    if (deadline.effort != EFFORT_FULL)
+        deadline.degraded += size - deadline.last_pos;
+
+    map->params.max_chunks = deadline.max_chunks;
+    map->degraded_size     = deadline.degraded;
 
     return 0;
 }
@@ -2,6 +2,8 @@
  * Copyright (c) 2022 Chris Dragan
  */
 
+#pragma once
+
 #include <stddef.h>
 #include <stdint.h>
 
@@ -11,6 +13,24 @@ typedef struct {
     int      last;
 } OCCURRENCE;
 
+/* Heuristics which the match finder uses to choose between candidate matches.
+ * They only affect compression ratio and speed, the output can be decompressed
+ * regardless of which parameters were used.
+ */
+typedef struct {
+    uint32_t max_len3_distance; /* Longest distance of 3-byte matches */
+    uint32_t max_len4_distance; /* Longest distance of 4-byte matches */
+    int32_t  min_score;         /* Matches saving fewer bits than this are not used */
+    int32_t  trailing_rep;      /* Prefer matches after which SHORTREP can be used */
+    uint32_t max_chunks;        /* Number of location chunks searched, 0 for all */
+
+    /* Budgets, which are not a part of profiles */
+    size_t   max_map_size;      /* Memory limit of the offset map in bytes, 0 for none */
+    uint64_t deadline_us;       /* Search effort is reduced to finish by this time, 0 for none */
+} PARSER_PARAMS;
+
+void get_default_parser_params(PARSER_PARAMS *params);
+
 typedef void (* REPORT_LITERAL)(void *cookie, const uint8_t *buf, size_t pos, size_t size);
 typedef void (* REPORT_MATCH  )(void *cookie, const uint8_t *buf, size_t pos, OCCURRENCE occurrence);
 
@@ -19,3 +39,52 @@ int find_repeats(const uint8_t *buf,
                  REPORT_LITERAL report_literal,
                  REPORT_MATCH   report_match,
                  void          *cookie);
+
+/* State of the match finder, which can be reused for multiple inputs */
+typedef struct OFFSET_MAP_STRUCT OFFSET_MAP;
+
+/* Allocates offset map for inputs of up to max_size bytes */
+OFFSET_MAP *create_offset_map(size_t max_size);
+void        destroy_offset_map(OFFSET_MAP *map);
+
+/* Sets heuristics used for subsequent inputs, new maps use default parameters */
+void set_offset_map_params(OFFSET_MAP *map, const PARSER_PARAMS *params);
+
+/* Returns maximum input size supported by the offset map */
+size_t get_offset_map_capacity(const OFFSET_MAP *map);
+
+/* Returns size of memory occupied by the offset map */
+size_t get_offset_map_size(const OFFSET_MAP *map);
+
+/* Returns input size for which the offset map should be allocated, which is
+ * lower than size if the map would not fit in max_map_size from params.
+ * Larger inputs are still compressed, but when the map fills up, positions
+ * seen so far are dropped and matches are only found after that point.
+ */
+size_t get_offset_map_input_size(size_t size, const PARSER_PARAMS *params);
+
+/* Returns number of bytes of the last input, which were searched with
+ * reduced effort to finish by the deadline.
+ */
+size_t get_offset_map_degraded_size(const OFFSET_MAP *map);
+
+/* Same as find_repeats(), but reuses the offset map instead of allocating it */
+int find_repeats_with_map(OFFSET_MAP    *map,
+                          const uint8_t *buf,
+                          size_t         size,
+                          REPORT_LITERAL report_literal,
+                          REPORT_MATCH   report_match,
+                          void          *cookie);
+
+/* Same as find_repeats_with_map(), but matches can also refer to prefix_size
+ * bytes, which immediately precede input in memory, e.g. a dictionary.
+ * The prefix itself is not reported, positions passed to the callbacks
+ * are relative to the beginning of the prefix.
+ */
+int find_repeats_with_prefix(OFFSET_MAP    *map,
+                             const uint8_t *input,
+                             size_t         prefix_size,
+                             size_t         input_size,
+                             REPORT_LITERAL report_literal,
+                             REPORT_MATCH   report_match,
+                             void          *cookie);
@@ -0,0 +1,323 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+/* Build tool, which extracts .text sections of the loader stubs and writes them
+ * out as a C source file, which is then compiled into minify.  ELF loaders are
+ * linked into a single segment, which is extracted instead.
+ */
+
+#include "elf_format.h"
+#include "load_file.h"
+#include "pe_format.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    BUFFER   text;
+    uint32_t machine;
+    uint32_t entry_point_offs;
+} LOADER;
+
+static int parse_elf_loader(BUFFER file_buf, const char *filename, LOADER *loader)
+{
+    const ELF64_HEADER         *header = (const ELF64_HEADER *)file_buf.buf;
+    const ELF64_PROGRAM_HEADER *ph;
+    const ELF64_PROGRAM_HEADER *load   = NULL;
+    uint64_t                    ph_offset;
+    uint64_t                    offset;
+    uint64_t                    vaddr;
+    uint64_t                    size;
+    uint64_t                    entry_point;
+    uint32_t                    num_headers;
+    uint32_t                    i;
+
+    ph_offset   = get_uint64_le(header->ph_offset);
+    num_headers = get_uint16_le(header->ph_count);
+
+    if (get_uint16_le(header->machine) != ELF_MACHINE_X86_64) {
+        fprintf(stderr, "Error: %s has unsupported machine 0x%x\n", filename, get_uint16_le(header->machine));
+        return 1;
+    }
+
+    if (get_uint16_le(header->ph_entry_size) != sizeof(ELF64_PROGRAM_HEADER) ||
+        ph_offset + num_headers * sizeof(ELF64_PROGRAM_HEADER) > file_buf.size) {
+        fprintf(stderr, "Error: Corrupted %s, program headers are outside of the file\n", filename);
+        return 1;
+    }
+
+    ph = (const ELF64_PROGRAM_HEADER *)at_offset(file_buf.buf, (uint32_t)ph_offset);
+
+    /* The loader must be position-independent and must not have bss, so that
+     * its only segment can be copied anywhere.
+     */
+    for (i = 0; i < num_headers; i++) {
+        if (get_uint32_le(ph[i].type) != PT_LOAD)
+            continue;
+
+        if (load || get_uint64_le(ph[i].file_size) != get_uint64_le(ph[i].mem_size)) {
+            fprintf(stderr, "Error: %s must have exactly one loadable segment without bss\n", filename);
+            return 1;
+        }
+
+        load = &ph[i];
+    }
+
+    if ( ! load) {
+        fprintf(stderr, "Error: Failed to find loadable segment in %s\n", filename);
+        return 1;
+    }
+
+    offset      = get_uint64_le(load->offset);
+    vaddr       = get_uint64_le(load->vaddr);
+    size        = get_uint64_le(load->file_size);
+    entry_point = get_uint64_le(header->entry_point);
+
+    if (offset + size > file_buf.size) {
+        fprintf(stderr, "Error: Corrupted %s, segment is outside of the file\n", filename);
+        return 1;
+    }
+
+    if (entry_point < vaddr || entry_point >= vaddr + size) {
+        fprintf(stderr, "Error: Corrupted %s, entry point 0x%llx is outside of the segment\n",
+                filename, (unsigned long long)entry_point);
+        return 1;
+    }
+
+    loader->text             = buf_slice(file_buf, (size_t)offset, (size_t)size);
+    loader->machine          = ELF_MACHINE_X86_64;
+    loader->entry_point_offs = (uint32_t)(entry_point - vaddr);
+
+    return 0;
+}
+
+static int parse_loader(BUFFER file_buf, const char *filename, LOADER *loader)
+{
+    const PE_HEADER      *pe_header;
+    const PE32_HEADER    *opt_header;
+    const SECTION_HEADER *section_header;
+    uint32_t              pe_offset;
+    uint32_t              sect_offset;
+    uint32_t              num_sections;
+    uint32_t              machine;
+    uint32_t              text_pos;
+    uint32_t              text_virt_size;
+    uint32_t              text_file_size;
+    uint32_t              text_size;
+    uint32_t              text_virt_offs;
+    uint32_t              entry_point;
+    uint32_t              i;
+
+    if (is_elf64_le(file_buf.buf, file_buf.size))
+        return parse_elf_loader(file_buf, filename, loader);
+
+    pe_offset = get_pe_offset(file_buf.buf, file_buf.size);
+
+    if (pe_offset == 0) {
+        fprintf(stderr, "Error: %s is neither a PE nor an ELF file\n", filename);
+        return 1;
+    }
+
+    pe_header    = (const PE_HEADER *)at_offset(file_buf.buf, pe_offset);
+    opt_header   = (const PE32_HEADER *)at_offset(file_buf.buf, pe_offset + (uint32_t)sizeof(PE_HEADER));
+    sect_offset  = pe_offset + (uint32_t)sizeof(PE_HEADER) + get_uint16_le(pe_header->optional_hdr_size);
+    num_sections = get_uint16_le(pe_header->number_of_sections);
+    machine      = get_uint16_le(pe_header->machine);
+
+    if (machine != PE_MACHINE_X86_32 && machine != PE_MACHINE_X86_64) {
+        fprintf(stderr, "Error: %s has unsupported machine 0x%x\n", filename, machine);
+        return 1;
+    }
+
+    if (file_buf.size < sect_offset + num_sections * (uint32_t)sizeof(SECTION_HEADER)) {
+        fprintf(stderr, "Error: Corrupted %s, section headers are outside of the file\n", filename);
+        return 1;
+    }
+
+    section_header = (const SECTION_HEADER *)at_offset(file_buf.buf, sect_offset);
+
+    for (i = 0; i < num_sections; i++) {
+        if ( ! strncmp(section_header[i].name, ".text", sizeof(section_header[i].name)))
+            break;
+    }
+
+    if (i == num_sections) {
+        fprintf(stderr, "Error: Failed to find .text section in %s\n", filename);
+        return 1;
+    }
+
+    text_pos       = get_uint32_le(section_header[i].pointer_to_raw_data);
+    text_file_size = get_uint32_le(section_header[i].size_of_raw_data);
+    text_virt_size = get_uint32_le(section_header[i].virtual_size);
+    text_size      = text_file_size < text_virt_size ? text_file_size : text_virt_size;
+    text_virt_offs = get_uint32_le(section_header[i].virtual_address);
+    entry_point    = get_uint32_le(opt_header->entry_point);
+
+    if (file_buf.size < text_pos + text_file_size) {
+        fprintf(stderr, "Error: Corrupted %s, .text section is outside of the file\n", filename);
+        return 1;
+    }
+
+    if (entry_point < text_virt_offs || entry_point >= text_virt_offs + text_size) {
+        fprintf(stderr, "Error: Corrupted %s, entry point 0x%x is outside .text section\n",
+                filename, entry_point);
+        return 1;
+    }
+
+    loader->text             = buf_slice(file_buf, text_pos, text_size);
+    loader->machine          = machine;
+    loader->entry_point_offs = entry_point - text_virt_offs;
+
+    return 0;
+}
+
+/* Extracts loader name from path, e.g. "loaders/windows/x64/pe_arith_decode.exe"
+ * or "loaders/linux/x64/elf_loader"
+ */
+static void get_loader_name(const char *filename, char *name, size_t name_size)
+{
+    const char *base = filename;
+    const char *ptr;
+    size_t      len;
+
+    for (ptr = filename; *ptr; ptr++) {
+        if (*ptr == '/' || *ptr == '\\')
+            base = ptr + 1;
+    }
+
+    len = strlen(base);
+    if (len > 4 && ! strcmp(&base[len - 4], ".exe"))
+        len -= 4;
+    if (len >= name_size)
+        len = name_size - 1;
+
+    memcpy(name, base, len);
+    name[len] = 0;
+}
+
+static const char *get_arch_name(uint32_t machine)
+{
+    return (machine == PE_MACHINE_X86_32) ? "x86" : "x64";
+}
+
+static const char *get_machine_name(uint32_t machine)
+{
+    switch (machine) {
+
+        case PE_MACHINE_X86_32:
+            return "PE_MACHINE_X86_32";
+
+        case PE_MACHINE_X86_64:
+            return "PE_MACHINE_X86_64";
+
+        default:
+            return "ELF_MACHINE_X86_64";
+    }
+}
+
+static void write_text(FILE *file, const LOADER *loader, const char *name)
+{
+    size_t i;
+
+    fprintf(file, "static const uint8_t %s_%s[] = {",
+            get_arch_name(loader->machine), name);
+
+    for (i = 0; i < loader->text.size; i++) {
+        if ((i % 16) == 0)
+            fprintf(file, "\n   ");
+        fprintf(file, " 0x%02X,", loader->text.buf[i]);
+    }
+
+    fprintf(file, "\n};\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+    FILE   *file = NULL;
+    BUFFER *file_bufs;
+    LOADER *loaders;
+    char    name[64];
+    int     num_loaders;
+    int     i;
+    int     err = 0;
+
+    if (argc < 3) {
+        fprintf(stderr, "Error: Invalid arguments\n");
+        fprintf(stderr, "Usage: gen_loaders <OUTPUT.c> <LOADER>...\n");
+        return EXIT_FAILURE;
+    }
+
+    num_loaders = argc - 2;
+    file_bufs   = (BUFFER *)calloc((size_t)num_loaders, sizeof(BUFFER));
+    loaders     = (LOADER *)calloc((size_t)num_loaders, sizeof(LOADER));
+
+    if ( ! file_bufs || ! loaders) {
+        perror(NULL);
+        free(file_bufs);
+        free(loaders);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < num_loaders && ! err; i++) {
+        const char *const filename = argv[i + 2];
+
+        file_bufs[i] = load_file(filename);
+        if ( ! file_bufs[i].buf)
+            err = 1;
+        else
+            err = parse_loader(file_bufs[i], filename, &loaders[i]);
+    }
+
+    if ( ! err) {
+        file = fopen(argv[1], "w");
+        if ( ! file) {
+            perror(argv[1]);
+            err = 1;
+        }
+    }
+
+    if ( ! err) {
+        fprintf(file, "/* Generated by gen_loaders, do not edit */\n\n");
+        fprintf(file, "#include \"loaders.h\"\n");
+        fprintf(file, "#include \"elf_format.h\"\n\n");
+
+        for (i = 0; i < num_loaders; i++) {
+            get_loader_name(argv[i + 2], name, sizeof(name));
+            write_text(file, &loaders[i], name);
+        }
+
+        fprintf(file, "const LOADER_STUB loader_stubs[] = {\n");
+
+        for (i = 0; i < num_loaders; i++) {
+            const char *const arch = get_arch_name(loaders[i].machine);
+
+            get_loader_name(argv[i + 2], name, sizeof(name));
+
+            fprintf(file, "    { \"%s\", %s, 0x%x, %s_%s, (uint32_t)sizeof(%s_%s) },\n",
+                    name,
+                    get_machine_name(loaders[i].machine),
+                    loaders[i].entry_point_offs,
+                    arch, name, arch, name);
+        }
+
+        fprintf(file, "};\n\n");
+        fprintf(file, "const uint32_t num_loader_stubs = %d;\n", num_loaders);
+
+        if (fclose(file)) {
+            perror(argv[1]);
+            err = 1;
+        }
+
+        if (err)
+            remove(argv[1]);
+    }
+
+    for (i = 0; i < num_loaders; i++)
+        buf_free(file_bufs[i]);
+    free(file_bufs);
+    free(loaders);
+
+    return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
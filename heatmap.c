@@ -0,0 +1,263 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "heatmap.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_REGIONS     32
+#define MAX_NAME_LEN    15
+#define NUM_TOP_PAGES   16
+#define BLOCKS_PER_PAGE (HEATMAP_PAGE_SIZE / HEATMAP_BLOCK_SIZE)
+
+typedef struct {
+    char     name[MAX_NAME_LEN + 1];
+    uint32_t rva;
+    uint32_t size;
+} REGION;
+
+struct HEATMAP_STRUCT {
+    uint32_t base_rva;
+    uint32_t num_pages;
+    uint32_t num_regions;
+    REGION   regions[MAX_REGIONS];
+    double  *blocks;    /* Compressed bits per HEATMAP_BLOCK_SIZE bytes */
+};
+
+HEATMAP *create_heatmap(uint32_t base_rva, uint32_t size)
+{
+    HEATMAP *heatmap;
+
+    assert(base_rva % HEATMAP_PAGE_SIZE == 0);
+    assert(size % HEATMAP_PAGE_SIZE == 0);
+
+    heatmap = (HEATMAP *)calloc(1, sizeof(HEATMAP));
+    if ( ! heatmap) {
+        perror(NULL);
+        return NULL;
+    }
+
+    heatmap->base_rva  = base_rva;
+    heatmap->num_pages = size / HEATMAP_PAGE_SIZE;
+    heatmap->blocks    = (double *)calloc((size_t)heatmap->num_pages * BLOCKS_PER_PAGE, sizeof(double));
+    if ( ! heatmap->blocks) {
+        perror(NULL);
+        free(heatmap);
+        return NULL;
+    }
+
+    return heatmap;
+}
+
+void destroy_heatmap(HEATMAP *heatmap)
+{
+    if ( ! heatmap)
+        return;
+
+    free(heatmap->blocks);
+    free(heatmap);
+}
+
+int add_heatmap_region(HEATMAP *heatmap, const char *name, size_t name_len, uint32_t rva, uint32_t size)
+{
+    REGION *region;
+
+    if (heatmap->num_regions >= MAX_REGIONS)
+        return 1;
+
+    region = &heatmap->regions[heatmap->num_regions++];
+
+    if (name_len > MAX_NAME_LEN)
+        name_len = MAX_NAME_LEN;
+
+    memset(region->name, 0, sizeof(region->name));
+    memcpy(region->name, name, strnlen(name, name_len));
+    region->rva  = rva;
+    region->size = size;
+
+    return 0;
+}
+
+void add_heatmap_costs(HEATMAP *heatmap, uint32_t rva, const double *byte_costs, size_t size)
+{
+    const size_t end = (size_t)heatmap->num_pages * HEATMAP_PAGE_SIZE;
+    size_t       offs;
+    size_t       i;
+
+    assert(rva >= heatmap->base_rva);
+    offs = rva - heatmap->base_rva;
+
+    assert(offs + size <= end);
+    if (offs + size > end)
+        size = (offs < end) ? (end - offs) : 0;
+
+    for (i = 0; i < size; i++)
+        heatmap->blocks[(offs + i) / HEATMAP_BLOCK_SIZE] += byte_costs[i];
+}
+
+static double get_range_bits(const HEATMAP *heatmap, uint32_t rva, uint32_t size)
+{
+    const uint32_t end   = heatmap->num_pages * BLOCKS_PER_PAGE;
+    uint32_t       block = (rva - heatmap->base_rva) / HEATMAP_BLOCK_SIZE;
+    uint32_t       last  = (rva - heatmap->base_rva + size + HEATMAP_BLOCK_SIZE - 1) / HEATMAP_BLOCK_SIZE;
+    double         bits  = 0;
+
+    if (rva < heatmap->base_rva)
+        return 0;
+
+    if (last > end)
+        last = end;
+
+    for ( ; block < last; block++)
+        bits += heatmap->blocks[block];
+
+    return bits;
+}
+
+static double get_page_bits(const HEATMAP *heatmap, uint32_t page)
+{
+    return get_range_bits(heatmap, heatmap->base_rva + page * HEATMAP_PAGE_SIZE, HEATMAP_PAGE_SIZE);
+}
+
+static const char *get_region_name(const HEATMAP *heatmap, uint32_t rva)
+{
+    uint32_t i;
+
+    for (i = 0; i < heatmap->num_regions; i++) {
+        const REGION *const region = &heatmap->regions[i];
+
+        if (rva >= region->rva && rva - region->rva < region->size)
+            return region->name;
+    }
+
+    return "-";
+}
+
+typedef struct {
+    uint32_t idx;
+    double   bits;
+} SORT_ITEM;
+
+static int compare_bits(const void *left, const void *right)
+{
+    const double left_bits  = ((const SORT_ITEM *)left)->bits;
+    const double right_bits = ((const SORT_ITEM *)right)->bits;
+
+    return (left_bits < right_bits) ? 1 : (left_bits > right_bits) ? -1 : 0;
+}
+
+static void print_row(FILE *file, const char *name, uint32_t rva, uint32_t size, double bits)
+{
+    fprintf(file, "        %-16s 0x%08x %10u %12.1f %6.1f%%\n",
+            name, rva, size, bits / 8, size ? (bits * 100 / 8 / size) : 0.0);
+}
+
+void print_heatmap(FILE *file, const HEATMAP *heatmap)
+{
+    SORT_ITEM *items;
+    uint32_t   i;
+    double     total = 0;
+
+    items = (SORT_ITEM *)malloc(sizeof(SORT_ITEM) * (heatmap->num_pages + MAX_REGIONS));
+    if ( ! items) {
+        perror(NULL);
+        return;
+    }
+
+    for (i = 0; i < heatmap->num_regions; i++) {
+        items[i].idx  = i;
+        items[i].bits = get_range_bits(heatmap, heatmap->regions[i].rva, heatmap->regions[i].size);
+    }
+
+    qsort(items, heatmap->num_regions, sizeof(SORT_ITEM), compare_bits);
+
+    fprintf(file, "Compressed size per region:\n");
+    fprintf(file, "        %-16s %-10s %10s %12s %7s\n", "region", "rva", "size", "compressed", "ratio");
+
+    for (i = 0; i < heatmap->num_regions; i++) {
+        const REGION *const region = &heatmap->regions[items[i].idx];
+
+        print_row(file, region->name, region->rva, region->size, items[i].bits);
+    }
+
+    for (i = 0; i < heatmap->num_pages; i++) {
+        items[i].idx  = i;
+        items[i].bits = get_page_bits(heatmap, i);
+        total        += items[i].bits;
+    }
+
+    print_row(file, "total", heatmap->base_rva, heatmap->num_pages * HEATMAP_PAGE_SIZE, total);
+
+    qsort(items, heatmap->num_pages, sizeof(SORT_ITEM), compare_bits);
+
+    fprintf(file, "Most expensive pages:\n");
+    fprintf(file, "        %-16s %-10s %10s %12s %7s\n", "region", "rva", "size", "compressed", "ratio");
+
+    for (i = 0; i < heatmap->num_pages && i < NUM_TOP_PAGES; i++) {
+        const uint32_t rva = heatmap->base_rva + items[i].idx * HEATMAP_PAGE_SIZE;
+
+        if (items[i].bits <= 0)
+            break;
+
+        print_row(file, get_region_name(heatmap, rva), rva, HEATMAP_PAGE_SIZE, items[i].bits);
+    }
+
+    free(items);
+}
+
+static void write_csv(FILE *file, const HEATMAP *heatmap)
+{
+    uint32_t i;
+
+    fprintf(file, "rva,region,compressed_bits\n");
+
+    for (i = 0; i < heatmap->num_pages; i++) {
+        const uint32_t rva = heatmap->base_rva + i * HEATMAP_PAGE_SIZE;
+
+        fprintf(file, "0x%x,%s,%.1f\n", rva, get_region_name(heatmap, rva), get_page_bits(heatmap, i));
+    }
+}
+
+static void write_pgm(FILE *file, const HEATMAP *heatmap)
+{
+    const size_t num_blocks = (size_t)heatmap->num_pages * BLOCKS_PER_PAGE;
+    size_t       i;
+
+    fprintf(file, "P5\n# One row per page starting at RVA 0x%x, %u bytes per pixel\n%u %u\n255\n",
+            heatmap->base_rva, HEATMAP_BLOCK_SIZE, BLOCKS_PER_PAGE, heatmap->num_pages);
+
+    for (i = 0; i < num_blocks; i++) {
+        const double value = heatmap->blocks[i] * 255 / (HEATMAP_BLOCK_SIZE * 8);
+
+        fputc((value >= 255) ? 255 : (int)(value + 0.5), file);
+    }
+}
+
+int save_heatmap(const HEATMAP *heatmap, const char *filename, enum HEATMAP_FORMAT format)
+{
+    FILE *const file = fopen(filename, (format == HEATMAP_PGM) ? "wb" : "w");
+    int         err;
+
+    if ( ! file) {
+        perror(filename);
+        return 1;
+    }
+
+    if (format == HEATMAP_PGM)
+        write_pgm(file, heatmap);
+    else
+        write_csv(file, heatmap);
+
+    err = ferror(file);
+
+    if (fclose(file))
+        err = 1;
+
+    if (err)
+        fprintf(stderr, "Error: Failed to write heat map to %s\n", filename);
+
+    return err;
+}
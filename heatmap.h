@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define HEATMAP_PAGE_SIZE  0x1000U
+#define HEATMAP_BLOCK_SIZE 64U      /* Bytes per pixel of PGM heat map */
+
+enum HEATMAP_FORMAT {
+    HEATMAP_NONE,
+    HEATMAP_CSV,        /* One line per page                              */
+    HEATMAP_PGM         /* Grayscale image, one row per page, white means
+                           the data did not compress at all               */
+};
+
+/* Compressed bits spent on each part of an executable image, indexed by RVA */
+typedef struct HEATMAP_STRUCT HEATMAP;
+
+/* The range covered by the heat map must be page-aligned */
+HEATMAP *create_heatmap(uint32_t base_rva, uint32_t size);
+void     destroy_heatmap(HEATMAP *heatmap);
+
+/* Names a range of the image, e.g. a section.  Only the first name_len
+ * characters of the name are used.  Returns non-zero if there are too many
+ * regions.
+ */
+int add_heatmap_region(HEATMAP *heatmap, const char *name, size_t name_len, uint32_t rva, uint32_t size);
+
+/* Adds costs of size consecutive bytes starting at rva */
+void add_heatmap_costs(HEATMAP *heatmap, uint32_t rva, const double *byte_costs, size_t size);
+
+/* Prints regions and the most expensive pages, sorted by compressed size */
+void print_heatmap(FILE *file, const HEATMAP *heatmap);
+
+/* Returns non-zero on failure */
+int save_heatmap(const HEATMAP *heatmap, const char *filename, enum HEATMAP_FORMAT format);
@@ -6,6 +6,71 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+/* Reads file which does not support seeking, e.g. a pipe */
+static BUFFER read_stream(FILE *file, const char *filename)
+{
+    BUFFER buf  = { NULL, 0 };
+    size_t size = 0;
+
+    for (;;) {
+        size_t num_read;
+
+        if (size == buf.size) {
+            const BUFFER new_buf = buf_alloc_flags(buf.size ? buf.size * 2 : 0x10000, 0);
+
+            if ( ! new_buf.buf) {
+                perror(NULL);
+                buf_free(buf);
+                buf.buf  = NULL;
+                buf.size = 0;
+                return buf;
+            }
+
+            if (size)
+                memcpy(new_buf.buf, buf.buf, size);
+            buf_free(buf);
+            buf = new_buf;
+        }
+
+        num_read = fread(buf.buf + size, 1, buf.size - size, file);
+        size += num_read;
+
+        if (num_read)
+            continue;
+
+        if (ferror(file)) {
+            perror(filename);
+            buf_free(buf);
+            buf.buf  = NULL;
+            buf.size = 0;
+            return buf;
+        }
+
+        break;
+    }
+
+    if ( ! size) {
+        fprintf(stderr, "%s: empty file\n", filename);
+        buf_free(buf);
+        buf.buf = NULL;
+    }
+
+    buf.size = size;
+
+    return buf;
+}
 
 BUFFER load_file(const char *filename)
 {
@@ -20,7 +85,7 @@ BUFFER load_file(const char *filename)
     }
 
     if (fseek(file, 0, SEEK_END)) {
-        perror(filename);
+        buf = read_stream(file, filename);
         fclose(file);
         return buf;
     }
@@ -44,7 +109,7 @@ BUFFER load_file(const char *filename)
         return buf;
     }
 
-    buf = buf_alloc((size_t)size);
+    buf = buf_alloc_flags((size_t)size, 0);
     if ( ! buf.buf) {
         perror(NULL);
         fclose(file);
@@ -55,7 +120,7 @@ BUFFER load_file(const char *filename)
         perror(filename);
         fclose(file);
 
-        free(buf.buf);
+        buf_free(buf);
         buf.buf  = NULL;
         buf.size = 0;
         return buf;
@@ -65,3 +130,113 @@ BUFFER load_file(const char *filename)
 
     return buf;
 }
+
+/* Returns NULL if the file cannot be mapped, size is set to 0 if the file is empty */
+static void *map_file_view(const char *filename, size_t *size)
+{
+#ifdef _WIN32
+    HANDLE        file;
+    HANDLE        mapping;
+    LARGE_INTEGER file_size;
+    void         *view = NULL;
+
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                       FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    if (GetFileType(file) != FILE_TYPE_DISK || ! GetFileSizeEx(file, &file_size)) {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    *size = (size_t)file_size.QuadPart;
+
+    if (*size) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) {
+            view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+            /* The view keeps the mapping alive */
+            CloseHandle(mapping);
+        }
+    }
+
+    CloseHandle(file);
+
+    return view;
+#else
+    struct stat st;
+    void       *view = NULL;
+    int         flags = MAP_PRIVATE;
+    const int   fd    = open(filename, O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) || ! S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    *size = (size_t)st.st_size;
+
+#   ifdef MAP_POPULATE
+    /* The whole file is going to be read, so avoid taking page faults */
+    flags |= MAP_POPULATE;
+#   endif
+
+    if (*size) {
+        view = mmap(NULL, *size, PROT_READ, flags, fd, 0);
+        if (view == MAP_FAILED)
+            view = NULL;
+#   ifdef MADV_WILLNEED
+        /* Not sequential, the match finder compares with earlier data */
+        else
+            madvise(view, *size, MADV_WILLNEED);
+#   endif
+    }
+
+    close(fd);
+
+    return view;
+#endif
+}
+
+FILE_VIEW map_file(const char *filename)
+{
+    FILE_VIEW view = { { NULL, 0 }, 0 };
+    size_t    size = ~(size_t)0;
+    void     *ptr;
+
+    ptr = map_file_view(filename, &size);
+
+    if (ptr) {
+        view.data.buf  = (uint8_t *)ptr;
+        view.data.size = size;
+        view.is_mapped = 1;
+    }
+    else if ( ! size)
+        fprintf(stderr, "%s: empty file\n", filename);
+    else
+        view.data = load_file(filename);
+
+    return view;
+}
+
+void unmap_file(FILE_VIEW *view)
+{
+    if (view->is_mapped) {
+#ifdef _WIN32
+        UnmapViewOfFile(view->data.buf);
+#else
+        munmap(view->data.buf, view->data.size);
+#endif
+    }
+    else
+        buf_free(view->data);
+
+    view->data.buf  = NULL;
+    view->data.size = 0;
+    view->is_mapped = 0;
+}
@@ -2,6 +2,22 @@
  * Copyright (c) 2022 Chris Dragan
  */
 
+#pragma once
+
 #include "buffer.h"
 
 BUFFER load_file(const char *filename);
+
+/* Read-only view of a file's contents */
+typedef struct {
+    BUFFER data;        /* Must not be modified */
+    int    is_mapped;   /* Non-zero if the file is mapped, otherwise data was loaded */
+} FILE_VIEW;
+
+/* Maps file into memory without copying it.  If the file cannot be mapped,
+ * e.g. if it is a pipe, it is loaded with load_file().  On failure data.size
+ * is 0.
+ */
+FILE_VIEW map_file(const char *filename);
+
+void unmap_file(FILE_VIEW *view);
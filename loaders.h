@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Loader stub extracted at build time from loaders/windows/<arch>/<name>.exe
+ * or loaders/linux/<arch>/<name>
+ */
+typedef struct {
+    const char    *name;             /* Name of the loader, e.g. "pe_load_imports" */
+    uint32_t       machine;          /* PE_MACHINE_X86_32, PE_MACHINE_X86_64 or ELF_MACHINE_X86_64 */
+    uint32_t       entry_point_offs; /* Offset of the entry point in .text section */
+    const uint8_t *text;             /* Contents of .text section or ELF segment */
+    uint32_t       text_size;        /* Size of .text section or ELF segment */
+} LOADER_STUB;
+
+/* Table generated by gen_loaders */
+extern const LOADER_STUB loader_stubs[];
+extern const uint32_t    num_loader_stubs;
@@ -0,0 +1,11 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+/* Windows loaders are cross-compiled without C library headers, because they
+ * don't use the C library.  Asserts are disabled in loaders.
+ */
+
+#pragma once
+
+#define assert(x) ((void)0)
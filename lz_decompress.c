@@ -28,58 +28,99 @@ static uint32_t decode_length(BIT_STREAM *stream)
     return value + get_bits(stream, bits);
 }
 
-static uint32_t decode_distance(BIT_STREAM *stream)
+static uint64_t decode_distance(BIT_STREAM *stream, int slot_bits)
 {
-    uint32_t data = get_bits(stream, 6);
-    uint32_t bits;
+    uint32_t data = get_bits(stream, slot_bits);
+    uint64_t value;
+    int      bits;
 
     if (data < 2)
         return data + 1;
 
-    bits = (data >> 1) - 1;
+    bits  = (int)(data >> 1) - 1;
+    value = (uint64_t)((data & 1) + 2) << bits;
 
-    return (((data & 1) + 2) << bits) + get_bits(stream, (int)bits) + 1;
+#ifndef LZA_COMPACT_ONLY
+    /* get_bits() returns at most 32 bits */
+    if (bits > 32) {
+        value += (uint64_t)get_bits(stream, bits - 32) << 32;
+        bits   = 32;
+    }
+#endif
+
+    return value + get_bits(stream, bits) + 1;
 }
 
-void lz_decompress(void       *input_dest,
-                   size_t      dest_size,
-                   const void *input_src)
+/* If a zero region starts at the current output position, skip over it */
+static uint8_t *skip_zero_region(uint8_t *ptr, uint8_t *begin, const ZERO_REGION **region)
 {
-    BIT_STREAM     stream[LZS_NUM_STREAMS];
-    uint32_t       stream_size[LZS_NUM_STREAMS];
-    uint32_t       last_dist[4] = { 0, 0, 0, 0 };
-    uint8_t       *dest         = (uint8_t *)input_dest;
-#ifndef NDEBUG
-    uint8_t *const begin        = dest;
-#endif
-    uint8_t *const end          = dest + dest_size;
-    const uint8_t *input        = (const uint8_t *)input_src;
-    uint32_t       i_stream;
-    uint8_t        prev_lit     = 0;
+    const ZERO_REGION *const next = *region;
+
+    if (next->size && ptr == begin + next->offset) {
+        ptr     += next->size;
+        *region  = next + 1;
+    }
+
+    return ptr;
+}
+
+/* If src_size is not 0, the input is not trusted: stream sizes and matches are
+ * checked against the input and output buffers and 1 is returned if the input
+ * is corrupted.
+ */
+static int decompress(void              *input_dest,
+                      size_t             dest_size,
+                      const void        *input_src,
+                      size_t             src_size,
+                      const ZERO_REGION *zero_regions,
+                      size_t             prefix_size)
+{
+    BIT_STREAM         stream[LZS_NUM_STREAMS];
+    size_t             stream_size[LZS_NUM_STREAMS];
+    const ZERO_REGION  no_zero_regions = { 0, 0 }; /* Not static, 32-bit loaders can't use data */
+    size_t             last_dist[4] = { 0, 0, 0, 0 };
+    uint8_t *const     begin        = (uint8_t *)input_dest;
+    uint8_t           *dest         = begin;
+    uint8_t *const     end          = dest + dest_size;
+    const uint8_t     *input        = (const uint8_t *)input_src;
+    const uint8_t     *input_end    = input + src_size;
+    const ZERO_REGION *first_region = zero_regions ? zero_regions : &no_zero_regions;
+    const ZERO_REGION *region       = first_region;
+    const int          slot_bits    = LZA_SLOT_BITS(dest_size);
+    uint32_t           i_stream;
+    uint8_t            prev_lit     = 0;
 
     assert(dest_size);
 
     /* Load sizes of each stream from input */
-    init_bit_stream(&stream[0], input, dest_size);
+    init_bit_stream(&stream[0], input, src_size ? src_size : dest_size);
     for (i_stream = 0; i_stream < LZS_NUM_STREAMS; i_stream++)
-        stream_size[i_stream] = decode_distance(&stream[0]);
+        stream_size[i_stream] = (size_t)decode_distance(&stream[0], slot_bits);
 
     /* Prepare input streams */
     input = stream[0].buf;
     for (i_stream = 0; i_stream < LZS_NUM_STREAMS; i_stream++) {
-        const uint32_t size = stream_size[i_stream];
+        const size_t size = stream_size[i_stream];
+
+        if (src_size && size > (size_t)(input_end - input))
+            return 1;
+
         init_bit_stream(&stream[i_stream], input, size);
         input += size;
     }
 
-    do {
+    dest = skip_zero_region(dest, begin, &region);
+
+    while (dest < end) {
         /* Decode packet type */
         uint32_t data = get_one_bit(&stream[LZS_TYPE]);
 
         if (data) {
-            uint32_t distance;
-            uint32_t length;
-            uint32_t i;
+            const ZERO_REGION *src_region;
+            uint8_t           *src;
+            size_t             distance;
+            uint32_t           length;
+            uint32_t           i;
 
             data = get_one_bit(&stream[LZS_TYPE]);
 
@@ -105,9 +146,14 @@ void lz_decompress(void       *input_dest,
             /* MATCH */
             else {
                 length   = decode_length(&stream[LZS_SIZE]);
-                distance = decode_distance(&stream[LZS_OFFSET]);
+                distance = (size_t)decode_distance(&stream[LZS_OFFSET], slot_bits);
             }
 
+            /* Match must not start before the prefix nor end past the output */
+            if (src_size && (distance > (size_t)(dest - begin) + prefix_size ||
+                             length > (size_t)(end - dest)))
+                return 1;
+
             /* Put distance on the list of last distances and deduplicate the list */
             for (i = 0; i < 3; ++i)
                 if (last_dist[i] == distance)
@@ -116,10 +162,24 @@ void lz_decompress(void       *input_dest,
                 last_dist[i] = last_dist[i - 1];
             last_dist[0] = distance;
 
-            assert(dest + length <= end);
-            assert(distance <= dest - begin);
-            for (i = 0; i < length; ++i, ++dest)
-                *dest = *(dest - distance);
+            /* Distance does not include zero regions, so find the source
+             * by moving back over any zero regions between source and destination.
+             */
+            src        = dest - distance;
+            src_region = region;
+            while (src_region > first_region &&
+                   src < begin + src_region[-1].offset + src_region[-1].size) {
+                --src_region;
+                src -= src_region->size;
+            }
+
+            assert(src >= begin - prefix_size);
+            for (i = 0; i < length; ++i) {
+                assert(dest < end);
+                *dest = *src;
+                dest  = skip_zero_region(dest + 1, begin, &region);
+                src   = skip_zero_region(src + 1, begin, &src_region);
+            }
         }
         /* LIT */
         else {
@@ -127,8 +187,47 @@ void lz_decompress(void       *input_dest,
 
             lit = (uint8_t)(lit + get_bits(&stream[LZS_LITERAL], 7));
 
-            *(dest++) = lit;
-            prev_lit  = lit;
+            *dest    = lit;
+            dest     = skip_zero_region(dest + 1, begin, &region);
+            prev_lit = lit;
         }
-    } while (dest < end);
+    }
+
+    return 0;
+}
+
+void lz_decompress(void              *input_dest,
+                   size_t             dest_size,
+                   const void        *input_src,
+                   const ZERO_REGION *zero_regions)
+{
+    decompress(input_dest, dest_size, input_src, 0, zero_regions, 0);
+}
+
+void lz_decompress_with_prefix(void       *input_dest,
+                               size_t      dest_size,
+                               const void *input_src,
+                               size_t      prefix_size)
+{
+    decompress(input_dest, dest_size, input_src, 0, NULL, prefix_size);
 }
+
+/* Loaders only decompress their own data, leaving this out keeps them small */
+#ifndef LZA_TRUSTED_ONLY
+int lz_decompress_checked(void       *input_dest,
+                          size_t      dest_size,
+                          const void *input_src,
+                          size_t      src_size,
+                          size_t      prefix_size)
+{
+    if ( ! dest_size || ! src_size)
+        return 1;
+
+    return decompress(input_dest, dest_size, input_src, src_size, NULL, prefix_size);
+}
+
+uint64_t lz_decode_distance(BIT_STREAM *stream, int slot_bits)
+{
+    return decode_distance(stream, slot_bits);
+}
+#endif
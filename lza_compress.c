@@ -11,38 +11,89 @@
 #include "lza_defines.h"
 
 #include <assert.h>
+#include <stdio.h>
 #include <string.h>
 
 typedef struct {
     BIT_EMITTER      emitter[LZS_NUM_STREAMS];
     COMPRESSED_SIZES sizes;
+    int              slot_bits;     /* Size of distance slots, see LZA_SLOT_BITS() */
     uint8_t          prev_lit;
 } COMPRESS;
 
-static void init_compress(COMPRESS *compress, void *buf, size_t size)
+/* Each stream size in the header takes up to 69 bits with 7-bit slots */
+#define MAX_HEADER_SIZE (LZS_NUM_STREAMS * 9)
+
+/* Upper bound of the size of each stream, derived from the packet encoding:
+ * - LZS_TYPE: up to 4 bits per byte (SHORTREP),
+ * - LZS_LITERAL_MSB: 1 bit per literal,
+ * - LZS_LITERAL: 7 bits per literal,
+ * - LZS_SIZE: up to 4 bits per match, each match is at least 2 bytes long,
+ * - LZS_OFFSET: find_repeats() only selects a MATCH if it takes fewer bits than
+ *   literals, i.e. up to 9 bits per byte.
+ * Each stream also needs up to 2 bytes for the tail.
+ */
+static size_t get_stream_bound(enum LZ_STREAM stream, size_t src_size)
+{
+    static const uint8_t eighths_per_byte[LZS_NUM_STREAMS] = { 4, 1, 7, 2, 9 };
+
+    return src_size / 8 * eighths_per_byte[stream] +
+           (src_size % 8 * eighths_per_byte[stream] + 7) / 8 + 2;
+}
+
+size_t lz_compress_bound(size_t src_size)
 {
-    uint8_t     *dest       = (uint8_t *)buf;
-    const size_t chunk_size = size / LZS_NUM_STREAMS;
-    uint32_t     i;
+    size_t   size = MAX_HEADER_SIZE;
+    uint32_t i;
+
+    for (i = 0; i < LZS_NUM_STREAMS; i++)
+        size += get_stream_bound((enum LZ_STREAM)i, src_size);
+
+    return size;
+}
+
+static void init_compress(COMPRESS *compress, void *buf, size_t src_size)
+{
+    uint8_t *dest = (uint8_t *)buf;
+    uint32_t i;
 
     memset(compress, 0, sizeof(*compress));
 
     for (i = 0; i < LZS_NUM_STREAMS; i++) {
-        init_bit_emitter(&compress->emitter[i], dest, chunk_size);
-        dest += chunk_size;
+        const size_t stream_size = get_stream_bound((enum LZ_STREAM)i, src_size);
+
+        init_bit_emitter(&compress->emitter[i], dest, stream_size);
+        dest += stream_size;
     }
 }
 
-static void finish_compress(COMPRESS *compress, size_t stream_sizes[])
+static int finish_compress(COMPRESS *compress, size_t stream_sizes[])
 {
     uint8_t *buf;
     uint32_t i;
     size_t   total = 0;
 
     for (i = 0; i < LZS_NUM_STREAMS; i++) {
-        const size_t stream_size = emit_tail(&compress->emitter[i]);
-        stream_sizes[i]          = stream_size;
-        total                   += stream_size;
+        BIT_EMITTER *const emitter = &compress->emitter[i];
+        size_t             stream_size;
+
+        /* Size 0 cannot be encoded in the header, so an empty stream, e.g.
+         * when there are no matches in random data, is padded to one byte.
+         */
+        if (emitter->buf == emitter->begin && emitter->data == 1)
+            emit_bit(emitter, 0);
+
+        stream_size = emit_tail(emitter);
+
+        assert( ! emitter->overflow);
+        if (emitter->overflow) {
+            fprintf(stderr, "Error: LZ77 stream %u exceeded its size bound\n", i);
+            return 1;
+        }
+
+        stream_sizes[i]             = stream_size;
+        compress->sizes.streams[i]  = stream_size;
+        total                      += stream_size;
     }
 
     buf = compress->emitter[0].begin;
@@ -53,6 +104,8 @@ static void finish_compress(COMPRESS *compress, size_t stream_sizes[])
     }
 
     compress->sizes.lz = total;
+
+    return 0;
 }
 
 /* LZMA packets
@@ -119,7 +172,7 @@ static void emit_length(BIT_EMITTER *emitter, size_t length)
     }
 }
 
-static void emit_distance(BIT_EMITTER *emitter, size_t distance)
+void lz_emit_distance(BIT_EMITTER *emitter, uint64_t distance, int slot_bits)
 {
     /* LZ77 variable-length distance encoding:
      * - 6-bit distance slot
@@ -139,6 +192,8 @@ static void emit_distance(BIT_EMITTER *emitter, size_t distance)
      * 6      00101x                4
      * :      :::                   :
      * 32     11111x                30
+     *
+     * 7-bit slots for large inputs extend the table up to 64 bits.
      */
 
     assert(distance > 0);
@@ -146,15 +201,15 @@ static void emit_distance(BIT_EMITTER *emitter, size_t distance)
     --distance;
 
     if (distance < 2)
-        emit_bits(emitter, distance, 6);
+        emit_bits(emitter, (size_t)distance, slot_bits);
     else {
-        const int bits_m1 = 31 - count_leading_zeroes((unsigned int)distance);
+        const int bits_m1 = 63 - count_leading_zeroes64(distance);
 
-        distance &= ~((size_t)1 << bits_m1);
+        distance &= ~((uint64_t)1 << bits_m1);
 
-        distance |= (uint32_t)bits_m1 << bits_m1;
-
-        emit_bits(emitter, distance, bits_m1 + 5);
+        /* Upper bits of the slot, followed by the rest of the distance */
+        emit_bits(emitter, (size_t)bits_m1, slot_bits - 1);
+        emit_bits(emitter, (size_t)distance, bits_m1);
     }
 }
 
@@ -191,6 +246,8 @@ static void report_match(void *cookie, const uint8_t *buf, size_t pos, OCCURRENC
 
     assert(occurrence.length <= MAX_LZA_SIZE);
 
+    STATS_HIST(match_length, occurrence.length);
+
     if (occurrence.last < 0) {
 
         assert(occurrence.length > 1);
@@ -199,7 +256,7 @@ static void report_match(void *cookie, const uint8_t *buf, size_t pos, OCCURRENC
 
         emit_length(&compress->emitter[LZS_SIZE], occurrence.length);
 
-        emit_distance(&compress->emitter[LZS_OFFSET], occurrence.distance);
+        lz_emit_distance(&compress->emitter[LZS_OFFSET], occurrence.distance, compress->slot_bits);
     }
     else if (occurrence.length == 1) {
         assert(occurrence.last == 0);
@@ -224,7 +281,7 @@ static void report_match(void *cookie, const uint8_t *buf, size_t pos, OCCURRENC
     }
 }
 
-static size_t emit_header(uint8_t *dest, size_t dest_size, const size_t stream_sizes[])
+static size_t emit_header(uint8_t *dest, size_t dest_size, const size_t stream_sizes[], int slot_bits)
 {
     BIT_EMITTER emitter;
     uint32_t    i;
@@ -232,7 +289,7 @@ static size_t emit_header(uint8_t *dest, size_t dest_size, const size_t stream_s
     init_bit_emitter(&emitter, dest, dest_size);
 
     for (i = 0; i < LZS_NUM_STREAMS; i++)
-        emit_distance(&emitter, stream_sizes[i]);
+        lz_emit_distance(&emitter, stream_sizes[i], slot_bits);
 
     return emit_tail(&emitter);
 }
@@ -249,24 +306,75 @@ COMPRESSED_SIZES lz_compress(void       *dest,
                              size_t      dest_size,
                              const void *src,
                              size_t      src_size)
+{
+    return lz_compress_with_map(NULL, dest, dest_size, src, src_size);
+}
+
+COMPRESSED_SIZES lz_compress_with_map(OFFSET_MAP *map,
+                                      void       *dest,
+                                      size_t      dest_size,
+                                      const void *src,
+                                      size_t      src_size)
+{
+    return lz_compress_with_prefix(map, dest, dest_size, src, src_size, 0);
+}
+
+COMPRESSED_SIZES lz_compress_with_prefix(OFFSET_MAP *map,
+                                         void       *dest,
+                                         size_t      dest_size,
+                                         const void *src,
+                                         size_t      src_size,
+                                         size_t      prefix_size)
 {
     COMPRESS compress;
+    int      err;
     size_t   stream_sizes[LZS_NUM_STREAMS];
     size_t   hdr_size;
-    uint8_t  hdr[LZS_NUM_STREAMS * 4];
+    uint8_t  hdr[MAX_HEADER_SIZE];
+#ifdef MINIFY_STATS
+    COMPRESS_STATS *prev_stats;
+#endif
+
+    assert(dest_size >= lz_compress_bound(src_size));
 
-    assert(dest_size >= src_size);
+    memset(&compress.sizes, 0, sizeof(compress.sizes));
+
+    if (dest_size < lz_compress_bound(src_size))
+        return compress.sizes;
 
-    init_compress(&compress, dest, dest_size);
+    init_compress(&compress, dest, src_size);
+
+    compress.slot_bits = LZA_SLOT_BITS(src_size);
+
+#ifdef MINIFY_STATS
+    prev_stats = set_current_stats(&compress.sizes.match_stats);
+#endif
+
+    assert(map || ! prefix_size);
+
+    if (map)
+        err = find_repeats_with_prefix(map, (const uint8_t *)src, prefix_size, src_size,
+                                       report_literal, report_match, &compress);
+    else
+        err = find_repeats((const uint8_t *)src, src_size, report_literal, report_match, &compress);
+
+    if ( ! err)
+        err = finish_compress(&compress, stream_sizes);
+
+    if ( ! err && map)
+        compress.sizes.degraded = get_offset_map_degraded_size(map);
+
+#ifdef MINIFY_STATS
+    set_current_stats(prev_stats);
+#endif
+
+    if (err) {
 
-    if (find_repeats((const uint8_t *)src, src_size, report_literal, report_match, &compress)) {
         memset(&compress.sizes, 0, sizeof(compress.sizes));
         return compress.sizes;
     }
 
-    finish_compress(&compress, stream_sizes);
-
-    hdr_size = emit_header(hdr, sizeof(hdr), stream_sizes);
+    hdr_size = emit_header(hdr, sizeof(hdr), stream_sizes, compress.slot_bits);
     assert(hdr_size + compress.sizes.lz <= dest_size);
     if (hdr_size + compress.sizes.lz > dest_size) {
         memset(&compress.sizes, 0, sizeof(compress.sizes));
@@ -277,6 +385,11 @@ COMPRESSED_SIZES lz_compress(void       *dest,
     memcpy(dest, hdr, hdr_size);
     compress.sizes.lz += hdr_size;
 
+#ifdef MINIFY_STATS
+    if (get_bit_costs(&compress.sizes.bit_costs, NULL, dest, compress.sizes.lz, src_size))
+        fprintf(stderr, "Warning: failed to attribute compressed bits to LZ77 streams\n");
+#endif
+
     return compress.sizes;
 }
 
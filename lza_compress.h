@@ -2,26 +2,66 @@
  * Copyright (c) 2022 Chris Dragan
  */
 
+#pragma once
+
+#include "bit_cost.h"
+#include "bit_emit.h"
+#include "find_repeats.h"
+#include "lza_defines.h"
+#include "stats.h"
+
 #include <stddef.h>
 
 typedef struct {
     size_t compressed;          /* Final compressed size       */
     size_t lz;                  /* Total size after LZ77 compression */
+    size_t streams[LZS_NUM_STREAMS]; /* Size of each LZ77 stream */
+    size_t degraded;            /* Input searched with reduced effort to meet the deadline */
 
     size_t stats_lit;           /* Number of LIT packets       */
     size_t stats_match;         /* Number of MATCH packets     */
     size_t stats_shortrep;      /* Number of SHORTREP packets  */
     size_t stats_longrep[4];    /* Number of LONGREP* packets  */
+
+#ifdef MINIFY_STATS
+    COMPRESS_STATS match_stats; /* Counters from match finder and LZ77 emitters */
+    BIT_COSTS      bit_costs;   /* Compressed bits spent per stream and packet */
+#endif
 } COMPRESSED_SIZES;
 
 /* Returns size of the working buffer needed for compress() for the given input size */
 size_t estimate_compress_size(size_t src_size);
 
+/* Returns size of the output buffer needed for lz_compress() for the given input size */
+size_t lz_compress_bound(size_t src_size);
+
+/* Emits a match distance or a stream size, slot_bits is LZA_SLOT_BITS() of the input size */
+void lz_emit_distance(BIT_EMITTER *emitter, uint64_t distance, int slot_bits);
+
 COMPRESSED_SIZES lz_compress(void       *dest,
                              size_t      dest_size,
                              const void *src,
                              size_t      src_size);
 
+/* Same as lz_compress(), but reuses offset map instead of allocating it */
+COMPRESSED_SIZES lz_compress_with_map(OFFSET_MAP *map,
+                                      void       *dest,
+                                      size_t      dest_size,
+                                      const void *src,
+                                      size_t      src_size);
+
+/* Same as lz_compress_with_map(), but matches can also refer to prefix_size
+ * bytes, which immediately precede src in memory.  The output must be
+ * decompressed with the same prefix in front of it, see
+ * lz_decompress_with_prefix().  The map must not be NULL if there is a prefix.
+ */
+COMPRESSED_SIZES lz_compress_with_prefix(OFFSET_MAP *map,
+                                         void       *dest,
+                                         size_t      dest_size,
+                                         const void *src,
+                                         size_t      src_size,
+                                         size_t      prefix_size);
+
 COMPRESSED_SIZES lza_compress(void       *dest,
                               size_t      dest_size,
                               const void *src,
@@ -13,6 +13,16 @@ void lza_decompress(void       *input_dest,
                     size_t      scratch_size,
                     const void *compressed,
                     size_t      compressed_size)
+{
+    lza_decompress_with_prefix(input_dest, dest_size, scratch_size, compressed, compressed_size, 0);
+}
+
+void lza_decompress_with_prefix(void       *input_dest,
+                                size_t      dest_size,
+                                size_t      scratch_size,
+                                const void *compressed,
+                                size_t      compressed_size,
+                                size_t      prefix_size)
 {
     uint8_t *const dest  = (uint8_t *)input_dest;
     uint8_t *const input = (uint8_t *)dest + dest_size;
@@ -22,5 +32,23 @@ void lza_decompress(void       *input_dest,
 
     arith_decode(input, scratch_size, (const uint8_t *)compressed, compressed_size);
 
-    lz_decompress(input_dest, dest_size, input);
+    lz_decompress_with_prefix(input_dest, dest_size, input, prefix_size);
+}
+
+int lza_decompress_checked(void       *input_dest,
+                           size_t      dest_size,
+                           size_t      scratch_size,
+                           const void *compressed,
+                           size_t      compressed_size,
+                           size_t      prefix_size)
+{
+    uint8_t *const dest  = (uint8_t *)input_dest;
+    uint8_t *const input = (uint8_t *)dest + dest_size;
+
+    if ( ! dest_size || ! scratch_size || compressed_size < 3)
+        return 1;
+
+    arith_decode(input, scratch_size, (const uint8_t *)compressed, compressed_size);
+
+    return lz_decompress_checked(input_dest, dest_size, input, scratch_size, prefix_size);
 }
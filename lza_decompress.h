@@ -2,14 +2,68 @@
  * Copyright (c) 2022 Chris Dragan
  */
 
+#pragma once
+
+#include "bit_stream.h"
+
 #include <stddef.h>
+#include <stdint.h>
+
+/* Region of the output which is entirely filled with zeroes and which is not
+ * present in the compressed stream.  The decompressor skips over such regions
+ * without writing to them.  A list of regions is sorted by offset and is
+ * terminated by an entry with size 0.
+ */
+typedef struct {
+    uint32_t offset;    /* Offset of the region from the beginning of the output */
+    uint32_t size;      /* Size of the region in bytes */
+} ZERO_REGION;
 
-void lz_decompress(void       *input_dest,
-                   size_t      dest_size,
-                   const void *input_src);
+void lz_decompress(void              *input_dest,
+                   size_t             dest_size,
+                   const void        *input_src,
+                   const ZERO_REGION *zero_regions);
 
 void lza_decompress(void       *dest,
                     size_t      dest_size,
                     size_t      scratch_size,
                     const void *compressed,
                     size_t      compressed_size);
+
+/* Decompresses output of lz_compress_with_prefix(), the same prefix_size
+ * bytes which were used for compression must immediately precede dest.
+ */
+void lz_decompress_with_prefix(void       *input_dest,
+                               size_t      dest_size,
+                               const void *input_src,
+                               size_t      prefix_size);
+
+void lza_decompress_with_prefix(void       *dest,
+                                size_t      dest_size,
+                                size_t      scratch_size,
+                                const void *compressed,
+                                size_t      compressed_size,
+                                size_t      prefix_size);
+
+/* Same as lz_decompress_with_prefix(), but for untrusted input, e.g. read
+ * from a file.  Nothing outside of dest, the prefix and src_size bytes of
+ * input is accessed.  Returns 0 on success or 1 if the input is corrupted.
+ */
+int lz_decompress_checked(void       *input_dest,
+                          size_t      dest_size,
+                          const void *input_src,
+                          size_t      src_size,
+                          size_t      prefix_size);
+
+/* Same as lza_decompress_with_prefix(), but for untrusted input, see
+ * lz_decompress_checked().  Returns 0 on success or 1 if the input is corrupted.
+ */
+int lza_decompress_checked(void       *dest,
+                           size_t      dest_size,
+                           size_t      scratch_size,
+                           const void *compressed,
+                           size_t      compressed_size,
+                           size_t      prefix_size);
+
+/* Decodes a value emitted by lz_emit_distance() with the same slot_bits */
+uint64_t lz_decode_distance(BIT_STREAM *stream, int slot_bits);
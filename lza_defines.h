@@ -2,9 +2,25 @@
  * Copyright (c) 2022 Chris Dragan
  */
 
+#pragma once
+
 #define LZA_LENGTH_TAIL_BITS 11
 #define MAX_LZA_SIZE (17 + (1 << LZA_LENGTH_TAIL_BITS))
 
+/* Distances and stream sizes are encoded with 6-bit slots, which cover values
+ * of up to 32 bits.  LZ77 data of inputs larger than LZA_MAX_COMPACT_SIZE uses
+ * 7-bit slots, which cover values of up to 64 bits.  Below the limit, the size
+ * of each stream, which is at most 9/8 of the input, fits in 32 bits.
+ */
+#define LZA_MAX_COMPACT_SIZE 0x80000000U
+
+/* Loaders only decompress executables, which are smaller than the limit */
+#ifdef LZA_COMPACT_ONLY
+#   define LZA_SLOT_BITS(src_size) 6
+#else
+#   define LZA_SLOT_BITS(src_size) (((src_size) > LZA_MAX_COMPACT_SIZE) ? 7 : 6)
+#endif
+
 enum LZ_STREAM {
     LZS_TYPE,
     LZS_LITERAL_MSB,
@@ -2,23 +2,77 @@
  * Copyright (c) 2022 Chris Dragan
  */
 
+#include "arena.h"
+#include "cache.h"
+#include "delta.h"
+#include "dict.h"
+#include "estimate.h"
+#include "exe_elf.h"
 #include "exe_pe.h"
 #include "lza_compress.h"
 #include "lza_decompress.h"
 #include "load_file.h"
+#include "minify_ctx.h"
+#include "profile.h"
+#include "report.h"
+#include "stream.h"
+#include "thread_pool.h"
+#include "timer.h"
 
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static int save_file(const char *filename, BUFFER buf)
+#ifdef _WIN32
+#   include <fcntl.h>
+#   include <io.h>
+#else
+#   include <sys/stat.h>
+#endif
+
+typedef struct {
+    int                 quiet;          /* Don't print anything except errors and JSON report */
+    int                 json_report;    /* Print one JSON record for each file */
+    int                 analyze;        /* Print compressed size of sections and pages */
+    enum HEATMAP_FORMAT heatmap;        /* Save heat map of compressed size next to the input */
+    int                 perf;           /* Count hardware events in each phase */
+    int                 estimate;       /* Only estimate compressed size, don't save output */
+    PARSER_PARAMS       params;         /* Match finder heuristics, loaded with --profile */
+    size_t              memory_budget;  /* Memory for compressing each file, 0 for no limit */
+    BUFFER              dict;           /* Prefix of generic files, loaded with --dict */
+    uint32_t            lazy_block_size; /* Blocks of ELF images decompressed on first touch, 0 for eager */
+} OUTPUT_OPTIONS;
+
+/* Approximate time of arithmetic coding and verification per input byte,
+ * which is reserved after the match finder's deadline.
+ */
+#define FINISH_US_PER_BYTE 0.5
+
+static uint64_t get_search_deadline(uint64_t deadline, size_t size)
 {
-    static char new_filename[1024];
-    static char prefix[] = "mini.";
-    FILE       *file;
-    const char *slash;
-    size_t      len;
+    const uint64_t reserve = (uint64_t)((double)size * FINISH_US_PER_BYTE);
+
+    if ( ! deadline)
+        return 0;
+
+    /* If there is no time left, the match finder stores everything as literals */
+    return (deadline > reserve + 1) ? (deadline - reserve) : 1;
+}
+
+/* Returns non-zero if details of compression should be printed */
+static int is_verbose(const OUTPUT_OPTIONS *options)
+{
+    return ! options->quiet && ! options->json_report;
+}
+
+static int save_file(const char *filename, BUFFER buf, int verbose)
+{
+    char              new_filename[1024];
+    static const char prefix[] = "mini.";
+    FILE             *file;
+    const char       *slash;
+    size_t            len;
 
     len = strlen(filename);
 
@@ -59,90 +113,1084 @@ static int save_file(const char *filename, BUFFER buf)
 
     fclose(file);
 
-    printf("Saved compressed executable in %s\n", new_filename);
+#ifndef _WIN32
+    /* Packed ELF executables are run directly */
+    if (is_elf_file(buf.buf, buf.size))
+        chmod(new_filename, 0755);
+#endif
+
+    if (verbose)
+        printf("Saved compressed executable in %s\n", new_filename);
 
     return EXIT_SUCCESS;
 }
 
-int main(int argc, char *argv[])
+typedef struct {
+    const char *filename;
+    size_t      input_size;
+    size_t      output_size;
+    uint64_t    time_us;
+    int         error;
+    REPORT      report;
+} FILE_RESULT;
+
+static size_t estimate_generic_memory(size_t size)
+{
+    return size * 4 + estimate_compress_size(size);
+}
+
+static int compress_generic(MINIFY_CTX *ctx, BUFFER buf, BUFFER dict, int verbose, FILE_RESULT *result)
 {
     COMPRESSED_SIZES compressed;
-    BUFFER           buf;
+    BUFFER           dest_buf;
     uint8_t         *dest;
     uint8_t         *decompressed;
     size_t           compr_buffer_size;
     size_t           decompr_buffer_size;
+    uint64_t         phase_start;
 
-    if (argc != 2) {
-        fprintf(stderr, "Error: Invalid arguments\n");
-        fprintf(stderr, "Usage: minify <FILE>\n");
+    compr_buffer_size   = estimate_compress_size(buf.size);
+    decompr_buffer_size = buf.size * 3;
+
+    dest_buf = buf_alloc_flags(compr_buffer_size + dict.size + decompr_buffer_size, ARENA_HUGE_PAGES);
+    dest     = dest_buf.buf;
+    if ( ! dest) {
+        perror(NULL);
         return EXIT_FAILURE;
     }
 
-    buf = load_file(argv[1]);
-    if ( ! buf.size)
+    /* Decompressed data is preceded by the dictionary */
+    decompressed = dest + compr_buffer_size + dict.size;
+    if (dict.size)
+        memcpy(decompressed - dict.size, dict.buf, dict.size);
+
+    phase_start = get_time_us();
+
+    compressed = minify_compress(ctx, dest, compr_buffer_size, buf.buf, buf.size);
+
+    if ( ! compressed.lz || compressed.compressed > compr_buffer_size) {
+        buf_free(dest_buf);
+        return EXIT_FAILURE;
+    }
+
+    phase_start = end_phase(&result->report, REPORT_LZ77, phase_start);
+
+    lza_decompress_with_prefix(decompressed,
+                               buf.size,
+                               decompr_buffer_size - buf.size,
+                               dest,
+                               compressed.compressed,
+                               dict.size);
+
+    if (memcmp(buf.buf, decompressed, buf.size)) {
+        fprintf(stderr, "Decompressed output doesn't match input data\n");
+        buf_free(dest_buf);
+        return EXIT_FAILURE;
+    }
+
+    end_phase(&result->report, REPORT_VERIFY, phase_start);
+
+    if (verbose) {
+        printf("Original    %zu bytes\n", buf.size);
+        printf("LZ77        %zu bytes\n", compressed.lz);
+        printf("Entropy     %zu bytes (%zu%%)\n", compressed.compressed, compressed.compressed * 100 / buf.size);
+
+        printf("LIT         %zu\n", compressed.stats_lit);
+        printf("MATCH       %zu\n", compressed.stats_match);
+        printf("SHORTREP    %zu\n", compressed.stats_shortrep);
+        printf("LONGREP0    %zu\n", compressed.stats_longrep[0]);
+        printf("LONGREP1    %zu\n", compressed.stats_longrep[1]);
+        printf("LONGREP2    %zu\n", compressed.stats_longrep[2]);
+        printf("LONGREP3    %zu\n", compressed.stats_longrep[3]);
+#ifdef MINIFY_STATS
+        print_compress_stats(stdout, &compressed.match_stats);
+        print_bit_costs(stdout, &compressed.bit_costs);
+#endif
+    }
+
+    result->report.sizes = compressed;
+    result->output_size  = compressed.compressed;
+
+    buf_free(dest_buf);
+
+    return EXIT_SUCCESS;
+}
+
+static int estimate_file(BUFFER buf, const PARSER_PARAMS *params, int verbose, FILE_RESULT *result)
+{
+    SIZE_ESTIMATE  estimate;
+    const uint64_t phase_start = get_time_us();
+
+    if (estimate_lza_size(&estimate, buf.buf, buf.size, params))
+        return EXIT_FAILURE;
+
+    end_phase(&result->report, REPORT_LZ77, phase_start);
+
+    if (verbose) {
+        printf("Original    %zu bytes\n", buf.size);
+        printf("LZ77        %zu bytes (reduced search)\n", estimate.lz);
+        printf("Estimated   %zu bytes (%zu%%)\n", estimate.compressed, estimate.compressed * 100 / buf.size);
+    }
+
+    result->report.sizes.lz         = estimate.lz;
+    result->report.sizes.compressed = estimate.compressed;
+    memcpy(result->report.sizes.streams, estimate.streams, sizeof(estimate.streams));
+    result->output_size             = estimate.compressed;
+
+    return EXIT_SUCCESS;
+}
+
+/* Options which affect compressed output and are a part of cache keys */
+static void get_cache_settings(char *buf, size_t size, const PARSER_PARAMS *params, uint32_t lazy_block_size)
+{
+    char profile[96];
+    char suffix[64];
+
+    suffix[0] = 0;
+    if (params->max_map_size)
+        snprintf(suffix, sizeof(suffix), " map=%zu", params->max_map_size);
+    if (lazy_block_size)
+        snprintf(suffix + strlen(suffix), sizeof(suffix) - strlen(suffix), " lazy=%u", lazy_block_size);
+
+    /* Keep keys of entries created before profiles were supported */
+    if (is_default_profile(params)) {
+        snprintf(buf, size, "pe%s", suffix);
+        return;
+    }
+
+    format_profile(profile, sizeof(profile), params);
+    snprintf(buf, size, "pe %s%s", profile, suffix);
+}
+
+/* Returns memory left for the offset map of the match finder */
+static size_t get_map_budget(const char *filename, size_t budget, size_t other_size)
+{
+    if (budget > other_size)
+        return budget - other_size;
+
+    fprintf(stderr, "Warning: Memory budget is too small for %s, using the smallest match finder window\n",
+            filename);
+
+    /* The offset map has a minimum size */
+    return 1;
+}
+
+/* Saves compressed executable from the cache, returns non-zero if it is not cached */
+static int load_from_cache(CACHE           *cache,
+                           const CACHE_KEY *key,
+                           const char      *filename,
+                           int              verbose,
+                           FILE_RESULT     *result)
+{
+    BUFFER output = cache_lookup(cache, key);
+    int    err;
+
+    if ( ! output.buf)
         return EXIT_FAILURE;
 
-    if (is_pe_file(buf.buf, buf.size)) {
-        int    err    = EXIT_SUCCESS;
-        BUFFER output = exe_pe(buf.buf, buf.size);
+    if (verbose)
+        printf("Found compressed executable in cache\n");
+
+    err = save_file(filename, output, verbose);
+
+    result->output_size      = output.size;
+    result->report.cache_hit = 1;
+
+    buf_free(output);
+
+    /* If the file could not be saved, it will fail again after compressing */
+    return err;
+}
+
+static int compress_file(MINIFY_CTX           *ctx,
+                         CACHE                *cache,
+                         const char           *filename,
+                         MEM_BUDGET           *budget,
+                         const OUTPUT_OPTIONS *options,
+                         FILE_RESULT          *result)
+{
+    const int     verbose = is_verbose(options);
+    FILE_VIEW     input;
+    BUFFER        buf;
+    CACHE_KEY     key;
+    ARENA         arena;
+    ARENA        *prev_arena;
+    PARSER_PARAMS params      = options->params;
+    size_t        mem_size;
+    uint64_t      phase_start = get_time_us();
+    uint64_t      page_faults = get_page_faults();
+    int           is_pe;
+    int           is_elf;
+    int           use_cache;
+    int           err;
+
+    /* Counters are per thread, so they are opened by the thread which compresses the file */
+    if (options->perf)
+        start_report_perf(&result->report, open_perf_counters());
+
+    /* Input is only read, so it does not need to be copied */
+    input = map_file(filename);
+    buf   = input.data;
+    if ( ! buf.size) {
+        close_report_perf(&result->report);
+        return EXIT_FAILURE;
+    }
+
+    end_phase(&result->report, REPORT_LOAD, phase_start);
+
+    result->input_size = buf.size;
+
+    memset(&key, 0, sizeof(key));
+
+    is_pe  = is_pe_file(buf.buf, buf.size);
+    is_elf = ! is_pe && is_elf_file(buf.buf, buf.size);
+
+    /* Only the layout of Windows executables is analyzed */
+    if (options->analyze && ! options->estimate && ! is_pe) {
+        fprintf(stderr, "Error: --analyze and --heatmap only support Windows executables, %s is not one\n",
+                filename);
+        unmap_file(&input);
+        close_report_perf(&result->report);
+        return EXIT_FAILURE;
+    }
+
+    mem_size = is_pe  ? estimate_pe_memory(buf.buf, buf.size)
+             : is_elf ? estimate_elf_memory(buf.buf, buf.size)
+             :          estimate_generic_memory(options->dict.size + buf.size);
+
+    params.deadline_us = get_search_deadline(options->params.deadline_us, buf.size);
+
+    /* The offset map gets whatever is left from the budget */
+    if (options->memory_budget)
+        params.max_map_size = get_map_budget(filename, options->memory_budget, mem_size);
+
+    /* Only executables are saved, so only they are cached.  Analysis needs
+     * to compress the executable, so the cache is not used for it at all.
+     */
+    use_cache = (is_pe || is_elf) && cache && ! options->analyze && ! options->estimate;
+
+    if (use_cache) {
+        char cache_settings[176];
+
+        get_cache_settings(cache_settings, sizeof(cache_settings), &params,
+                           is_elf ? options->lazy_block_size : 0);
+
+        phase_start = get_time_us();
+        key         = get_cache_key(buf.buf, buf.size, cache_settings);
+        err         = load_from_cache(cache, &key, filename, verbose, result);
+        end_phase(&result->report, REPORT_SAVE, phase_start);
+
+        if ( ! err) {
+            unmap_file(&input);
+            result->report.page_faults = get_page_faults() - page_faults;
+            close_report_perf(&result->report);
+            return EXIT_SUCCESS;
+        }
+    }
+
+    /* With a memory budget, the offset map is counted as well */
+    if (budget)
+        reserve_memory(budget, mem_size + params.max_map_size);
+
+    /* Address space is only reserved, so be generous, the LZ77 offset map is not
+     * included in the estimate.  If the arena cannot be created or runs out
+     * of space, buffers are allocated from the heap.
+     */
+    prev_arena = set_current_arena(arena_init(&arena, mem_size * 4 + (64U << 20)) ? NULL : &arena);
+
+    /* Executables are estimated as they are, without loading them */
+    if (options->estimate)
+        err = estimate_file(buf, &params, verbose, result);
+    else if (is_pe || is_elf) {
+        char        heatmap_file[1024];
+        PE_ANALYSIS analysis;
+        BUFFER      output;
+
+        analysis.format       = options->heatmap;
+        analysis.heatmap_file = heatmap_file;
+        snprintf(heatmap_file, sizeof(heatmap_file), "%s.heatmap.%s",
+                 filename, (options->heatmap == HEATMAP_PGM) ? "pgm" : "csv");
+
+        if (is_pe)
+            output = exe_pe(buf.buf, buf.size, &params, verbose,
+                            options->analyze ? &analysis : NULL, &result->report);
+        else
+            output = exe_elf(buf.buf, buf.size, &params, options->lazy_block_size, verbose, &result->report);
         if ( ! output.buf)
             err = EXIT_FAILURE;
-        else
-            err = save_file(argv[1], output);
+        else {
+            phase_start = get_time_us();
+            err         = save_file(filename, output, verbose);
 
-        if ( ! err)
-            printf("Compressed %zu -> %zu (%zu %%)\n",
-                   buf.size, output.size, output.size * 100 / buf.size);
+            /* Failing to store the output in the cache is not fatal.  Output
+             * compressed with reduced effort due to the time budget is not
+             * stored, so that it is not reused when there is enough time.
+             */
+            if ( ! err && use_cache && ! result->report.sizes.degraded)
+                cache_store(cache, &key, output);
+
+            end_phase(&result->report, REPORT_SAVE, phase_start);
+        }
+
+        result->output_size = output.size;
 
         if (output.buf)
-            free(output.buf);
+            buf_free(output);
+    }
+    else {
+        set_minify_ctx_params(ctx, &params);
+        set_minify_ctx_dict(ctx, options->dict.buf, options->dict.size);
+        err = compress_generic(ctx, buf, options->dict, verbose, result);
+
+        /* Scratch memory of the match finder and its state are owned by the context */
+        result->report.peak_memory = get_minify_ctx_peak_memory(ctx);
+    }
+
+    if ( ! err && verbose && result->report.sizes.degraded)
+        printf("Search effort was reduced for the last %zu bytes to fit in the time budget\n",
+               result->report.sizes.degraded);
+
+    /* Memory used for this file only, input is mapped and not counted */
+    result->report.peak_memory += arena.peak;
+
+    set_current_arena(prev_arena);
+    arena_destroy(&arena);
+
+    if (budget)
+        release_memory(budget, mem_size + params.max_map_size);
+
+    unmap_file(&input);
+
+    result->report.page_faults = get_page_faults() - page_faults;
+
+    if (result->report.perf && verbose)
+        print_perf_report(stdout, &result->report, buf.size);
+
+    close_report_perf(&result->report);
+
+    return err;
+}
+
+typedef struct {
+    FILE_RESULT          *results;
+    MEM_BUDGET           *budget;
+    MINIFY_CTX          **contexts; /* One context per thread */
+    CACHE                *cache;
+    const OUTPUT_OPTIONS *options;
+} BATCH;
+
+static void compress_batch_item(void *cookie, size_t item, uint32_t thread_id)
+{
+    BATCH *const       batch  = (BATCH *)cookie;
+    FILE_RESULT *const result = &batch->results[item];
+    const uint64_t     start  = get_time_us();
+
+    /* Each slot is only accessed by its own thread */
+    if ( ! batch->contexts[thread_id])
+        batch->contexts[thread_id] = create_minify_ctx();
+
+    if ( ! batch->contexts[thread_id])
+        result->error = EXIT_FAILURE;
+    else
+        result->error = compress_file(batch->contexts[thread_id], batch->cache, result->filename,
+                                      batch->budget, batch->options, result);
+    result->time_us = get_time_us() - start;
+
+    lock_output();
+
+    if (batch->options->json_report)
+        write_json_report(stdout, result->filename, result->error, result->input_size,
+                          result->output_size, result->time_us, &result->report);
+    else if (batch->options->quiet) {
+        /* Errors have already been printed to stderr */
+    }
+    else if (result->error)
+        printf("%s: failed\n", result->filename);
+    else
+        printf("%s: %s%zu -> %zu (%zu %%) in %.3f s\n",
+               result->filename,
+               batch->options->estimate ? "estimated " : "",
+               result->input_size,
+               result->output_size,
+               result->output_size * 100 / result->input_size,
+               (double)result->time_us / 1e6);
+
+    fflush(stdout);
+
+    unlock_output();
+}
+
+static size_t get_file_size(const char *filename)
+{
+    FILE *const file = fopen(filename, "rb");
+    long        size = 0;
+
+    if (file) {
+        if ( ! fseek(file, 0, SEEK_END))
+            size = ftell(file);
+        fclose(file);
+    }
+
+    return (size > 0) ? (size_t)size : 0;
+}
+
+static int compare_input_size(const void *left, const void *right)
+{
+    const size_t left_size  = ((const FILE_RESULT *)left)->input_size;
+    const size_t right_size = ((const FILE_RESULT *)right)->input_size;
+
+    /* Sort from largest to smallest */
+    return (left_size < right_size) ? 1 : (left_size > right_size) ? -1 : 0;
+}
+
+static int compress_batch(const char *const    *filenames,
+                          size_t                num_files,
+                          uint32_t              num_threads,
+                          size_t                max_memory,
+                          CACHE                *cache,
+                          const OUTPUT_OPTIONS *options)
+{
+    BATCH          batch;
+    const uint64_t start        = get_time_us();
+    uint64_t       time_us;
+    size_t         total_input  = 0;
+    size_t         total_output = 0;
+    size_t         num_failed   = 0;
+    size_t         i;
+    int            err;
+
+    batch.results = (FILE_RESULT *)calloc(num_files, sizeof(FILE_RESULT));
+    if ( ! batch.results) {
+        perror(NULL);
+        return EXIT_FAILURE;
+    }
+
+    batch.contexts = (MINIFY_CTX **)calloc(num_threads, sizeof(MINIFY_CTX *));
+    if ( ! batch.contexts) {
+        perror(NULL);
+        free(batch.results);
+        return EXIT_FAILURE;
+    }
+
+    batch.options = options;
+    batch.cache   = cache;
+    batch.budget  = create_mem_budget(max_memory);
+    if ( ! batch.budget) {
+        free(batch.contexts);
+        free(batch.results);
+        return EXIT_FAILURE;
+    }
+
+    /* Process largest files first to balance load between threads */
+    for (i = 0; i < num_files; i++) {
+        batch.results[i].filename   = filenames[i];
+        batch.results[i].input_size = get_file_size(filenames[i]);
+    }
+
+    qsort(batch.results, num_files, sizeof(FILE_RESULT), compare_input_size);
+
+    err = run_parallel(num_files, num_threads, compress_batch_item, &batch);
+
+    time_us = get_time_us() - start;
+
+    for (i = 0; i < num_files; i++) {
+        if (batch.results[i].error)
+            ++num_failed;
+        else {
+            total_input  += batch.results[i].input_size;
+            total_output += batch.results[i].output_size;
+        }
+    }
+
+    if (is_verbose(options)) {
+        printf("%s %zu files (%zu failed) using %u threads in %.3f s\n",
+               options->estimate ? "Estimated" : "Compressed",
+               num_files - num_failed, num_failed, num_threads, (double)time_us / 1e6);
+        printf("Total %zu -> %zu (%zu %%), %.2f MB/s\n",
+               total_input,
+               total_output,
+               total_input ? (total_output * 100 / total_input) : 0,
+               time_us ? ((double)total_input / (double)time_us) : 0.0);
+    }
+
+    for (i = 0; i < num_threads; i++)
+        destroy_minify_ctx(batch.contexts[i]);
+
+    destroy_mem_budget(batch.budget);
+    free(batch.contexts);
+    free(batch.results);
+
+    return (err || num_failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Appends file names from a manifest, one file name per line */
+static int load_manifest(const char *manifest, char ***filenames, size_t *num_files, char **storage)
+{
+    BUFFER buf;
+    char  *line;
+    char  *end;
+
+    buf = load_file(manifest);
+    if ( ! buf.size)
+        return EXIT_FAILURE;
+
+    *storage = (char *)realloc(buf.buf, buf.size + 1);
+    if ( ! *storage) {
+        perror(NULL);
         free(buf.buf);
+        return EXIT_FAILURE;
+    }
+
+    line = *storage;
+    end  = line + buf.size;
+    *end = 0;
+
+    while (line < end) {
+        char *eol = line + strcspn(line, "\r\n");
+        char **new_filenames;
+
+        *eol = 0;
 
-        return err;
+        /* Skip empty lines and comments */
+        if ( ! *line || *line == '#') {
+            line = eol + 1;
+            continue;
+        }
+
+        new_filenames = (char **)realloc(*filenames, (*num_files + 1) * sizeof(char *));
+        if ( ! new_filenames) {
+            perror(NULL);
+            return EXIT_FAILURE;
+        }
+
+        *filenames = new_filenames;
+        (*filenames)[(*num_files)++] = line;
+
+        line = eol + 1;
     }
 
-    compr_buffer_size   = estimate_compress_size(buf.size);
-    decompr_buffer_size = buf.size * 3;
+    return EXIT_SUCCESS;
+}
 
-    dest = (uint8_t *)malloc(compr_buffer_size + decompr_buffer_size);
-    if ( ! dest) {
+/* Trains dictionary on the input files and saves it in dict_file */
+static int train_dictionary(const char        *dict_file,
+                            const char *const *filenames,
+                            size_t             num_files,
+                            size_t             dict_size,
+                            int                verbose)
+{
+    FILE_VIEW *inputs;
+    BUFFER    *samples;
+    BUFFER     dict;
+    FILE      *file;
+    size_t     i;
+    int        err = EXIT_FAILURE;
+
+    inputs  = (FILE_VIEW *)calloc(num_files, sizeof(FILE_VIEW));
+    samples = (BUFFER *)calloc(num_files, sizeof(BUFFER));
+    if ( ! inputs || ! samples) {
         perror(NULL);
+        free(samples);
+        free(inputs);
         return EXIT_FAILURE;
     }
 
-    decompressed = dest + compr_buffer_size;
+    for (i = 0; i < num_files; i++) {
+        inputs[i]  = map_file(filenames[i]);
+        samples[i] = inputs[i].data;
+        if ( ! samples[i].size)
+            break;
+    }
+
+    if (i == num_files) {
+        dict = train_dict(samples, num_files, dict_size);
+
+        if ( ! dict.size)
+            fprintf(stderr, "Error: Input files have nothing in common to put in a dictionary\n");
+        else {
+            file = fopen(dict_file, "wb");
+            if ( ! file)
+                perror(dict_file);
+            else {
+                if (fwrite(dict.buf, 1, dict.size, file) != dict.size)
+                    fprintf(stderr, "Error: Failed to write to file %s\n", dict_file);
+                else
+                    err = EXIT_SUCCESS;
+
+                if (fclose(file) && ! err) {
+                    perror(dict_file);
+                    err = EXIT_FAILURE;
+                }
+            }
+
+            if ( ! err && verbose)
+                printf("Saved dictionary of %zu bytes trained on %zu files in %s\n",
+                       dict.size, num_files, dict_file);
+
+            buf_free(dict);
+        }
+    }
+
+    for (i = 0; i < num_files; i++)
+        unmap_file(&inputs[i]);
+
+    free(samples);
+    free(inputs);
+
+    return err;
+}
+
+/* Creates patch from old_file to new_file, or applies patch to old_file */
+static int make_patch(int                  mode,
+                      const char          *old_file,
+                      const char          *new_file,
+                      const PARSER_PARAMS *params,
+                      size_t               memory_budget)
+{
+    FILE_VIEW     old_view;
+    FILE_VIEW     new_view;
+    PARSER_PARAMS patch_params = *params;
+    int           err          = EXIT_FAILURE;
 
-    compressed = lza_compress(dest, compr_buffer_size, buf.buf, buf.size);
+    memset(&new_view, 0, sizeof(new_view));
 
-    if ( ! compressed.lz)
+    old_view = map_file(old_file);
+    if ( ! old_view.data.size)
         return EXIT_FAILURE;
 
-    lza_decompress(decompressed,
-                   buf.size,
-                   decompr_buffer_size - buf.size,
-                   dest,
-                   compressed.compressed);
+    if (mode == 'p')
+        err = apply_patch(old_view.data, stdin, stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+    else {
+        new_view = map_file(new_file);
 
-    if (memcmp(buf.buf, decompressed, buf.size)) {
-        fprintf(stderr, "Decompressed output doesn't match input data\n");
+        if (new_view.data.size) {
+            const size_t size = old_view.data.size + new_view.data.size;
+
+            patch_params.deadline_us = get_search_deadline(params->deadline_us, new_view.data.size);
+
+            if (memory_budget)
+                patch_params.max_map_size = get_map_budget(new_file, memory_budget,
+                                                           estimate_generic_memory(size));
+
+            err = create_patch(old_view.data, new_view.data, stdout, &patch_params)
+                  ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+
+        unmap_file(&new_view);
+    }
+
+    unmap_file(&old_view);
+
+    return err;
+}
+
+/* Writes a range of data compressed with -c in file to stdout */
+static int extract_range(const char *filename, uint64_t offset, size_t length, const BUFFER *dict)
+{
+    FILE_VIEW view;
+    BUFFER    output;
+    int       err = EXIT_FAILURE;
+
+    view = map_file(filename);
+    if ( ! view.data.size)
         return EXIT_FAILURE;
+
+    output = buf_alloc_flags(length, 0);
+    if ( ! output.buf)
+        perror(NULL);
+    else if ( ! lza_decompress_range(view.data.buf, view.data.size, offset, output.buf, length, dict)) {
+        if (fwrite(output.buf, 1, length, stdout) != length || fflush(stdout))
+            perror("Error: Failed to write output");
+        else
+            err = EXIT_SUCCESS;
+    }
+
+    buf_free(output);
+    unmap_file(&view);
+
+    return err;
+}
+
+/* Parses OFFSET,LENGTH, offset can be 0 */
+static int parse_range(const char *value, uint64_t *offset, size_t *length)
+{
+    char *end;
+
+    *offset = strtoull(value, &end, 10);
+    if (end != value && *end == ',') {
+        const char *const length_str = end + 1;
+
+        *length = (size_t)strtoull(length_str, &end, 10);
+        if (end != length_str && ! *end && *length)
+            return EXIT_SUCCESS;
     }
 
-    printf("Original    %zu bytes\n", buf.size);
-    printf("LZ77        %zu bytes\n", compressed.lz);
-    printf("Entropy     %zu bytes (%zu%%)\n", compressed.compressed, compressed.compressed * 100 / buf.size);
+    fprintf(stderr, "Error: Invalid value for --range: %s\n", value);
+    return EXIT_FAILURE;
+}
 
-    printf("LIT         %zu\n", compressed.stats_lit);
-    printf("MATCH       %zu\n", compressed.stats_match);
-    printf("SHORTREP    %zu\n", compressed.stats_shortrep);
-    printf("LONGREP0    %zu\n", compressed.stats_longrep[0]);
-    printf("LONGREP1    %zu\n", compressed.stats_longrep[1]);
-    printf("LONGREP2    %zu\n", compressed.stats_longrep[2]);
-    printf("LONGREP3    %zu\n", compressed.stats_longrep[3]);
+static int parse_number(const char *arg, const char *value, size_t *out_value)
+{
+    char         *end;
+    unsigned long number;
 
-    free(dest);
-    free(buf.buf);
+    if ( ! value || ! *value) {
+        fprintf(stderr, "Error: Missing value for %s\n", arg);
+        return EXIT_FAILURE;
+    }
 
+    number = strtoul(value, &end, 10);
+    if (*end || ! number) {
+        fprintf(stderr, "Error: Invalid value for %s: %s\n", arg, value);
+        return EXIT_FAILURE;
+    }
+
+    *out_value = number;
     return EXIT_SUCCESS;
 }
+
+static void print_usage(void)
+{
+    fprintf(stderr, "Usage: minify [OPTIONS] FILE...\n");
+    fprintf(stderr, "       minify -c|-d [--block-size=KB] [--dict=FILE] < INPUT > OUTPUT\n");
+    fprintf(stderr, "       minify --train-dict=FILE [--dict-size=KB] SAMPLE...\n");
+    fprintf(stderr, "       minify --range=OFFSET,LENGTH [--dict=FILE] COMPRESSED > OUTPUT\n");
+    fprintf(stderr, "       minify --delta OLD NEW > PATCH\n");
+    fprintf(stderr, "       minify --patch OLD < PATCH > NEW\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    --analyze            Print compressed size of sections and pages of executables\n");
+    fprintf(stderr, "    --block-size=KB      Block size for -c, default 1024\n");
+    fprintf(stderr, "    --cache=DIR          Reuse compressed executables stored in DIR\n");
+    fprintf(stderr, "    --cache-size=MB      Size limit of the cache, default 1024\n");
+    fprintf(stderr, "    -c, --stdout         Compress stdin to stdout\n");
+    fprintf(stderr, "    -d, --decompress     Decompress stdin to stdout\n");
+    fprintf(stderr, "    --delta OLD          Write patch, which turns OLD into the input file, to stdout\n");
+    fprintf(stderr, "    --dict=FILE          Use dictionary for -c, -d and for files other than executables\n");
+    fprintf(stderr, "    --dict-size=KB       Maximum size of the trained dictionary, default %u\n",
+            DEFAULT_DICT_SIZE >> 10);
+    fprintf(stderr, "    --estimate           Quickly estimate compressed size without saving output\n");
+    fprintf(stderr, "    --heatmap=csv|pgm    Save compressed size per page in FILE.heatmap.csv|pgm\n");
+    fprintf(stderr, "    -j N, --jobs=N       Number of files compressed in parallel\n");
+    fprintf(stderr, "    --lazy[=KB]          Decompress blocks of Linux executables on first touch, default %u\n",
+            DEFAULT_ELF_LAZY_BLOCK_SIZE >> 10);
+    fprintf(stderr, "    --manifest=FILE      Compress files listed in FILE, one per line\n");
+    fprintf(stderr, "    --max-memory=MB      Memory limit for files compressed in parallel\n");
+    fprintf(stderr, "    --memory-budget=MB   Limit memory by using a smaller match finder window\n");
+    fprintf(stderr, "    --patch OLD          Apply patch from stdin to OLD and write the result to stdout\n");
+    fprintf(stderr, "    --perf               Count hardware events in each phase (Linux only)\n");
+    fprintf(stderr, "    --profile=FILE       Load match finder parameters produced by tune\n");
+    fprintf(stderr, "    -q, --quiet          Don't print anything except errors\n");
+    fprintf(stderr, "    --range=OFF,LEN      Decompress LEN bytes at OFF from data compressed with -c\n");
+    fprintf(stderr, "    --report=json        Print statistics as one JSON record per file\n");
+    fprintf(stderr, "    --seek-table         Append table of block positions to output of -c for --range\n");
+    fprintf(stderr, "    --time-budget=SEC    Reduce search effort to finish within SEC seconds\n");
+    fprintf(stderr, "    --train-dict=FILE    Train dictionary on the input files and save it in FILE\n");
+}
+
+int main(int argc, char *argv[])
+{
+    OUTPUT_OPTIONS options          = { 0, 0, 0, HEATMAP_NONE, 0 };
+    const uint64_t start_time       = get_time_us();
+    char         **filenames        = NULL;
+    char          *manifest_storage = NULL;
+    size_t         num_files        = 0;
+    size_t         num_threads      = 0;
+    size_t         max_memory_mb    = 4096;
+    size_t         memory_budget_mb = 0;
+    size_t         time_budget_s    = 0;
+    size_t         block_size_kb    = DEFAULT_STREAM_BLOCK_SIZE >> 10;
+    size_t         cache_size_mb    = 1024;
+    size_t         dict_size_kb     = DEFAULT_DICT_SIZE >> 10;
+    const char    *cache_dir        = NULL;
+    const char    *dict_file        = NULL;
+    const char    *train_file       = NULL;
+    const char    *delta_file       = NULL;
+    int            delta_mode       = 0;
+    int            range_mode       = 0;
+    int            seek_table       = 0;
+    uint64_t       range_offset     = 0;
+    size_t         range_length     = 0;
+    CACHE         *cache            = NULL;
+    int            batch            = 0;
+    int            stream_mode      = 0;
+    int            err              = EXIT_SUCCESS;
+    int            i;
+
+    get_default_parser_params(&options.params);
+
+    for (i = 1; i < argc && ! err; i++) {
+        const char *const arg = argv[i];
+
+        if ( ! strcmp(arg, "-j")) {
+            err   = parse_number(arg, (i + 1 < argc) ? argv[++i] : NULL, &num_threads);
+            batch = 1;
+        }
+        else if ( ! strncmp(arg, "--jobs=", 7)) {
+            err   = parse_number("--jobs", arg + 7, &num_threads);
+            batch = 1;
+        }
+        else if ( ! strncmp(arg, "--max-memory=", 13)) {
+            err   = parse_number("--max-memory", arg + 13, &max_memory_mb);
+            batch = 1;
+        }
+        else if ( ! strncmp(arg, "--memory-budget=", 16))
+            err = parse_number("--memory-budget", arg + 16, &memory_budget_mb);
+        else if ( ! strncmp(arg, "--time-budget=", 14))
+            err = parse_number("--time-budget", arg + 14, &time_budget_s);
+        else if ( ! strncmp(arg, "--manifest=", 11)) {
+            if (manifest_storage) {
+                fprintf(stderr, "Error: Only one manifest is supported\n");
+                err = EXIT_FAILURE;
+            }
+            else
+                err = load_manifest(arg + 11, &filenames, &num_files, &manifest_storage);
+            batch = 1;
+        }
+        else if ( ! strcmp(arg, "--delta") || ! strcmp(arg, "--patch")) {
+            delta_mode = arg[2];
+            delta_file = (i + 1 < argc) ? argv[++i] : NULL;
+            if ( ! delta_file) {
+                fprintf(stderr, "Error: Missing file name for %s\n", arg);
+                err = EXIT_FAILURE;
+            }
+        }
+        else if ( ! strncmp(arg, "--range=", 8)) {
+            err        = parse_range(arg + 8, &range_offset, &range_length);
+            range_mode = 1;
+        }
+        else if ( ! strcmp(arg, "--seek-table"))
+            seek_table = 1;
+        else if ( ! strcmp(arg, "-c") || ! strcmp(arg, "--stdout"))
+            stream_mode = 'c';
+        else if ( ! strcmp(arg, "-d") || ! strcmp(arg, "--decompress"))
+            stream_mode = 'd';
+        else if ( ! strncmp(arg, "--cache=", 8))
+            cache_dir = arg + 8;
+        else if ( ! strncmp(arg, "--cache-size=", 13))
+            err = parse_number("--cache-size", arg + 13, &cache_size_mb);
+        else if ( ! strncmp(arg, "--block-size=", 13))
+            err = parse_number("--block-size", arg + 13, &block_size_kb);
+        else if ( ! strncmp(arg, "--dict=", 7))
+            dict_file = arg + 7;
+        else if ( ! strncmp(arg, "--dict-size=", 12))
+            err = parse_number("--dict-size", arg + 12, &dict_size_kb);
+        else if ( ! strncmp(arg, "--train-dict=", 13))
+            train_file = arg + 13;
+        else if ( ! strcmp(arg, "--analyze"))
+            options.analyze = 1;
+        else if ( ! strcmp(arg, "--estimate"))
+            options.estimate = 1;
+        else if ( ! strncmp(arg, "--heatmap=", 10)) {
+            if ( ! strcmp(arg + 10, "csv"))
+                options.heatmap = HEATMAP_CSV;
+            else if ( ! strcmp(arg + 10, "pgm"))
+                options.heatmap = HEATMAP_PGM;
+            else {
+                fprintf(stderr, "Error: Unsupported heat map format %s\n", arg + 10);
+                err = EXIT_FAILURE;
+            }
+            options.analyze = 1;
+        }
+        else if ( ! strcmp(arg, "--lazy"))
+            options.lazy_block_size = DEFAULT_ELF_LAZY_BLOCK_SIZE;
+        else if ( ! strncmp(arg, "--lazy=", 7)) {
+            size_t lazy_kb = 0;
+
+            err = parse_number("--lazy", arg + 7, &lazy_kb);
+            if ( ! err && ( ! lazy_kb || lazy_kb % 4 || lazy_kb > (1U << 20))) {
+                fprintf(stderr, "Error: --lazy block size must be a multiple of 4 KB up to 1 GB\n");
+                err = EXIT_FAILURE;
+            }
+            options.lazy_block_size = (uint32_t)(lazy_kb << 10);
+        }
+        else if ( ! strcmp(arg, "--perf"))
+            options.perf = 1;
+        else if ( ! strncmp(arg, "--profile=", 10))
+            err = load_profile(arg + 10, &options.params) ? EXIT_FAILURE : EXIT_SUCCESS;
+        else if ( ! strcmp(arg, "-q") || ! strcmp(arg, "--quiet"))
+            options.quiet = 1;
+        else if ( ! strncmp(arg, "--report=", 9)) {
+            if (strcmp(arg + 9, "json")) {
+                fprintf(stderr, "Error: Unsupported report format %s\n", arg + 9);
+                err = EXIT_FAILURE;
+            }
+            options.json_report = 1;
+        }
+        else if (arg[0] == '-' && arg[1]) {
+            fprintf(stderr, "Error: Unknown option %s\n", arg);
+            err = EXIT_FAILURE;
+        }
+        else {
+            char **const new_filenames = (char **)realloc(filenames, (num_files + 1) * sizeof(char *));
+            if ( ! new_filenames) {
+                perror(NULL);
+                err = EXIT_FAILURE;
+            }
+            else {
+                filenames              = new_filenames;
+                filenames[num_files++] = argv[i];
+            }
+        }
+    }
+
+    if (num_files > 1)
+        batch = 1;
+
+    /* All files share the deadline, each file's match finder finishes
+     * early enough to leave time for the other phases.
+     */
+    if (time_budget_s)
+        options.params.deadline_us = start_time + (uint64_t)time_budget_s * 1000000U;
+
+    if ( ! err && options.perf) {
+        PERF_COUNTERS *const perf = open_perf_counters();
+
+        if ( ! perf) {
+            fprintf(stderr, "Warning: Hardware performance counters are not available, ignoring --perf\n");
+            options.perf = 0;
+        }
+
+        close_perf_counters(perf);
+    }
+
+    if ( ! err && dict_file) {
+        options.dict = load_file(dict_file);
+
+        if ( ! options.dict.size)
+            err = EXIT_FAILURE;
+        else if (options.dict.size > MAX_DICT_SIZE) {
+            fprintf(stderr, "Error: Dictionary %s is larger than %u MB\n", dict_file, MAX_DICT_SIZE >> 20);
+            err = EXIT_FAILURE;
+        }
+    }
+
+    if ( ! err && dict_size_kb > (MAX_DICT_SIZE >> 10)) {
+        fprintf(stderr, "Error: Dictionary size is larger than %u KB\n", MAX_DICT_SIZE >> 10);
+        err = EXIT_FAILURE;
+    }
+
+    if ( ! err && cache_dir && ! stream_mode && ! train_file) {
+        cache = open_cache(cache_dir, (uint64_t)cache_size_mb << 20);
+        if ( ! cache)
+            err = EXIT_FAILURE;
+    }
+
+    if ( ! err && delta_mode) {
+        if (stream_mode || train_file || batch || num_files != (delta_mode == 'd' ? 1U : 0U)) {
+            fprintf(stderr, "Error: Invalid arguments for --%s\n", (delta_mode == 'd') ? "delta" : "patch");
+            print_usage();
+            err = EXIT_FAILURE;
+        }
+        else {
+#ifdef _WIN32
+            _setmode(_fileno(stdin), _O_BINARY);
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            err = make_patch(delta_mode, delta_file, (delta_mode == 'd') ? filenames[0] : NULL,
+                             &options.params, memory_budget_mb << 20);
+        }
+    }
+    else if ( ! err && range_mode) {
+        if (stream_mode || train_file || batch || num_files != 1) {
+            fprintf(stderr, "Error: Invalid arguments for --range\n");
+            print_usage();
+            err = EXIT_FAILURE;
+        }
+        else {
+#ifdef _WIN32
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            err = extract_range(filenames[0], range_offset, range_length, &options.dict);
+        }
+    }
+    else if ( ! err && train_file) {
+        if (stream_mode || ! num_files) {
+            fprintf(stderr, "Error: Sample files must be specified with --train-dict\n");
+            print_usage();
+            err = EXIT_FAILURE;
+        }
+        else
+            err = train_dictionary(train_file, (const char *const *)filenames, num_files,
+                                   dict_size_kb << 10, is_verbose(&options));
+    }
+    else if ( ! err && stream_mode) {
+        if (num_files || batch) {
+            fprintf(stderr, "Error: Files cannot be specified with -%c\n", stream_mode);
+            print_usage();
+            err = EXIT_FAILURE;
+        }
+        else {
+#ifdef _WIN32
+            _setmode(_fileno(stdin), _O_BINARY);
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            /* Size of the input is not known, so blocks are compressed with
+             * full effort until the deadline gets close.
+             */
+            options.params.deadline_us = get_search_deadline(options.params.deadline_us,
+                                                             block_size_kb << 10);
+
+            if (memory_budget_mb)
+                options.params.max_map_size = get_map_budget("stdin", memory_budget_mb << 20,
+                                                             estimate_generic_memory(block_size_kb << 10));
+
+            if (stream_mode == 'c')
+                err = compress_stream(stdin, stdout, block_size_kb << 10, &options.params, &options.dict,
+                                      seek_table);
+            else
+                err = decompress_stream(stdin, stdout, &options.dict);
+
+            err = err ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+    }
+    else if ( ! err && ! num_files) {
+        fprintf(stderr, "Error: Invalid arguments\n");
+        print_usage();
+        err = EXIT_FAILURE;
+    }
+    else if ( ! err && batch) {
+        if ( ! num_threads)
+            num_threads = get_num_cpus();
+
+        /* Files compressed in parallel share the memory budget */
+        if (memory_budget_mb) {
+            options.memory_budget = (memory_budget_mb << 20) / num_threads;
+
+            if (max_memory_mb > memory_budget_mb)
+                max_memory_mb = memory_budget_mb;
+        }
+
+        err = compress_batch((const char *const *)filenames, num_files,
+                             (uint32_t)num_threads, max_memory_mb << 20, cache, &options);
+    }
+    else if ( ! err) {
+        FILE_RESULT       result;
+        const uint64_t    start = get_time_us();
+        MINIFY_CTX *const ctx   = create_minify_ctx();
+
+        memset(&result, 0, sizeof(result));
+
+        options.memory_budget = memory_budget_mb << 20;
+
+        err            = ctx ? compress_file(ctx, cache, filenames[0], NULL, &options, &result)
+                             : EXIT_FAILURE;
+        result.time_us = get_time_us() - start;
+
+        destroy_minify_ctx(ctx);
+
+        if (options.json_report)
+            write_json_report(stdout, filenames[0], err, result.input_size,
+                              result.output_size, result.time_us, &result.report);
+        else if ( ! err && ! options.quiet)
+            printf("%s %zu -> %zu (%zu %%)\n",
+                   options.estimate ? "Estimated" : "Compressed",
+                   result.input_size, result.output_size, result.output_size * 100 / result.input_size);
+    }
+
+    close_cache(cache);
+    buf_free(options.dict);
+    free(filenames);
+    free(manifest_storage);
+
+    return err;
+}
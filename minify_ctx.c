@@ -0,0 +1,166 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "minify_ctx.h"
+#include "arena.h"
+#include "arith_encode.h"
+#include "buffer.h"
+#include "find_repeats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct MINIFY_CTX_STRUCT {
+    ARENA          arena;     /* Scratch memory, reset for each input */
+    OFFSET_MAP    *map;       /* Match finder state, reused between inputs */
+    PARSER_PARAMS  params;    /* Applied to the offset map whenever it is created */
+    const uint8_t *dict;      /* Prefix of each input, owned by the caller */
+    size_t         dict_size;
+};
+
+/* Address space is only reserved, memory is committed as it is used */
+static size_t get_arena_size(void)
+{
+    return (sizeof(void *) > 4) ? ((size_t)1 << 30) : ((size_t)1 << 26);
+}
+
+MINIFY_CTX *create_minify_ctx(void)
+{
+    MINIFY_CTX *const ctx = (MINIFY_CTX *)calloc(1, sizeof(MINIFY_CTX));
+
+    if ( ! ctx) {
+        perror(NULL);
+        return NULL;
+    }
+
+    /* If address space cannot be reserved, scratch memory comes from the heap */
+    arena_init(&ctx->arena, get_arena_size());
+
+    get_default_parser_params(&ctx->params);
+
+    return ctx;
+}
+
+/* The offset map outlives scratch memory, so it is allocated from the heap */
+static void destroy_map(MINIFY_CTX *ctx)
+{
+    if (ctx->map) {
+        ARENA *const prev_arena = set_current_arena(NULL);
+
+        destroy_offset_map(ctx->map);
+        ctx->map = NULL;
+
+        set_current_arena(prev_arena);
+    }
+}
+
+static int ensure_map(MINIFY_CTX *ctx, size_t size)
+{
+    ARENA *prev_arena;
+
+    size = get_offset_map_input_size(size, &ctx->params);
+
+    if (ctx->map && size <= get_offset_map_capacity(ctx->map))
+        return 0;
+
+    destroy_map(ctx);
+
+    prev_arena = set_current_arena(NULL);
+    ctx->map   = create_offset_map(size);
+    set_current_arena(prev_arena);
+
+    if ( ! ctx->map)
+        return 1;
+
+    set_offset_map_params(ctx->map, &ctx->params);
+
+    return 0;
+}
+
+void destroy_minify_ctx(MINIFY_CTX *ctx)
+{
+    if ( ! ctx)
+        return;
+
+    destroy_map(ctx);
+    arena_destroy(&ctx->arena);
+    free(ctx);
+}
+
+void set_minify_ctx_params(MINIFY_CTX *ctx, const PARSER_PARAMS *params)
+{
+    ctx->params = *params;
+
+    if (ctx->map)
+        set_offset_map_params(ctx->map, params);
+}
+
+void set_minify_ctx_dict(MINIFY_CTX *ctx, const void *dict, size_t size)
+{
+    ctx->dict      = size ? (const uint8_t *)dict : NULL;
+    ctx->dict_size = size;
+}
+
+void reset_minify_ctx(MINIFY_CTX *ctx)
+{
+    arena_reset(&ctx->arena);
+}
+
+size_t get_minify_ctx_peak_memory(const MINIFY_CTX *ctx)
+{
+    return ctx->arena.peak + (ctx->map ? get_offset_map_size(ctx->map) : 0);
+}
+
+COMPRESSED_SIZES minify_compress(MINIFY_CTX *ctx,
+                                 void       *dest,
+                                 size_t      dest_size,
+                                 const void *src,
+                                 size_t      src_size)
+{
+    COMPRESSED_SIZES compressed;
+    ARENA           *prev_arena;
+    BUFFER           lz_buf;
+    BUFFER           input;
+
+    memset(&compressed, 0, sizeof(compressed));
+    memset(&input, 0, sizeof(input));
+
+    if ( ! src_size || ensure_map(ctx, ctx->dict_size + src_size))
+        return compressed;
+
+    reset_minify_ctx(ctx);
+
+    prev_arena = set_current_arena(&ctx->arena);
+
+    /* The match finder needs the dictionary right in front of the input */
+    if (ctx->dict_size) {
+        input = buf_alloc_flags(ctx->dict_size + src_size, 0);
+        if (input.buf) {
+            memcpy(input.buf, ctx->dict, ctx->dict_size);
+            memcpy(input.buf + ctx->dict_size, src, src_size);
+            src = input.buf + ctx->dict_size;
+        }
+    }
+
+    lz_buf = buf_alloc_flags(lz_compress_bound(src_size), 0);
+    if ( ! lz_buf.buf || (ctx->dict_size && ! input.buf))
+        perror(NULL);
+    else {
+        compressed = lz_compress_with_prefix(ctx->map, lz_buf.buf, lz_buf.size, src, src_size,
+                                             ctx->dict_size);
+
+        if (compressed.lz)
+            compressed.compressed = arith_encode(dest, dest_size, lz_buf.buf, compressed.lz);
+    }
+
+    if (lz_buf.buf)
+        buf_free(lz_buf);
+    if (input.buf)
+        buf_free(input);
+
+    set_current_arena(prev_arena);
+
+    return compressed;
+}
@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include "lza_compress.h"
+
+#include <stddef.h>
+
+/* Compression context which owns match finder state and scratch memory,
+ * which are reused between inputs.  Compressing many small inputs with one
+ * context avoids allocating and clearing this state for every input.
+ *
+ * A context must only be used by one thread at a time, multiple threads
+ * can compress in parallel if each of them uses its own context.
+ */
+typedef struct MINIFY_CTX_STRUCT MINIFY_CTX;
+
+MINIFY_CTX *create_minify_ctx(void);
+void        destroy_minify_ctx(MINIFY_CTX *ctx);
+
+/* Sets heuristics of the match finder used for subsequent inputs */
+void set_minify_ctx_params(MINIFY_CTX *ctx, const PARSER_PARAMS *params);
+
+/* Sets dictionary, which is used as a prefix of subsequent inputs.  The
+ * dictionary is not copied and must remain valid while the context is used.
+ * Output must be decompressed with the same dictionary in front of it,
+ * see lza_decompress_with_prefix().  Size 0 removes the dictionary.
+ */
+void set_minify_ctx_dict(MINIFY_CTX *ctx, const void *dict, size_t size);
+
+/* Releases scratch memory for reuse.  This is done automatically for each
+ * input.  The match finder state is not cleared, entries from previous
+ * inputs are skipped and the state is only cleared once it fills up.
+ */
+void reset_minify_ctx(MINIFY_CTX *ctx);
+
+/* Returns peak memory used by the last input, which includes scratch memory
+ * and the match finder state
+ */
+size_t get_minify_ctx_peak_memory(const MINIFY_CTX *ctx);
+
+/* Compresses input with LZ77 and arithmetic coding, the output is the same
+ * as from lza_compress().  If compressed size in the returned value exceeds
+ * dest_size, the output was truncated.  On error, the returned sizes are 0.
+ */
+COMPRESSED_SIZES minify_compress(MINIFY_CTX *ctx,
+                                 void       *dest,
+                                 size_t      dest_size,
+                                 const void *src,
+                                 size_t      src_size);
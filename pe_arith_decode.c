@@ -153,3 +153,21 @@ L2:
     }
 }
 #endif
+
+// GCC calls __udivdi3 in 32-bit builds to perform 64-bit division.  The decoder only
+// divides by 32-bit values, so two 32-bit divisions are enough.
+#if defined(__GNUC__) && defined(__i386__)
+uint64_t __udivdi3(uint64_t dividend, uint64_t divisor)
+{
+    const uint32_t dvsr = (uint32_t)divisor;
+    const uint32_t hi   = (uint32_t)(dividend >> 32);
+    uint32_t       quot_lo;
+    uint32_t       rem;
+
+    __asm__("divl %4"
+            : "=a" (quot_lo), "=d" (rem)
+            : "a" ((uint32_t)dividend), "d" (hi % dvsr), "rm" (dvsr));
+
+    return ((uint64_t)(hi / dvsr) << 32) | quot_lo;
+}
+#endif
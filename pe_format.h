@@ -0,0 +1,295 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Auxiliary endianness-agnostic data types */
+
+typedef struct {
+    uint8_t bytes[2];
+} uint16_le;
+
+typedef struct {
+    uint8_t bytes[4];
+} uint32_le;
+
+typedef struct {
+    uint8_t bytes[8];
+} uint64_le;
+
+inline static uint16_t get_uint16_le(uint16_le data)
+{
+    return (uint16_t)((uint32_t)data.bytes[0] + ((uint32_t)data.bytes[1] << 8));
+}
+
+inline static uint32_t get_uint32_le(uint32_le data)
+{
+    return (uint32_t)data.bytes[0] +
+           ((uint32_t)data.bytes[1] << 8) +
+           ((uint32_t)data.bytes[2] << 16) +
+           ((uint32_t)data.bytes[3] << 24);
+}
+
+inline static uint64_t get_uint64_le(uint64_le data)
+{
+    return (uint64_t)data.bytes[0] +
+           ((uint64_t)data.bytes[1] << 8) +
+           ((uint64_t)data.bytes[2] << 16) +
+           ((uint64_t)data.bytes[3] << 24) +
+           ((uint64_t)data.bytes[4] << 32) +
+           ((uint64_t)data.bytes[5] << 40) +
+           ((uint64_t)data.bytes[6] << 48) +
+           ((uint64_t)data.bytes[7] << 56);
+}
+
+inline static uint16_le make_uint16_le(uint16_t value)
+{
+    uint16_le data;
+
+    data.bytes[0] = (uint8_t)(value & 0xFFU);
+    data.bytes[1] = (uint8_t)((value >> 8) & 0xFFU);
+
+    return data;
+}
+
+inline static uint32_le make_uint32_le(uint32_t value)
+{
+    uint32_le data;
+
+    data.bytes[0] = (uint8_t)(value & 0xFFU);
+    data.bytes[1] = (uint8_t)((value >> 8) & 0xFFU);
+    data.bytes[2] = (uint8_t)((value >> 16) & 0xFFU);
+    data.bytes[3] = (uint8_t)((value >> 24) & 0xFFU);
+
+    return data;
+}
+
+inline static uint64_le make_uint64_le(uint64_t value)
+{
+    uint64_le data;
+
+    data.bytes[0] = (uint8_t)(value & 0xFFU);
+    data.bytes[1] = (uint8_t)((value >> 8) & 0xFFU);
+    data.bytes[2] = (uint8_t)((value >> 16) & 0xFFU);
+    data.bytes[3] = (uint8_t)((value >> 24) & 0xFFU);
+    data.bytes[4] = (uint8_t)((value >> 32) & 0xFFU);
+    data.bytes[5] = (uint8_t)((value >> 40) & 0xFFU);
+    data.bytes[6] = (uint8_t)((value >> 48) & 0xFFU);
+    data.bytes[7] = (uint8_t)((value >> 56) & 0xFFU);
+
+    return data;
+}
+
+/* Structures representing various data structures in PE files */
+/* Reference: https://learn.microsoft.com/en-us/windows/win32/debug/pe-format */
+
+/* The MZ (DOS) header is located at offset 0 in a PE file */
+typedef struct {
+    uint16_le mz_signature;
+    uint8_t   useless[0x3A];
+    uint32_le pe_offset;
+} DOS_HEADER;
+
+/* The PE header is located at offset `pe_offset` from the beginning of the file */
+typedef struct {
+    uint32_le pe_signature;
+    uint16_le machine;
+    uint16_le number_of_sections; /* Sections follow the optional header */
+    uint32_le time_date_stamp;
+    uint32_le symbol_table_offset;
+    uint32_le number_of_symbols;
+    uint16_le optional_hdr_size; /* "Optional" header is the PE32_HEADER */
+    uint16_le flags;
+} PE_HEADER;
+
+#define PE_MACHINE_X86_32  0x014C
+#define PE_MACHINE_X86_64  0x8664
+#define PE_MACHINE_AARCH64 0xAA64
+
+#define PE_FLAG_RELOCS_STRIPPED     0x0001
+#define PE_FLAG_EXECUTABLE_IMAGE    0x0002
+#define PE_FLAG_LARGE_ADDRESS_AWARE 0x0020
+#define PE_FLAG_32BIT_MACHINE       0x0100
+#define PE_FLAG_DLL                 0x2000
+#define PE_FLAG_UNSUPPORTED         0xD09C
+
+typedef struct {
+    uint32_le virtual_address;
+    uint32_le size;
+} DATA_DIRECTORY;
+
+/* The "optional" header immediately follows the PE header.
+ * The actual size of this header is specified in the PE header.
+ */
+typedef struct {
+    uint16_le pe_format;
+    uint8_t   linker_ver_major;
+    uint8_t   linker_ver_minor;
+    uint32_le size_of_code;
+    uint32_le size_of_data;
+    uint32_le size_of_uninitialized_data;
+    uint32_le entry_point;
+    uint32_le base_of_code;
+    union { /* Different layout between 32-bit and 64-bit executable */
+        struct {
+            uint32_le base_of_data;
+            uint32_le image_base;
+        } u32;
+        struct {
+            uint64_le image_base;
+        } u64;
+    } u1;
+    uint32_le section_alignment;
+    uint32_le file_alignment;
+    uint16_le min_os_ver_major;
+    uint16_le min_os_ver_minor;
+    uint16_le image_ver_major;
+    uint16_le image_ver_minor;
+    uint16_le subsystem_ver_major;
+    uint16_le subsystem_ver_minor;
+    uint32_le reserved_win32_version;
+    uint32_le size_of_image;
+    uint32_le size_of_headers;
+    uint32_le checksum;
+    uint16_le subsystem;
+    uint16_le dll_flags;
+    union { /* Different layout between 32-bit and 64-bit executable */
+        struct {
+            uint32_le size_of_stack_reserve;
+            uint32_le size_of_stack_commit;
+            uint32_le size_of_head_reserve;
+            uint32_le size_of_heap_commit;
+            uint32_le reserved_loader_flags;
+            uint32_le number_of_rva_and_sizes;
+            DATA_DIRECTORY rva_and_sizes[1]; /* There is one or more data directories */
+        } u32;                               /* at the end of the optional header */
+        struct {
+            uint64_le size_of_stack_reserve;
+            uint64_le size_of_stack_commit;
+            uint64_le size_of_head_reserve;
+            uint64_le size_of_heap_commit;
+            uint32_le reserved_loader_flags;
+            uint32_le number_of_rva_and_sizes;
+            DATA_DIRECTORY rva_and_sizes[1];
+        } u64;
+    } u2;
+} PE32_HEADER;
+
+#define PE_FORMAT_PE32      0x010B
+#define PE_FORMAT_PE32_PLUS 0x020B
+
+#define SUBSYSTEM_GUI 0x02
+#define SUBSYSTEM_CUI 0x03
+
+#define DIR_EXPORT_TABLE            0
+#define DIR_IMPORT_TABLE            1
+#define DIR_RESOURCE_TABLE          2
+#define DIR_EXCEPTION_TABLE         3
+#define DIR_CERTIFICATE_TABLE       4
+#define DIR_BASE_RELOCATION_TABLE   5
+#define DIR_DEBUG                   6
+#define DIR_ARCHITECTURE            7
+#define DIR_GLOBAL_PTR              8
+#define DIR_TLS_TABLE               9
+#define DIR_LOAD_CONFIG_TABLE       10
+#define DIR_BOUND_IMPORT            11
+#define DIR_IAT                     12
+#define DIR_DELAY_IMPORT_DESCRIPTOR 13
+#define DIR_CLR_RUNTIME_HEADER      14
+#define DIR_RESERVED                15
+
+/* Import directory is located at an RVA specified by DIR_IMPORT_TABLE data directory */
+typedef struct {
+    uint32_le import_lookup_table_rva;
+    uint32_le time_stamp;
+    uint32_le forwarder_chain;
+    uint32_le name_rva;
+    uint32_le import_address_table_rva;
+} IMPORT_DIR_ENTRY;
+
+/* Section headers immediately follow the optional header (after the
+ * data directory entries).  The number of section headers is specified
+ * by the `number_of_sections` member in the PE header.
+ */
+typedef struct {
+    char      name[8];
+    uint32_le virtual_size;
+    uint32_le virtual_address;
+    uint32_le size_of_raw_data;
+    uint32_le pointer_to_raw_data;
+    uint32_le pointer_to_relocations;
+    uint32_le pointer_to_line_numbers;
+    uint16_le number_of_relocations;
+    uint16_le number_of_line_numbers;
+    uint32_le flags;
+} SECTION_HEADER;
+
+#define SECTION_TYPE_NO_PAD            0x00000008U
+#define SECTION_CNT_CODE               0x00000020U
+#define SECTION_CNT_INITIALIZED_DATA   0x00000040U
+#define SECTION_CNT_UNINITIALIZED_DATA 0x00000080U
+#define SECTION_LNK_INFO               0x00000200U
+#define SECTION_LNK_REMOVE             0x00000800U
+#define SECTION_LNK_COMDAT             0x00001000U
+#define SECTION_GPREL                  0x00008000U
+#define SECTION_ALIGN_1BYTES           0x00100000U
+#define SECTION_ALIGN_2BYTES           0x00200000U
+#define SECTION_ALIGN_4BYTES           0x00300000U
+#define SECTION_ALIGN_8BYTES           0x00400000U
+#define SECTION_ALIGN_16BYTES          0x00500000U
+#define SECTION_ALIGN_32BYTES          0x00600000U
+#define SECTION_ALIGN_64BYTES          0x00700000U
+#define SECTION_ALIGN_128BYTES         0x00800000U
+#define SECTION_ALIGN_256BYTES         0x00900000U
+#define SECTION_ALIGN_512BYTES         0x00A00000U
+#define SECTION_ALIGN_1024BYTES        0x00B00000U
+#define SECTION_ALIGN_2048BYTES        0x00C00000U
+#define SECTION_ALIGN_4096BYTES        0x00D00000U
+#define SECTION_ALIGN_8192BYTES        0x00E00000U
+#define SECTION_LNK_NRELOC_OVFL        0x01000000U
+#define SECTION_MEM_DISCARDABLE        0x02000000U
+#define SECTION_MEM_NOT_CACHED         0x04000000U
+#define SECTION_MEM_NOT_PAGED          0x08000000U
+#define SECTION_MEM_SHARED             0x10000000U
+#define SECTION_MEM_EXECUTE            0x20000000U
+#define SECTION_MEM_READ               0x40000000U
+#define SECTION_MEM_WRITE              0x80000000U
+
+inline static const void *at_offset(const void *buf, uint32_t offset)
+{
+    return (const uint8_t *)buf + offset;
+}
+
+/* Returns offset of the PE header or 0 if the buffer does not contain a PE file */
+inline static uint32_t get_pe_offset(const void *buf, size_t size)
+{
+    const DOS_HEADER *dos_header;
+    const PE_HEADER  *pe_header;
+    uint32_t          pe_offset;
+
+    if (size < sizeof(DOS_HEADER))
+        return 0;
+
+    dos_header = (const DOS_HEADER *)buf;
+
+    /* "MZ" signature */
+    if (get_uint16_le(dos_header->mz_signature) != 0x5A4D)
+        return 0;
+
+    pe_offset = get_uint32_le(dos_header->pe_offset);
+
+    if (pe_offset + sizeof(PE_HEADER) > size)
+        return 0;
+
+    pe_header = (const PE_HEADER *)at_offset(buf, pe_offset);
+
+    /* "PE" signature */
+    if (get_uint32_le(pe_header->pe_signature) != 0x4550)
+        return 0;
+
+    return pe_offset;
+}
@@ -9,7 +9,8 @@ int STDCALL loader(const LIVE_LAYOUT *layout)
 {
     lz_decompress(layout->decomp_base,
                   (uint32_t)(layout->lz77_data - layout->decomp_base),
-                  layout->lz77_data);
+                  layout->lz77_data,
+                  layout->zero_regions);
 
     return layout->import_loader(layout);
 }
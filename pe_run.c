@@ -0,0 +1,323 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+/* Runs a Windows executable on Linux the way the Windows loader would, so
+ * that packed executables and the Windows loaders can be tested on Linux.
+ * It is built for the same architecture as the executable, without the C
+ * library.  The executable is read from stdin and it is mapped at its image
+ * base.  It can only import a few functions from KERNEL32.dll, which are
+ * implemented here with the same calling convention as on Windows.
+ * Exit code is the exit code of the executable.
+ */
+
+#include "pe_common.h"
+#include "pe_format.h"
+
+#ifdef __x86_64__
+#   define MACHINE   PE_MACHINE_X86_64
+#   define PE_FORMAT PE_FORMAT_PE32_PLUS
+#else
+#   define MACHINE   PE_MACHINE_X86_32
+#   define PE_FORMAT PE_FORMAT_PE32
+#endif
+
+#define EXIT_ERROR 255
+
+#define MAX_FILE_SIZE (1U << 20)
+
+typedef int (STDCALL * PROCESS_ENTRY)(void);
+
+/* Calls run() with the stack aligned as it would be by a function call
+ * and exits with the value it returns.
+ */
+#ifdef __x86_64__
+__asm__(".globl _start\n"
+        "_start:\n"
+        "    and  $-16, %rsp\n"
+        "    sub  $32, %rsp\n"
+        "    call run\n"
+        "    mov  %eax, %edi\n"
+        "    mov  $231, %eax\n"  /* exit_group */
+        "    syscall\n");
+
+static intptr_t sys_call(intptr_t num, intptr_t arg1, intptr_t arg2, intptr_t arg3)
+{
+    intptr_t ret;
+
+    __asm__ volatile("syscall"
+                     : "=a" (ret)
+                     : "a" (num), "D" (arg1), "S" (arg2), "d" (arg3)
+                     : "rcx", "r11", "memory");
+
+    return ret;
+}
+
+#define SYS_READ       0
+#define SYS_WRITE      1
+#define SYS_EXIT_GROUP 231
+
+static void *map_memory(uintptr_t addr, uint32_t size)
+{
+    register intptr_t flags __asm__("r10") = 0x100022; /* MAP_FIXED_NOREPLACE | MAP_ANONYMOUS | MAP_PRIVATE */
+    register intptr_t fd    __asm__("r8")  = -1;
+    register intptr_t offs  __asm__("r9")  = 0;
+    intptr_t          ret;
+
+    __asm__ volatile("syscall"
+                     : "=a" (ret)
+                     : "a" ((intptr_t)9), "D" (addr), "S" ((intptr_t)size), "d" ((intptr_t)7),
+                       "r" (flags), "r" (fd), "r" (offs)
+                     : "rcx", "r11", "memory");
+
+    return (void *)ret;
+}
+#else
+__asm__(".globl _start\n"
+        "_start:\n"
+        "    and  $-16, %esp\n"
+        "    call run\n"
+        "    mov  %eax, %ebx\n"
+        "    mov  $252, %eax\n"  /* exit_group */
+        "    int  $0x80\n");
+
+static intptr_t sys_call(intptr_t num, intptr_t arg1, intptr_t arg2, intptr_t arg3)
+{
+    intptr_t ret;
+
+    __asm__ volatile("int $0x80"
+                     : "=a" (ret)
+                     : "a" (num), "b" (arg1), "c" (arg2), "d" (arg3)
+                     : "memory");
+
+    return ret;
+}
+
+#define SYS_READ       3
+#define SYS_WRITE      4
+#define SYS_EXIT_GROUP 252
+
+static void *map_memory(uintptr_t addr, uint32_t size)
+{
+    /* Old mmap takes arguments in memory, because there is no register for the sixth one */
+    uint32_t args[6];
+
+    args[0] = (uint32_t)addr;
+    args[1] = size;
+    args[2] = 7;        /* PROT_READ | PROT_WRITE | PROT_EXEC */
+    args[3] = 0x100022; /* MAP_FIXED_NOREPLACE | MAP_ANONYMOUS | MAP_PRIVATE */
+    args[4] = ~0U;
+    args[5] = 0;
+
+    return (void *)sys_call(90, (intptr_t)args, 0, 0);
+}
+#endif
+
+static uint32_t str_len(const char *str)
+{
+    uint32_t len = 0;
+
+    while (str[len])
+        ++len;
+
+    return len;
+}
+
+/* DLL names are case-insensitive */
+static int str_equal(const char *str1, const char *str2, int ignore_case)
+{
+    for (;; ++str1, ++str2) {
+        char c1 = *str1;
+        char c2 = *str2;
+
+        if (ignore_case) {
+            if (c1 >= 'a' && c1 <= 'z')
+                c1 = (char)(c1 - 'a' + 'A');
+            if (c2 >= 'a' && c2 <= 'z')
+                c2 = (char)(c2 - 'a' + 'A');
+        }
+
+        if (c1 != c2)
+            return 0;
+        if ( ! c1)
+            return 1;
+    }
+}
+
+static void copy_memory(uint8_t *dest, const uint8_t *src, uint32_t size)
+{
+    uint32_t i;
+
+    for (i = 0; i < size; i++)
+        dest[i] = src[i];
+}
+
+static int error(const char *msg, const char *name)
+{
+    static const char prefix[] = "Error: ";
+
+    sys_call(SYS_WRITE, 2, (intptr_t)prefix, (intptr_t)(sizeof(prefix) - 1));
+    sys_call(SYS_WRITE, 2, (intptr_t)msg, (intptr_t)str_len(msg));
+    if (name) {
+        sys_call(SYS_WRITE, 2, (intptr_t)" ", 1);
+        sys_call(SYS_WRITE, 2, (intptr_t)name, (intptr_t)str_len(name));
+    }
+    sys_call(SYS_WRITE, 2, (intptr_t)"\n", 1);
+
+    return EXIT_ERROR;
+}
+
+static void STDCALL exit_process(uint32_t exit_code)
+{
+    sys_call(SYS_EXIT_GROUP, (intptr_t)exit_code, 0, 0);
+}
+
+static const char kernel32[] = "KERNEL32.dll";
+
+static MODULE_TYPE STDCALL load_library(const char *name)
+{
+    return str_equal(name, kernel32, 1) ? (MODULE_TYPE)kernel32 : NULL;
+}
+
+static FUNCTION_TYPE STDCALL get_proc_address(MODULE_TYPE module, const char *name);
+
+static const struct {
+    const char   *name;
+    FUNCTION_TYPE function;
+} kernel32_functions[] = {
+    { "ExitProcess",    (FUNCTION_TYPE)exit_process     },
+    { "GetProcAddress", (FUNCTION_TYPE)get_proc_address },
+    { "LoadLibraryA",   (FUNCTION_TYPE)load_library     }
+};
+
+static FUNCTION_TYPE STDCALL get_proc_address(MODULE_TYPE module, const char *name)
+{
+    uint32_t i;
+
+    if (module != (MODULE_TYPE)kernel32)
+        return NULL;
+
+    for (i = 0; i < sizeof(kernel32_functions) / sizeof(kernel32_functions[0]); i++) {
+        if (str_equal(name, kernel32_functions[i].name, 0))
+            return kernel32_functions[i].function;
+    }
+
+    return NULL;
+}
+
+/* Fills import address tables, like the Windows loader */
+static int load_imports(uint8_t *image, uint32_t import_dir_rva)
+{
+    const IMPORT_DIR_ENTRY *entry;
+
+    for (entry = (const IMPORT_DIR_ENTRY *)(image + import_dir_rva);
+         get_uint32_le(entry->import_address_table_rva);
+         entry++) {
+
+        const char *const dll_name   = (const char *)image + get_uint32_le(entry->name_rva);
+        const uint32_t    iat_rva    = get_uint32_le(entry->import_address_table_rva);
+        const uint32_t    lookup_rva = get_uint32_le(entry->import_lookup_table_rva);
+        const uintptr_t  *lookup     = (const uintptr_t *)(image + (lookup_rva ? lookup_rva : iat_rva));
+        FUNCTION_TYPE    *iat        = (FUNCTION_TYPE *)(image + iat_rva);
+        const MODULE_TYPE module     = load_library(dll_name);
+
+        if ( ! module)
+            return error("Missing DLL", dll_name);
+
+        for ( ; *lookup; ++lookup, ++iat) {
+            const char *name;
+
+            if (*lookup >> (sizeof(uintptr_t) * 8 - 1))
+                return error("Importing by ordinal from", dll_name);
+
+            /* Function name is preceded by a 16-bit hint */
+            name = (const char *)image + (uint32_t)*lookup + 2;
+
+            *iat = get_proc_address(module, name);
+            if ( ! *iat)
+                return error("Missing function", name);
+        }
+    }
+
+    return 0;
+}
+
+__attribute__((used))
+int run(void)
+{
+    static uint8_t        file[MAX_FILE_SIZE];
+    uint32_t              size = 0;
+    uint32_t              pe_offset;
+    const PE_HEADER      *pe_header;
+    const PE32_HEADER    *opt_header;
+    const SECTION_HEADER *section_header;
+    const DATA_DIRECTORY *data_dir;
+    uint32_t              num_dirs;
+    uintptr_t             image_base;
+    uint32_t              image_size;
+    uint8_t              *image;
+    uint32_t              i;
+
+    for (;;) {
+        const intptr_t num_read = sys_call(SYS_READ, 0, (intptr_t)&file[size], (intptr_t)(MAX_FILE_SIZE - size));
+
+        if (num_read < 0)
+            return error("Failed to read executable from stdin", NULL);
+        if ( ! num_read)
+            break;
+
+        size += (uint32_t)num_read;
+        if (size == MAX_FILE_SIZE)
+            return error("Executable is too large", NULL);
+    }
+
+    pe_offset = get_pe_offset(file, size);
+    if ( ! pe_offset)
+        return error("Not a PE file", NULL);
+
+    pe_header  = (const PE_HEADER *)&file[pe_offset];
+    opt_header = (const PE32_HEADER *)&file[pe_offset + sizeof(PE_HEADER)];
+
+    if (get_uint16_le(pe_header->machine) != MACHINE ||
+        get_uint16_le(opt_header->pe_format) != PE_FORMAT)
+        return error("Unsupported machine", NULL);
+
+#ifdef __x86_64__
+    image_base = (uintptr_t)get_uint64_le(opt_header->u1.u64.image_base);
+    data_dir   = opt_header->u2.u64.rva_and_sizes;
+    num_dirs   = get_uint32_le(opt_header->u2.u64.number_of_rva_and_sizes);
+#else
+    image_base = get_uint32_le(opt_header->u1.u32.image_base);
+    data_dir   = opt_header->u2.u32.rva_and_sizes;
+    num_dirs   = get_uint32_le(opt_header->u2.u32.number_of_rva_and_sizes);
+#endif
+
+    /* Relocations are not supported, the image is always loaded at image base */
+    image_size = get_uint32_le(opt_header->size_of_image);
+    image      = (uint8_t *)map_memory(image_base, image_size);
+    if ((uintptr_t)image != image_base)
+        return error("Failed to map image at image base", NULL);
+
+    copy_memory(image, file, get_uint32_le(opt_header->size_of_headers));
+
+    section_header = (const SECTION_HEADER *)((const uint8_t *)opt_header + get_uint16_le(pe_header->optional_hdr_size));
+
+    for (i = 0; i < get_uint16_le(pe_header->number_of_sections); i++) {
+        const uint32_t raw_size     = get_uint32_le(section_header[i].size_of_raw_data);
+        const uint32_t virtual_size = get_uint32_le(section_header[i].virtual_size);
+
+        copy_memory(image + get_uint32_le(section_header[i].virtual_address),
+                    &file[get_uint32_le(section_header[i].pointer_to_raw_data)],
+                    (raw_size < virtual_size) ? raw_size : virtual_size);
+    }
+
+    if (num_dirs > DIR_IMPORT_TABLE && get_uint32_le(data_dir[DIR_IMPORT_TABLE].size)) {
+        const int err = load_imports(image, get_uint32_le(data_dir[DIR_IMPORT_TABLE].virtual_address));
+
+        if (err)
+            return err;
+    }
+
+    /* Executables exit with ExitProcess, but they can also return the exit code */
+    return ((PROCESS_ENTRY)(image + get_uint32_le(opt_header->entry_point)))();
+}
@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "perf.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#   include <linux/perf_event.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+#endif
+
+struct PERF_COUNTERS_STRUCT {
+    int fd[PERF_NUM_EVENTS];
+};
+
+static const char *const event_names[PERF_NUM_EVENTS] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+};
+
+const char *get_perf_event_name(enum PERF_EVENT event)
+{
+    return event_names[event];
+}
+
+#ifdef __linux__
+static int open_event(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+
+    attr.size           = sizeof(attr);
+    attr.type           = type;
+    attr.config         = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    /* Count only the calling thread, on any CPU */
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+PERF_COUNTERS *open_perf_counters(void)
+{
+    static const struct {
+        uint32_t type;
+        uint64_t config;
+    } events[PERF_NUM_EVENTS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES       },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS     },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES     },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES    }
+    };
+
+    PERF_COUNTERS *const perf      = (PERF_COUNTERS *)malloc(sizeof(PERF_COUNTERS));
+    int                  num_valid = 0;
+    int                  i;
+
+    if ( ! perf)
+        return NULL;
+
+    /* Events are opened separately, so that the ones which are supported
+     * are counted even if some other ones are not.
+     */
+    for (i = 0; i < PERF_NUM_EVENTS; i++) {
+        perf->fd[i] = open_event(events[i].type, events[i].config);
+        if (perf->fd[i] >= 0)
+            ++num_valid;
+    }
+
+    if ( ! num_valid) {
+        free(perf);
+        return NULL;
+    }
+
+    return perf;
+}
+
+void close_perf_counters(PERF_COUNTERS *perf)
+{
+    int i;
+
+    if ( ! perf)
+        return;
+
+    for (i = 0; i < PERF_NUM_EVENTS; i++)
+        if (perf->fd[i] >= 0)
+            close(perf->fd[i]);
+
+    free(perf);
+}
+
+void read_perf_counters(PERF_COUNTERS *perf, PERF_VALUES *values)
+{
+    int i;
+
+    memset(values, 0, sizeof(*values));
+
+    for (i = 0; i < PERF_NUM_EVENTS; i++) {
+        uint64_t data[3]; /* Value, time enabled, time running */
+
+        if (perf->fd[i] < 0 || read(perf->fd[i], data, sizeof(data)) != (ssize_t)sizeof(data))
+            continue;
+
+        /* Raw values, add_perf_values() scales differences between readings */
+        values->count[i]        = data[0];
+        values->time_enabled[i] = data[1];
+        values->time_running[i] = data[2];
+        values->valid          |= 1U << i;
+    }
+}
+#else
+PERF_COUNTERS *open_perf_counters(void)
+{
+    return NULL;
+}
+
+void close_perf_counters(PERF_COUNTERS *perf)
+{
+}
+
+void read_perf_counters(PERF_COUNTERS *perf, PERF_VALUES *values)
+{
+    memset(values, 0, sizeof(*values));
+}
+#endif
+
+void add_perf_values(PERF_VALUES *total, const PERF_VALUES *begin, const PERF_VALUES *end)
+{
+    const uint32_t valid       = begin->valid & end->valid;
+    uint32_t       not_running = 0;
+    int            i;
+
+    for (i = 0; i < PERF_NUM_EVENTS; i++) {
+        uint64_t count;
+        uint64_t enabled;
+        uint64_t running;
+
+        if ( ! (valid & (1U << i)))
+            continue;
+
+        count   = end->count[i] - begin->count[i];
+        enabled = end->time_enabled[i] - begin->time_enabled[i];
+        running = end->time_running[i] - begin->time_running[i];
+
+        if ( ! running) {
+            not_running |= 1U << i;
+            continue;
+        }
+
+        /* If there are more events than counters, the kernel multiplexes them */
+        if (running < enabled)
+            count = (uint64_t)((double)count * (double)enabled / (double)running);
+
+        total->count[i] += count;
+    }
+
+    total->not_running |= not_running;
+    total->valid        = (total->valid | valid) & ~total->not_running;
+}
+
+void print_perf_columns(FILE *file)
+{
+    fprintf(file, " %12s %12s %6s %12s %12s %12s\n",
+            "cycles", "instructions", "IPC", "l1d_misses", "llc_misses", "branch_misses");
+}
+
+static void print_per_byte(FILE *file, const PERF_VALUES *values, enum PERF_EVENT event, uint64_t bytes)
+{
+    if (values->valid & (1U << event))
+        fprintf(file, " %12.4f", (double)values->count[event] / (double)(bytes ? bytes : 1));
+    else
+        fprintf(file, " %12s", "n/a");
+}
+
+void print_perf_values(FILE *file, const PERF_VALUES *values, uint64_t bytes)
+{
+    const uint32_t ipc = (1U << PERF_CYCLES) | (1U << PERF_INSTRUCTIONS);
+
+    print_per_byte(file, values, PERF_CYCLES, bytes);
+    print_per_byte(file, values, PERF_INSTRUCTIONS, bytes);
+
+    if ((values->valid & ipc) == ipc && values->count[PERF_CYCLES])
+        fprintf(file, " %6.2f", (double)values->count[PERF_INSTRUCTIONS] / (double)values->count[PERF_CYCLES]);
+    else
+        fprintf(file, " %6s", "n/a");
+
+    print_per_byte(file, values, PERF_L1D_MISSES, bytes);
+    print_per_byte(file, values, PERF_LLC_MISSES, bytes);
+    print_per_byte(file, values, PERF_BRANCH_MISSES, bytes);
+
+    fprintf(file, "\n");
+}
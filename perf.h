@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+enum PERF_EVENT {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,        /* L1 data cache read misses */
+    PERF_LLC_MISSES,        /* Last level cache misses   */
+    PERF_BRANCH_MISSES,
+
+    PERF_NUM_EVENTS
+};
+
+/* Values read by read_perf_counters() are raw counts together with the time
+ * each event was enabled and running.  Totals from add_perf_values() are
+ * scaled counts and their times are not used.
+ */
+typedef struct {
+    uint64_t count[PERF_NUM_EVENTS];
+    uint64_t time_enabled[PERF_NUM_EVENTS];
+    uint64_t time_running[PERF_NUM_EVENTS]; /* Less than enabled if the event was multiplexed */
+    uint32_t valid;         /* Bit mask of events which were counted */
+    uint32_t not_running;   /* Bit mask of events which did not run during some interval */
+} PERF_VALUES;
+
+/* Hardware performance counters of the calling thread.  They are only
+ * available on Linux and only if the kernel allows unprivileged processes
+ * to use them, see /proc/sys/kernel/perf_event_paranoid.
+ */
+typedef struct PERF_COUNTERS_STRUCT PERF_COUNTERS;
+
+/* Returns NULL if none of the counters is available */
+PERF_COUNTERS *open_perf_counters(void);
+void           close_perf_counters(PERF_COUNTERS *perf);
+
+void read_perf_counters(PERF_COUNTERS *perf, PERF_VALUES *values);
+
+/* Adds counts between begin and end to total.  If the kernel multiplexed an
+ * event, the difference is scaled by the time it was enabled over the time
+ * it was running.  An event which was not running at all between begin and
+ * end is no longer valid in total.
+ */
+void add_perf_values(PERF_VALUES *total, const PERF_VALUES *begin, const PERF_VALUES *end);
+
+const char *get_perf_event_name(enum PERF_EVENT event);
+
+/* Prints headers of the columns printed by print_perf_values() */
+void print_perf_columns(FILE *file);
+
+/* Prints events per byte and instructions per cycle, followed by a new line */
+void print_perf_values(FILE *file, const PERF_VALUES *values, uint64_t bytes);
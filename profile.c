@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "profile.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int set_param(PARSER_PARAMS *params, const char *name, long value)
+{
+    if (value < 0 || value > INT32_MAX)
+        return 1;
+
+    if ( ! strcmp(name, "max_len3_distance"))
+        params->max_len3_distance = (uint32_t)value;
+    else if ( ! strcmp(name, "max_len4_distance"))
+        params->max_len4_distance = (uint32_t)value;
+    else if ( ! strcmp(name, "min_score"))
+        params->min_score = (int32_t)value;
+    else if ( ! strcmp(name, "trailing_rep") && value <= 1)
+        params->trailing_rep = (int32_t)value;
+    else if ( ! strcmp(name, "max_chunks"))
+        params->max_chunks = (uint32_t)value;
+    else
+        return 1;
+
+    return 0;
+}
+
+int load_profile(const char *filename, PARSER_PARAMS *params)
+{
+    FILE *const file = fopen(filename, "r");
+    char        line[256];
+    unsigned    line_no = 0;
+
+    if ( ! file) {
+        perror(filename);
+        return 1;
+    }
+
+    get_default_parser_params(params);
+
+    while (fgets(line, sizeof(line), file)) {
+        char name[32];
+        long value;
+
+        ++line_no;
+
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        if (sscanf(line, "%31s %ld", name, &value) != 2 || set_param(params, name, value))
+            break;
+    }
+
+    if ( ! feof(file)) {
+        fprintf(stderr, "%s:%u: Error: Invalid profile entry\n", filename, line_no);
+        fclose(file);
+        return 1;
+    }
+
+    fclose(file);
+
+    return 0;
+}
+
+void write_profile(FILE *file, const PARSER_PARAMS *params)
+{
+    fprintf(file, "max_len3_distance %u\n", params->max_len3_distance);
+    fprintf(file, "max_len4_distance %u\n", params->max_len4_distance);
+    fprintf(file, "min_score         %d\n", params->min_score);
+    fprintf(file, "trailing_rep      %d\n", params->trailing_rep);
+    fprintf(file, "max_chunks        %u\n", params->max_chunks);
+}
+
+void format_profile(char *buf, size_t size, const PARSER_PARAMS *params)
+{
+    snprintf(buf, size, "len3=%u len4=%u score=%d rep=%d chunks=%u",
+             params->max_len3_distance, params->max_len4_distance,
+             params->min_score, params->trailing_rep, params->max_chunks);
+}
+
+int is_same_profile(const PARSER_PARAMS *left, const PARSER_PARAMS *right)
+{
+    return left->max_len3_distance == right->max_len3_distance &&
+           left->max_len4_distance == right->max_len4_distance &&
+           left->min_score         == right->min_score         &&
+           left->trailing_rep      == right->trailing_rep      &&
+           left->max_chunks        == right->max_chunks;
+}
+
+int is_default_profile(const PARSER_PARAMS *params)
+{
+    PARSER_PARAMS defaults;
+
+    get_default_parser_params(&defaults);
+
+    return is_same_profile(params, &defaults);
+}
@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include "find_repeats.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* Profiles are text files with one parameter per line, as produced by the
+ * tune tool:
+ *
+ *     max_len3_distance 2048
+ *     max_len4_distance 8192
+ *     min_score         2
+ *     trailing_rep      1
+ *     max_chunks        0
+ *
+ * Parameters which are not listed keep their default values.
+ */
+
+/* Returns non-zero if the file could not be loaded or is invalid */
+int load_profile(const char *filename, PARSER_PARAMS *params);
+
+void write_profile(FILE *file, const PARSER_PARAMS *params);
+
+/* Returns short description of parameters, e.g. for cache keys */
+void format_profile(char *buf, size_t size, const PARSER_PARAMS *params);
+
+int is_same_profile(const PARSER_PARAMS *left, const PARSER_PARAMS *right);
+int is_default_profile(const PARSER_PARAMS *params);
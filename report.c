@@ -0,0 +1,257 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#ifndef _WIN32
+#   define _GNU_SOURCE /* RUSAGE_THREAD */
+#endif
+
+#include "report.h"
+#include "timer.h"
+
+#include <assert.h>
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#   include <psapi.h>
+#else
+#   include <sys/resource.h>
+#endif
+
+static const char *const phase_names[REPORT_NUM_PHASES] = {
+    "load", "parse", "lz77", "arith", "verify", "save"
+};
+
+uint64_t end_phase(REPORT *report, enum REPORT_PHASE phase, uint64_t start)
+{
+    const uint64_t now = get_time_us();
+
+    report->phase_us[phase] += now - start;
+
+    if (report->perf) {
+        PERF_VALUES values;
+
+        read_perf_counters(report->perf, &values);
+        add_perf_values(&report->phase_perf[phase], &report->perf_mark, &values);
+        report->perf_mark = values;
+    }
+
+    return now;
+}
+
+void start_report_perf(REPORT *report, PERF_COUNTERS *perf)
+{
+    report->perf = perf;
+
+    if (perf)
+        read_perf_counters(perf, &report->perf_mark);
+}
+
+void close_report_perf(REPORT *report)
+{
+    close_perf_counters(report->perf);
+    report->perf = NULL;
+}
+
+void print_perf_report(FILE *file, const REPORT *report, size_t input_size)
+{
+    uint32_t i;
+
+    fprintf(file, "Hardware counters per input byte:\n");
+    fprintf(file, "        %-8s", "phase");
+    print_perf_columns(file);
+
+    for (i = 0; i < REPORT_NUM_PHASES; i++) {
+        if ( ! report->phase_perf[i].valid)
+            continue;
+
+        fprintf(file, "        %-8s", phase_names[i]);
+        print_perf_values(file, &report->phase_perf[i], input_size);
+    }
+}
+
+static void write_json_perf(FILE *file, const REPORT *report)
+{
+    uint32_t i;
+    int      first = 1;
+
+    fprintf(file, ",\"perf\":{");
+
+    for (i = 0; i < REPORT_NUM_PHASES; i++) {
+        const PERF_VALUES *const values = &report->phase_perf[i];
+        uint32_t                 event;
+        const char              *sep    = "";
+
+        if ( ! values->valid)
+            continue;
+
+        fprintf(file, "%s\"%s\":{", first ? "" : ",", phase_names[i]);
+        first = 0;
+
+        for (event = 0; event < PERF_NUM_EVENTS; event++) {
+            if ( ! (values->valid & (1U << event)))
+                continue;
+
+            fprintf(file, "%s\"%s\":%" PRIu64, sep,
+                    get_perf_event_name((enum PERF_EVENT)event), values->count[event]);
+            sep = ",";
+        }
+
+        fprintf(file, "}");
+    }
+
+    fprintf(file, "}");
+}
+
+void add_report_region(REPORT *report, const char *name, uint32_t rva, uint32_t size)
+{
+    REPORT_REGION *region;
+
+    assert(report->num_regions < REPORT_MAX_REGIONS);
+    if (report->num_regions >= REPORT_MAX_REGIONS)
+        return;
+
+    region = &report->regions[report->num_regions++];
+
+    region->name = name;
+    region->rva  = rva;
+    region->size = size;
+}
+
+uint64_t get_peak_memory(void)
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+
+    if ( ! GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+
+#   ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss;
+#   else
+    return (uint64_t)usage.ru_maxrss * 1024U;
+#   endif
+#endif
+}
+
+uint64_t get_page_faults(void)
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+
+    if ( ! GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+
+    return counters.PageFaultCount;
+#else
+    struct rusage usage;
+
+#   ifdef RUSAGE_THREAD
+    if (getrusage(RUSAGE_THREAD, &usage))
+        return 0;
+#   else
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+#   endif
+
+    return (uint64_t)usage.ru_minflt + (uint64_t)usage.ru_majflt;
+#endif
+}
+
+static void write_json_string(FILE *file, const char *str)
+{
+    fputc('"', file);
+
+    for ( ; *str; str++) {
+        const unsigned char c = (unsigned char)*str;
+
+        if (c == '"' || c == '\\')
+            fprintf(file, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(file, "\\u%04x", c);
+        else
+            fputc(c, file);
+    }
+
+    fputc('"', file);
+}
+
+void write_json_report(FILE         *file,
+                       const char   *filename,
+                       int           error,
+                       size_t        input_size,
+                       size_t        output_size,
+                       uint64_t      time_us,
+                       const REPORT *report)
+{
+    static const char *const stream_names[LZS_NUM_STREAMS] = {
+        "type", "literal_msb", "literal", "size", "offset"
+    };
+
+    const COMPRESSED_SIZES *const sizes = &report->sizes;
+    uint32_t                      i;
+
+    fprintf(file, "{\"file\":");
+    write_json_string(file, filename);
+    fprintf(file, ",\"status\":\"%s\"", error ? "failed" : "ok");
+    fprintf(file, ",\"input_size\":%zu,\"output_size\":%zu", input_size, output_size);
+
+    fprintf(file, ",\"time_us\":{\"total\":%" PRIu64, time_us);
+    for (i = 0; i < REPORT_NUM_PHASES; i++)
+        fprintf(file, ",\"%s\":%" PRIu64, phase_names[i], report->phase_us[i]);
+    fprintf(file, "}");
+
+    fprintf(file, ",\"lz77_size\":%zu,\"arith_size\":%zu", sizes->lz, sizes->compressed);
+    fprintf(file, ",\"degraded_size\":%zu", sizes->degraded);
+
+    fprintf(file, ",\"streams\":{");
+    for (i = 0; i < LZS_NUM_STREAMS; i++)
+        fprintf(file, "%s\"%s\":%zu", i ? "," : "", stream_names[i], sizes->streams[i]);
+    fprintf(file, "}");
+
+    fprintf(file, ",\"packets\":{\"lit\":%zu,\"match\":%zu,\"shortrep\":%zu",
+            sizes->stats_lit, sizes->stats_match, sizes->stats_shortrep);
+    for (i = 0; i < 4; i++)
+        fprintf(file, ",\"longrep%u\":%zu", i, sizes->stats_longrep[i]);
+    fprintf(file, "}");
+
+#ifdef MINIFY_STATS
+    fprintf(file, ",\"match_stats\":");
+    write_json_stats(file, &sizes->match_stats);
+    fprintf(file, ",\"bit_costs\":");
+    write_json_bit_costs(file, &sizes->bit_costs);
+#endif
+
+    if (report->num_regions) {
+        fprintf(file, ",\"zero_pages\":%u", report->zero_pages);
+        fprintf(file, ",\"layout\":{\"image_base\":%" PRIu64, report->image_base);
+        for (i = 0; i < report->num_regions; i++)
+            fprintf(file, ",\"%s\":{\"rva\":%u,\"size\":%u}",
+                    report->regions[i].name, report->regions[i].rva, report->regions[i].size);
+        fprintf(file, "}");
+    }
+
+    for (i = 0; i < REPORT_NUM_PHASES; i++)
+        if (report->phase_perf[i].valid)
+            break;
+    if (i < REPORT_NUM_PHASES)
+        write_json_perf(file, report);
+
+    fprintf(file, ",\"cache_hit\":%s", report->cache_hit ? "true" : "false");
+    fprintf(file, ",\"page_faults\":%" PRIu64, report->page_faults);
+    fprintf(file, ",\"peak_memory\":%" PRIu64, report->peak_memory);
+    /* Peak of the whole process so far, which includes files compressed before
+     * and in parallel with this one
+     */
+    fprintf(file, ",\"process_peak_memory\":%" PRIu64 "}\n", get_peak_memory());
+}
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include "lza_compress.h"
+#include "perf.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Phases of compressing a single file.  For generic (non-executable) files
+ * entropy coding is done together with LZ77 and is included in REPORT_LZ77.
+ */
+enum REPORT_PHASE {
+    REPORT_LOAD,        /* Loading input file                           */
+    REPORT_PARSE,       /* Parsing headers, loading image, imports      */
+    REPORT_LZ77,        /* Finding zero pages and LZ77 compression      */
+    REPORT_ARITH,       /* Arithmetic coding                            */
+    REPORT_VERIFY,      /* Decompressing and comparing with input       */
+    REPORT_SAVE,        /* Writing output file                          */
+
+    REPORT_NUM_PHASES
+};
+
+/* Region of the packed executable's address space */
+typedef struct {
+    const char *name;
+    uint32_t    rva;
+    uint32_t    size;
+} REPORT_REGION;
+
+#define REPORT_MAX_REGIONS 16
+
+typedef struct {
+    uint64_t         phase_us[REPORT_NUM_PHASES];
+    COMPRESSED_SIZES sizes;
+    uint32_t         zero_pages;
+    uint32_t         num_regions;
+    uint64_t         image_base;
+    uint64_t         page_faults;
+    uint64_t         peak_memory;   /* Memory allocated to compress the file, excluding mapped input */
+    int              cache_hit;     /* Output was found in the cache */
+    REPORT_REGION    regions[REPORT_MAX_REGIONS];
+    PERF_COUNTERS   *perf;          /* Counters of the compressing thread, NULL if not used */
+    PERF_VALUES      perf_mark;     /* Counters at the end of the last phase */
+    PERF_VALUES      phase_perf[REPORT_NUM_PHASES];
+} REPORT;
+
+/* Adds time elapsed since start to the phase, returns current time.  If
+ * performance counters are used, counts since the end of the previous phase
+ * are also added to the phase.
+ */
+uint64_t end_phase(REPORT *report, enum REPORT_PHASE phase, uint64_t start);
+
+/* Starts counting hardware events for subsequent phases, the report takes
+ * ownership of the counters.
+ */
+void start_report_perf(REPORT *report, PERF_COUNTERS *perf);
+
+/* Closes the counters, counts collected so far remain in the report */
+void close_report_perf(REPORT *report);
+
+/* Prints IPC and events per input byte for each phase */
+void print_perf_report(FILE *file, const REPORT *report, size_t input_size);
+
+void add_report_region(REPORT *report, const char *name, uint32_t rva, uint32_t size);
+
+/* Returns peak resident memory of the whole process in bytes */
+uint64_t get_peak_memory(void);
+
+/* Returns number of page faults of the calling thread so far, or of the whole
+ * process if per-thread statistics are not available.
+ */
+uint64_t get_page_faults(void);
+
+/* Writes report for a single file as one line of JSON */
+void write_json_report(FILE         *file,
+                       const char   *filename,
+                       int           error,
+                       size_t        input_size,
+                       size_t        output_size,
+                       uint64_t      time_us,
+                       const REPORT *report);
@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "stats.h"
+
+#include <stddef.h>
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+
+#ifdef _WIN32
+#   define THREAD_LOCAL __declspec(thread)
+#else
+#   define THREAD_LOCAL __thread
+#endif
+
+static THREAD_LOCAL COMPRESS_STATS *current_stats;
+static THREAD_LOCAL COMPRESS_STATS  discarded_stats;
+
+COMPRESS_STATS *set_current_stats(COMPRESS_STATS *stats)
+{
+    COMPRESS_STATS *const prev = current_stats;
+
+    current_stats = stats;
+
+    return prev;
+}
+
+COMPRESS_STATS *get_current_stats(void)
+{
+    return current_stats ? current_stats : &discarded_stats;
+}
+
+unsigned get_stats_bucket(uint64_t value)
+{
+    unsigned bucket = 0;
+
+    while (value && bucket < STATS_HIST_SIZE - 1) {
+        value >>= 1;
+        ++bucket;
+    }
+
+    return bucket;
+}
+
+static const struct {
+    const char *name;
+    size_t      offset;
+} counters[] = {
+    { "positions",             offsetof(COMPRESS_STATS, positions)             },
+    { "chunks_visited",        offsetof(COMPRESS_STATS, chunks_visited)        },
+    { "offsets_examined",      offsetof(COMPRESS_STATS, offsets_examined)      },
+    { "bytes_compared",        offsetof(COMPRESS_STATS, bytes_compared)        },
+    { "rejected_last_dist",    offsetof(COMPRESS_STATS, rejected_last_dist)    },
+    { "rejected_trailing_rep", offsetof(COMPRESS_STATS, rejected_trailing_rep) },
+    { "rejected_score",        offsetof(COMPRESS_STATS, rejected_score)        },
+    { "rejected_min_score",    offsetof(COMPRESS_STATS, rejected_min_score)    },
+    { "rejected_far_short",    offsetof(COMPRESS_STATS, rejected_far_short)    },
+    { "emitter_flushes",       offsetof(COMPRESS_STATS, emitter_flushes)       },
+    { "map_restarts",          offsetof(COMPRESS_STATS, map_restarts)          },
+    { "window_moves",          offsetof(COMPRESS_STATS, window_moves)          }
+};
+
+static uint64_t get_counter(const COMPRESS_STATS *stats, unsigned idx)
+{
+    return *(const uint64_t *)((const char *)stats + counters[idx].offset);
+}
+
+static uint64_t get_bucket_min(unsigned bucket)
+{
+    return bucket ? ((uint64_t)1 << (bucket - 1)) : 0;
+}
+
+static void print_histogram(FILE *file, const char *name, const uint64_t *hist)
+{
+    unsigned i;
+
+    fprintf(file, "        %s:\n", name);
+
+    for (i = 0; i < STATS_HIST_SIZE; i++) {
+        if ( ! hist[i])
+            continue;
+
+        if (i + 1 < STATS_HIST_SIZE && i > 1)
+            fprintf(file, "            %5" PRIu64 "-%-5" PRIu64 " %12" PRIu64 "\n",
+                    get_bucket_min(i), get_bucket_min(i + 1) - 1, hist[i]);
+        else
+            fprintf(file, "            %5" PRIu64 "%-6s %12" PRIu64 "\n",
+                    get_bucket_min(i), (i + 1 < STATS_HIST_SIZE) ? "" : "+", hist[i]);
+    }
+}
+
+void print_compress_stats(FILE *file, const COMPRESS_STATS *stats)
+{
+    unsigned i;
+
+    fprintf(file, "Match finder stats:\n");
+
+    for (i = 0; i < sizeof(counters) / sizeof(counters[0]); i++)
+        fprintf(file, "        %-24s %" PRIu64 "\n", counters[i].name, get_counter(stats, i));
+
+    print_histogram(file, "chain length", stats->chain_length);
+    print_histogram(file, "match length", stats->match_length);
+}
+
+static void write_json_histogram(FILE *file, const char *name, const uint64_t *hist)
+{
+    unsigned i;
+
+    /* Histogram is an array indexed by bucket, bucket i > 0 starts at 2^(i-1) */
+    fprintf(file, ",\"%s\":[", name);
+    for (i = 0; i < STATS_HIST_SIZE; i++)
+        fprintf(file, "%s%" PRIu64, i ? "," : "", hist[i]);
+    fprintf(file, "]");
+}
+
+void write_json_stats(FILE *file, const COMPRESS_STATS *stats)
+{
+    unsigned i;
+
+    fprintf(file, "{");
+    for (i = 0; i < sizeof(counters) / sizeof(counters[0]); i++)
+        fprintf(file, "%s\"%s\":%" PRIu64, i ? "," : "", counters[i].name, get_counter(stats, i));
+
+    write_json_histogram(file, "chain_length", stats->chain_length);
+    write_json_histogram(file, "match_length", stats->match_length);
+    fprintf(file, "}");
+}
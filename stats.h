@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Buckets for values 0, 1, 2-3, 4-7, ..., 32768 and more */
+#define STATS_HIST_SIZE 17
+
+/* Counters from the hot paths of the compressor.  They are only collected
+ * when minify is built with MINIFY_STATS defined (make stats=1), otherwise
+ * the instrumentation is compiled out.
+ */
+typedef struct {
+    uint64_t positions;             /* Positions searched for matches            */
+    uint64_t chunks_visited;        /* Location chunks visited in offset map     */
+    uint64_t offsets_examined;      /* Previous offsets compared to the position */
+    uint64_t bytes_compared;        /* Bytes compared by compare()               */
+    uint64_t rejected_last_dist;    /* Candidate is one of the last 4 distances  */
+    uint64_t rejected_trailing_rep; /* Candidate allows worse subsequent *REP    */
+    uint64_t rejected_score;        /* Candidate not better than the best one    */
+    uint64_t rejected_min_score;    /* Candidate saves fewer than 2 bits         */
+    uint64_t rejected_far_short;    /* 3 or 4 byte candidate is too far          */
+    uint64_t emitter_flushes;       /* Bytes flushed by LZ77 stream emitters     */
+    uint64_t map_restarts;          /* Offset map filled up and was cleared      */
+    uint64_t window_moves;          /* Offsets older than 2 GB were dropped      */
+    uint64_t chain_length[STATS_HIST_SIZE]; /* Chunks visited per position       */
+    uint64_t match_length[STATS_HIST_SIZE]; /* Lengths of emitted matches        */
+} COMPRESS_STATS;
+
+#ifdef MINIFY_STATS
+#   define STATS_ADD(counter, value) (get_current_stats()->counter += (value))
+#   define STATS_HIST(hist, value)   (++get_current_stats()->hist[get_stats_bucket(value)])
+#else
+#   define STATS_ADD(counter, value) ((void)0)
+#   define STATS_HIST(hist, value)   ((void)0)
+#endif
+
+/* Sets stats which receive counters from the calling thread, returns previous stats.
+ * When no stats are set, counters are discarded.
+ */
+COMPRESS_STATS *set_current_stats(COMPRESS_STATS *stats);
+COMPRESS_STATS *get_current_stats(void);
+
+unsigned get_stats_bucket(uint64_t value);
+
+void print_compress_stats(FILE *file, const COMPRESS_STATS *stats);
+
+/* Writes stats as a JSON object */
+void write_json_stats(FILE *file, const COMPRESS_STATS *stats);
@@ -0,0 +1,764 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "stream.h"
+#include "buffer.h"
+#include "dict.h"
+#include "entropy.h"
+#include "lza_compress.h"
+#include "lza_decompress.h"
+#include "minify_ctx.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Stream format, all values are 32-bit little endian:
+ *
+ * "MNFS" magic, or "MNFD" if compressed with a dictionary
+ * block size       Maximum uncompressed size of a block
+ * dictionary id    Only with "MNFD", see get_dict_id()
+ * Blocks:
+ *   raw size       Uncompressed size of the block, 0 terminates the stream
+ *   packed size    Size of the data which follows
+ *   lz size        Size of LZ77 data after arithmetic decoding, 0 if the
+ *                  block is stored uncompressed
+ *   data
+ *
+ * Optional seek table, which follows the terminating block:
+ *   entries        One for each block, two 64-bit little endian values:
+ *     raw offset   Offset of the block's data in uncompressed data
+ *     offset       Offset of the block's header from the beginning of the stream
+ *   num entries
+ *   "MNFT" magic
+ *
+ * Each block is compressed independently with a fresh model, so any block
+ * can be decompressed on its own.  The seek table lets readers find the
+ * blocks covering a range of uncompressed data without reading the
+ * whole stream.  A stream without a seek table ends with a zero block
+ * header, so the magic cannot appear at its end.
+ *
+ * Runs of incompressible data found by the entropy pre-scan are written
+ * as separate stored blocks, which are not passed to the compressor.
+ * With a dictionary, each block is compressed as if the dictionary
+ * preceded it.
+ */
+
+static const char stream_magic[4]      = { 'M', 'N', 'F', 'S' };
+static const char dict_stream_magic[4] = { 'M', 'N', 'F', 'D' };
+static const char seek_table_magic[4]  = { 'M', 'N', 'F', 'T' };
+
+#define SEEK_ENTRY_SIZE  16U
+#define SEEK_FOOTER_SIZE 8U
+
+#define MAX_STREAM_BLOCK_SIZE (64U << 20)
+
+/* Shorter runs of incompressible data are left to the compressor, so that
+ * compressible data around them is not split into many small blocks.
+ */
+#define MIN_STORED_SIZE (4U * ENTROPY_BLOCK_SIZE)
+
+static void put_uint32(uint8_t *dest, uint32_t value)
+{
+    dest[0] = (uint8_t)value;
+    dest[1] = (uint8_t)(value >> 8);
+    dest[2] = (uint8_t)(value >> 16);
+    dest[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t get_uint32(const uint8_t *src)
+{
+    return (uint32_t)src[0] |
+           ((uint32_t)src[1] << 8) |
+           ((uint32_t)src[2] << 16) |
+           ((uint32_t)src[3] << 24);
+}
+
+static void put_uint64(uint8_t *dest, uint64_t value)
+{
+    put_uint32(&dest[0], (uint32_t)value);
+    put_uint32(&dest[4], (uint32_t)(value >> 32));
+}
+
+static uint64_t get_uint64(const uint8_t *src)
+{
+    return (uint64_t)get_uint32(&src[0]) | ((uint64_t)get_uint32(&src[4]) << 32);
+}
+
+/* Compressed stream being written, with positions of blocks for the seek table */
+typedef struct {
+    FILE    *file;
+    uint64_t raw_pos;       /* Size of uncompressed data written so far */
+    uint64_t pos;           /* Size of the stream written so far */
+    int      seek;          /* Non-zero if the seek table is written */
+    uint8_t *entries;       /* Seek table entries */
+    size_t   num_entries;
+    size_t   capacity;
+} STREAM_OUTPUT;
+
+static int write_data(STREAM_OUTPUT *output, const void *data, size_t size)
+{
+    if (fwrite(data, 1, size, output->file) != size) {
+        perror("Error: Failed to write output");
+        return 1;
+    }
+
+    output->pos += size;
+
+    return 0;
+}
+
+static int add_seek_entry(STREAM_OUTPUT *output)
+{
+    if (output->num_entries == output->capacity) {
+        const size_t   new_capacity = output->capacity ? output->capacity * 2 : 64;
+        uint8_t *const new_entries  = (uint8_t *)realloc(output->entries, new_capacity * SEEK_ENTRY_SIZE);
+
+        if ( ! new_entries) {
+            perror(NULL);
+            return 1;
+        }
+
+        output->entries  = new_entries;
+        output->capacity = new_capacity;
+    }
+
+    put_uint64(&output->entries[output->num_entries * SEEK_ENTRY_SIZE],     output->raw_pos);
+    put_uint64(&output->entries[output->num_entries * SEEK_ENTRY_SIZE + 8], output->pos);
+    ++output->num_entries;
+
+    return 0;
+}
+
+static int write_block_header(STREAM_OUTPUT *output, uint32_t raw_size, uint32_t packed_size, uint32_t lz_size)
+{
+    uint8_t header[12];
+
+    if (raw_size && output->seek && add_seek_entry(output))
+        return 1;
+
+    put_uint32(&header[0], raw_size);
+    put_uint32(&header[4], packed_size);
+    put_uint32(&header[8], lz_size);
+
+    output->raw_pos += raw_size;
+
+    return write_data(output, header, sizeof(header));
+}
+
+static int write_seek_table(STREAM_OUTPUT *output)
+{
+    uint8_t footer[SEEK_FOOTER_SIZE];
+
+    if ((uint64_t)output->num_entries > 0xFFFFFFFFU) {
+        fprintf(stderr, "Error: Too many blocks for the seek table\n");
+        return 1;
+    }
+
+    put_uint32(&footer[0], (uint32_t)output->num_entries);
+    memcpy(&footer[4], seek_table_magic, sizeof(seek_table_magic));
+
+    return write_data(output, output->entries, output->num_entries * SEEK_ENTRY_SIZE) ||
+           write_data(output, footer, sizeof(footer));
+}
+
+/* Returns number of bytes read, which is less than size only at the end of the input */
+static size_t read_data(FILE *input, void *dest, size_t size, int *error)
+{
+    const size_t num_read = fread(dest, 1, size, input);
+
+    if (num_read < size && ferror(input)) {
+        perror("Error: Failed to read input");
+        *error = 1;
+    }
+
+    return num_read;
+}
+
+static int write_stored(STREAM_OUTPUT *output, const uint8_t *raw, size_t raw_size)
+{
+    return write_block_header(output, (uint32_t)raw_size, (uint32_t)raw_size, 0) ||
+           write_data(output, raw, raw_size);
+}
+
+/* Decompressed data is verified after the dictionary, which is at the
+ * beginning of the decompressed buffer.
+ */
+static int write_compressed(MINIFY_CTX    *ctx,
+                            STREAM_OUTPUT *output,
+                            const uint8_t *raw,
+                            size_t         raw_size,
+                            BUFFER         packed,
+                            BUFFER         decompressed,
+                            size_t         dict_size)
+{
+    const COMPRESSED_SIZES compressed = minify_compress(ctx, packed.buf, packed.size, raw, raw_size);
+
+    if ( ! compressed.lz)
+        return 1;
+
+    /* Store incompressible data as is */
+    if (compressed.compressed >= raw_size)
+        return write_stored(output, raw, raw_size);
+
+    lza_decompress_with_prefix(decompressed.buf + dict_size, raw_size, compressed.lz,
+                               packed.buf, compressed.compressed, dict_size);
+
+    if (memcmp(raw, decompressed.buf + dict_size, raw_size)) {
+        fprintf(stderr, "Decompressed output doesn't match input data\n");
+        return 1;
+    }
+
+    return write_block_header(output, (uint32_t)raw_size, (uint32_t)compressed.compressed,
+                              (uint32_t)compressed.lz) ||
+           write_data(output, packed.buf, compressed.compressed);
+}
+
+/* Stores runs of incompressible data and compresses the rest of the block */
+static int write_block(MINIFY_CTX    *ctx,
+                       STREAM_OUTPUT *output,
+                       const uint8_t *raw,
+                       size_t         raw_size,
+                       BUFFER         packed,
+                       BUFFER         decompressed,
+                       size_t         dict_size)
+{
+    size_t begin = 0;
+    size_t pos   = 0;
+
+    while (pos < raw_size) {
+        const size_t stored = get_incompressible_size(&raw[pos], raw_size - pos);
+
+        if (stored >= MIN_STORED_SIZE || stored == raw_size) {
+            if (pos > begin &&
+                write_compressed(ctx, output, &raw[begin], pos - begin, packed, decompressed, dict_size))
+                return 1;
+
+            if (write_stored(output, &raw[pos], stored))
+                return 1;
+
+            pos  += stored;
+            begin = pos;
+        }
+        else
+            /* Skip the incompressible blocks and the compressible block after them */
+            pos += stored + ENTROPY_BLOCK_SIZE;
+    }
+
+    if (begin < raw_size)
+        return write_compressed(ctx, output, &raw[begin], raw_size - begin, packed, decompressed,
+                                dict_size);
+
+    return 0;
+}
+
+static int compress_blocks(MINIFY_CTX    *ctx,
+                           FILE          *input,
+                           STREAM_OUTPUT *output,
+                           BUFFER         raw,
+                           BUFFER         packed,
+                           BUFFER         decompressed,
+                           size_t         dict_size)
+{
+    int error = 0;
+
+    for (;;) {
+        const size_t raw_size = read_data(input, raw.buf, raw.size, &error);
+
+        if (error)
+            return 1;
+
+        if ( ! raw_size)
+            break;
+
+        if (write_block(ctx, output, raw.buf, raw_size, packed, decompressed, dict_size))
+            return 1;
+
+        if (raw_size < raw.size)
+            break;
+    }
+
+    if (write_block_header(output, 0, 0, 0))
+        return 1;
+
+    return output->seek ? write_seek_table(output) : 0;
+}
+
+int compress_stream(FILE                *input,
+                    FILE                *output,
+                    size_t               block_size,
+                    const PARSER_PARAMS *params,
+                    const BUFFER        *dict,
+                    int                  seek_table)
+{
+    MINIFY_CTX   *ctx;
+    STREAM_OUTPUT out;
+    BUFFER        raw;
+    BUFFER        packed;
+    BUFFER        decompressed;
+    uint8_t       header[12];
+    size_t        header_size = 8;
+    const size_t  dict_size   = dict ? dict->size : 0;
+    int           error       = 1;
+
+    if ( ! block_size || block_size > MAX_STREAM_BLOCK_SIZE) {
+        fprintf(stderr, "Error: Invalid block size %zu\n", block_size);
+        return 1;
+    }
+
+    memcpy(header, dict_size ? dict_stream_magic : stream_magic, sizeof(stream_magic));
+    put_uint32(&header[4], (uint32_t)block_size);
+
+    if (dict_size) {
+        put_uint32(&header[8], get_dict_id(dict->buf, dict_size));
+        header_size = 12;
+    }
+
+    memset(&out, 0, sizeof(out));
+    out.file = output;
+    out.seek = seek_table;
+
+    if (write_data(&out, header, header_size))
+        return 1;
+
+    ctx = create_minify_ctx();
+    if ( ! ctx)
+        return 1;
+
+    if (params)
+        set_minify_ctx_params(ctx, params);
+
+    if (dict_size)
+        set_minify_ctx_dict(ctx, dict->buf, dict_size);
+
+    /* Blocks which don't compress below raw size are stored, so packed
+     * data never needs more space than the block.
+     */
+    raw          = buf_alloc_flags(block_size, 0);
+    packed       = buf_alloc_flags(block_size, 0);
+    decompressed = buf_alloc_flags(dict_size + block_size + lz_compress_bound(block_size), 0);
+
+    if ( ! raw.buf || ! packed.buf || ! decompressed.buf)
+        perror(NULL);
+    else {
+        if (dict_size)
+            memcpy(decompressed.buf, dict->buf, dict_size);
+
+        error = compress_blocks(ctx, input, &out, raw, packed, decompressed, dict_size);
+    }
+
+    if ( ! error && fflush(output)) {
+        perror("Error: Failed to write output");
+        error = 1;
+    }
+
+    free(out.entries);
+    buf_free(decompressed);
+    buf_free(packed);
+    buf_free(raw);
+    destroy_minify_ctx(ctx);
+
+    return error;
+}
+
+static int is_valid_block(uint32_t raw_size, uint32_t packed_size, uint32_t lz_size, uint32_t block_size)
+{
+    return raw_size <= block_size && packed_size <= block_size && lz_size <= lz_compress_bound(block_size) &&
+           (lz_size ? (packed_size >= 3) : (packed_size == raw_size));
+}
+
+/* Checks that the dictionary is the one the stream was compressed with */
+static int check_dict(uint32_t dict_id, const BUFFER *dict)
+{
+    if ( ! dict || ! dict->size) {
+        fprintf(stderr, "Error: Stream was compressed with dictionary %08x, use --dict\n", dict_id);
+        return 1;
+    }
+
+    if (get_dict_id(dict->buf, dict->size) != dict_id) {
+        fprintf(stderr, "Error: Dictionary doesn't match dictionary %08x used for the stream\n", dict_id);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Returns pointer to decompressed block data, which is either in decompressed
+ * buffer after the dictionary, or packed data if the block is stored.  Returns
+ * NULL if the block is corrupted.
+ */
+static const uint8_t *decompress_block(const uint8_t *packed,
+                                       uint32_t       raw_size,
+                                       uint32_t       packed_size,
+                                       uint32_t       lz_size,
+                                       BUFFER         decompressed,
+                                       size_t         dict_size)
+{
+    if ( ! lz_size)
+        return packed;
+
+    if (lza_decompress_checked(decompressed.buf + dict_size, raw_size, lz_size,
+                               packed, packed_size, dict_size)) {
+        fprintf(stderr, "Error: Corrupted compressed stream\n");
+        return NULL;
+    }
+
+    return decompressed.buf + dict_size;
+}
+
+static int decompress_blocks(FILE          *input,
+                             STREAM_OUTPUT *output,
+                             uint32_t       block_size,
+                             BUFFER         packed,
+                             BUFFER         decompressed,
+                             size_t         dict_size)
+{
+    int error = 0;
+
+    for (;;) {
+        const uint8_t *data;
+        uint8_t        header[12];
+        uint32_t       raw_size;
+        uint32_t       packed_size;
+        uint32_t       lz_size;
+
+        if (read_data(input, header, sizeof(header), &error) != sizeof(header)) {
+            if ( ! error)
+                fprintf(stderr, "Error: Unexpected end of compressed stream\n");
+            return 1;
+        }
+
+        raw_size    = get_uint32(&header[0]);
+        packed_size = get_uint32(&header[4]);
+        lz_size     = get_uint32(&header[8]);
+
+        if ( ! raw_size)
+            break;
+
+        if ( ! is_valid_block(raw_size, packed_size, lz_size, block_size)) {
+            fprintf(stderr, "Error: Corrupted compressed stream\n");
+            return 1;
+        }
+
+        if (read_data(input, packed.buf, packed_size, &error) != packed_size) {
+            if ( ! error)
+                fprintf(stderr, "Error: Unexpected end of compressed stream\n");
+            return 1;
+        }
+
+        data = decompress_block(packed.buf, raw_size, packed_size, lz_size, decompressed, dict_size);
+        if ( ! data || write_data(output, data, raw_size))
+            return 1;
+    }
+
+    return 0;
+}
+
+int decompress_stream(FILE *input, FILE *output, const BUFFER *dict)
+{
+    STREAM_OUTPUT out;
+    BUFFER        packed;
+    BUFFER        decompressed;
+    uint8_t       header[12];
+    uint32_t      block_size;
+    size_t        dict_size = 0;
+    int           error     = 0;
+
+    if (read_data(input, header, 8, &error) != 8 ||
+        (memcmp(header, stream_magic, sizeof(stream_magic)) &&
+         memcmp(header, dict_stream_magic, sizeof(dict_stream_magic)))) {
+        if ( ! error)
+            fprintf(stderr, "Error: Input is not a compressed stream\n");
+        return 1;
+    }
+
+    /* A dictionary passed for a stream compressed without it is not used */
+    if ( ! memcmp(header, dict_stream_magic, sizeof(dict_stream_magic))) {
+        if (read_data(input, &header[8], 4, &error) != 4) {
+            if ( ! error)
+                fprintf(stderr, "Error: Unexpected end of compressed stream\n");
+            return 1;
+        }
+
+        if (check_dict(get_uint32(&header[8]), dict))
+            return 1;
+
+        dict_size = dict->size;
+    }
+
+    block_size = get_uint32(&header[4]);
+    if ( ! block_size || block_size > MAX_STREAM_BLOCK_SIZE) {
+        fprintf(stderr, "Error: Invalid block size %u in compressed stream\n", block_size);
+        return 1;
+    }
+
+    memset(&out, 0, sizeof(out));
+    out.file = output;
+
+    packed       = buf_alloc_flags(block_size, 0);
+    decompressed = buf_alloc_flags(dict_size + block_size + lz_compress_bound(block_size), 0);
+
+    if ( ! packed.buf || ! decompressed.buf) {
+        perror(NULL);
+        error = 1;
+    }
+    else {
+        if (dict_size)
+            memcpy(decompressed.buf, dict->buf, dict_size);
+
+        error = decompress_blocks(input, &out, block_size, packed, decompressed, dict_size);
+    }
+
+    if ( ! error && fflush(output)) {
+        perror("Error: Failed to write output");
+        error = 1;
+    }
+
+    buf_free(decompressed);
+    buf_free(packed);
+
+    return error;
+}
+
+/* Position of a block in a stream, which is entirely in memory */
+typedef struct {
+    uint64_t raw_offset;    /* Offset of the block's data in uncompressed data */
+    uint64_t offset;        /* Offset of the block's header in the stream */
+} BLOCK_POS;
+
+/* Checks that the seek table starts with the first block, that entries are
+ * in increasing order and that each block header lies before the table.
+ */
+static int is_valid_seek_table(const uint8_t *entries, uint32_t num_entries, size_t header_size, size_t table_offset)
+{
+    uint64_t prev_raw_offset = 0;
+    uint64_t prev_offset     = header_size;
+    uint32_t i;
+
+    for (i = 0; i < num_entries; i++) {
+        const uint64_t raw_offset = get_uint64(&entries[(size_t)i * SEEK_ENTRY_SIZE]);
+        const uint64_t offset     = get_uint64(&entries[(size_t)i * SEEK_ENTRY_SIZE + 8]);
+
+        if (i ? (raw_offset <= prev_raw_offset || offset < prev_offset + 12)
+              : (raw_offset || offset != header_size))
+            return 0;
+
+        if (offset > table_offset || table_offset - offset < 12)
+            return 0;
+
+        prev_raw_offset = raw_offset;
+        prev_offset     = offset;
+    }
+
+    return 1;
+}
+
+/* Finds the last block which starts at or before raw_offset using the seek
+ * table.  Without the seek table, block headers are walked from the first
+ * block, which does not need decompressing either.
+ */
+static int find_block(BUFFER stream, size_t header_size, uint64_t raw_offset, BLOCK_POS *block)
+{
+    const uint8_t *const footer = stream.buf + stream.size - SEEK_FOOTER_SIZE;
+
+    if (stream.size >= header_size + SEEK_FOOTER_SIZE &&
+        ! memcmp(&footer[4], seek_table_magic, sizeof(seek_table_magic))) {
+
+        const uint32_t       num_entries = get_uint32(footer);
+        const uint8_t *const entries     = footer - (size_t)num_entries * SEEK_ENTRY_SIZE;
+        uint32_t             lo          = 0;
+        uint32_t             hi          = num_entries;
+
+        if ((size_t)num_entries > (stream.size - header_size - SEEK_FOOTER_SIZE) / SEEK_ENTRY_SIZE ||
+            ! is_valid_seek_table(entries, num_entries, header_size, (size_t)(entries - stream.buf))) {
+            fprintf(stderr, "Error: Corrupted seek table\n");
+            return 1;
+        }
+
+        /* Empty stream */
+        if ( ! num_entries) {
+            block->raw_offset = 0;
+            block->offset     = header_size;
+            return 0;
+        }
+
+        /* Binary search for the last entry with raw offset not above the requested one */
+        while (hi - lo > 1) {
+            const uint32_t mid = lo + (hi - lo) / 2;
+
+            if (get_uint64(&entries[(size_t)mid * SEEK_ENTRY_SIZE]) <= raw_offset)
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        block->raw_offset = get_uint64(&entries[(size_t)lo * SEEK_ENTRY_SIZE]);
+        block->offset     = get_uint64(&entries[(size_t)lo * SEEK_ENTRY_SIZE + 8]);
+
+        return 0;
+    }
+
+    block->raw_offset = 0;
+    block->offset     = header_size;
+
+    for (;;) {
+        const uint8_t *header;
+        uint32_t       raw_size;
+
+        if (stream.size - block->offset < 12) {
+            fprintf(stderr, "Error: Unexpected end of compressed stream\n");
+            return 1;
+        }
+
+        header   = stream.buf + block->offset;
+        raw_size = get_uint32(header);
+
+        if ( ! raw_size || raw_offset - block->raw_offset < raw_size)
+            return 0;
+
+        block->raw_offset += raw_size;
+        block->offset     += 12 + (uint64_t)get_uint32(&header[4]);
+
+        if (block->offset > stream.size) {
+            fprintf(stderr, "Error: Unexpected end of compressed stream\n");
+            return 1;
+        }
+    }
+}
+
+static int decompress_range(BUFFER     stream,
+                            size_t     header_size,
+                            uint32_t   block_size,
+                            uint64_t   offset,
+                            uint8_t   *dest,
+                            size_t     length,
+                            BUFFER     decompressed,
+                            size_t     dict_size)
+{
+    BLOCK_POS block;
+
+    if (find_block(stream, header_size, offset, &block))
+        return 1;
+
+    while (length) {
+        const uint8_t *header;
+        const uint8_t *data;
+        uint32_t       raw_size;
+        uint32_t       packed_size;
+        uint32_t       lz_size;
+        uint64_t       skip;
+        size_t         size;
+
+        if (stream.size - block.offset < 12) {
+            fprintf(stderr, "Error: Unexpected end of compressed stream\n");
+            return 1;
+        }
+
+        header      = stream.buf + block.offset;
+        raw_size    = get_uint32(&header[0]);
+        packed_size = get_uint32(&header[4]);
+        lz_size     = get_uint32(&header[8]);
+
+        if ( ! raw_size) {
+            fprintf(stderr, "Error: Requested range is beyond the end of compressed data\n");
+            return 1;
+        }
+
+        if ( ! is_valid_block(raw_size, packed_size, lz_size, block_size) ||
+            packed_size > stream.size - block.offset - 12) {
+            fprintf(stderr, "Error: Corrupted compressed stream\n");
+            return 1;
+        }
+
+        /* Blocks before the requested range are only skipped */
+        skip = offset - block.raw_offset;
+        if (skip < raw_size) {
+            data = decompress_block(header + 12, raw_size, packed_size, lz_size, decompressed, dict_size);
+            if ( ! data)
+                return 1;
+
+            size = ((uint64_t)length < raw_size - skip) ? length : (size_t)(raw_size - skip);
+
+            memcpy(dest, data + skip, size);
+
+            dest   += size;
+            offset += size;
+            length -= size;
+        }
+
+        block.raw_offset += raw_size;
+        block.offset     += 12 + (uint64_t)packed_size;
+    }
+
+    return 0;
+}
+
+int lza_decompress_range(const void   *stream,
+                         size_t        stream_size,
+                         uint64_t      offset,
+                         void         *dest,
+                         size_t        length,
+                         const BUFFER *dict)
+{
+    BUFFER         input;
+    BUFFER         decompressed;
+    const uint8_t *header      = (const uint8_t *)stream;
+    size_t         header_size = 8;
+    size_t         dict_size   = 0;
+    uint32_t       block_size;
+    int            error;
+
+    if (stream_size < 8 ||
+        (memcmp(header, stream_magic, sizeof(stream_magic)) &&
+         memcmp(header, dict_stream_magic, sizeof(dict_stream_magic)))) {
+        fprintf(stderr, "Error: Input is not a compressed stream\n");
+        return 1;
+    }
+
+    if ( ! memcmp(header, dict_stream_magic, sizeof(dict_stream_magic))) {
+        if (stream_size < 12) {
+            fprintf(stderr, "Error: Unexpected end of compressed stream\n");
+            return 1;
+        }
+
+        if (check_dict(get_uint32(&header[8]), dict))
+            return 1;
+
+        header_size = 12;
+        dict_size   = dict->size;
+    }
+
+    block_size = get_uint32(&header[4]);
+    if ( ! block_size || block_size > MAX_STREAM_BLOCK_SIZE) {
+        fprintf(stderr, "Error: Invalid block size %u in compressed stream\n", block_size);
+        return 1;
+    }
+
+    if ( ! length)
+        return 0;
+
+    if (offset + length < offset) {
+        fprintf(stderr, "Error: Requested range is beyond the end of compressed data\n");
+        return 1;
+    }
+
+    decompressed = buf_alloc_flags(dict_size + block_size + lz_compress_bound(block_size), 0);
+    if ( ! decompressed.buf) {
+        perror(NULL);
+        return 1;
+    }
+
+    if (dict_size)
+        memcpy(decompressed.buf, dict->buf, dict_size);
+
+    input.buf  = (uint8_t *)stream;
+    input.size = stream_size;
+
+    error = decompress_range(input, header_size, block_size, offset, (uint8_t *)dest, length,
+                             decompressed, dict_size);
+
+    buf_free(decompressed);
+
+    return error;
+}
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include "buffer.h"
+#include "find_repeats.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define DEFAULT_STREAM_BLOCK_SIZE (1U << 20)
+
+/* Compresses input stream block by block, each block is compressed
+ * independently.  Memory use is bounded by the block size.  If params
+ * is NULL, default match finder heuristics are used.  If dict is not NULL,
+ * matches in each block can also refer to the dictionary.  If seek_table
+ * is non-zero, a table of block positions is appended to the stream.
+ * Returns non-zero on failure.
+ */
+int compress_stream(FILE                *input,
+                    FILE                *output,
+                    size_t               block_size,
+                    const PARSER_PARAMS *params,
+                    const BUFFER        *dict,
+                    int                  seek_table);
+
+/* Decompresses stream produced by compress_stream().  A stream compressed
+ * with a dictionary needs the same dictionary, otherwise dict can be NULL.
+ * Returns non-zero on failure.
+ */
+int decompress_stream(FILE *input, FILE *output, const BUFFER *dict);
+
+/* Decompresses length bytes starting at offset of the uncompressed data from
+ * a stream produced by compress_stream(), which is entirely in memory, e.g.
+ * mapped from a file.  Only blocks covering the range are decompressed.
+ * With a seek table the first of them is found with a binary search,
+ * otherwise block headers are walked from the beginning of the stream.
+ * Returns non-zero on failure, including if the range is beyond the end
+ * of the data.
+ */
+int lza_decompress_range(const void   *stream,
+                         size_t        stream_size,
+                         uint64_t      offset,
+                         void         *dest,
+                         size_t        length,
+                         const BUFFER *dict);
@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "arena.h"
+#include "buffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST(expr) do { if ( ! (expr)) { report_error(#expr, __LINE__); ++num_failed; } } while (0)
+
+static void report_error(const char *desc, int line)
+{
+    fprintf(stderr, "test_arena.c:%d: failed test: %s\n",
+            line, desc);
+}
+
+static int is_zero(const uint8_t *buf, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        if (buf[i])
+            return 0;
+    }
+
+    return 1;
+}
+
+int main(void)
+{
+    unsigned num_failed = 0;
+
+    /* Reused memory is zeroed only if requested */
+    {
+        ARENA    arena;
+        uint8_t *first;
+        uint8_t *second;
+
+        TEST(arena_init(&arena, 1U << 20) == 0);
+
+        first = (uint8_t *)arena_alloc(&arena, 1000, ARENA_ZERO);
+        TEST(first != NULL);
+        TEST(is_zero(first, 1000));
+        memset(first, 0xAA, 1000);
+
+        arena_free(&arena, first, 1000);
+
+        second = (uint8_t *)arena_alloc(&arena, 2000, 0);
+        TEST(second == first);
+        TEST(second[0] == 0xAA);
+        TEST(is_zero(second + 1024, 2000 - 1024));
+
+        arena_reset(&arena);
+
+        second = (uint8_t *)arena_alloc(&arena, 3000, ARENA_ZERO);
+        TEST(second == first);
+        TEST(is_zero(second, 3000));
+
+        arena_destroy(&arena);
+    }
+
+    /* Only the last allocation is returned to the arena */
+    {
+        ARENA    arena;
+        uint8_t *first;
+        uint8_t *second;
+
+        TEST(arena_init(&arena, 1U << 20) == 0);
+
+        first  = (uint8_t *)arena_alloc(&arena, 100, 0);
+        second = (uint8_t *)arena_alloc(&arena, 100, 0);
+        TEST(first && second && second > first);
+        TEST(arena_owns(&arena, first));
+        TEST(arena_owns(&arena, second));
+
+        arena_free(&arena, first, 100);
+        TEST((uint8_t *)arena_alloc(&arena, 100, 0) > second);
+
+        arena_destroy(&arena);
+    }
+
+    /* Peak usage survives freeing and starts over after reset */
+    {
+        ARENA    arena;
+        uint8_t *first;
+
+        TEST(arena_init(&arena, 1U << 20) == 0);
+
+        first = (uint8_t *)arena_alloc(&arena, 3000, 0);
+        TEST(first != NULL);
+        TEST(arena.peak >= 3000);
+
+        arena_free(&arena, first, 3000);
+        TEST(arena.peak >= 3000);
+
+        arena_reset(&arena);
+        TEST(arena.peak == 0);
+
+        TEST(arena_alloc(&arena, 100, 0) != NULL);
+        TEST(arena.peak >= 100 && arena.peak < 3000);
+
+        arena_destroy(&arena);
+    }
+
+    /* Allocations which don't fit in the arena fail */
+    {
+        ARENA arena;
+
+        TEST(arena_init(&arena, 1U << 20) == 0);
+        TEST(arena_alloc(&arena, arena.reserved + 1, 0) == NULL);
+        TEST(arena_alloc(&arena, arena.reserved, ARENA_HUGE_PAGES) != NULL);
+        TEST(arena_alloc(&arena, 1, 0) == NULL);
+
+        arena_destroy(&arena);
+    }
+
+    /* Buffers fall back to the heap when the arena is exhausted */
+    {
+        ARENA  arena;
+        BUFFER in_arena;
+        BUFFER on_heap;
+
+        TEST(arena_init(&arena, 1U << 20) == 0);
+        TEST(set_current_arena(&arena) == NULL);
+
+        in_arena = buf_alloc(1000);
+        on_heap  = buf_alloc(arena.reserved);
+
+        TEST(in_arena.buf && in_arena.size == 1000);
+        TEST(on_heap.buf && on_heap.size == arena.reserved);
+        TEST(arena_owns(&arena, in_arena.buf));
+        TEST( ! arena_owns(&arena, on_heap.buf));
+        TEST(is_zero(on_heap.buf, on_heap.size));
+
+        buf_free(on_heap);
+        buf_free(in_arena);
+
+        TEST(set_current_arena(NULL) == &arena);
+        arena_destroy(&arena);
+    }
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -313,5 +313,28 @@ int main(void)
         }
     }
 
+    /* Output buffer too small */
+    {
+        uint32_t lcg_state = 0xF00DCAFE;
+        uint8_t  input[256];
+        uint8_t  output[320];
+        size_t   full_size;
+        size_t   out_size;
+        size_t   i;
+
+        for (i = 0; i < sizeof(input); i++)
+            input[i] = lcg(&lcg_state) & 0xFFU;
+
+        full_size = arith_encode(output, sizeof(output), input, sizeof(input));
+        TEST(full_size <= sizeof(output));
+
+        memset(output, 0xAA, sizeof(output));
+
+        /* Returns the full size, but does not write past the buffer */
+        out_size = arith_encode(output, 16, input, sizeof(input));
+        TEST(out_size == full_size);
+        TEST(output[16] == 0xAA);
+    }
+
     return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "arith_decode.h"
+#include "arith_encode.h"
+#include "bit_cost.h"
+#include "lza_compress.h"
+#include "test_data.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST(expr) do { if ( ! (expr)) { report_error(#expr, __LINE__); ++num_failed; } } while (0)
+
+static void report_error(const char *desc, int line)
+{
+    fprintf(stderr, "test_bit_cost.c:%d: failed test: %s\n",
+            line, desc);
+}
+
+/* Cost of all bits computed by running the model used by the encoder */
+static double get_model_cost(const uint8_t *lz, size_t size)
+{
+    MODEL  model;
+    double cost = 0;
+    size_t i;
+
+    init_model(&model);
+
+    for (i = 0; i < size * 8; i++) {
+        const uint32_t bit = (lz[i >> 3] >> (7 - (i & 7))) & 1U;
+
+        cost += log2((double)(model.prob[0] + model.prob[1]) / (double)model.prob[bit]);
+
+        update_model(&model, bit);
+    }
+
+    return cost;
+}
+
+static double get_row_cost(const BIT_COSTS *costs, enum COST_PACKET packet)
+{
+    double   cost = 0;
+    uint32_t i;
+
+    for (i = 0; i < LZS_NUM_STREAMS; i++)
+        cost += costs->bits[packet][i];
+
+    return cost;
+}
+
+typedef struct {
+    size_t           lz_size;
+    size_t           arith_size;
+    double           model_cost;
+    double           byte_cost;     /* Sum of costs of all input bytes */
+    COMPRESSED_SIZES sizes;
+    BIT_COSTS        costs;
+    int              error;
+} RESULT;
+
+static RESULT compress_costs(const uint8_t *input, size_t size)
+{
+    const size_t   lz_bound = lz_compress_bound(size);
+    uint8_t *const lz       = (uint8_t *)malloc(lz_bound);
+    uint8_t *const arith    = (uint8_t *)malloc(lz_bound * 2);
+    double *const  bytes    = (double *)malloc(size * sizeof(double));
+    RESULT         result;
+
+    memset(&result, 0, sizeof(result));
+    result.error = 1;
+
+    if (lz && arith && bytes) {
+        result.sizes = lz_compress(lz, lz_bound, input, size);
+
+        if (result.sizes.lz) {
+            result.lz_size    = result.sizes.lz;
+            result.arith_size = arith_encode(arith, lz_bound * 2, lz, result.lz_size);
+            result.model_cost = get_model_cost(lz, result.lz_size);
+            result.error      = get_bit_costs(&result.costs, bytes, lz, result.lz_size, size);
+
+            /* Truncated LZ77 data is detected */
+            if ( ! result.error) {
+                BIT_COSTS truncated;
+
+                size_t    i;
+
+                for (i = 0; i < size; i++)
+                    result.byte_cost += bytes[i];
+
+                result.error = ! get_bit_costs(&truncated, NULL, lz, result.lz_size / 2, size);
+            }
+        }
+    }
+
+    free(lz);
+    free(arith);
+    free(bytes);
+
+    return result;
+}
+
+int main(void)
+{
+    unsigned num_failed = 0;
+
+    /* Costs add up to the cost computed by the model and predict the size
+     * of the arithmetic coder's output
+     */
+    {
+        static uint8_t input[0x10000];
+        RESULT         result;
+        uint32_t       i;
+
+        fill_test_data(input, sizeof(input), 1);
+
+        result = compress_costs(input, sizeof(input));
+
+        TEST( ! result.error);
+        TEST(fabs(result.costs.total - result.model_cost) < 0.001);
+        TEST(result.costs.total <= (double)result.arith_size * 8);
+        TEST(result.costs.total + 64 >= (double)result.arith_size * 8);
+        TEST(result.costs.header > 0);
+
+        /* Each packet is charged to the bytes it produces */
+        TEST(fabs(result.byte_cost + result.costs.header +
+                  get_row_cost(&result.costs, COST_PADDING) - result.costs.total) < 0.001);
+
+        for (i = 0; i < COST_NUM_PACKETS; i++)
+            TEST(get_row_cost(&result.costs, (enum COST_PACKET)i) >= 0);
+
+        TEST(result.costs.bits[COST_LIT][LZS_LITERAL] > 0);
+        TEST(result.costs.bits[COST_LIT][LZS_SIZE] == 0);
+        TEST(result.costs.bits[COST_LIT][LZS_OFFSET] == 0);
+        TEST(result.costs.bits[COST_MATCH][LZS_OFFSET] > 0);
+        TEST(result.costs.bits[COST_MATCH][LZS_LITERAL] == 0);
+        TEST(get_row_cost(&result.costs, COST_SHORTREP) == result.costs.bits[COST_SHORTREP][LZS_TYPE]);
+
+        for (i = COST_LONGREP0; i <= COST_LONGREP3; i++) {
+            TEST(result.costs.bits[i][LZS_OFFSET] == 0);
+            TEST(result.costs.bits[i][LZS_LITERAL] == 0);
+        }
+
+        /* Packets which did not occur cost nothing */
+        TEST((result.sizes.stats_shortrep == 0) == (result.costs.bits[COST_SHORTREP][LZS_TYPE] == 0));
+        for (i = 0; i < 4; i++)
+            TEST((result.sizes.stats_longrep[i] == 0) ==
+                 (result.costs.bits[COST_LONGREP0 + i][LZS_TYPE] == 0));
+    }
+
+    /* Incompressible data is spent almost entirely on literals */
+    {
+        static uint8_t input[0x8000];
+        RESULT         result;
+        uint32_t       state = 0x12345678U;
+        size_t         i;
+
+        for (i = 0; i < sizeof(input); i++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            input[i] = (uint8_t)(state >> 24);
+        }
+
+        result = compress_costs(input, sizeof(input));
+
+        TEST( ! result.error);
+        TEST(fabs(result.costs.total - result.model_cost) < 0.001);
+        TEST(get_row_cost(&result.costs, COST_LIT) > result.costs.total * 0.95);
+    }
+
+    /* Tiny input */
+    {
+        static const char input[] = "abcabcabcabcxyzxyzabcabc";
+        RESULT            result  = compress_costs((const uint8_t *)input, sizeof(input) - 1);
+
+        TEST( ! result.error);
+        TEST(fabs(result.costs.total - result.model_cost) < 0.001);
+        TEST(result.costs.total > 0);
+    }
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "cache.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   include <direct.h>
+#   define remove_dir(dir) _rmdir(dir)
+#else
+#   include <dirent.h>
+#   include <unistd.h>
+#   define remove_dir(dir) rmdir(dir)
+#endif
+
+#define TEST(expr) do { if ( ! (expr)) { report_error(#expr, __LINE__); ++num_failed; } } while (0)
+
+static void report_error(const char *desc, int line)
+{
+    fprintf(stderr, "test_cache.c:%d: failed test: %s\n",
+            line, desc);
+}
+
+static CACHE_KEY key_from_seed(uint8_t *input, size_t size, uint8_t seed)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        input[i] = (uint8_t)(seed + i * 7);
+
+    return get_cache_key(input, size, "test");
+}
+
+static int lookup_matches(CACHE *cache, const CACHE_KEY *key, const void *expected, size_t size)
+{
+    BUFFER     output = cache_lookup(cache, key);
+    const int  ok     = output.size == size && ! memcmp(output.buf, expected, size);
+
+    buf_free(output);
+
+    return ok;
+}
+
+static void remove_entries(const char *dir)
+{
+#ifndef _WIN32
+    DIR           *handle = opendir(dir);
+    struct dirent *entry;
+
+    if ( ! handle)
+        return;
+
+    while ((entry = readdir(handle)) != NULL) {
+        char path[1100];
+
+        if (entry->d_name[0] == '.')
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        remove(path);
+    }
+
+    closedir(handle);
+#endif
+    remove_dir(dir);
+}
+
+int main(void)
+{
+    unsigned  num_failed = 0;
+    uint8_t   input[1000];
+    uint8_t   output[3000];
+    char      dir[1024];
+    CACHE    *cache;
+    CACHE_KEY key1;
+    CACHE_KEY key2;
+    CACHE_KEY key3;
+    BUFFER    buf;
+    size_t    i;
+
+    /* Keys depend on data, size and settings */
+    key1 = key_from_seed(input, sizeof(input), 1);
+    key2 = key_from_seed(input, sizeof(input), 2);
+    TEST(memcmp(&key1, &key2, sizeof(key1)) != 0);
+
+    key2 = get_cache_key(input, sizeof(input) - 1, "test");
+    key3 = get_cache_key(input, sizeof(input), "test");
+    TEST(memcmp(&key2, &key3, sizeof(key2)) != 0);
+
+    key2 = get_cache_key(input, sizeof(input), "other");
+    TEST(memcmp(&key2, &key3, sizeof(key2)) != 0);
+
+    key2 = get_cache_key(input, sizeof(input), "test");
+    TEST(memcmp(&key2, &key3, sizeof(key2)) == 0);
+
+    /* Single byte change affects the key */
+    for (i = 0; i < 40; i++) {
+        input[i] ^= 1;
+        key2 = get_cache_key(input, sizeof(input), "test");
+        input[i] ^= 1;
+        TEST(memcmp(&key2, &key3, sizeof(key2)) != 0);
+    }
+
+    snprintf(dir, sizeof(dir), "%s/test_cache.%u",
+             getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (unsigned)getpid());
+
+    for (i = 0; i < sizeof(output); i++)
+        output[i] = (uint8_t)(i * 13);
+
+    /* Limit allows two entries */
+    cache = open_cache(dir, 2 * (sizeof(output) + 100));
+    TEST(cache != NULL);
+    if ( ! cache)
+        return EXIT_FAILURE;
+
+    key1 = key_from_seed(input, sizeof(input), 1);
+    key2 = key_from_seed(input, sizeof(input), 2);
+    key3 = key_from_seed(input, sizeof(input), 3);
+
+    buf = cache_lookup(cache, &key1);
+    TEST(buf.buf == NULL);
+    TEST(buf.size == 0);
+
+    buf.buf  = output;
+    buf.size = sizeof(output);
+    TEST(cache_store(cache, &key1, buf) == 0);
+    TEST(lookup_matches(cache, &key1, output, sizeof(output)));
+
+    buf.buf  = output + 1;
+    buf.size = sizeof(output) - 1;
+    TEST(cache_store(cache, &key2, buf) == 0);
+    TEST(lookup_matches(cache, &key2, output + 1, sizeof(output) - 1));
+    TEST(lookup_matches(cache, &key1, output, sizeof(output)));
+
+    /* Storing third entry evicts one of the previous entries */
+    buf.buf  = output + 2;
+    buf.size = sizeof(output) - 2;
+    TEST(cache_store(cache, &key3, buf) == 0);
+    TEST(lookup_matches(cache, &key3, output + 2, sizeof(output) - 2));
+    TEST(lookup_matches(cache, &key1, output, sizeof(output)) +
+         lookup_matches(cache, &key2, output + 1, sizeof(output) - 1) == 1);
+
+    /* Entries larger than the whole cache are not stored */
+    close_cache(cache);
+    cache = open_cache(dir, 100);
+    TEST(cache != NULL);
+    if (cache) {
+        TEST(cache_store(cache, &key1, buf) == 0);
+        close_cache(cache);
+    }
+
+    remove_entries(dir);
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
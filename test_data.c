@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "test_data.h"
+
+#include <string.h>
+
+/* Xorshift generator, state must be non-zero */
+static uint32_t rng(uint32_t *state)
+{
+    uint32_t value = *state;
+
+    value ^= value << 13;
+    value ^= value >> 17;
+    value ^= value << 5;
+
+    *state = value;
+
+    return value;
+}
+
+void fill_test_data(uint8_t *buf, size_t size, uint32_t seed)
+{
+    static const char words[][8] = {
+        "mov", "push", "pop", "call", "ret", "jmp", "lea", "xor"
+    };
+
+    size_t pos = 0;
+
+    seed = seed * 2U + 1U;
+
+    while (pos < size) {
+        const uint32_t value = rng(&seed);
+        const char    *word  = words[value % 8];
+        size_t         len   = strlen(word);
+
+        if ( ! (value & 0x700U)) {
+            buf[pos++] = (uint8_t)(value >> 16);
+            continue;
+        }
+
+        if (len > size - pos)
+            len = size - pos;
+
+        memcpy(&buf[pos], word, len);
+        pos += len;
+    }
+}
+
+void fill_random_data(uint8_t *buf, size_t size, uint32_t seed)
+{
+    size_t pos;
+
+    seed = seed * 2U + 1U;
+
+    for (pos = 0; pos < size; pos++)
+        buf[pos] = (uint8_t)(rng(&seed) >> 16);
+}
@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Fills buffer with short words mixed with some noise, which has repetitions like code */
+void fill_test_data(uint8_t *buf, size_t size, uint32_t seed);
+
+/* Fills buffer with noise */
+void fill_random_data(uint8_t *buf, size_t size, uint32_t seed);
@@ -0,0 +1,206 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "delta.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST(expr) do { if ( ! (expr)) { report_error(#expr, __LINE__); ++num_failed; } } while (0)
+
+static void report_error(const char *desc, int line)
+{
+    fprintf(stderr, "test_delta.c:%d: failed test: %s\n",
+            line, desc);
+}
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/* Creates patch, applies it to the old version and compares with the new version */
+static int check_patch(BUFFER old_data, BUFFER new_data, long *patch_size)
+{
+    FILE    *const patch  = tmpfile();
+    FILE    *const dest   = tmpfile();
+    uint8_t *const output = (uint8_t *)malloc(new_data.size + 1);
+    int            ok     = 0;
+
+    if (patch && dest && output && ! create_patch(old_data, new_data, patch, NULL)) {
+        *patch_size = ftell(patch);
+        rewind(patch);
+
+        if ( ! apply_patch(old_data, patch, dest)) {
+            rewind(dest);
+
+            ok = fread(output, 1, new_data.size + 1, dest) == new_data.size &&
+                 memcmp(output, new_data.buf, new_data.size) == 0;
+        }
+    }
+
+    if (patch)
+        fclose(patch);
+    if (dest)
+        fclose(dest);
+    free(output);
+
+    return ok;
+}
+
+/* Applies patch to a wrong old version or a truncated patch, returns non-zero if it fails */
+static int check_bad_patch(BUFFER old_data, BUFFER new_data, BUFFER other_data, long truncated_size)
+{
+    FILE *const patch  = tmpfile();
+    FILE *const cut    = tmpfile();
+    FILE *const dest   = tmpfile();
+    int         failed = 0;
+
+    if (patch && cut && dest && ! create_patch(old_data, new_data, patch, NULL)) {
+        long i;
+
+        rewind(patch);
+        for (i = 0; i < truncated_size; i++)
+            fputc(fgetc(patch), cut);
+        rewind(cut);
+
+        failed = apply_patch(other_data, cut, dest) != 0;
+    }
+
+    if (patch)
+        fclose(patch);
+    if (cut)
+        fclose(cut);
+    if (dest)
+        fclose(dest);
+
+    return failed;
+}
+
+/* Applies copies of the patch with random bits flipped in the compressed data,
+ * returns number of copies which were reported as corrupted
+ */
+static unsigned check_corrupted_patch(BUFFER old_data, BUFFER new_data, unsigned num_copies)
+{
+    FILE    *const patch  = tmpfile();
+    uint8_t       *buf    = NULL;
+    uint8_t       *copy   = NULL;
+    long           size   = 0;
+    unsigned       failed = 0;
+    unsigned       i_copy;
+
+    if (patch && ! create_patch(old_data, new_data, patch, NULL)) {
+        size = ftell(patch);
+        buf  = (uint8_t *)malloc((size_t)size);
+        copy = (uint8_t *)malloc((size_t)size);
+        rewind(patch);
+
+        if (buf && fread(buf, 1, (size_t)size, patch) != (size_t)size)
+            size = 0;
+    }
+
+    for (i_copy = 0; buf && copy && size > 24 && i_copy < num_copies; i_copy++) {
+        FILE *const bad  = tmpfile();
+        FILE *const dest = tmpfile();
+        unsigned    i_bit;
+
+        memcpy(copy, buf, (size_t)size);
+
+        /* Leave the patch header intact */
+        for (i_bit = 0; i_bit < 3; i_bit++)
+            copy[24 + rng() % (uint32_t)(size - 24)] ^= (uint8_t)(1U << (rng() % 8));
+
+        if (bad && dest && fwrite(copy, 1, (size_t)size, bad) == (size_t)size) {
+            rewind(bad);
+
+            if (apply_patch(old_data, bad, dest))
+                ++failed;
+        }
+
+        if (bad)
+            fclose(bad);
+        if (dest)
+            fclose(dest);
+    }
+
+    if (patch)
+        fclose(patch);
+    free(copy);
+    free(buf);
+
+    return failed;
+}
+
+int main(void)
+{
+    const size_t   size       = 0x40000;
+    uint8_t *const old_buf    = (uint8_t *)malloc(size);
+    uint8_t *const new_buf    = (uint8_t *)malloc(size + 0x1000);
+    unsigned       num_failed = 0;
+    BUFFER         old_data;
+    BUFFER         new_data;
+    long           patch_size = 0;
+    size_t         i;
+
+    if ( ! old_buf || ! new_buf) {
+        perror(NULL);
+        return EXIT_FAILURE;
+    }
+
+    /* Data which does not compress on its own */
+    for (i = 0; i < size; i++)
+        old_buf[i] = (uint8_t)rng();
+
+    /* New version with a few changed bytes, a removed range and an inserted range */
+    memcpy(new_buf, old_buf, 0x10000);
+    for (i = 0; i < 16; i++)
+        new_buf[0x1000 * i + 0x123] ^= 0x5A;
+    memcpy(&new_buf[0x10000], &old_buf[0x18000], 0x10000);
+    for (i = 0x20000; i < 0x21000; i++)
+        new_buf[i] = (uint8_t)rng();
+    memcpy(&new_buf[0x21000], &old_buf[0x28000], size - 0x28000);
+
+    old_data.buf  = old_buf;
+    old_data.size = size;
+    new_data.buf  = new_buf;
+    new_data.size = 0x21000 + size - 0x28000;
+
+    /* Patch is only as large as the changes */
+    TEST(check_patch(old_data, new_data, &patch_size));
+    TEST(patch_size > 0x1000);
+    TEST(patch_size < 0x1000 + 0x400);
+
+    /* Corrupted patch */
+    TEST(check_corrupted_patch(old_data, new_data, 100) > 0);
+
+    /* Unrelated new version is stored */
+    new_data.size = 0x1000;
+    memcpy(new_buf, &new_buf[0x20000], new_data.size);
+    TEST(check_patch(old_data, new_data, &patch_size));
+    TEST(patch_size == 24 + 0x1000);
+
+    /* Identical files */
+    TEST(check_patch(old_data, old_data, &patch_size));
+    TEST(patch_size < 0x100);
+
+    /* Wrong old version or truncated patch */
+    old_data.size = 0x20000;
+    new_data.buf  = &old_buf[0x20000];
+    new_data.size = 0x20000;
+    TEST(check_bad_patch(old_data, old_data, new_data, 1000));
+    TEST(check_bad_patch(old_data, old_data, old_data, 20));
+    TEST(check_bad_patch(old_data, old_data, old_data, 30));
+
+    free(new_buf);
+    free(old_buf);
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,144 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "dict.h"
+#include "lza_compress.h"
+#include "lza_decompress.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST(expr) do { if ( ! (expr)) { report_error(#expr, __LINE__); ++num_failed; } } while (0)
+
+static void report_error(const char *desc, int line)
+{
+    fprintf(stderr, "test_dict.c:%d: failed test: %s\n",
+            line, desc);
+}
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/* Small documents with the same structure, but different values */
+static size_t gen_document(uint8_t *buf, size_t size)
+{
+    static const char *const keys[] = {
+        "\"identifier\": ", "\"description\": ", "\"created_timestamp\": ",
+        "\"modified_timestamp\": ", "\"owner_account\": ", "\"permissions\": ",
+        "\"content_type\": ", "\"checksum_sha256\": "
+    };
+    size_t pos = 0;
+
+    while (pos + 64 < size) {
+        const char *const key = keys[rng() % (sizeof(keys) / sizeof(keys[0]))];
+
+        pos += (size_t)snprintf((char *)&buf[pos], size - pos, "    %s%u,\n", key, (unsigned)rng());
+    }
+
+    return pos;
+}
+
+/* Compresses input with optional prefix, returns LZ77 size or 0 if it does not decompress */
+static size_t compress_with_prefix(const uint8_t *input, size_t size, const BUFFER *dict)
+{
+    const size_t     prefix = dict ? dict->size : 0;
+    const size_t     bound  = lz_compress_bound(size);
+    uint8_t *const   lz     = (uint8_t *)malloc(bound);
+    uint8_t *const   src    = (uint8_t *)malloc(prefix + size);
+    uint8_t *const   decomp = (uint8_t *)malloc(prefix + size);
+    OFFSET_MAP      *map    = create_offset_map(prefix + size);
+    COMPRESSED_SIZES compressed;
+    size_t           lz_size = 0;
+
+    if (lz && src && decomp && map) {
+        if (prefix) {
+            memcpy(src, dict->buf, prefix);
+            memcpy(decomp, dict->buf, prefix);
+        }
+        memcpy(src + prefix, input, size);
+
+        compressed = lz_compress_with_prefix(map, lz, bound, src + prefix, size, prefix);
+
+        if (compressed.lz) {
+            lz_decompress_with_prefix(decomp + prefix, size, lz, prefix);
+            if ( ! memcmp(decomp + prefix, input, size))
+                lz_size = compressed.lz;
+        }
+    }
+
+    if (map)
+        destroy_offset_map(map);
+    free(decomp);
+    free(src);
+    free(lz);
+
+    return lz_size;
+}
+
+int main(void)
+{
+    enum { NUM_SAMPLES = 100, SAMPLE_SIZE = 0x400 };
+
+    static uint8_t sample_data[NUM_SAMPLES][SAMPLE_SIZE];
+    BUFFER         samples[NUM_SAMPLES];
+    uint8_t        input[SAMPLE_SIZE];
+    size_t         input_size;
+    BUFFER         dict;
+    unsigned       num_failed = 0;
+    size_t         i;
+
+    for (i = 0; i < NUM_SAMPLES; i++) {
+        samples[i].buf  = sample_data[i];
+        samples[i].size = gen_document(sample_data[i], SAMPLE_SIZE);
+    }
+
+    input_size = gen_document(input, sizeof(input));
+
+    /* Dictionary is limited to the requested size */
+    dict = train_dict(samples, NUM_SAMPLES, 0x1000);
+    TEST(dict.size > 0);
+    TEST(dict.size <= 0x1000);
+
+    /* Input similar to the samples compresses better with the dictionary */
+    if (dict.size) {
+        const size_t plain_size = compress_with_prefix(input, input_size, NULL);
+        const size_t dict_size  = compress_with_prefix(input, input_size, &dict);
+
+        TEST(plain_size > 0);
+        TEST(dict_size > 0);
+        TEST(dict_size < plain_size * 7 / 8);
+    }
+
+    /* Identifier depends on contents */
+    TEST(get_dict_id(dict.buf, dict.size) == get_dict_id(dict.buf, dict.size));
+    TEST(get_dict_id(dict.buf, dict.size) != get_dict_id(dict.buf, dict.size - 1));
+
+    buf_free(dict);
+
+    /* Samples without anything in common */
+    for (i = 0; i < NUM_SAMPLES; i++) {
+        size_t pos;
+
+        for (pos = 0; pos < SAMPLE_SIZE; pos++)
+            sample_data[i][pos] = (uint8_t)rng();
+
+        samples[i].size = SAMPLE_SIZE;
+    }
+
+    dict = train_dict(samples, NUM_SAMPLES, 0x1000);
+    TEST(dict.size == 0);
+
+    buf_free(dict);
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
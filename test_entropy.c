@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "entropy.h"
+#include "lza_compress.h"
+#include "lza_decompress.h"
+#include "test_data.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST(expr) do { if ( ! (expr)) { report_error(#expr, __LINE__); ++num_failed; } } while (0)
+
+static void report_error(const char *desc, int line)
+{
+    fprintf(stderr, "test_entropy.c:%d: failed test: %s\n",
+            line, desc);
+}
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/* Instruction-like data with a skewed distribution of bytes */
+static void gen_code(uint8_t *buf, size_t size)
+{
+    static const uint8_t opcodes[] = { 0x48, 0x89, 0x8B, 0xE8, 0xC3, 0x00, 0xFF, 0x0F };
+    size_t               i;
+
+    for (i = 0; i < size; i++)
+        buf[i] = (rng() & 1U) ? opcodes[rng() % sizeof(opcodes)] : (uint8_t)(rng() & 0x3FU);
+}
+
+int main(void)
+{
+    enum {
+        block     = ENTROPY_BLOCK_SIZE,
+        size      = 16 * ENTROPY_BLOCK_SIZE,
+        code_size = 4 * ENTROPY_BLOCK_SIZE
+    };
+    uint8_t *const input      = (uint8_t *)malloc(size);
+    uint8_t *const output     = (uint8_t *)malloc(size);
+    uint8_t *const lz         = (uint8_t *)malloc(lz_compress_bound(size));
+    unsigned       num_failed = 0;
+
+    if ( ! input || ! output || ! lz) {
+        perror(NULL);
+        return EXIT_FAILURE;
+    }
+
+    /* Detection of random data */
+    fill_random_data(input, block, 1);
+    TEST(is_incompressible(input, block));
+
+    gen_code(input, block);
+    TEST( ! is_incompressible(input, block));
+
+    memset(input, 0, block);
+    TEST( ! is_incompressible(input, block));
+
+    TEST( ! is_incompressible(input, 0));
+
+    /* Only whole blocks at the beginning of the buffer are counted */
+    fill_random_data(input, 3 * block, 2);
+    gen_code(&input[3 * block], block);
+    fill_random_data(&input[4 * block], block, 3);
+    TEST(get_incompressible_size(input, 5 * block) == 3 * block);
+    TEST(get_incompressible_size(input, 3 * block - 1) == 2 * block);
+    TEST(get_incompressible_size(&input[3 * block], 2 * block) == 0);
+    TEST(get_incompressible_size(&input[4 * block], block) == block);
+    TEST(get_incompressible_size(&input[4 * block], block - 1) == 0);
+
+    /* Code surrounding random data, matches are still found across the
+     * random data, which is skipped by the match finder.
+     */
+    gen_code(input, code_size);
+    fill_random_data(&input[code_size], size - 2 * code_size - 100, 4);
+    memcpy(&input[size - code_size - 100], input, code_size);
+    gen_code(&input[size - 100], 100);
+    {
+        const COMPRESSED_SIZES compressed = lz_compress(lz, lz_compress_bound(size), input, size);
+
+        TEST(compressed.lz > 0);
+        /* Each literal takes 9 bits before arithmetic coding, the copy of
+         * code after random data takes just a few bytes.
+         */
+        TEST(compressed.lz < (size - code_size) * 9 / 8);
+
+        memset(output, 0, size);
+        lz_decompress(output, size, lz, NULL);
+        TEST(memcmp(input, output, size) == 0);
+    }
+
+    /* Random data which is not aligned on block boundary */
+    fill_random_data(input, size, 5);
+    {
+        const COMPRESSED_SIZES compressed = lz_compress(lz, lz_compress_bound(size), input + 1, size - 1);
+
+        TEST(compressed.lz > 0);
+
+        memset(output, 0, size);
+        lz_decompress(output, size - 1, lz, NULL);
+        TEST(memcmp(input + 1, output, size - 1) == 0);
+    }
+
+    free(lz);
+    free(output);
+    free(input);
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
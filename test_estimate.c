@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "arith_encode.h"
+#include "estimate.h"
+#include "lza_compress.h"
+#include "test_data.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST(expr) do { if ( ! (expr)) { report_error(#expr, __LINE__); ++num_failed; } } while (0)
+
+static void report_error(const char *desc, int line)
+{
+    fprintf(stderr, "test_estimate.c:%d: failed test: %s\n",
+            line, desc);
+}
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/* Records of similar structure with a few varying fields, like tables in executables */
+static void gen_records(uint8_t *buf, size_t size, uint32_t seed)
+{
+    size_t i;
+
+    rng_state = seed * 2U + 1U;
+
+    for (i = 0; i < size; i++) {
+        switch (i % 16) {
+            case 0:  buf[i] = (uint8_t)(i >> 4);     break;
+            case 1:  buf[i] = (uint8_t)(i >> 12);    break;
+            case 4:  buf[i] = (uint8_t)(rng() & 7U); break;
+            case 8:  buf[i] = (uint8_t)rng();        break;
+            default: buf[i] = (uint8_t)(i % 16);     break;
+        }
+    }
+}
+
+typedef void (* GEN_FUNC)(uint8_t *buf, size_t size, uint32_t seed);
+
+int main(void)
+{
+    /* Text-like data has many candidate matches for each position and the
+     * reduced search misses many long matches, so the estimate is worse.
+     */
+    static const struct {
+        GEN_FUNC generate;
+        double   max_error;
+    } generators[] = {
+        { gen_records,      0.05 },
+        { fill_test_data,   0.30 },
+        { fill_random_data, 0.01 }
+    };
+    const size_t   size       = 0x20000;
+    uint8_t *const input      = (uint8_t *)malloc(size);
+    const size_t   dest_size  = estimate_compress_size(size);
+    uint8_t *const dest       = (uint8_t *)malloc(dest_size);
+    uint8_t *const lz         = (uint8_t *)malloc(lz_compress_bound(size));
+    unsigned       num_failed = 0;
+    uint32_t       i;
+
+    if ( ! input || ! dest || ! lz) {
+        perror(NULL);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < sizeof(generators) / sizeof(generators[0]); i++) {
+        COMPRESSED_SIZES compressed;
+        SIZE_ESTIMATE    estimate;
+        size_t           total;
+        size_t           encoded;
+        double           bits;
+        uint32_t         stream;
+
+        generators[i].generate(input, size, i);
+
+        /* Replaying the model predicts the size of arithmetic coding to a byte */
+        compressed = lz_compress(lz, lz_compress_bound(size), input, size);
+        TEST(compressed.lz > 0);
+
+        bits    = estimate_arith_bits(lz, compressed.lz);
+        encoded = arith_encode(dest, dest_size, lz, compressed.lz);
+        TEST(encoded >= (size_t)floor(bits / 8));
+        TEST(encoded <= (size_t)ceil(bits / 8) + 2);
+
+        /* Estimated size of the whole compression is close */
+        compressed = lza_compress(dest, dest_size, input, size);
+        TEST(compressed.compressed > 0);
+
+        TEST(estimate_lza_size(&estimate, input, size, NULL) == 0);
+        TEST(estimate.compressed > 0);
+        TEST((double)estimate.compressed < (double)compressed.compressed * (1 + generators[i].max_error));
+        TEST((double)estimate.compressed > (double)compressed.compressed * (1 - generators[i].max_error));
+
+        /* Stream sizes add up to LZ77 size together with the header */
+        total = 0;
+        bits  = estimate.header_bits;
+        for (stream = 0; stream < LZS_NUM_STREAMS; stream++) {
+            total += estimate.streams[stream];
+            bits  += estimate.stream_bits[stream];
+        }
+        TEST(total < estimate.lz);
+        TEST(estimate.lz - total <= LZS_NUM_STREAMS * 4);
+        TEST((size_t)ceil(bits / 8) + 1 == estimate.compressed);
+    }
+
+    /* Nothing to compress */
+    {
+        SIZE_ESTIMATE estimate;
+
+        TEST(estimate_lza_size(&estimate, input, 0, NULL) == 0);
+        TEST(estimate.compressed == 0);
+    }
+
+    free(lz);
+    free(dest);
+    free(input);
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
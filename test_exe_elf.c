@@ -0,0 +1,218 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "elf_format.h"
+#include "exe_elf.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) && defined(__x86_64__)
+#   include <sys/stat.h>
+#   include <sys/wait.h>
+#   include <unistd.h>
+#   define CAN_RUN_ELF 1
+#else
+#   define CAN_RUN_ELF 0
+#endif
+
+#define TEST(expr) do { if ( ! (expr)) { report_error(#expr, __LINE__); ++num_failed; } } while (0)
+
+static void report_error(const char *desc, int line)
+{
+    fprintf(stderr, "test_exe_elf.c:%d: failed test: %s\n",
+            line, desc);
+}
+
+#define CODE_VADDR 0x400000U
+#define DATA_VADDR 0x402000U
+#define DATA_OFFS  0x1000U
+#define DATA_SIZE  0x3000U
+#define BSS_SIZE   0x2000U
+#define FILE_SIZE  (DATA_OFFS + DATA_SIZE)
+
+/* Sums bytes of data and bss, stores the sum in the last byte of bss
+ * to check that it is writable and exits with the sum.
+ */
+static const uint8_t code[] = {
+    0x48, 0x8D, 0x35, 0x00, 0x00, 0x00, 0x00,   /* lea    rsi, [rip + data]   */
+    0xB9, 0x00, 0x00, 0x00, 0x00,               /* mov    ecx, size           */
+    0x31, 0xC0,                                 /* xor    eax, eax            */
+    0x02, 0x06,                                 /* add    al, [rsi]           */
+    0x48, 0xFF, 0xC6,                           /* inc    rsi                 */
+    0xFF, 0xC9,                                 /* dec    ecx                 */
+    0x75, 0xF7,                                 /* jnz    add                 */
+    0x88, 0x46, 0xFF,                           /* mov    [rsi - 1], al       */
+    0x0F, 0xB6, 0xF8,                           /* movzx  edi, al             */
+    0xB8, 0xE7, 0x00, 0x00, 0x00,               /* mov    eax, 231 (exit_group) */
+    0x0F, 0x05                                  /* syscall                    */
+};
+
+static void set_segment(ELF64_PROGRAM_HEADER *ph, uint32_t flags, uint32_t offset, uint32_t vaddr,
+                        uint32_t file_size, uint32_t mem_size)
+{
+    ph->type      = make_uint32_le(PT_LOAD);
+    ph->flags     = make_uint32_le(flags);
+    ph->offset    = make_uint64_le(offset);
+    ph->vaddr     = make_uint64_le(vaddr);
+    ph->paddr     = make_uint64_le(vaddr);
+    ph->file_size = make_uint64_le(file_size);
+    ph->mem_size  = make_uint64_le(mem_size);
+    ph->align     = make_uint64_le(0x1000);
+}
+
+/* Builds a minimal static executable with a code and a data segment, returns exit code it produces */
+static int build_exe(uint8_t *buf, uint16_t type)
+{
+    ELF64_HEADER         *const header = (ELF64_HEADER *)buf;
+    ELF64_PROGRAM_HEADER *const ph     = (ELF64_PROGRAM_HEADER *)(buf + sizeof(ELF64_HEADER));
+    const uint32_t              code_offs = (uint32_t)(sizeof(ELF64_HEADER) + 2 * sizeof(ELF64_PROGRAM_HEADER));
+    static const char           text[] = "minify packs executables ";
+    uint8_t                    *data   = buf + DATA_OFFS;
+    uint32_t                    rel;
+    uint32_t                    i;
+    uint8_t                     sum    = 0;
+
+    memset(buf, 0, FILE_SIZE);
+
+    buf[0] = 0x7F;
+    buf[1] = 'E';
+    buf[2] = 'L';
+    buf[3] = 'F';
+    buf[4] = ELF_CLASS_64;
+    buf[5] = ELF_DATA_LE;
+    buf[6] = ELF_VERSION;
+
+    header->type          = make_uint16_le(type);
+    header->machine       = make_uint16_le(ELF_MACHINE_X86_64);
+    header->version       = make_uint32_le(ELF_VERSION);
+    header->entry_point   = make_uint64_le(CODE_VADDR + code_offs);
+    header->ph_offset     = make_uint64_le(sizeof(ELF64_HEADER));
+    header->header_size   = make_uint16_le((uint16_t)sizeof(ELF64_HEADER));
+    header->ph_entry_size = make_uint16_le((uint16_t)sizeof(ELF64_PROGRAM_HEADER));
+    header->ph_count      = make_uint16_le(2);
+
+    set_segment(&ph[0], PF_R | PF_X, 0, CODE_VADDR, code_offs + (uint32_t)sizeof(code),
+                code_offs + (uint32_t)sizeof(code));
+    set_segment(&ph[1], PF_R | PF_W, DATA_OFFS, DATA_VADDR, DATA_SIZE, DATA_SIZE + BSS_SIZE);
+
+    memcpy(buf + code_offs, code, sizeof(code));
+
+    rel = DATA_VADDR - (CODE_VADDR + code_offs + 7);
+    memcpy(buf + code_offs + 3, make_uint32_le(rel).bytes, 4);
+    memcpy(buf + code_offs + 8, make_uint32_le(DATA_SIZE + BSS_SIZE).bytes, 4);
+
+    /* Compressible data */
+    for (i = 0; i < DATA_SIZE; i++) {
+        data[i]  = (uint8_t)((uint8_t)text[i % (sizeof(text) - 1)] + (i >> 10));
+        sum     = (uint8_t)(sum + data[i]);
+    }
+
+    return sum;
+}
+
+#if CAN_RUN_ELF
+/* Saves executable in a temporary file, runs it and returns its exit code */
+static int run_exe(const uint8_t *buf, size_t size)
+{
+    char  filename[256];
+    FILE *file;
+    int   status;
+
+    snprintf(filename, sizeof(filename), "%s/test_exe_elf.%u",
+             getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (unsigned)getpid());
+
+    file = fopen(filename, "wb");
+    if ( ! file)
+        return -1;
+
+    if (fwrite(buf, 1, size, file) != size) {
+        fclose(file);
+        remove(filename);
+        return -1;
+    }
+
+    fclose(file);
+    chmod(filename, 0700);
+
+    status = system(filename);
+
+    remove(filename);
+
+    return (status != -1 && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+}
+#endif
+
+int main(void)
+{
+    static uint8_t input[FILE_SIZE];
+    unsigned       num_failed = 0;
+    int            exit_code;
+    REPORT         report;
+    BUFFER         output;
+
+    memset(&report, 0, sizeof(report));
+
+    /* Executable is packed with loader segment below the image and data segment above it */
+    exit_code = build_exe(input, ELF_TYPE_EXEC);
+    TEST(is_elf_file(input, sizeof(input)));
+    TEST(estimate_elf_memory(input, sizeof(input)) > sizeof(input));
+
+    output = exe_elf(input, sizeof(input), NULL, 0, 0, &report);
+    TEST(output.buf != NULL);
+    TEST(output.size < sizeof(input));
+    TEST(is_elf_file(output.buf, output.size));
+    TEST(report.sizes.compressed > 0);
+
+    /* Compressed data is above the image, only one page of the loader is below it */
+    if (output.buf) {
+        const ELF64_PROGRAM_HEADER *const ph = (const ELF64_PROGRAM_HEADER *)(output.buf + sizeof(ELF64_HEADER));
+
+        TEST(get_uint64_le(ph[0].vaddr) == CODE_VADDR - 0x1000U);
+        TEST(get_uint64_le(ph[2].vaddr) > DATA_VADDR + DATA_SIZE + BSS_SIZE);
+    }
+
+#if CAN_RUN_ELF
+    /* Packed executable behaves like the original */
+    TEST(run_exe(input, sizeof(input)) == exit_code);
+    if (output.buf)
+        TEST(run_exe(output.buf, output.size) == exit_code);
+#else
+    (void)exit_code;
+#endif
+
+    buf_free(output);
+
+    /* Image split into blocks, which are decompressed on first touch */
+    output = exe_elf(input, sizeof(input), NULL, 0x1000, 0, &report);
+    TEST(output.buf != NULL);
+    TEST(output.size < sizeof(input));
+    TEST(is_elf_file(output.buf, output.size));
+
+#if CAN_RUN_ELF
+    if (output.buf)
+        TEST(run_exe(output.buf, output.size) == exit_code);
+#endif
+
+    buf_free(output);
+
+    /* Position-independent and dynamically linked executables are compressed as generic files */
+    build_exe(input, ELF_TYPE_DYN);
+    TEST( ! is_elf_file(input, sizeof(input)));
+    build_exe(input, ELF_TYPE_EXEC);
+    ((ELF64_PROGRAM_HEADER *)(input + sizeof(ELF64_HEADER)))[1].type = make_uint32_le(PT_INTERP);
+    TEST( ! is_elf_file(input, sizeof(input)));
+    build_exe(input, ELF_TYPE_EXEC);
+    ((ELF64_PROGRAM_HEADER *)(input + sizeof(ELF64_HEADER)))[1].type = make_uint32_le(PT_DYNAMIC);
+    TEST( ! is_elf_file(input, sizeof(input)));
+
+    /* Other files */
+    TEST( ! is_elf_file("\x7F" "ELF", 4));
+    input[4] = 1;
+    TEST( ! is_elf_file(input, sizeof(input)));
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,323 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "exe_pe.h"
+#include "pe_format.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#   include <process.h>
+#   define CAN_RUN_PE 1
+#elif defined(__linux__) && defined(__x86_64__)
+#   include <sys/wait.h>
+#   include <unistd.h>
+#   define CAN_RUN_PE 1
+#else
+#   define CAN_RUN_PE 0
+#endif
+
+#define TEST(expr) do { if ( ! (expr)) { report_error(#expr, __LINE__); ++num_failed; } } while (0)
+
+static void report_error(const char *desc, int line)
+{
+    fprintf(stderr, "test_exe_pe.c:%d: failed test: %s\n",
+            line, desc);
+}
+
+#define IMAGE_BASE_32 0x400000U
+#define IMAGE_BASE_64 0x140000000U
+#define CODE_RVA      0x1000U
+#define DATA_RVA      0x2000U
+#define DATA_SIZE     0x5000U
+#define BSS_SIZE      0x2000U
+#define IDATA_RVA     (DATA_RVA + DATA_SIZE + BSS_SIZE)
+#define IMAGE_SIZE    (IDATA_RVA + 0x1000U)
+#define HEADERS_SIZE  0x400U
+#define CODE_OFFS     HEADERS_SIZE
+#define DATA_OFFS     (CODE_OFFS + 0x200U)
+#define IDATA_OFFS    (DATA_OFFS + DATA_SIZE)
+#define FILE_SIZE     (IDATA_OFFS + 0x200U)
+#define NUM_DIRS      16U
+
+/* Offsets of import data in .idata */
+#define ILT_OFFS      0x40U
+#define IAT_OFFS      0x60U
+#define FUNC_OFFS     0x80U
+#define DLL_OFFS      0xA0U
+
+/* Sums bytes of data and bss, stores the sum in the last byte of bss
+ * to check that it is writable and calls ExitProcess with the sum.
+ */
+static const uint8_t code_32[] = {
+    0xBE, 0x00, 0x00, 0x00, 0x00,               /* mov    esi, data           */
+    0xB9, 0x00, 0x00, 0x00, 0x00,               /* mov    ecx, size           */
+    0x31, 0xC0,                                 /* xor    eax, eax            */
+    0x02, 0x06,                                 /* add    al, [esi]           */
+    0x46,                                       /* inc    esi                 */
+    0x49,                                       /* dec    ecx                 */
+    0x75, 0xFA,                                 /* jnz    add                 */
+    0x88, 0x46, 0xFF,                           /* mov    [esi - 1], al       */
+    0x0F, 0xB6, 0xC0,                           /* movzx  eax, al             */
+    0x50,                                       /* push   eax                 */
+    0xFF, 0x15, 0x00, 0x00, 0x00, 0x00,         /* call   [ExitProcess]       */
+    0xC3                                        /* ret                        */
+};
+
+static const uint8_t code_64[] = {
+    0x48, 0x8D, 0x35, 0x00, 0x00, 0x00, 0x00,   /* lea    rsi, [rip + data]   */
+    0xB9, 0x00, 0x00, 0x00, 0x00,               /* mov    ecx, size           */
+    0x31, 0xC0,                                 /* xor    eax, eax            */
+    0x02, 0x06,                                 /* add    al, [rsi]           */
+    0x48, 0xFF, 0xC6,                           /* inc    rsi                 */
+    0xFF, 0xC9,                                 /* dec    ecx                 */
+    0x75, 0xF7,                                 /* jnz    add                 */
+    0x88, 0x46, 0xFF,                           /* mov    [rsi - 1], al       */
+    0x0F, 0xB6, 0xC8,                           /* movzx  ecx, al             */
+    0x48, 0x83, 0xEC, 0x28,                     /* sub    rsp, 40             */
+    0xFF, 0x15, 0x00, 0x00, 0x00, 0x00,         /* call   [rip + ExitProcess] */
+    0xC3                                        /* ret                        */
+};
+
+static void set_section(SECTION_HEADER *section, const char *name, uint32_t rva, uint32_t virtual_size,
+                        uint32_t offset, uint32_t raw_size, uint32_t flags)
+{
+    memcpy(section->name, name, strlen(name));
+    section->virtual_size        = make_uint32_le(virtual_size);
+    section->virtual_address     = make_uint32_le(rva);
+    section->size_of_raw_data    = make_uint32_le(raw_size);
+    section->pointer_to_raw_data = make_uint32_le(offset);
+    section->flags               = make_uint32_le(flags);
+}
+
+/* Stores a 32-bit or 64-bit value in the import lookup table or IAT */
+static void set_thunk(uint8_t *buf, uint32_t value, int is_64bit)
+{
+    if (is_64bit)
+        memcpy(buf, make_uint64_le(value).bytes, 8);
+    else
+        memcpy(buf, make_uint32_le(value).bytes, 4);
+}
+
+/* Builds a minimal executable with code, data and import sections, which
+ * imports ExitProcess from KERNEL32.dll, returns exit code it produces
+ */
+static int build_exe(uint8_t *buf, int is_64bit)
+{
+    DOS_HEADER       *const dos_header = (DOS_HEADER *)buf;
+    PE_HEADER        *const pe_header  = (PE_HEADER *)(buf + sizeof(DOS_HEADER));
+    PE32_HEADER      *const opt_header = (PE32_HEADER *)(pe_header + 1);
+    const uint32_t          opt_size   = (is_64bit ? 112U : 96U) + NUM_DIRS * (uint32_t)sizeof(DATA_DIRECTORY);
+    SECTION_HEADER   *const sections   = (SECTION_HEADER *)((uint8_t *)opt_header + opt_size);
+    DATA_DIRECTORY         *data_dir;
+    IMPORT_DIR_ENTRY *const import_dir = (IMPORT_DIR_ENTRY *)(buf + IDATA_OFFS);
+    uint8_t          *const code       = buf + CODE_OFFS;
+    uint8_t          *const data       = buf + DATA_OFFS;
+    const uint32_t          thunk_size = is_64bit ? 8U : 4U;
+    const uint32_t          rw_flags   = SECTION_CNT_INITIALIZED_DATA | SECTION_MEM_READ | SECTION_MEM_WRITE;
+    static const char       text[]     = "minify packs executables ";
+    uint32_t                i;
+    uint8_t                 sum        = 0;
+
+    memset(buf, 0, FILE_SIZE);
+
+    dos_header->mz_signature = make_uint16_le(0x5A4D);
+    dos_header->pe_offset    = make_uint32_le((uint32_t)sizeof(DOS_HEADER));
+
+    pe_header->pe_signature       = make_uint32_le(0x4550);
+    pe_header->machine            = make_uint16_le(is_64bit ? PE_MACHINE_X86_64 : PE_MACHINE_X86_32);
+    pe_header->number_of_sections = make_uint16_le(3);
+    pe_header->optional_hdr_size  = make_uint16_le((uint16_t)opt_size);
+    pe_header->flags              = make_uint16_le(PE_FLAG_RELOCS_STRIPPED | PE_FLAG_EXECUTABLE_IMAGE |
+                                                   (is_64bit ? PE_FLAG_LARGE_ADDRESS_AWARE : PE_FLAG_32BIT_MACHINE));
+
+    opt_header->pe_format           = make_uint16_le(is_64bit ? PE_FORMAT_PE32_PLUS : PE_FORMAT_PE32);
+    opt_header->size_of_code        = make_uint32_le(0x1000);
+    opt_header->size_of_data        = make_uint32_le(IMAGE_SIZE - DATA_RVA);
+    opt_header->entry_point         = make_uint32_le(CODE_RVA);
+    opt_header->base_of_code        = make_uint32_le(CODE_RVA);
+    opt_header->section_alignment   = make_uint32_le(0x1000);
+    opt_header->file_alignment      = make_uint32_le(0x200);
+    opt_header->min_os_ver_major    = make_uint16_le(6);
+    opt_header->subsystem_ver_major = make_uint16_le(6);
+    opt_header->size_of_image       = make_uint32_le(IMAGE_SIZE);
+    opt_header->size_of_headers     = make_uint32_le(HEADERS_SIZE);
+    opt_header->subsystem           = make_uint16_le(SUBSYSTEM_CUI);
+
+    if (is_64bit) {
+        opt_header->u1.u64.image_base                 = make_uint64_le(IMAGE_BASE_64);
+        opt_header->u2.u64.size_of_stack_reserve      = make_uint64_le(0x100000);
+        opt_header->u2.u64.size_of_stack_commit       = make_uint64_le(0x1000);
+        opt_header->u2.u64.number_of_rva_and_sizes    = make_uint32_le(NUM_DIRS);
+        data_dir                                      = opt_header->u2.u64.rva_and_sizes;
+    }
+    else {
+        opt_header->u1.u32.base_of_data               = make_uint32_le(DATA_RVA);
+        opt_header->u1.u32.image_base                 = make_uint32_le(IMAGE_BASE_32);
+        opt_header->u2.u32.size_of_stack_reserve      = make_uint32_le(0x100000);
+        opt_header->u2.u32.size_of_stack_commit       = make_uint32_le(0x1000);
+        opt_header->u2.u32.number_of_rva_and_sizes    = make_uint32_le(NUM_DIRS);
+        data_dir                                      = opt_header->u2.u32.rva_and_sizes;
+    }
+
+    data_dir[DIR_IMPORT_TABLE].virtual_address = make_uint32_le(IDATA_RVA);
+    data_dir[DIR_IMPORT_TABLE].size            = make_uint32_le(2 * (uint32_t)sizeof(IMPORT_DIR_ENTRY));
+    data_dir[DIR_IAT].virtual_address          = make_uint32_le(IDATA_RVA + IAT_OFFS);
+    data_dir[DIR_IAT].size                     = make_uint32_le(2 * thunk_size);
+
+    set_section(&sections[0], ".text", CODE_RVA, 0x1000, CODE_OFFS, 0x200,
+                SECTION_CNT_CODE | SECTION_MEM_EXECUTE | SECTION_MEM_READ);
+    set_section(&sections[1], ".data", DATA_RVA, DATA_SIZE + BSS_SIZE, DATA_OFFS, DATA_SIZE, rw_flags);
+    set_section(&sections[2], ".idata", IDATA_RVA, 0x1000, IDATA_OFFS, 0x200, rw_flags);
+
+    /* Code */
+    if (is_64bit) {
+        memcpy(code, code_64, sizeof(code_64));
+        memcpy(code + 3,  make_uint32_le(DATA_RVA - (CODE_RVA + 7)).bytes, 4);
+        memcpy(code + 8,  make_uint32_le(DATA_SIZE + BSS_SIZE).bytes, 4);
+        memcpy(code + 35, make_uint32_le(IDATA_RVA + IAT_OFFS - (CODE_RVA + 39)).bytes, 4);
+    }
+    else {
+        memcpy(code, code_32, sizeof(code_32));
+        memcpy(code + 1,  make_uint32_le(IMAGE_BASE_32 + DATA_RVA).bytes, 4);
+        memcpy(code + 6,  make_uint32_le(DATA_SIZE + BSS_SIZE).bytes, 4);
+        memcpy(code + 27, make_uint32_le(IMAGE_BASE_32 + IDATA_RVA + IAT_OFFS).bytes, 4);
+    }
+
+    /* Imports */
+    import_dir->import_lookup_table_rva  = make_uint32_le(IDATA_RVA + ILT_OFFS);
+    import_dir->name_rva                 = make_uint32_le(IDATA_RVA + DLL_OFFS);
+    import_dir->import_address_table_rva = make_uint32_le(IDATA_RVA + IAT_OFFS);
+
+    set_thunk(buf + IDATA_OFFS + ILT_OFFS, IDATA_RVA + FUNC_OFFS, is_64bit);
+    set_thunk(buf + IDATA_OFFS + IAT_OFFS, IDATA_RVA + FUNC_OFFS, is_64bit);
+    strcpy((char *)buf + IDATA_OFFS + FUNC_OFFS + 2, "ExitProcess");
+    strcpy((char *)buf + IDATA_OFFS + DLL_OFFS, "KERNEL32.dll");
+
+    /* Compressible data with zero pages in the middle, which are skipped by the packer */
+    for (i = 0; i < DATA_SIZE; i++) {
+        if (i >= 0x1000 && i < 0x3000)
+            continue;
+        data[i]  = (uint8_t)((uint8_t)text[i % (sizeof(text) - 1)] + (i >> 10));
+        sum     = (uint8_t)(sum + data[i]);
+    }
+
+    return sum;
+}
+
+#if CAN_RUN_PE
+/* Saves executable in a temporary file, runs it and returns its exit code.
+ * On Windows it runs directly, elsewhere it runs with pe_run.
+ */
+static int run_exe(const char *pe_run, const uint8_t *buf, size_t size)
+{
+    char  filename[256];
+    char  command[1024];
+    FILE *file;
+    int   status;
+
+#ifdef _WIN32
+    snprintf(filename, sizeof(filename), "%s\\test_exe_pe.%d.exe",
+             getenv("TEMP") ? getenv("TEMP") : ".", _getpid());
+#else
+    snprintf(filename, sizeof(filename), "%s/test_exe_pe.%u",
+             getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (unsigned)getpid());
+#endif
+
+    file = fopen(filename, "wb");
+    if ( ! file)
+        return -1;
+
+    if (fwrite(buf, 1, size, file) != size) {
+        fclose(file);
+        remove(filename);
+        return -1;
+    }
+
+    fclose(file);
+
+#ifdef _WIN32
+    (void)pe_run;
+    snprintf(command, sizeof(command), "\"%s\"", filename);
+    status = system(command);
+#else
+    snprintf(command, sizeof(command), "%s < %s", pe_run, filename);
+    status = system(command);
+    status = (status != -1 && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+#endif
+
+    remove(filename);
+
+    return status;
+}
+
+/* Returns runner for executables, NULL if they can't be run */
+static const char *get_pe_run(int argc, char *argv[], int is_64bit)
+{
+#ifdef _WIN32
+    (void)argc;
+    (void)argv;
+    (void)is_64bit;
+    return "";
+#else
+    return (argc > 1 + is_64bit) ? argv[1 + is_64bit] : NULL;
+#endif
+}
+#endif
+
+/* Optional arguments are pe_run built for x86 and x64, which run the executables,
+ * on Windows the executables run directly
+ */
+int main(int argc, char *argv[])
+{
+    static uint8_t input[FILE_SIZE];
+    unsigned       num_failed = 0;
+    int            is_64bit;
+    REPORT         report;
+
+    for (is_64bit = 0; is_64bit < 2; is_64bit++) {
+        const int   exit_code = build_exe(input, is_64bit);
+        const char *pe_run    = NULL;
+        BUFFER      output;
+
+        memset(&report, 0, sizeof(report));
+
+        TEST(is_pe_file(input, sizeof(input)));
+        TEST(estimate_pe_memory(input, sizeof(input)) > sizeof(input));
+
+        output = exe_pe(input, sizeof(input), NULL, 0, NULL, &report);
+        TEST(output.buf != NULL);
+        TEST(output.size < sizeof(input));
+        TEST(is_pe_file(output.buf, output.size));
+        TEST(report.sizes.compressed > 0);
+
+#if CAN_RUN_PE
+        /* Packed executable behaves like the original */
+        pe_run = get_pe_run(argc, argv, is_64bit);
+        if (pe_run) {
+            TEST(run_exe(pe_run, input, sizeof(input)) == exit_code);
+            if (output.buf)
+                TEST(run_exe(pe_run, output.buf, output.size) == exit_code);
+        }
+#else
+        (void)exit_code;
+        (void)pe_run;
+        (void)argc;
+        (void)argv;
+#endif
+
+        buf_free(output);
+    }
+
+    /* DLLs are not supported */
+    memset(&report, 0, sizeof(report));
+    build_exe(input, 0);
+    ((PE_HEADER *)(input + sizeof(DOS_HEADER)))->flags = make_uint16_le(PE_FLAG_EXECUTABLE_IMAGE | PE_FLAG_DLL);
+    TEST(exe_pe(input, sizeof(input), NULL, 0, NULL, &report).buf == NULL);
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "heatmap.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   include <process.h>
+#else
+#   include <unistd.h>
+#endif
+
+#define TEST(expr) do { if ( ! (expr)) { report_error(#expr, __LINE__); ++num_failed; } } while (0)
+
+static void report_error(const char *desc, int line)
+{
+    fprintf(stderr, "test_heatmap.c:%d: failed test: %s\n",
+            line, desc);
+}
+
+static size_t read_file(const char *filename, char *buf, size_t size)
+{
+    FILE  *const file = fopen(filename, "rb");
+    size_t       len  = 0;
+
+    if (file) {
+        len = fread(buf, 1, size - 1, file);
+        fclose(file);
+    }
+
+    buf[len] = 0;
+
+    return len;
+}
+
+int main(void)
+{
+    static double costs[0x1000];
+    static char   buf[0x4000];
+    char          filename[256];
+    HEATMAP      *heatmap;
+    unsigned      num_failed = 0;
+    size_t        i;
+
+    heatmap = create_heatmap(0x1000, 0x3000);
+    TEST(heatmap != NULL);
+    if ( ! heatmap)
+        return EXIT_FAILURE;
+
+    /* Section names are not always terminated */
+    TEST(add_heatmap_region(heatmap, ".text\0\0\0", 8, 0x1000, 0x800) == 0);
+    TEST(add_heatmap_region(heatmap, ".rdata", 8, 0x2000, 0x1000) == 0);
+
+    /* First 256 bytes are incompressible, 64 bytes in the second page take 4 bits each */
+    for (i = 0; i < 0x100; i++)
+        costs[i] = 8;
+    add_heatmap_costs(heatmap, 0x1000, costs, 0x100);
+
+    for (i = 0; i < 0x40; i++)
+        costs[i] = 4;
+    add_heatmap_costs(heatmap, 0x2040, costs, 0x40);
+
+    snprintf(filename, sizeof(filename), "%s/test_heatmap.%u",
+             getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (unsigned)getpid());
+
+    TEST(save_heatmap(heatmap, filename, HEATMAP_CSV) == 0);
+    read_file(filename, buf, sizeof(buf));
+    TEST(strcmp(buf, "rva,region,compressed_bits\n"
+                     "0x1000,.text,2048.0\n"
+                     "0x2000,.rdata,256.0\n"
+                     "0x3000,-,0.0\n") == 0);
+
+    TEST(save_heatmap(heatmap, filename, HEATMAP_PGM) == 0);
+    {
+        static const char header[] = "P5\n# One row per page starting at RVA 0x1000, 64 bytes per pixel\n64 3\n255\n";
+        const size_t      len      = read_file(filename, buf, sizeof(buf));
+        const uint8_t    *pixels   = (const uint8_t *)buf + sizeof(header) - 1;
+
+        TEST(len == sizeof(header) - 1 + 64 * 3);
+        TEST(memcmp(buf, header, sizeof(header) - 1) == 0);
+        if (len == sizeof(header) - 1 + 64 * 3) {
+            TEST(pixels[0] == 255);
+            TEST(pixels[3] == 255);
+            TEST(pixels[4] == 0);
+            TEST(pixels[64] == 0);
+            TEST(pixels[65] == 128);
+            TEST(pixels[66] == 0);
+            TEST(pixels[128] == 0);
+        }
+    }
+
+    remove(filename);
+
+    /* Too many regions */
+    for (i = 0; i < 30; i++)
+        TEST(add_heatmap_region(heatmap, "x", 1, 0x3000, 0x10) == 0);
+    TEST(add_heatmap_region(heatmap, "x", 1, 0x3000, 0x10) != 0);
+
+    destroy_heatmap(heatmap);
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,312 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "lza_compress.h"
+#include "lza_decompress.h"
+#include "test_data.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST(expr) do { if ( ! (expr)) { report_error(#expr, __LINE__); ++num_failed; } } while (0)
+
+static void report_error(const char *desc, int line)
+{
+    fprintf(stderr, "test_lz_compress.c:%d: failed test: %s\n",
+            line, desc);
+}
+
+static uint32_t lcg(uint32_t *state)
+{
+    const uint32_t prev_state = *state;
+    const uint32_t value      = prev_state & 0x7FFFFFFFU;
+
+    *state = prev_state * 0x8088406U + 1U;
+
+    return value;
+}
+
+/* Returns random distance from 1 to max_value, which is spread over all slots */
+static uint64_t random_distance(uint32_t *state, uint64_t max_value)
+{
+    const int bits  = (int)(lcg(state) % 64);
+    uint64_t  value = (uint64_t)lcg(state) << 33;
+
+    value ^= (uint64_t)lcg(state) << 2;
+    value ^= lcg(state);
+    value >>= 63 - bits;
+
+    return (value % max_value) + 1;
+}
+
+static int round_trip(const uint8_t *input, size_t size)
+{
+    const size_t   dest_size = lz_compress_bound(size);
+    uint8_t *const dest      = (uint8_t *)malloc(dest_size);
+    uint8_t *const decomp    = (uint8_t *)malloc(size);
+    int            ok        = 0;
+
+    if (dest && decomp) {
+        const COMPRESSED_SIZES compressed = lz_compress(dest, dest_size, input, size);
+
+        if (compressed.lz) {
+            lz_decompress(decomp, size, dest, NULL);
+            ok = memcmp(input, decomp, size) == 0;
+        }
+    }
+
+    free(dest);
+    free(decomp);
+
+    return ok;
+}
+
+/* Compresses with a map allocated for the given parameters */
+static int round_trip_with_params(const uint8_t       *input,
+                                  size_t               size,
+                                  const PARSER_PARAMS *params,
+                                  COMPRESSED_SIZES    *compressed)
+{
+    const size_t   dest_size = lz_compress_bound(size);
+    uint8_t *const dest      = (uint8_t *)malloc(dest_size);
+    uint8_t *const decomp    = (uint8_t *)malloc(size);
+    OFFSET_MAP    *map       = create_offset_map(get_offset_map_input_size(size, params));
+    int            ok        = 0;
+
+    if (dest && decomp && map) {
+        set_offset_map_params(map, params);
+
+        *compressed = lz_compress_with_map(map, dest, dest_size, input, size);
+
+        if (compressed->lz) {
+            lz_decompress(decomp, size, dest, NULL);
+            ok = memcmp(input, decomp, size) == 0;
+        }
+    }
+
+    if (map)
+        destroy_offset_map(map);
+    free(dest);
+    free(decomp);
+
+    return ok;
+}
+
+int main(void)
+{
+    unsigned num_failed = 0;
+
+    {
+        static const char input[] = "abcabcabcabcxyzxyzabcabc";
+        TEST(round_trip((const uint8_t *)input, sizeof(input) - 1));
+    }
+
+    {
+        static uint8_t input[0x10000];
+        fill_test_data(input, sizeof(input), 1);
+        TEST(round_trip(input, sizeof(input)));
+    }
+
+    /* Output fits in lz_compress_bound() for incompressible data */
+    {
+        static uint8_t input[0x10000];
+        uint32_t       seed = 3;
+        size_t         i;
+
+        for (i = 0; i < sizeof(input); i++)
+            input[i] = (uint8_t)(lcg(&seed) >> 8);
+        TEST(round_trip(input, sizeof(input)));
+    }
+
+    /* Output fits in lz_compress_bound() for data with many short repeats */
+    {
+        static uint8_t input[0x10000];
+        uint32_t       seed = 4;
+        size_t         i;
+
+        for (i = 0; i < sizeof(input); i++)
+            input[i] = (uint8_t)((i & 1) ? (lcg(&seed) >> 8) : 0);
+        TEST(round_trip(input, sizeof(input)));
+    }
+
+    /* Checked decompressor rejects truncated and corrupted input */
+    {
+        static uint8_t   input[0x10000];
+        static uint8_t   decomp[0x10000];
+        const size_t     dest_size = lz_compress_bound(sizeof(input));
+        uint8_t *const   dest      = (uint8_t *)malloc(dest_size);
+        uint8_t *const   corrupted = (uint8_t *)malloc(dest_size);
+        COMPRESSED_SIZES compressed;
+        uint32_t         seed      = 5;
+        unsigned         failed    = 0;
+        unsigned         i;
+
+        TEST(dest && corrupted);
+        if ( ! dest || ! corrupted)
+            return EXIT_FAILURE;
+
+        fill_test_data(input, sizeof(input), 2);
+        compressed = lz_compress(dest, dest_size, input, sizeof(input));
+        TEST(compressed.lz > 0);
+
+        TEST(lz_decompress_checked(decomp, sizeof(decomp), dest, compressed.lz, 0) == 0);
+        TEST(memcmp(input, decomp, sizeof(input)) == 0);
+        TEST(lz_decompress_checked(decomp, sizeof(decomp), dest, compressed.lz / 2, 0) == 1);
+        TEST(lz_decompress_checked(decomp, sizeof(decomp), dest, 0, 0) == 1);
+
+        for (i = 0; i < 200; i++) {
+            const size_t pos = lcg(&seed) % compressed.lz;
+
+            memcpy(corrupted, dest, compressed.lz);
+            corrupted[pos] ^= (uint8_t)(1U << (lcg(&seed) % 8));
+            failed += (unsigned)lz_decompress_checked(decomp, sizeof(decomp), corrupted, compressed.lz, 0);
+        }
+        TEST(failed > 0);
+
+        free(dest);
+        free(corrupted);
+    }
+
+    /* Distances and stream sizes of inputs over 4 GB round trip with 7-bit slots */
+    {
+        static const uint64_t values[] = {
+            1, 2, 3, 4, 0xFFFFFFFFU, 0x100000000ULL,
+            0x100000001ULL, 0x200000000ULL, 0x3FFFFFFFFULL, 0x123456789ABULL,
+            0x8000000000000000ULL, 0xFFFFFFFFFFFFFFFFULL
+        };
+        static uint8_t buf[0x1000];
+        const size_t   num_values = sizeof(values) / sizeof(values[0]);
+        const size_t   num_random = 200;
+        BIT_EMITTER    emitter;
+        BIT_STREAM     stream;
+        size_t         size;
+        uint32_t       seed       = 7;
+        int            slot_bits;
+        size_t         i;
+
+        TEST(LZA_SLOT_BITS((size_t)LZA_MAX_COMPACT_SIZE) == 6);
+        TEST(LZA_SLOT_BITS((size_t)LZA_MAX_COMPACT_SIZE + 1) == 7);
+
+        for (slot_bits = 6; slot_bits <= 7; slot_bits++) {
+            /* 6-bit slots only cover values up to 32 bits */
+            const uint64_t max_value = (slot_bits == 6) ? 0x100000000ULL : ~(uint64_t)0;
+            uint32_t       state     = seed;
+
+            init_bit_emitter(&emitter, buf, sizeof(buf));
+            for (i = 0; i < num_values; i++) {
+                if (values[i] <= max_value)
+                    lz_emit_distance(&emitter, values[i], slot_bits);
+            }
+            for (i = 0; i < num_random; i++)
+                lz_emit_distance(&emitter, random_distance(&state, max_value), slot_bits);
+            size = emit_tail(&emitter);
+            TEST(size < sizeof(buf));
+
+            state = seed;
+            init_bit_stream(&stream, buf, size);
+            for (i = 0; i < num_values; i++) {
+                if (values[i] <= max_value)
+                    TEST(lz_decode_distance(&stream, slot_bits) == values[i]);
+            }
+            for (i = 0; i < num_random; i++)
+                TEST(lz_decode_distance(&stream, slot_bits) == random_distance(&state, max_value));
+        }
+    }
+
+    /* Zero regions are skipped by the decompressor */
+    {
+        static uint8_t     input[0x8000];
+        static uint8_t     compact[0x8000];
+        static uint8_t     dest[0x40000];
+        static uint8_t     decomp[0x8000];
+        static ZERO_REGION regions[] = {
+            { 0x0000, 0x1000 },
+            { 0x3000, 0x2000 },
+            { 0x7000, 0x1000 },
+            { 0,      0      }
+        };
+        COMPRESSED_SIZES compressed;
+        size_t           compact_size = 0;
+        size_t           offs         = 0;
+        uint32_t         i;
+
+        fill_test_data(input, sizeof(input), 2);
+
+        for (i = 0; regions[i].size; i++) {
+            memcpy(&compact[compact_size], &input[offs], regions[i].offset - offs);
+            compact_size += regions[i].offset - offs;
+            offs          = regions[i].offset + regions[i].size;
+            memset(&input[regions[i].offset], 0, regions[i].size);
+        }
+        memcpy(&compact[compact_size], &input[offs], sizeof(input) - offs);
+        compact_size += sizeof(input) - offs;
+
+        compressed = lz_compress(dest, sizeof(dest), compact, compact_size);
+        TEST(compressed.lz > 0);
+
+        memset(decomp, 0xAA, sizeof(decomp));
+
+        lz_decompress(decomp, sizeof(decomp), dest, regions);
+
+        for (i = 0; regions[i].size; i++) {
+            uint32_t j;
+
+            for (j = 0; j < regions[i].size; j++) {
+                if (decomp[regions[i].offset + j] != 0xAA)
+                    break;
+            }
+            TEST(j == regions[i].size);
+
+            memset(&decomp[regions[i].offset], 0, regions[i].size);
+        }
+
+        TEST(memcmp(input, decomp, sizeof(input)) == 0);
+    }
+
+    /* Budgets produce valid output */
+    {
+        const size_t     size  = 0x100000;
+        uint8_t *const   input = (uint8_t *)malloc(size);
+        PARSER_PARAMS    params;
+        COMPRESSED_SIZES compressed;
+        COMPRESSED_SIZES unlimited;
+
+        TEST(input != NULL);
+        if ( ! input)
+            return EXIT_FAILURE;
+
+        /* The second half repeats the first half, so the whole input in the map is never worse */
+        fill_test_data(input, size / 2, 5);
+        memcpy(input + size / 2, input, size / 2);
+
+        get_default_parser_params(&params);
+        TEST(round_trip_with_params(input, size, &params, &unlimited));
+        TEST(unlimited.degraded == 0);
+
+        /* The map is smaller than the input and is cleared when it fills up */
+        params.max_map_size = 1;
+        TEST(get_offset_map_input_size(size, NULL) == size);
+        TEST(get_offset_map_input_size(size, &params) < size);
+        TEST(round_trip_with_params(input, size, &params, &compressed));
+        TEST(compressed.degraded == 0);
+        TEST(compressed.lz >= unlimited.lz);
+
+        /* Deadline has passed, everything is stored as literals */
+        get_default_parser_params(&params);
+        params.deadline_us = 1;
+        TEST(round_trip_with_params(input, size, &params, &compressed));
+        TEST(compressed.degraded == size);
+        TEST(compressed.stats_match == 0);
+        TEST(compressed.stats_lit == size);
+
+        free(input);
+    }
+
+    if (num_failed)
+        fprintf(stderr, "test_lz_compress.c: failed %u tests\n", num_failed);
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
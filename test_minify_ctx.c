@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "minify_ctx.h"
+#include "lza_compress.h"
+#include "lza_decompress.h"
+#include "test_data.h"
+#include "thread_pool.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST(expr) do { if ( ! (expr)) { report_error(#expr, __LINE__); ++num_failed; } } while (0)
+
+static void report_error(const char *desc, int line)
+{
+    fprintf(stderr, "test_minify_ctx.c:%d: failed test: %s\n",
+            line, desc);
+}
+
+/* Compresses input with the context and checks that the output is the same
+ * as without the context and that it decompresses correctly.
+ */
+static int check_compress(MINIFY_CTX *ctx, size_t size, uint32_t seed)
+{
+    const size_t   dest_size = estimate_compress_size(size);
+    uint8_t *const input     = (uint8_t *)malloc(size);
+    uint8_t *const expected  = (uint8_t *)malloc(dest_size);
+    uint8_t *const dest      = (uint8_t *)malloc(dest_size);
+    uint8_t *const decomp    = (uint8_t *)malloc(size + lz_compress_bound(size));
+    int            ok        = 0;
+
+    if (input && expected && dest && decomp) {
+        COMPRESSED_SIZES compressed;
+        COMPRESSED_SIZES ref;
+
+        fill_test_data(input, size, seed);
+
+        ref        = lza_compress(expected, dest_size, input, size);
+        compressed = minify_compress(ctx, dest, dest_size, input, size);
+
+        if (compressed.lz && compressed.compressed == ref.compressed &&
+            compressed.compressed <= dest_size &&
+            memcmp(dest, expected, compressed.compressed) == 0) {
+
+            lza_decompress(decomp, size, compressed.lz, dest, compressed.compressed);
+            ok = memcmp(input, decomp, size) == 0;
+        }
+    }
+
+    free(input);
+    free(expected);
+    free(dest);
+    free(decomp);
+
+    return ok;
+}
+
+typedef struct {
+    MINIFY_CTX *contexts[4];
+    unsigned    num_failed[4];
+} PARALLEL;
+
+static void compress_item(void *cookie, size_t item, uint32_t thread_id)
+{
+    PARALLEL *const parallel = (PARALLEL *)cookie;
+
+    if ( ! check_compress(parallel->contexts[thread_id], 500 + item * 100, (uint32_t)item))
+        ++parallel->num_failed[thread_id];
+}
+
+int main(void)
+{
+    unsigned num_failed = 0;
+
+    /* Reuse context for inputs of different sizes, including inputs which
+     * don't fit in the initial offset map.
+     */
+    {
+        MINIFY_CTX *const ctx = create_minify_ctx();
+
+        TEST(ctx != NULL);
+        if (ctx) {
+            TEST(check_compress(ctx, 1000, 1));
+            TEST(check_compress(ctx, 0x10000, 2));
+            TEST(check_compress(ctx, 100, 3));
+            TEST(check_compress(ctx, 0x100000, 4));
+            TEST(check_compress(ctx, 5000, 5));
+
+            destroy_minify_ctx(ctx);
+        }
+    }
+
+    /* Many small inputs, the offset map fills up and is cleared */
+    {
+        MINIFY_CTX *const ctx = create_minify_ctx();
+
+        TEST(ctx != NULL);
+        if (ctx) {
+            uint32_t i;
+            unsigned num_ok = 0;
+
+            for (i = 0; i < 200; i++)
+                num_ok += (unsigned)check_compress(ctx, 3000 + i, i);
+
+            TEST(num_ok == 200);
+
+            destroy_minify_ctx(ctx);
+        }
+    }
+
+    /* One context per thread */
+    {
+        PARALLEL parallel;
+        uint32_t i;
+
+        memset(&parallel, 0, sizeof(parallel));
+
+        for (i = 0; i < 4; i++) {
+            parallel.contexts[i] = create_minify_ctx();
+            TEST(parallel.contexts[i] != NULL);
+        }
+
+        TEST(run_parallel(64, 4, compress_item, &parallel) == 0);
+
+        for (i = 0; i < 4; i++) {
+            TEST(parallel.num_failed[i] == 0);
+            destroy_minify_ctx(parallel.contexts[i]);
+        }
+    }
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "lza_compress.h"
+#include "lza_decompress.h"
+#include "profile.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   include <process.h>
+#else
+#   include <unistd.h>
+#endif
+
+#define TEST(expr) do { if ( ! (expr)) { report_error(#expr, __LINE__); ++num_failed; } } while (0)
+
+static void report_error(const char *desc, int line)
+{
+    fprintf(stderr, "test_profile.c:%d: failed test: %s\n",
+            line, desc);
+}
+
+static int write_text(const char *filename, const char *text)
+{
+    FILE *const file = fopen(filename, "w");
+
+    if ( ! file)
+        return 1;
+
+    fputs(text, file);
+
+    return fclose(file);
+}
+
+/* Compresses input with the given parameters, returns LZ77 size or 0 on failure */
+static size_t compress_with_params(const uint8_t *input, size_t size, const PARSER_PARAMS *params)
+{
+    const size_t     bound  = lz_compress_bound(size);
+    uint8_t *const   lz     = (uint8_t *)malloc(bound);
+    uint8_t *const   decomp = (uint8_t *)malloc(size);
+    OFFSET_MAP      *map    = create_offset_map(size);
+    COMPRESSED_SIZES compressed;
+    size_t           lz_size = 0;
+
+    if (lz && decomp && map) {
+        set_offset_map_params(map, params);
+
+        compressed = lz_compress_with_map(map, lz, bound, input, size);
+
+        if (compressed.lz) {
+            lz_decompress(decomp, size, lz, NULL);
+            if ( ! memcmp(decomp, input, size))
+                lz_size = compressed.lz;
+        }
+    }
+
+    if (map)
+        destroy_offset_map(map);
+    free(decomp);
+    free(lz);
+
+    return lz_size;
+}
+
+int main(void)
+{
+    static uint8_t input[0x10000];
+    char           filename[256];
+    PARSER_PARAMS  params;
+    PARSER_PARAMS  defaults;
+    unsigned       num_failed = 0;
+    uint32_t       state      = 1;
+    size_t         i;
+
+    snprintf(filename, sizeof(filename), "%s/test_profile.%u",
+             getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (unsigned)getpid());
+
+    get_default_parser_params(&defaults);
+    TEST(is_default_profile(&defaults));
+
+    /* Saved profile loads back */
+    params.max_len3_distance = 512;
+    params.max_len4_distance = 65536;
+    params.min_score         = 4;
+    params.trailing_rep      = 0;
+    TEST( ! is_default_profile(&params));
+    {
+        FILE *const file = fopen(filename, "w");
+
+        TEST(file != NULL);
+        if (file) {
+            fprintf(file, "# comment\n\n");
+            write_profile(file, &params);
+            fclose(file);
+        }
+    }
+    memset(&params, 0, sizeof(params));
+    TEST(load_profile(filename, &params) == 0);
+    TEST(params.max_len3_distance == 512);
+    TEST(params.max_len4_distance == 65536);
+    TEST(params.min_score         == 4);
+    TEST(params.trailing_rep      == 0);
+
+    /* Missing parameters keep defaults */
+    TEST(write_text(filename, "min_score 3\n") == 0);
+    TEST(load_profile(filename, &params) == 0);
+    TEST(params.max_len3_distance == defaults.max_len3_distance);
+    TEST(params.max_len4_distance == defaults.max_len4_distance);
+    TEST(params.min_score         == 3);
+    TEST(params.trailing_rep      == defaults.trailing_rep);
+
+    /* Invalid entries */
+    TEST(write_text(filename, "min_score 3\nunknown 1\n") == 0);
+    TEST(load_profile(filename, &params) != 0);
+    TEST(write_text(filename, "trailing_rep 2\n") == 0);
+    TEST(load_profile(filename, &params) != 0);
+    TEST(write_text(filename, "max_len3_distance -1\n") == 0);
+    TEST(load_profile(filename, &params) != 0);
+
+    remove(filename);
+
+    /* Text-like data with short matches at various distances */
+    for (i = 0; i < sizeof(input); i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        input[i] = (uint8_t)('a' + (state % 8));
+    }
+
+    /* Any parameters produce valid output, but they affect the result */
+    {
+        const size_t default_size = compress_with_params(input, sizeof(input), &defaults);
+        size_t       other_size;
+
+        TEST(default_size > 0);
+
+        params                   = defaults;
+        params.max_len3_distance = 0;
+        params.max_len4_distance = 0;
+        other_size = compress_with_params(input, sizeof(input), &params);
+        TEST(other_size > 0);
+        TEST(other_size != default_size);
+
+        params              = defaults;
+        params.min_score    = 0;
+        params.trailing_rep = 0;
+        TEST(compress_with_params(input, sizeof(input), &params) > 0);
+    }
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,446 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "stream.h"
+#include "test_data.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST(expr) do { if ( ! (expr)) { report_error(#expr, __LINE__); ++num_failed; } } while (0)
+
+static void report_error(const char *desc, int line)
+{
+    fprintf(stderr, "test_stream.c:%d: failed test: %s\n",
+            line, desc);
+}
+
+static uint32_t lcg(uint32_t *state)
+{
+    const uint32_t prev_state = *state;
+    const uint32_t value      = prev_state & 0x7FFFFFFFU;
+
+    *state = prev_state * 0x8088406U + 1U;
+
+    return value;
+}
+
+static long get_file_size(FILE *file)
+{
+    const long size = ftell(file);
+
+    rewind(file);
+
+    return size;
+}
+
+/* Compresses input through a stream, decompresses it back and compares */
+static int check_stream(const uint8_t *input,
+                        size_t         size,
+                        size_t         block_size,
+                        const BUFFER  *dict,
+                        long          *packed_size)
+{
+    FILE    *const src    = tmpfile();
+    FILE    *const packed = tmpfile();
+    FILE    *const dest   = tmpfile();
+    uint8_t *const output = (uint8_t *)malloc(size + 1);
+    int            ok     = 0;
+
+    if (src && packed && dest && output) {
+        if (fwrite(input, 1, size, src) == size) {
+            rewind(src);
+
+            if ( ! compress_stream(src, packed, block_size, NULL, dict, 0)) {
+                *packed_size = get_file_size(packed);
+
+                if ( ! decompress_stream(packed, dest, dict)) {
+                    rewind(dest);
+
+                    ok = fread(output, 1, size + 1, dest) == size &&
+                         (size == 0 || memcmp(input, output, size) == 0);
+                }
+            }
+        }
+    }
+
+    if (src)
+        fclose(src);
+    if (packed)
+        fclose(packed);
+    if (dest)
+        fclose(dest);
+    free(output);
+
+    return ok;
+}
+
+/* Compresses input into memory, optionally with a seek table */
+static BUFFER compress_to_buffer(const uint8_t *input, size_t size, size_t block_size,
+                                 const BUFFER *dict, int seek_table)
+{
+    FILE *const src    = tmpfile();
+    FILE *const packed = tmpfile();
+    BUFFER      output = { NULL, 0 };
+
+    if (src && packed && fwrite(input, 1, size, src) == size) {
+        rewind(src);
+
+        if ( ! compress_stream(src, packed, block_size, NULL, dict, seek_table)) {
+            const long packed_size = get_file_size(packed);
+
+            output.buf = (uint8_t *)malloc((size_t)packed_size);
+            if (output.buf && fread(output.buf, 1, (size_t)packed_size, packed) == (size_t)packed_size)
+                output.size = (size_t)packed_size;
+        }
+    }
+
+    if (src)
+        fclose(src);
+    if (packed)
+        fclose(packed);
+
+    return output;
+}
+
+/* Decompresses a range of the compressed data and compares it with input */
+static int check_range(BUFFER packed, const uint8_t *input, size_t offset, size_t length, const BUFFER *dict)
+{
+    uint8_t *const output = (uint8_t *)malloc(length);
+    int            ok     = 0;
+
+    if (output) {
+        ok = ! lza_decompress_range(packed.buf, packed.size, offset, output, length, dict) &&
+             ! memcmp(output, &input[offset], length);
+        free(output);
+    }
+
+    return ok;
+}
+
+/* Overwrites 64-bit value at index pos in the seek table of a copy of packed
+ * stream and decompresses a range from it, returns non-zero if it fails
+ */
+static int check_bad_seek_table(BUFFER packed, uint32_t num_entries, uint32_t pos, uint64_t value, size_t size)
+{
+    uint8_t *const copy   = (uint8_t *)malloc(packed.size);
+    uint8_t *const output = (uint8_t *)malloc(size);
+    int            failed = 0;
+
+    if (copy && output) {
+        uint8_t *const entry = copy + packed.size - 8 - num_entries * 16 + pos * 8;
+        int            i;
+
+        memcpy(copy, packed.buf, packed.size);
+        for (i = 0; i < 8; i++)
+            entry[i] = (uint8_t)(value >> (i * 8));
+
+        failed = lza_decompress_range(copy, packed.size, 0, output, size, NULL) != 0;
+    }
+
+    free(copy);
+    free(output);
+
+    return failed;
+}
+
+/* Decompresses stream truncated to the specified size */
+static int check_truncated(const uint8_t *input, size_t size, long truncated_size)
+{
+    FILE   *const src    = tmpfile();
+    FILE   *const packed = tmpfile();
+    FILE   *const cut    = tmpfile();
+    FILE   *const dest   = tmpfile();
+    int           failed = 0;
+
+    if (src && packed && cut && dest && fwrite(input, 1, size, src) == size) {
+        rewind(src);
+
+        if ( ! compress_stream(src, packed, 0x1000, NULL, NULL, 0)) {
+            long i;
+
+            rewind(packed);
+            for (i = 0; i < truncated_size; i++)
+                fputc(fgetc(packed), cut);
+            rewind(cut);
+
+            failed = decompress_stream(cut, dest, NULL) != 0;
+        }
+    }
+
+    if (src)
+        fclose(src);
+    if (packed)
+        fclose(packed);
+    if (cut)
+        fclose(cut);
+    if (dest)
+        fclose(dest);
+
+    return failed;
+}
+
+/* Decompresses copies of the stream with random bits flipped, returns number
+ * of copies which were reported as corrupted
+ */
+static unsigned check_corrupted(const uint8_t *input, size_t size, unsigned num_copies)
+{
+    BUFFER         packed = compress_to_buffer(input, size, 0x1000, NULL, 0);
+    uint8_t *const copy   = packed.buf ? (uint8_t *)malloc(packed.size) : NULL;
+    uint32_t       seed   = 1;
+    unsigned       failed = 0;
+    unsigned       i_copy;
+
+    for (i_copy = 0; copy && i_copy < num_copies; i_copy++) {
+        FILE *const src  = tmpfile();
+        FILE *const dest = tmpfile();
+        unsigned    i_bit;
+
+        memcpy(copy, packed.buf, packed.size);
+
+        /* Leave the stream header intact */
+        for (i_bit = 0; i_bit < 3; i_bit++) {
+            const size_t pos = 8 + lcg(&seed) % (packed.size - 8);
+
+            copy[pos] ^= (uint8_t)(1U << (lcg(&seed) % 8));
+        }
+
+        if (src && dest && fwrite(copy, 1, packed.size, src) == packed.size) {
+            rewind(src);
+
+            if (decompress_stream(src, dest, NULL))
+                ++failed;
+        }
+
+        if (src)
+            fclose(src);
+        if (dest)
+            fclose(dest);
+    }
+
+    free(copy);
+    free(packed.buf);
+
+    return failed;
+}
+
+/* Decompresses stream compressed with a dictionary using another dictionary */
+static int check_wrong_dict(const uint8_t *input, size_t size, const BUFFER *dict, const BUFFER *other)
+{
+    FILE *const src    = tmpfile();
+    FILE *const packed = tmpfile();
+    FILE *const dest   = tmpfile();
+    int         failed = 0;
+
+    if (src && packed && dest && fwrite(input, 1, size, src) == size) {
+        rewind(src);
+
+        if ( ! compress_stream(src, packed, 0x1000, NULL, dict, 0)) {
+            rewind(packed);
+
+            failed = decompress_stream(packed, dest, other) != 0;
+        }
+    }
+
+    if (src)
+        fclose(src);
+    if (packed)
+        fclose(packed);
+    if (dest)
+        fclose(dest);
+
+    return failed;
+}
+
+int main(void)
+{
+    unsigned       num_failed = 0;
+    const size_t   size       = 0x11000;
+    uint8_t *const data       = (uint8_t *)malloc(size);
+    long           packed_size;
+
+    TEST(data != NULL);
+    if ( ! data)
+        return EXIT_FAILURE;
+
+    /* Empty input */
+    TEST(check_stream(data, 0, 0x1000, NULL, &packed_size));
+    TEST(packed_size == 20);
+
+    /* Multiple blocks, last block partial */
+    fill_test_data(data, size, 1);
+    TEST(check_stream(data, size, 0x1000, NULL, &packed_size));
+    TEST(packed_size < (long)size / 2);
+
+    /* Input is an exact multiple of block size */
+    TEST(check_stream(data, 0x4000, 0x1000, NULL, &packed_size));
+
+    /* Single block */
+    TEST(check_stream(data, size, 0x100000, NULL, &packed_size));
+
+    /* Incompressible blocks are stored */
+    fill_random_data(data, size, 2);
+    TEST(check_stream(data, size, 0x1000, NULL, &packed_size));
+    TEST(packed_size <= (long)(size + 17 * 12 + 20));
+
+    /* Incompressible data in the middle of a block is stored separately */
+    fill_test_data(data, size, 4);
+    fill_random_data(&data[0x4000], 0x8000, 5);
+    TEST(check_stream(data, size, 0x100000, NULL, &packed_size));
+    TEST(packed_size <= (long)(0x8000 + (size - 0x8000) / 2 + 3 * 12 + 20));
+
+    /* Truncated stream */
+    fill_test_data(data, size, 3);
+    TEST(check_truncated(data, size, 6));
+    TEST(check_truncated(data, size, 30));
+
+    /* Corrupted stream */
+    TEST(check_corrupted(data, size, 200) > 0);
+
+    /* Blocks refer to the dictionary */
+    {
+        uint8_t      dict_data[0x2000];
+        BUFFER       dict;
+        BUFFER       other;
+        BUFFER       packed;
+        uint8_t      byte;
+        const size_t block_size = 0x400;
+        long         dict_packed_size;
+        size_t       pos;
+        uint32_t     state      = 1;
+
+        /* Noise which does not repeat within the dictionary */
+        for (pos = 0; pos < sizeof(dict_data); pos++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            dict_data[pos] = (uint8_t)state;
+        }
+
+        dict.buf  = dict_data;
+        dict.size = sizeof(dict_data);
+
+        /* Each block contains pieces of the dictionary, but they don't repeat within the block */
+        for (pos = 0; pos < size; pos += 0x100)
+            memcpy(&data[pos], &dict_data[(pos * 7) % (sizeof(dict_data) - 0x100)], 0x100);
+
+        TEST(check_stream(data, size, block_size, NULL, &packed_size));
+        TEST(check_stream(data, size, block_size, &dict, &dict_packed_size));
+        TEST(dict_packed_size < packed_size / 4);
+
+        /* Header of a stream compressed with a dictionary contains its id */
+        TEST(check_stream(data, 0, block_size, &dict, &packed_size));
+        TEST(packed_size == 24);
+
+        /* Missing or different dictionary */
+        other.buf  = dict_data;
+        other.size = sizeof(dict_data) - 1;
+        TEST(check_wrong_dict(data, size, &dict, NULL));
+        TEST(check_wrong_dict(data, size, &dict, &other));
+
+        /* Range of a stream compressed with a dictionary */
+        packed = compress_to_buffer(data, size, block_size, &dict, 1);
+        TEST(packed.size > 0);
+        if (packed.size) {
+            TEST(check_range(packed, data, 0x1234, 0x800, &dict));
+            TEST(lza_decompress_range(packed.buf, packed.size, 0x1234, &byte, 1, NULL) != 0);
+            TEST(lza_decompress_range(packed.buf, packed.size, 0x1234, &byte, 1, &other) != 0);
+        }
+        free(packed.buf);
+    }
+
+    /* Ranges of data, with and without seek table */
+    {
+        BUFFER  packed[2];
+        uint8_t byte;
+        int     seek;
+
+        fill_test_data(data, size, 6);
+        fill_random_data(&data[0x9000], 0x5000, 7);
+
+        for (seek = 0; seek < 2; seek++) {
+            packed[seek] = compress_to_buffer(data, size, 0x1000, NULL, seek);
+            TEST(packed[seek].size > 0);
+            if ( ! packed[seek].size)
+                continue;
+
+            TEST(check_range(packed[seek], data, 0, size, NULL));
+            TEST(check_range(packed[seek], data, 0, 1, NULL));
+            TEST(check_range(packed[seek], data, size - 1, 1, NULL));
+            TEST(check_range(packed[seek], data, 0xFFF, 2, NULL));
+            TEST(check_range(packed[seek], data, 0x2345, 0x3456, NULL));
+            TEST(check_range(packed[seek], data, 0x8800, 0x6000, NULL));
+            TEST(check_range(packed[seek], data, 0x10000, 0x1000, NULL));
+
+            /* Range beyond the end of data */
+            TEST(lza_decompress_range(packed[seek].buf, packed[seek].size, size - 1, &byte, 2, NULL) != 0);
+            TEST(lza_decompress_range(packed[seek].buf, packed[seek].size, size, &byte, 1, NULL) != 0);
+        }
+
+        /* Seek table takes 16 bytes per block and the footer */
+        if (packed[0].size && packed[1].size) {
+            TEST(packed[1].size == packed[0].size + 17 * 16 + 8);
+            TEST(check_stream(data, size, 0x1000, NULL, &packed_size));
+            TEST(packed_size == (long)packed[0].size);
+
+            /* Corrupted seek table entries: not starting at the first block,
+             * not increasing, or pointing past the table
+             */
+            TEST(check_bad_seek_table(packed[1], 17, 0, 1, size));
+            TEST(check_bad_seek_table(packed[1], 17, 1, 8 + 17, size));
+            TEST(check_bad_seek_table(packed[1], 17, 6, 0, size));
+            TEST(check_bad_seek_table(packed[1], 17, 7, 8, size));
+            TEST(check_bad_seek_table(packed[1], 17, 33, packed[1].size - 8 - 17 * 16 - 4, size));
+            TEST(check_bad_seek_table(packed[1], 17, 33, ~(uint64_t)0, size));
+        }
+
+        free(packed[0].buf);
+        free(packed[1].buf);
+
+        /* Stream with seek table is decompressed normally */
+        {
+            FILE *const src  = tmpfile();
+            FILE *const dest = tmpfile();
+            int         ok   = 0;
+
+            packed[1] = compress_to_buffer(data, size, 0x1000, NULL, 1);
+            if (src && dest && packed[1].size && fwrite(packed[1].buf, 1, packed[1].size, src) == packed[1].size) {
+                rewind(src);
+
+                if ( ! decompress_stream(src, dest, NULL)) {
+                    uint8_t *const output = (uint8_t *)malloc(size + 1);
+
+                    rewind(dest);
+                    ok = output && fread(output, 1, size + 1, dest) == size && ! memcmp(output, data, size);
+                    free(output);
+                }
+            }
+            TEST(ok);
+
+            if (src)
+                fclose(src);
+            if (dest)
+                fclose(dest);
+            free(packed[1].buf);
+        }
+
+        /* Empty stream */
+        packed[1] = compress_to_buffer(data, 0, 0x1000, NULL, 1);
+        TEST(packed[1].size == 28);
+        TEST(lza_decompress_range(packed[1].buf, packed[1].size, 0, &byte, 1, NULL) != 0);
+        free(packed[1].buf);
+
+        /* Not a compressed stream */
+        TEST(lza_decompress_range(data, size, 0, &byte, 1, NULL) != 0);
+    }
+
+    /* Invalid parameters */
+    TEST(compress_stream(stdin, stdout, 0, NULL, NULL, 0) != 0);
+
+    free(data);
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
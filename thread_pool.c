@@ -0,0 +1,268 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "thread_pool.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+
+typedef SRWLOCK            MUTEX;
+typedef CONDITION_VARIABLE COND_VAR;
+typedef HANDLE             THREAD;
+
+#   define MUTEX_INITIALIZER SRWLOCK_INIT
+
+static void init_mutex(MUTEX *mutex)       { InitializeSRWLock(mutex); }
+static void destroy_mutex(MUTEX *mutex)    { }
+static void lock_mutex(MUTEX *mutex)       { AcquireSRWLockExclusive(mutex); }
+static void unlock_mutex(MUTEX *mutex)     { ReleaseSRWLockExclusive(mutex); }
+static void init_cond(COND_VAR *cond)      { InitializeConditionVariable(cond); }
+static void destroy_cond(COND_VAR *cond)   { }
+static void signal_all(COND_VAR *cond)     { WakeAllConditionVariable(cond); }
+
+static void wait_cond(COND_VAR *cond, MUTEX *mutex)
+{
+    SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+}
+
+#else
+#   include <pthread.h>
+#   include <unistd.h>
+
+typedef pthread_mutex_t MUTEX;
+typedef pthread_cond_t  COND_VAR;
+typedef pthread_t       THREAD;
+
+#   define MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+
+static void init_mutex(MUTEX *mutex)       { pthread_mutex_init(mutex, NULL); }
+static void destroy_mutex(MUTEX *mutex)    { pthread_mutex_destroy(mutex); }
+static void lock_mutex(MUTEX *mutex)       { pthread_mutex_lock(mutex); }
+static void unlock_mutex(MUTEX *mutex)     { pthread_mutex_unlock(mutex); }
+static void init_cond(COND_VAR *cond)      { pthread_cond_init(cond, NULL); }
+static void destroy_cond(COND_VAR *cond)   { pthread_cond_destroy(cond); }
+static void signal_all(COND_VAR *cond)     { pthread_cond_broadcast(cond); }
+
+static void wait_cond(COND_VAR *cond, MUTEX *mutex)
+{
+    pthread_cond_wait(cond, mutex);
+}
+#endif
+
+uint32_t get_num_cpus(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+
+    return info.dwNumberOfProcessors ? (uint32_t)info.dwNumberOfProcessors : 1U;
+#else
+    const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (num_cpus > 0) ? (uint32_t)num_cpus : 1U;
+#endif
+}
+
+typedef struct {
+    MUTEX     mutex;
+    size_t    next_item;
+    size_t    num_items;
+    WORK_FUNC func;
+    void     *cookie;
+} WORK_QUEUE;
+
+typedef struct {
+    WORK_QUEUE *queue;
+    uint32_t    thread_id;
+} WORKER;
+
+static void process_items(WORKER *worker)
+{
+    WORK_QUEUE *const queue = worker->queue;
+
+    for (;;) {
+        size_t item;
+
+        lock_mutex(&queue->mutex);
+        item = queue->next_item;
+        if (item < queue->num_items)
+            ++queue->next_item;
+        unlock_mutex(&queue->mutex);
+
+        if (item >= queue->num_items)
+            break;
+
+        queue->func(queue->cookie, item, worker->thread_id);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker_thread(LPVOID cookie)
+{
+    process_items((WORKER *)cookie);
+    return 0;
+}
+
+static int create_thread(THREAD *thread, WORKER *worker)
+{
+    *thread = CreateThread(NULL, 0, worker_thread, worker, 0, NULL);
+
+    return *thread ? 0 : 1;
+}
+
+static void join_thread(THREAD thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+#else
+static void *worker_thread(void *cookie)
+{
+    process_items((WORKER *)cookie);
+    return NULL;
+}
+
+static int create_thread(THREAD *thread, WORKER *worker)
+{
+    return pthread_create(thread, NULL, worker_thread, worker);
+}
+
+static void join_thread(THREAD thread)
+{
+    pthread_join(thread, NULL);
+}
+#endif
+
+int run_parallel(size_t num_items, uint32_t num_threads, WORK_FUNC func, void *cookie)
+{
+    WORK_QUEUE queue;
+    WORKER    *workers;
+    THREAD    *threads;
+    uint32_t   num_created;
+    int        error = 0;
+
+    if (num_threads > num_items)
+        num_threads = (uint32_t)num_items;
+    if ( ! num_threads)
+        return 0;
+
+    init_mutex(&queue.mutex);
+    queue.next_item = 0;
+    queue.num_items = num_items;
+    queue.func      = func;
+    queue.cookie    = cookie;
+
+    workers = (WORKER *)calloc(num_threads, sizeof(WORKER));
+    threads = (THREAD *)calloc(num_threads, sizeof(THREAD));
+
+    if ( ! workers || ! threads) {
+        perror(NULL);
+        free(workers);
+        free(threads);
+        destroy_mutex(&queue.mutex);
+        return 1;
+    }
+
+    /* The calling thread acts as worker 0 */
+    for (num_created = 1; num_created < num_threads; num_created++) {
+        workers[num_created].queue     = &queue;
+        workers[num_created].thread_id = num_created;
+
+        if (create_thread(&threads[num_created], &workers[num_created])) {
+            fprintf(stderr, "Error: Failed to create thread\n");
+            error = 1;
+            break;
+        }
+    }
+
+    workers[0].queue     = &queue;
+    workers[0].thread_id = 0;
+    process_items(&workers[0]);
+
+    while (num_created > 1)
+        join_thread(threads[--num_created]);
+
+    free(workers);
+    free(threads);
+    destroy_mutex(&queue.mutex);
+
+    return error;
+}
+
+struct MEM_BUDGET_STRUCT {
+    MUTEX    mutex;
+    COND_VAR released;
+    size_t   limit;
+    size_t   used;
+};
+
+MEM_BUDGET *create_mem_budget(size_t limit)
+{
+    MEM_BUDGET *const budget = (MEM_BUDGET *)calloc(1, sizeof(MEM_BUDGET));
+
+    if ( ! budget) {
+        perror(NULL);
+        return NULL;
+    }
+
+    init_mutex(&budget->mutex);
+    init_cond(&budget->released);
+    budget->limit = limit;
+
+    return budget;
+}
+
+void destroy_mem_budget(MEM_BUDGET *budget)
+{
+    if ( ! budget)
+        return;
+
+    assert( ! budget->used);
+
+    destroy_cond(&budget->released);
+    destroy_mutex(&budget->mutex);
+    free(budget);
+}
+
+void reserve_memory(MEM_BUDGET *budget, size_t size)
+{
+    lock_mutex(&budget->mutex);
+
+    while (budget->used && budget->used + size > budget->limit)
+        wait_cond(&budget->released, &budget->mutex);
+
+    budget->used += size;
+
+    unlock_mutex(&budget->mutex);
+}
+
+void release_memory(MEM_BUDGET *budget, size_t size)
+{
+    lock_mutex(&budget->mutex);
+
+    assert(budget->used >= size);
+    budget->used -= size;
+
+    signal_all(&budget->released);
+
+    unlock_mutex(&budget->mutex);
+}
+
+static MUTEX output_mutex = MUTEX_INITIALIZER;
+
+void lock_output(void)
+{
+    lock_mutex(&output_mutex);
+}
+
+void unlock_output(void)
+{
+    unlock_mutex(&output_mutex);
+}
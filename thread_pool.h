@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Invoked for each work item, on any of the worker threads */
+typedef void (* WORK_FUNC)(void *cookie, size_t item, uint32_t thread_id);
+
+/* Returns number of logical CPUs available to the process */
+uint32_t get_num_cpus(void);
+
+/* Processes items 0..num_items-1 on num_threads threads.  Each thread picks up
+ * the next unprocessed item as soon as it is done with the previous one, so
+ * the items should be ordered from the most to the least expensive.
+ * Returns non-zero if threads could not be created.
+ */
+int run_parallel(size_t num_items, uint32_t num_threads, WORK_FUNC func, void *cookie);
+
+/* Memory budget shared between worker threads */
+typedef struct MEM_BUDGET_STRUCT MEM_BUDGET;
+
+MEM_BUDGET *create_mem_budget(size_t limit);
+void        destroy_mem_budget(MEM_BUDGET *budget);
+
+/* Blocks until the requested amount of memory fits within the budget.
+ * A request larger than the whole budget waits until no other memory
+ * is reserved, so it is processed alone.
+ */
+void reserve_memory(MEM_BUDGET *budget, size_t size);
+void release_memory(MEM_BUDGET *budget, size_t size);
+
+/* Lock used for serializing output from worker threads */
+void lock_output(void);
+void unlock_output(void);
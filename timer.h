@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Returns monotonic time in microseconds */
+uint64_t get_time_us(void);
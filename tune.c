@@ -0,0 +1,512 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#include "buffer.h"
+#include "load_file.h"
+#include "lza_compress.h"
+#include "minify_ctx.h"
+#include "profile.h"
+#include "thread_pool.h"
+#include "timer.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Offline tuning of match finder heuristics.
+ *
+ * Each candidate set of parameters is used to compress every file of
+ * a corpus, files and candidates are compressed in parallel.  The search
+ * either tries every combination of parameter values (grid) or changes one
+ * parameter at a time, keeping the value which produces the smallest output
+ * (coordinate descent), until no parameter improves the size.
+ *
+ * All evaluated candidates make up the Pareto front of compressed size vs.
+ * compression time, and the selected candidate is saved as a profile which
+ * can be loaded with minify --profile.
+ */
+
+#define MAX_CANDIDATES 1024
+#define MAX_ROUNDS     4
+
+enum PARAM {
+    PARAM_LEN3_DISTANCE,
+    PARAM_LEN4_DISTANCE,
+    PARAM_MIN_SCORE,
+    PARAM_TRAILING_REP,
+
+    NUM_PARAMS
+};
+
+static const uint32_t len3_values[]  = { 1U << 8, 1U << 9, 1U << 10, 1U << 11, 1U << 12, 1U << 13 };
+static const uint32_t len4_values[]  = { 1U << 11, 1U << 12, 1U << 13, 1U << 14, 1U << 15, 1U << 16 };
+static const uint32_t score_values[] = { 0, 1, 2, 3, 4 };
+static const uint32_t rep_values[]   = { 0, 1 };
+
+static const struct {
+    const uint32_t *values;
+    uint32_t        num_values;
+} param_space[NUM_PARAMS] = {
+    { len3_values,  sizeof(len3_values)  / sizeof(len3_values[0])  },
+    { len4_values,  sizeof(len4_values)  / sizeof(len4_values[0])  },
+    { score_values, sizeof(score_values) / sizeof(score_values[0]) },
+    { rep_values,   sizeof(rep_values)   / sizeof(rep_values[0])   }
+};
+
+static void set_param(PARSER_PARAMS *params, enum PARAM param, uint32_t value)
+{
+    switch (param) {
+        case PARAM_LEN3_DISTANCE: params->max_len3_distance = value;          break;
+        case PARAM_LEN4_DISTANCE: params->max_len4_distance = value;          break;
+        case PARAM_MIN_SCORE:     params->min_score         = (int32_t)value; break;
+        case PARAM_TRAILING_REP:  params->trailing_rep      = (int32_t)value; break;
+        default:                  break;
+    }
+}
+
+typedef struct {
+    PARSER_PARAMS params;
+    uint64_t      size;         /* Total compressed size of the corpus */
+    uint64_t      time_us;      /* Total compression time of the corpus */
+    int           error;
+} CANDIDATE;
+
+typedef struct {
+    BUFFER     *files;
+    size_t      num_files;
+    CANDIDATE  *candidates;     /* Candidates evaluated by the current batch */
+    uint64_t   *sizes;          /* Per item results, each item is accessed by one thread */
+    uint64_t   *times_us;
+    MINIFY_CTX *contexts[256];  /* One context per thread */
+} EVALUATION;
+
+static void evaluate_item(void *cookie, size_t item, uint32_t thread_id)
+{
+    EVALUATION *const      eval      = (EVALUATION *)cookie;
+    const CANDIDATE *const candidate = &eval->candidates[item / eval->num_files];
+    const BUFFER           input     = eval->files[item % eval->num_files];
+    COMPRESSED_SIZES       compressed;
+    BUFFER                 dest;
+    uint64_t               start;
+
+    eval->sizes[item] = 0;
+
+    if ( ! eval->contexts[thread_id]) {
+        eval->contexts[thread_id] = create_minify_ctx();
+        if ( ! eval->contexts[thread_id])
+            return;
+    }
+
+    dest = buf_alloc(lz_compress_bound(input.size));
+    if ( ! dest.buf) {
+        perror(NULL);
+        return;
+    }
+
+    set_minify_ctx_params(eval->contexts[thread_id], &candidate->params);
+
+    start      = get_time_us();
+    compressed = minify_compress(eval->contexts[thread_id], dest.buf, dest.size, input.buf, input.size);
+
+    eval->times_us[item] = get_time_us() - start;
+
+    if (compressed.lz && compressed.compressed <= dest.size)
+        eval->sizes[item] = compressed.compressed;
+
+    buf_free(dest);
+}
+
+/* Compresses the corpus with each candidate, returns non-zero on failure */
+static int evaluate(EVALUATION *eval, CANDIDATE *candidates, size_t num_candidates, uint32_t num_threads)
+{
+    const size_t num_items = num_candidates * eval->num_files;
+    size_t       i;
+
+    eval->candidates = candidates;
+    eval->sizes      = (uint64_t *)calloc(num_items, sizeof(uint64_t));
+    eval->times_us   = (uint64_t *)calloc(num_items, sizeof(uint64_t));
+
+    if ( ! eval->sizes || ! eval->times_us) {
+        perror(NULL);
+        free(eval->sizes);
+        free(eval->times_us);
+        return 1;
+    }
+
+    if (run_parallel(num_items, num_threads, evaluate_item, eval)) {
+        free(eval->sizes);
+        free(eval->times_us);
+        return 1;
+    }
+
+    for (i = 0; i < num_items; i++) {
+        CANDIDATE *const candidate = &candidates[i / eval->num_files];
+
+        if ( ! eval->sizes[i])
+            candidate->error = 1;
+
+        candidate->size    += eval->sizes[i];
+        candidate->time_us += eval->times_us[i];
+    }
+
+    free(eval->sizes);
+    free(eval->times_us);
+
+    for (i = 0; i < num_candidates; i++) {
+        if (candidates[i].error) {
+            fprintf(stderr, "Error: Failed to compress corpus\n");
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+typedef struct {
+    EVALUATION eval;
+    uint32_t   num_threads;
+    CANDIDATE  candidates[MAX_CANDIDATES];  /* All evaluated candidates */
+    size_t     num_candidates;
+} SEARCH;
+
+static const CANDIDATE *find_candidate(const SEARCH *search, const PARSER_PARAMS *params)
+{
+    size_t i;
+
+    for (i = 0; i < search->num_candidates; i++)
+        if (is_same_profile(&search->candidates[i].params, params))
+            return &search->candidates[i];
+
+    return NULL;
+}
+
+/* Queues candidate for evaluation unless it has already been evaluated */
+static int add_candidate(SEARCH *search, const PARSER_PARAMS *params)
+{
+    CANDIDATE *candidate;
+
+    if (find_candidate(search, params))
+        return 0;
+
+    if (search->num_candidates >= MAX_CANDIDATES) {
+        fprintf(stderr, "Error: Too many candidates\n");
+        return 1;
+    }
+
+    candidate = &search->candidates[search->num_candidates++];
+    memset(candidate, 0, sizeof(*candidate));
+    candidate->params = *params;
+
+    return 0;
+}
+
+/* Evaluates candidates added since the given index */
+static int evaluate_new(SEARCH *search, size_t first)
+{
+    if (first == search->num_candidates)
+        return 0;
+
+    return evaluate(&search->eval, &search->candidates[first], search->num_candidates - first,
+                    search->num_threads);
+}
+
+static void print_candidate(const CANDIDATE *candidate, const char *note)
+{
+    char desc[96];
+
+    format_profile(desc, sizeof(desc), &candidate->params);
+
+    printf("%12" PRIu64 " %10.3f  %s%s\n",
+           candidate->size, (double)candidate->time_us / 1e6, desc, note);
+}
+
+static int search_grid(SEARCH *search)
+{
+    uint32_t idx[NUM_PARAMS] = { 0 };
+    size_t   first           = search->num_candidates;
+
+    for (;;) {
+        PARSER_PARAMS params;
+        uint32_t      i;
+
+        get_default_parser_params(&params);
+
+        for (i = 0; i < NUM_PARAMS; i++)
+            set_param(&params, (enum PARAM)i, param_space[i].values[idx[i]]);
+
+        if (add_candidate(search, &params))
+            return 1;
+
+        /* Advance to the next combination */
+        for (i = 0; i < NUM_PARAMS; i++) {
+            if (++idx[i] < param_space[i].num_values)
+                break;
+            idx[i] = 0;
+        }
+
+        if (i == NUM_PARAMS)
+            break;
+    }
+
+    printf("Evaluating %zu combinations\n", search->num_candidates - first);
+
+    return evaluate_new(search, first);
+}
+
+static int search_descent(SEARCH *search, const PARSER_PARAMS *start)
+{
+    PARSER_PARAMS best = *start;
+    uint32_t      round;
+
+    for (round = 0; round < MAX_ROUNDS; round++) {
+        int      improved = 0;
+        uint32_t param;
+
+        for (param = 0; param < NUM_PARAMS; param++) {
+            const size_t first = search->num_candidates;
+            uint32_t     i;
+
+            for (i = 0; i < param_space[param].num_values; i++) {
+                PARSER_PARAMS params = best;
+
+                set_param(&params, (enum PARAM)param, param_space[param].values[i]);
+
+                if (add_candidate(search, &params))
+                    return 1;
+            }
+
+            if (evaluate_new(search, first))
+                return 1;
+
+            for (i = 0; i < param_space[param].num_values; i++) {
+                PARSER_PARAMS          params = best;
+                const CANDIDATE       *candidate;
+                const CANDIDATE *const current = find_candidate(search, &best);
+
+                set_param(&params, (enum PARAM)param, param_space[param].values[i]);
+
+                candidate = find_candidate(search, &params);
+
+                if (candidate->size < current->size) {
+                    best     = params;
+                    improved = 1;
+                }
+            }
+        }
+
+        printf("Round %u: ", round + 1);
+        print_candidate(find_candidate(search, &best), "");
+
+        if ( ! improved)
+            break;
+    }
+
+    return 0;
+}
+
+static int compare_size(const void *left, const void *right)
+{
+    const CANDIDATE *const left_cand  = (const CANDIDATE *)left;
+    const CANDIDATE *const right_cand = (const CANDIDATE *)right;
+
+    if (left_cand->size != right_cand->size)
+        return (left_cand->size < right_cand->size) ? -1 : 1;
+
+    return (left_cand->time_us < right_cand->time_us) ? -1 :
+           (left_cand->time_us > right_cand->time_us) ? 1 : 0;
+}
+
+/* Sorts candidates by size and moves the Pareto front to the beginning,
+ * returns the number of candidates on the front.
+ */
+static size_t find_pareto_front(CANDIDATE *candidates, size_t num_candidates)
+{
+    size_t num_front = 0;
+    size_t i;
+
+    qsort(candidates, num_candidates, sizeof(CANDIDATE), compare_size);
+
+    /* A candidate is on the front if it is faster than all smaller candidates */
+    for (i = 0; i < num_candidates; i++) {
+        if (num_front && candidates[i].time_us >= candidates[num_front - 1].time_us)
+            continue;
+
+        if (i != num_front) {
+            const CANDIDATE tmp = candidates[num_front];
+
+            candidates[num_front] = candidates[i];
+            candidates[i]         = tmp;
+        }
+
+        ++num_front;
+    }
+
+    return num_front;
+}
+
+static int save_profile(const char *filename, const CANDIDATE *candidate, const CANDIDATE *baseline)
+{
+    FILE *const file = fopen(filename, "w");
+    int         error;
+
+    if ( ! file) {
+        perror(filename);
+        return 1;
+    }
+
+    fprintf(file, "# minify profile produced by tune\n");
+    fprintf(file, "# corpus compressed to %" PRIu64 " bytes in %.3f s, defaults %" PRIu64 " bytes in %.3f s\n",
+            candidate->size, (double)candidate->time_us / 1e6,
+            baseline->size, (double)baseline->time_us / 1e6);
+    write_profile(file, &candidate->params);
+
+    error = ferror(file);
+
+    if (fclose(file) || error) {
+        fprintf(stderr, "Error: Failed to write to file %s\n", filename);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void print_usage(void)
+{
+    fprintf(stderr, "Usage: tune [OPTIONS] FILE...\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -j N, --jobs=N       Number of threads, use 1 for most accurate times\n");
+    fprintf(stderr, "    --max-slowdown=X     Select the smallest candidate at most X times slower than defaults\n");
+    fprintf(stderr, "    --output=FILE        Save the selected candidate as a profile for minify --profile\n");
+    fprintf(stderr, "    --search=grid        Evaluate all combinations of parameter values\n");
+    fprintf(stderr, "    --search=descent     Optimize one parameter at a time (default)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static SEARCH    search;
+    const char      *output       = NULL;
+    double           max_slowdown = 0;
+    int              grid         = 0;
+    int              err          = 0;
+    size_t           total_size   = 0;
+    size_t           num_front;
+    size_t           i;
+    CANDIDATE        baseline;
+    const CANDIDATE *selected     = NULL;
+    PARSER_PARAMS    defaults;
+
+    search.num_threads = get_num_cpus();
+
+    search.eval.files = (BUFFER *)calloc((size_t)argc, sizeof(BUFFER));
+    if ( ! search.eval.files) {
+        perror(NULL);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 1; i < (size_t)argc && ! err; i++) {
+        const char *const arg = argv[i];
+
+        if ( ! strcmp(arg, "-j") && i + 1 < (size_t)argc && atoi(argv[i + 1]) > 0)
+            search.num_threads = (uint32_t)atoi(argv[++i]);
+        else if ( ! strncmp(arg, "--jobs=", 7) && atoi(arg + 7) > 0)
+            search.num_threads = (uint32_t)atoi(arg + 7);
+        else if ( ! strncmp(arg, "--max-slowdown=", 15) && atof(arg + 15) >= 1.0)
+            max_slowdown = atof(arg + 15);
+        else if ( ! strncmp(arg, "--output=", 9))
+            output = arg + 9;
+        else if ( ! strcmp(arg, "--search=grid"))
+            grid = 1;
+        else if ( ! strcmp(arg, "--search=descent"))
+            grid = 0;
+        else if (arg[0] == '-') {
+            print_usage();
+            err = 1;
+        }
+        else {
+            const BUFFER file = load_file(arg);
+
+            if ( ! file.size)
+                err = 1;
+            else {
+                search.eval.files[search.eval.num_files++] = file;
+                total_size += file.size;
+            }
+        }
+    }
+
+    if ( ! err && ! search.eval.num_files) {
+        print_usage();
+        err = 1;
+    }
+
+    if (search.num_threads > sizeof(search.eval.contexts) / sizeof(search.eval.contexts[0]))
+        search.num_threads = sizeof(search.eval.contexts) / sizeof(search.eval.contexts[0]);
+
+    if ( ! err) {
+        printf("Tuning on %zu files, %zu bytes, using %u threads\n",
+               search.eval.num_files, total_size, search.num_threads);
+
+        /* Defaults are always evaluated first, as the reference */
+        get_default_parser_params(&defaults);
+
+        err = add_candidate(&search, &defaults) || evaluate_new(&search, 0);
+    }
+
+    if ( ! err) {
+        printf("Defaults: ");
+        print_candidate(&search.candidates[0], "");
+
+        err = grid ? search_grid(&search) : search_descent(&search, &defaults);
+    }
+
+    if ( ! err) {
+        baseline  = *find_candidate(&search, &defaults);
+        num_front = find_pareto_front(search.candidates, search.num_candidates);
+
+        for (i = 0; i < num_front; i++) {
+            const CANDIDATE *const candidate = &search.candidates[i];
+
+            if (max_slowdown && (double)candidate->time_us > (double)baseline.time_us * max_slowdown)
+                continue;
+
+            selected = candidate;
+            break;
+        }
+
+        printf("Evaluated %zu candidates, Pareto front of size vs. time:\n", search.num_candidates);
+        printf("%12s %10s  %s\n", "size", "time [s]", "parameters");
+
+        for (i = 0; i < num_front; i++) {
+            const CANDIDATE *const candidate = &search.candidates[i];
+
+            print_candidate(candidate, (candidate == selected) ? "  <- selected" :
+                                       is_same_profile(&candidate->params, &defaults) ? "  (defaults)" : "");
+        }
+
+        if ( ! selected)
+            printf("No candidate is within the allowed slowdown\n");
+        else {
+            printf("Selected candidate is %.3f%% smaller than defaults\n",
+                   100.0 - (double)selected->size * 100.0 / (double)baseline.size);
+
+            if (output) {
+                err = save_profile(output, selected, &baseline);
+                if ( ! err)
+                    printf("Saved profile in %s\n", output);
+            }
+        }
+    }
+
+    for (i = 0; i < sizeof(search.eval.contexts) / sizeof(search.eval.contexts[0]); i++)
+        destroy_minify_ctx(search.eval.contexts[i]);
+
+    for (i = 0; i < search.eval.num_files; i++)
+        buf_free(search.eval.files[i]);
+
+    free(search.eval.files);
+
+    return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
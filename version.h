@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2022 Chris Dragan
+ */
+
+#pragma once
+
+/* Version of minify.  It must be updated whenever the compressed output
+ * changes, because it is a part of the keys of cached outputs.
+ */
+#define MINIFY_VERSION "0.4.0"